@@ -0,0 +1,145 @@
+#!/bin/sh
+# Simulator throughput benchmark: runs every kernel of suite.txt through the
+# pipeline and reports host MIPS, simulated cycles per second, peak RSS and
+# CPI, checked against baseline.txt and host.txt.
+#
+#   bench.sh [--save] [simulator]	(make bench / make bench-baseline in src/)
+#
+# A kernel is flagged when its result or simulated cycle count differs from
+# baseline.txt (the model changed); those are the same on every machine and
+# baseline.txt is committed. Host numbers only compare on the machine they
+# were measured on, so --save keeps them in host.txt, which is not committed.
+# When host.txt is there a kernel is also flagged when its host MIPS drops or
+# its peak RSS grows by more than TOLERANCE percent. Host numbers are the best
+# of REPEAT runs; runs shorter than MIN_SECONDS are too noisy for their MIPS
+# to count. COMMANDS are extra simulator commands, separated by ';', run
+# before each kernel.
+#
+# The kernels are the .s files assembled to hex words for the simulator's
+# loader, addresses are built with addi/slli as the simulator has no lui.
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+SAVE=0
+if [ "$1" = "--save" ]; then
+	SAVE=1
+	shift
+fi
+SIM=${1:-$DIR/../src/mu-riscv}
+SUITE=${SUITE:-$DIR/suite.txt}
+BASELINE=${BASELINE:-$DIR/baseline.txt}
+HOST_BASELINE=${HOST_BASELINE:-$DIR/host.txt}
+REPEAT=${REPEAT:-3}
+TOLERANCE=${TOLERANCE:-10}
+MIN_SECONDS=${MIN_SECONDS:-0.2}
+COMMANDS=${COMMANDS:-}
+
+if [ ! -x "$SIM" ]; then
+	echo "Error: Can't run simulator $SIM"
+	exit 1
+fi
+
+# instructions cycles x10 mips cycles/s peak-rss of one run
+run_kernel() {
+	printf "input 10 %s\n%s\nsim\nq\n" "$2" "$(echo "$COMMANDS" | tr ';' '\n')" |
+		"$SIM" -q --dump-regs --stats-json - "$DIR/$1" | awk '
+		/^  "completed": false/ { incomplete = 1 }
+		/^  "instructions":/ { instructions = $2 + 0 }
+		/^  "cycles":/ { cycles = $2 + 0 }
+		/^  "regs":/ { gsub(/[\[\],]/, " "); x10 = $12 }
+		/^  "host":/ {
+			gsub(/[{},]/, " ")
+			for (i = 1; i < NF; i++) {
+				if ($i == "\"mips\":") mips = $(i + 1)
+				if ($i == "\"cycles_per_second\":") cps = $(i + 1)
+				if ($i == "\"peak_rss_kib\":") rss = $(i + 1)
+			}
+		}
+		END {
+			if (incomplete || cycles == "") exit 1
+			print instructions, cycles, x10, mips, cps, rss
+		}'
+}
+
+results=$(mktemp)
+trap 'rm -f "$results"' EXIT
+failed=0
+while read -r name program size; do
+	case "$name" in
+		""|\#*) continue ;;
+	esac
+	best=""
+	n=0
+	while [ $n -lt "$REPEAT" ]; do
+		run=$(run_kernel "$program" "$size")
+		if [ -z "$run" ]; then
+			echo "Error: $name did not run to completion"
+			failed=1
+			break
+		fi
+		best=$(echo "$best $run" | awk '{
+			if (NF == 6 || $4 > $10) print $1, $2, $3, $4, $5, $6
+			else print $7, $8, $9, $10, $11, $12
+		}')
+		n=$((n + 1))
+	done
+	[ -n "$best" ] && echo "$name $best" >> "$results"
+done < "$SUITE"
+
+if [ $SAVE -eq 1 ]; then
+	{
+		echo "# name instructions cycles x10 (bench.sh --save)"
+		awk '{ print $1, $2, $3, $4 }' "$results"
+	} > "$BASELINE"
+	{
+		echo "# name mips cycles_per_second peak_rss_kib, this machine only (bench.sh --save)"
+		awk '{ print $1, $5, $6, $7 }' "$results"
+	} > "$HOST_BASELINE"
+	echo "Baseline saved to $BASELINE, host numbers to $HOST_BASELINE"
+fi
+
+awk -v tolerance="$TOLERANCE" -v min_seconds="$MIN_SECONDS" -v failed=$failed \
+		-v baseline="$BASELINE" -v host_baseline="$HOST_BASELINE" '
+	BEGIN {
+		while ((getline line < baseline) > 0) {
+			if (line !~ /^#/) {
+				split(line, b, " ")
+				base[b[1]] = line
+			}
+		}
+		# no host.txt reads as empty
+		while ((getline line < host_baseline) > 0) {
+			if (line !~ /^#/) {
+				split(line, h, " ")
+				host[h[1]] = line
+			}
+		}
+	}
+	FNR == 1 {
+		printf "%-12s %10s %11s %6s %8s %11s %9s  %s\n", "kernel", "instrs", "cycles", "CPI", "MIPS", "cycles/s", "RSS KiB", "vs baseline"
+	}
+	{
+		note = ""
+		if (!($1 in base)) {
+			note = "no baseline"
+		} else {
+			split(base[$1], b, " ")
+			if ($4 != b[4]) note = note " WRONG-RESULT"
+			if ($2 != b[2] || $3 != b[3]) note = note sprintf(" CYCLES %+d", $3 - b[3])
+			if ($1 in host) {
+				split(host[$1], h, " ")
+				if ($2 / ($5 * 1e6) >= min_seconds && $5 < h[2] * (1 - tolerance / 100)) note = note sprintf(" SLOWER %.1f%%", ($5 / h[2] - 1) * 100)
+				if ($7 > h[4] * (1 + tolerance / 100)) note = note sprintf(" RSS +%.1f%%", ($7 / h[4] - 1) * 100)
+			}
+			if (note != "") failed = 1
+			else if ($1 in host) note = sprintf("ok (%+.1f%% MIPS)", ($5 / h[2] - 1) * 100)
+			else note = "ok"
+			sub(/^ /, "", note)
+		}
+		mips += $5
+		kernels++
+		printf "%-12s %10d %11d %6.3f %8.3f %11.0f %9d  %s\n", $1, $2, $3, $3 / $2, $5, $6, $7, note
+	}
+	END {
+		if (kernels > 0) printf "mean host MIPS %.3f over %d kernels\n", mips / kernels, kernels
+		exit failed
+	}' "$results"
@@ -0,0 +1,70 @@
+# crc32: bitwise CRC-32 (reflected, polynomial 0xEDB88320) of x10 xorshift
+# bytes (a multiple of 4), one branch-free step per bit. Leaves the CRC in x10.
+	addi x20, x0, 0x401
+	slli x20, x20, 18		# bytes at 0x10040000
+	addi x21, x0, 0x5a5		# xorshift seed
+	add x6, x20, x10
+	addi x5, x20, 0
+fill:
+	slli x22, x21, 13
+	xor x21, x21, x22
+	srli x22, x21, 17
+	xor x21, x21, x22
+	slli x22, x21, 5
+	xor x21, x21, x22
+	sw x21, 0(x5)
+	addi x5, x5, 4
+	bne x5, x6, fill
+	addi x24, x0, 0x3b6
+	slli x24, x24, 11
+	ori x24, x24, 0x710
+	slli x24, x24, 11
+	ori x24, x24, 0x320		# polynomial
+	addi x10, x0, -1
+	addi x5, x20, 0
+byte:
+	lbu x8, 0(x5)
+	xor x10, x10, x8
+	andi x9, x10, 1
+	sub x9, x0, x9
+	and x9, x9, x24
+	srli x10, x10, 1
+	xor x10, x10, x9
+	andi x9, x10, 1
+	sub x9, x0, x9
+	and x9, x9, x24
+	srli x10, x10, 1
+	xor x10, x10, x9
+	andi x9, x10, 1
+	sub x9, x0, x9
+	and x9, x9, x24
+	srli x10, x10, 1
+	xor x10, x10, x9
+	andi x9, x10, 1
+	sub x9, x0, x9
+	and x9, x9, x24
+	srli x10, x10, 1
+	xor x10, x10, x9
+	andi x9, x10, 1
+	sub x9, x0, x9
+	and x9, x9, x24
+	srli x10, x10, 1
+	xor x10, x10, x9
+	andi x9, x10, 1
+	sub x9, x0, x9
+	and x9, x9, x24
+	srli x10, x10, 1
+	xor x10, x10, x9
+	andi x9, x10, 1
+	sub x9, x0, x9
+	and x9, x9, x24
+	srli x10, x10, 1
+	xor x10, x10, x9
+	andi x9, x10, 1
+	sub x9, x0, x9
+	and x9, x9, x24
+	srli x10, x10, 1
+	xor x10, x10, x9
+	addi x5, x5, 1
+	bne x5, x6, byte
+	xori x10, x10, -1
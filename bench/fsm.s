@@ -0,0 +1,110 @@
+# fsm: generate x10 bytes of text from a 16 character alphabet, then run a
+# tokenizer state machine over it counting numbers, words, comments (from '#'
+# to the end of the line) and lines. Every byte takes a chain of data-dependent
+# branches. Leaves the four counts folded into x10.
+	addi x20, x0, 0x401
+	slli x20, x20, 18		# alphabet at 0x10040000
+	addi x21, x0, 0x5a5		# xorshift seed
+	addi x8, x0, 97
+	sb x8, 0(x20)			# a
+	addi x8, x0, 101
+	sb x8, 1(x20)			# e
+	addi x8, x0, 116
+	sb x8, 2(x20)			# t
+	addi x8, x0, 111
+	sb x8, 3(x20)			# o
+	addi x8, x0, 110
+	sb x8, 4(x20)			# n
+	addi x8, x0, 115
+	sb x8, 5(x20)			# s
+	addi x8, x0, 114
+	sb x8, 6(x20)			# r
+	addi x8, x0, 49
+	sb x8, 7(x20)			# 1
+	addi x8, x0, 55
+	sb x8, 8(x20)			# 7
+	addi x8, x0, 48
+	sb x8, 9(x20)			# 0
+	addi x8, x0, 32
+	sb x8, 10(x20)			# space
+	sb x8, 11(x20)			# space
+	addi x8, x0, 44
+	sb x8, 12(x20)			# ,
+	addi x8, x0, 46
+	sb x8, 13(x20)			# .
+	addi x8, x0, 10
+	sb x8, 14(x20)			# newline
+	addi x8, x0, 35
+	sb x8, 15(x20)			# #
+	addi x23, x20, 64		# text
+	add x6, x23, x10
+	addi x5, x23, 0
+gen:
+	slli x22, x21, 13
+	xor x21, x21, x22
+	srli x22, x21, 17
+	xor x21, x21, x22
+	slli x22, x21, 5
+	xor x21, x21, x22
+	andi x8, x21, 15
+	add x8, x8, x20
+	lbu x8, 0(x8)
+	sb x8, 0(x5)
+	addi x5, x5, 1
+	bne x5, x6, gen
+	addi x11, x0, 0			# state: 0 between tokens, 1 number, 2 word, 3 comment
+	addi x12, x0, 0			# numbers
+	addi x13, x0, 0			# words
+	addi x14, x0, 0			# comments
+	addi x15, x0, 0			# lines
+	addi x16, x0, 10
+	addi x17, x0, 26
+	addi x18, x0, 3
+	addi x19, x0, 35
+	addi x27, x0, 2
+	addi x5, x23, 0
+scan:
+	lbu x8, 0(x5)
+	addi x5, x5, 1
+	beq x8, x16, newline
+	beq x11, x18, next
+	addi x9, x8, -48
+	bltu x9, x16, digit
+	ori x9, x8, 32
+	addi x9, x9, -97
+	bltu x9, x17, letter
+	beq x8, x19, hash
+	addi x11, x0, 0
+	jal x0, next
+digit:
+	bne x11, x0, next		# digits inside a number or a word carry on with it
+	addi x12, x12, 1
+	addi x11, x0, 1
+	jal x0, next
+letter:
+	beq x11, x27, next
+	addi x13, x13, 1
+	addi x11, x0, 2
+	jal x0, next
+hash:
+	addi x14, x14, 1
+	addi x11, x0, 3
+	jal x0, next
+newline:
+	addi x15, x15, 1
+	addi x11, x0, 0
+next:
+	bne x5, x6, scan
+	addi x10, x12, 0
+	slli x9, x10, 8
+	srli x10, x10, 24
+	or x10, x10, x9
+	xor x10, x10, x13
+	slli x9, x10, 8
+	srli x10, x10, 24
+	or x10, x10, x9
+	xor x10, x10, x14
+	slli x9, x10, 8
+	srli x10, x10, 24
+	or x10, x10, x9
+	xor x10, x10, x15
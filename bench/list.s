@@ -0,0 +1,43 @@
+# list: build a circular linked list of x10 nodes (a power of two, at least 16)
+# {next, value} scattered over the array by an odd stride, then walk it four
+# times around. Leaves a rotate-add checksum of the values seen in x10.
+	addi x20, x0, 0x401
+	slli x20, x20, 18		# nodes at 0x10040000
+	addi x21, x0, 0x5a5		# xorshift seed
+	addi x24, x10, -1
+	srli x25, x10, 1
+	srli x26, x10, 3
+	add x25, x25, x26
+	addi x25, x25, 1		# stride n/2 + n/8 + 1
+	addi x5, x0, 0
+	addi x6, x10, 0
+build:
+	add x7, x5, x25
+	and x7, x7, x24
+	slli x8, x5, 3
+	add x8, x8, x20
+	slli x9, x7, 3
+	add x9, x9, x20
+	sw x9, 0(x8)
+	slli x22, x21, 13
+	xor x21, x21, x22
+	srli x22, x21, 17
+	xor x21, x21, x22
+	slli x22, x21, 5
+	xor x21, x21, x22
+	sw x21, 4(x8)
+	addi x5, x7, 0
+	addi x6, x6, -1
+	bne x6, x0, build
+	addi x7, x20, 0
+	slli x6, x10, 2
+	addi x10, x0, 0
+walk:
+	lw x8, 4(x7)
+	lw x7, 0(x7)
+	slli x9, x10, 1
+	srli x10, x10, 31
+	or x10, x10, x9
+	add x10, x10, x8
+	addi x6, x6, -1
+	bne x6, x0, walk
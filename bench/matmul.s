@@ -0,0 +1,76 @@
+# matmul: C = A * B for x10 x x10 matrices of xorshift bytes, multiplying with a
+# shift-and-add routine the way RV32I code without the M extension has to.
+# Leaves a rotate-xor checksum of C in x10.
+	jal x0, main
+# x13 = x11 * x12, clobbers x11, x12 and x14
+mul:
+	addi x13, x0, 0
+mul_loop:
+	beq x12, x0, mul_done
+	andi x14, x12, 1
+	beq x14, x0, mul_skip
+	add x13, x13, x11
+mul_skip:
+	slli x11, x11, 1
+	srli x12, x12, 1
+	jal x0, mul_loop
+mul_done:
+	jalr x0, 0(x1)
+main:
+	addi x20, x0, 0x401
+	slli x20, x20, 18		# A at 0x10040000
+	addi x21, x0, 0x5a5		# xorshift seed
+	addi x11, x10, 0
+	addi x12, x10, 0
+	jal x1, mul
+	slli x24, x13, 2		# bytes per matrix
+	add x25, x20, x24		# B
+	add x26, x25, x24		# C
+	addi x5, x20, 0
+fill:
+	slli x22, x21, 13
+	xor x21, x21, x22
+	srli x22, x21, 17
+	xor x21, x21, x22
+	slli x22, x21, 5
+	xor x21, x21, x22
+	andi x8, x21, 0xff
+	sw x8, 0(x5)
+	addi x5, x5, 4
+	bne x5, x26, fill
+	slli x27, x10, 2		# bytes per row
+	addi x5, x20, 0			# row of A
+	addi x7, x26, 0			# element of C
+row:
+	addi x8, x25, 0			# column of B
+	add x18, x25, x27
+	add x17, x5, x27
+col:
+	addi x9, x0, 0
+	addi x15, x5, 0
+	addi x16, x8, 0
+dot:
+	lw x11, 0(x15)
+	lw x12, 0(x16)
+	jal x1, mul
+	add x9, x9, x13
+	addi x15, x15, 4
+	add x16, x16, x27
+	bne x15, x17, dot
+	sw x9, 0(x7)
+	addi x7, x7, 4
+	addi x8, x8, 4
+	bne x8, x18, col
+	add x5, x5, x27
+	bne x5, x25, row
+	addi x7, x26, 0
+	add x6, x26, x24
+	addi x10, x0, 0
+sum:
+	lw x8, 0(x7)
+	slli x9, x10, 1
+	srli x10, x10, 31
+	or x10, x10, x9
+	xor x10, x10, x8
+	addi x7, x7, 4
+	bne x7, x6, sum
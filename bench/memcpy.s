@@ -0,0 +1,44 @@
+# memcpy: fill a buffer of x10 bytes (a multiple of 16) with xorshift words,
+# copy it four words at a time and leave a rotate-xor checksum of the copy in x10.
+	addi x20, x0, 0x401
+	slli x20, x20, 18		# source at 0x10040000
+	add x23, x20, x10
+	addi x23, x23, 64		# destination right behind it
+	addi x21, x0, 0x5a5		# xorshift seed
+	addi x5, x20, 0
+	add x6, x20, x10
+fill:
+	slli x22, x21, 13
+	xor x21, x21, x22
+	srli x22, x21, 17
+	xor x21, x21, x22
+	slli x22, x21, 5
+	xor x21, x21, x22
+	sw x21, 0(x5)
+	addi x5, x5, 4
+	bne x5, x6, fill
+	addi x5, x20, 0
+	addi x7, x23, 0
+copy:
+	lw x8, 0(x5)
+	lw x9, 4(x5)
+	lw x11, 8(x5)
+	lw x12, 12(x5)
+	sw x8, 0(x7)
+	sw x9, 4(x7)
+	sw x11, 8(x7)
+	sw x12, 12(x7)
+	addi x5, x5, 16
+	addi x7, x7, 16
+	bne x5, x6, copy
+	addi x7, x23, 0
+	add x6, x23, x10
+	addi x10, x0, 0
+sum:
+	lw x8, 0(x7)
+	slli x9, x10, 1
+	srli x10, x10, 31
+	or x10, x10, x9
+	xor x10, x10, x8
+	addi x7, x7, 4
+	bne x7, x6, sum
@@ -0,0 +1,62 @@
+# muldiv: C = A * B for x10 x x10 matrices of xorshift words with the M
+# extension's mul, then folds every element of C through divu and remu by a
+# divisor that changes with the checksum. Leaves the checksum in x10.
+	addi x20, x0, 0x401
+	slli x20, x20, 18		# A at 0x10040000
+	addi x21, x0, 0x5a5		# xorshift seed
+	mul x24, x10, x10
+	slli x24, x24, 2		# bytes per matrix
+	add x25, x20, x24		# B
+	add x26, x25, x24		# C
+	addi x5, x20, 0
+fill:
+	slli x22, x21, 13
+	xor x21, x21, x22
+	srli x22, x21, 17
+	xor x21, x21, x22
+	slli x22, x21, 5
+	xor x21, x21, x22
+	sw x21, 0(x5)
+	addi x5, x5, 4
+	bne x5, x26, fill
+	slli x27, x10, 2		# bytes per row
+	addi x5, x20, 0			# row of A
+	addi x7, x26, 0			# element of C
+row:
+	addi x8, x25, 0			# column of B
+	add x18, x25, x27
+	add x17, x5, x27
+col:
+	addi x9, x0, 0
+	addi x15, x5, 0
+	addi x16, x8, 0
+dot:
+	lw x11, 0(x15)
+	lw x12, 0(x16)
+	mul x13, x11, x12
+	add x9, x9, x13
+	addi x15, x15, 4
+	add x16, x16, x27
+	bne x15, x17, dot
+	sw x9, 0(x7)
+	addi x7, x7, 4
+	addi x8, x8, 4
+	bne x8, x18, col
+	add x5, x5, x27
+	bne x5, x25, row
+	addi x7, x26, 0
+	add x6, x26, x24
+	addi x10, x0, 0
+sum:
+	lw x8, 0(x7)
+	andi x9, x10, 0x7ff
+	addi x9, x9, 3			# divisor 3..2050
+	divu x11, x8, x9
+	remu x12, x8, x9
+	slli x9, x10, 1
+	srli x10, x10, 31
+	or x10, x10, x9
+	xor x10, x10, x11
+	add x10, x10, x12
+	addi x7, x7, 4
+	bne x7, x6, sum
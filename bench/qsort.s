@@ -0,0 +1,71 @@
+# qsort: recursive quicksort (Lomuto partition, last element as pivot) of x10
+# signed xorshift words. Leaves a rotate-xor checksum of the sorted array in x10.
+	jal x0, main
+# sort the words from x11 up to and including x12
+qsort:
+	bgeu x11, x12, qsort_ret
+	addi x2, x2, -12
+	sw x1, 0(x2)
+	sw x12, 8(x2)
+	lw x5, 0(x12)			# pivot
+	addi x6, x11, 0			# where the next smaller word goes
+	addi x7, x11, 0
+part:
+	beq x7, x12, part_done
+	lw x8, 0(x7)
+	bge x8, x5, part_next
+	lw x9, 0(x6)
+	sw x8, 0(x6)
+	sw x9, 0(x7)
+	addi x6, x6, 4
+part_next:
+	addi x7, x7, 4
+	jal x0, part
+part_done:
+	lw x9, 0(x6)
+	sw x5, 0(x6)
+	sw x9, 0(x12)
+	sw x6, 4(x2)
+	addi x12, x6, -4
+	jal x1, qsort
+	lw x6, 4(x2)
+	addi x11, x6, 4
+	lw x12, 8(x2)
+	jal x1, qsort
+	lw x1, 0(x2)
+	addi x2, x2, 12
+qsort_ret:
+	jalr x0, 0(x1)
+main:
+	addi x2, x0, 0x7ff
+	slli x2, x2, 20			# stack below 0x7ff00000
+	addi x20, x0, 0x401
+	slli x20, x20, 18		# array at 0x10040000
+	addi x21, x0, 0x5a5		# xorshift seed
+	slli x24, x10, 2
+	add x6, x20, x24
+	addi x5, x20, 0
+fill:
+	slli x22, x21, 13
+	xor x21, x21, x22
+	srli x22, x21, 17
+	xor x21, x21, x22
+	slli x22, x21, 5
+	xor x21, x21, x22
+	sw x21, 0(x5)
+	addi x5, x5, 4
+	bne x5, x6, fill
+	addi x11, x20, 0
+	addi x12, x6, -4
+	jal x1, qsort
+	addi x7, x20, 0
+	add x6, x20, x24
+	addi x10, x0, 0
+sum:
+	lw x8, 0(x7)
+	slli x9, x10, 1
+	srli x10, x10, 31
+	or x10, x10, x9
+	xor x10, x10, x8
+	addi x7, x7, 4
+	bne x7, x6, sum
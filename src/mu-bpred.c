@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Branch prediction for the pipeline's fetch stage.                                                 */
+/*                                                                                                                               */
+/* IF asks bpred_predict() where to fetch next, EX reports the outcome with   */
+/* bpred_update() and redirects fetch when the guess was wrong. Directions */
+/* come from 2-bit saturating counters (bimodal on the PC, gshare on the PC   */
+/* xor the global history, tournament choosing between the two per PC) or */
+/* from the sign of the offset (static, backward taken). Targets come from a  */
+/* direct mapped BTB, returns from a circular return-address stack. The      */
+/* history is only shifted at resolve, in program order, so a misprediction */
+/* only has to put the return-address stack back.                                             */
+/***************************************************************/
+#define BPRED_MAX_HISTORY 16	/* info keeps the history in its low 16 bits */
+#define BPRED_MAX_RAS 64
+#define BTB_INVALID 1u		/* never a fetch address */
+
+typedef struct {
+	uint32_t pc;
+	uint32_t target;
+} btb_entry_t;
+
+/* per simulator context (SIM->bpred), allocated by the first prediction */
+struct bpred_state {
+	uint32_t ghr;		/* outcomes of the last history_bits branches, newest in bit 0 */
+	uint32_t ras_top;		/* next free return-address stack slot */
+	uint8_t *bimodal;
+	uint8_t *gshare;
+	uint8_t *chooser;		/* >= 2 picks gshare */
+	btb_entry_t *btb;
+	uint32_t *ras;
+};
+
+const char *BPRED_NAMES[NUM_BPRED] = { "none", "static", "bimodal", "gshare", "tournament" };
+
+#define BP (SIM->bpred)
+
+static struct bpred_state *bpred_get()
+{
+	uint32_t i;
+	if (BP != NULL) {
+		return BP;
+	}
+	BP = calloc(1, sizeof(struct bpred_state));
+	if (BP != NULL) {
+		BP->bimodal = malloc(BPRED_CONFIG.table_entries);
+		BP->gshare = malloc(BPRED_CONFIG.table_entries);
+		BP->chooser = malloc(BPRED_CONFIG.table_entries);
+		BP->btb = malloc(BPRED_CONFIG.btb_entries * sizeof(btb_entry_t));
+		BP->ras = calloc(BPRED_CONFIG.ras_depth, sizeof(uint32_t));
+	}
+	if (BP == NULL || BP->bimodal == NULL || BP->gshare == NULL || BP->chooser == NULL ||
+			BP->btb == NULL || BP->ras == NULL) {
+		printf("Error: out of host memory for the branch predictor\n");
+		exit(-1);
+	}
+	//every counter starts weakly not-taken, the chooser weakly on bimodal
+	memset(BP->bimodal, 1, BPRED_CONFIG.table_entries);
+	memset(BP->gshare, 1, BPRED_CONFIG.table_entries);
+	memset(BP->chooser, 1, BPRED_CONFIG.table_entries);
+	for (i = 0; i < BPRED_CONFIG.btb_entries; i++) {
+		BP->btb[i].pc = BTB_INVALID;
+	}
+	return BP;
+}
+
+/***************************************************************/
+/* Forget everything learned (configuration changes, release of the context) */
+/***************************************************************/
+void bpred_release()
+{
+	if (BP == NULL) {
+		return;
+	}
+	free(BP->bimodal);
+	free(BP->gshare);
+	free(BP->chooser);
+	free(BP->btb);
+	free(BP->ras);
+	free(BP);
+	BP = NULL;
+}
+
+/***************************************************************/
+/* Configuration: a scheme by name, or one of the table sizes                       */
+/***************************************************************/
+int bpred_set(const char *name)
+{
+	int i;
+	for (i = 0; i < NUM_BPRED; i++) {
+		if (strcmp(name, BPRED_NAMES[i]) == 0) {
+			BPRED_CONFIG.scheme = i;
+			bpred_release();
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static int power_of_two(uint32_t value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+int bpred_config_valid(const bpred_config_t *config)
+{
+	return config->scheme < NUM_BPRED && power_of_two(config->table_entries) &&
+		config->history_bits <= BPRED_MAX_HISTORY && power_of_two(config->btb_entries) &&
+		config->ras_depth >= 1 && config->ras_depth <= BPRED_MAX_RAS;
+}
+
+int bpred_param(const char *name, uint32_t value)
+{
+	bpred_config_t config = BPRED_CONFIG;
+	if (strcmp(name, "table") == 0) {
+		config.table_entries = value;
+	}else if (strcmp(name, "history") == 0) {
+		config.history_bits = value;
+	}else if (strcmp(name, "btb") == 0) {
+		config.btb_entries = value;
+	}else if (strcmp(name, "ras") == 0) {
+		config.ras_depth = value;
+	}
+	if (!bpred_config_valid(&config)) {
+		return FALSE;
+	}
+	BPRED_CONFIG = config;
+	bpred_release();
+	return TRUE;
+}
+
+/***************************************************************/
+/* Prediction                                                                                                                  */
+/***************************************************************/
+static int is_link(uint32_t reg)
+{
+	return reg == 1 || reg == 5;
+}
+
+//jalr through a link register that is not also a call to the same register
+static int is_return(const decoded_inst_t *d)
+{
+	return d->op == OP_JALR && is_link(d->rs1) && !(is_link(d->rd) && d->rd == d->rs1);
+}
+
+static uint32_t bimodal_index(uint32_t pc)
+{
+	return (pc >> 2) & (BPRED_CONFIG.table_entries - 1);
+}
+
+static uint32_t gshare_index(uint32_t pc, uint32_t ghr)
+{
+	return ((pc >> 2) ^ ghr) & (BPRED_CONFIG.table_entries - 1);
+}
+
+static int predict_taken(const decoded_inst_t *d, uint32_t pc)
+{
+	uint32_t ghr = BP->ghr;
+	switch (BPRED_CONFIG.scheme) {
+		case BPRED_STATIC:
+			return d->imm < 0;
+		case BPRED_BIMODAL:
+			return BP->bimodal[bimodal_index(pc)] >= 2;
+		case BPRED_GSHARE:
+			return BP->gshare[gshare_index(pc, ghr)] >= 2;
+		default:
+			if (BP->chooser[bimodal_index(pc)] >= 2) {
+				return BP->gshare[gshare_index(pc, ghr)] >= 2;
+			}
+			return BP->bimodal[bimodal_index(pc)] >= 2;
+	}
+}
+
+static int btb_lookup(uint32_t pc, uint32_t *target)
+{
+	btb_entry_t *entry = &BP->btb[(pc >> 2) & (BPRED_CONFIG.btb_entries - 1)];
+	if (entry->pc != pc) {
+		return FALSE;
+	}
+	*target = entry->target;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Where to fetch after the instruction d at pc. *info receives what the   */
+/* update and the recovery for this instruction need later.                                 */
+/***************************************************************/
+uint32_t bpred_predict(uint32_t pc, const decoded_inst_t *d, uint32_t *info)
+{
+	uint32_t target = pc + 4;
+	int taken;
+
+	*info = 0;
+	if (BPRED_CONFIG.scheme == BPRED_NONE || (d->cls != CLASS_BRANCH && d->cls != CLASS_JUMP)) {
+		return pc + 4;
+	}
+	bpred_get();
+	*info = BP->ghr;
+	if (d->cls == CLASS_BRANCH) {
+		taken = predict_taken(d, pc) && btb_lookup(pc, &target);
+	}else if (is_return(d)) {
+		//the matching call pushed where to go
+		BP->ras_top = (BP->ras_top + BPRED_CONFIG.ras_depth - 1) % BPRED_CONFIG.ras_depth;
+		target = BP->ras[BP->ras_top];
+		taken = TRUE;
+	}else {
+		taken = btb_lookup(pc, &target);
+	}
+	if (d->cls == CLASS_JUMP && is_link(d->rd)) {
+		BP->ras[BP->ras_top] = pc + 4;
+		BP->ras_top = (BP->ras_top + 1) % BPRED_CONFIG.ras_depth;
+	}
+	*info |= BP->ras_top << 16;
+	return taken ? target : pc + 4;
+}
+
+/***************************************************************/
+/* Train on the resolved outcome of the branch or jump d at pc                        */
+/***************************************************************/
+static void counter_update(uint8_t *counter, int taken)
+{
+	if (taken && *counter < 3) {
+		(*counter)++;
+	}else if (!taken && *counter > 0) {
+		(*counter)--;
+	}
+}
+
+void bpred_update(uint32_t pc, const decoded_inst_t *d, uint32_t info, int taken, uint32_t target)
+{
+	uint8_t *bimodal, *gshare;
+	btb_entry_t *entry;
+
+	bpred_get();
+	if (d->cls == CLASS_BRANCH) {
+		bimodal = &BP->bimodal[bimodal_index(pc)];
+		gshare = &BP->gshare[gshare_index(pc, info & 0xFFFF)];
+		//the chooser moves towards whichever component was right when they disagree
+		if ((*bimodal >= 2) != (*gshare >= 2)) {
+			counter_update(&BP->chooser[bimodal_index(pc)], (*gshare >= 2) == taken);
+		}
+		counter_update(bimodal, taken);
+		counter_update(gshare, taken);
+		BP->ghr = ((BP->ghr << 1) | (taken ? 1 : 0)) & ((1u << BPRED_CONFIG.history_bits) - 1);
+	}
+	//returns are the stack's business, everything else taken goes through the BTB
+	if (taken && !is_return(d)) {
+		entry = &BP->btb[(pc >> 2) & (BPRED_CONFIG.btb_entries - 1)];
+		entry->pc = pc;
+		entry->target = target;
+	}
+}
+
+/***************************************************************/
+/* Undo what the wrong path did to the return-address stack                         */
+/***************************************************************/
+void bpred_recover(uint32_t info)
+{
+	bpred_get();
+	BP->ras_top = (info >> 16) % BPRED_CONFIG.ras_depth;
+}
+
+/***************************************************************/
+/* Learned state as one blob for checkpoints. Only valid with the same     */
+/* configuration, which is part of the checkpoint as well.                                    */
+/***************************************************************/
+static size_t bpred_blob_size()
+{
+	return 2 * 4 + 3 * BPRED_CONFIG.table_entries + BPRED_CONFIG.btb_entries * 8 + BPRED_CONFIG.ras_depth * 4;
+}
+
+uint8_t *bpred_snapshot(size_t *size)
+{
+	uint8_t *blob, *p;
+	uint32_t i;
+
+	bpred_get();
+	*size = bpred_blob_size();
+	blob = p = malloc(*size);
+	if (blob == NULL) {
+		printf("Error: out of host memory for the branch predictor\n");
+		exit(-1);
+	}
+	mem_store_le32(p, BP->ghr);
+	mem_store_le32(p + 4, BP->ras_top);
+	p += 8;
+	memcpy(p, BP->bimodal, BPRED_CONFIG.table_entries);
+	p += BPRED_CONFIG.table_entries;
+	memcpy(p, BP->gshare, BPRED_CONFIG.table_entries);
+	p += BPRED_CONFIG.table_entries;
+	memcpy(p, BP->chooser, BPRED_CONFIG.table_entries);
+	p += BPRED_CONFIG.table_entries;
+	for (i = 0; i < BPRED_CONFIG.btb_entries; i++, p += 8) {
+		mem_store_le32(p, BP->btb[i].pc);
+		mem_store_le32(p + 4, BP->btb[i].target);
+	}
+	for (i = 0; i < BPRED_CONFIG.ras_depth; i++, p += 4) {
+		mem_store_le32(p, BP->ras[i]);
+	}
+	return blob;
+}
+
+int bpred_restore(const uint8_t *blob, size_t size)
+{
+	const uint8_t *p = blob;
+	uint32_t i;
+
+	bpred_release();
+	if (size != bpred_blob_size()) {
+		return FALSE;
+	}
+	bpred_get();
+	BP->ghr = mem_load_le32(p);
+	BP->ras_top = mem_load_le32(p + 4) % BPRED_CONFIG.ras_depth;
+	p += 8;
+	memcpy(BP->bimodal, p, BPRED_CONFIG.table_entries);
+	p += BPRED_CONFIG.table_entries;
+	memcpy(BP->gshare, p, BPRED_CONFIG.table_entries);
+	p += BPRED_CONFIG.table_entries;
+	memcpy(BP->chooser, p, BPRED_CONFIG.table_entries);
+	p += BPRED_CONFIG.table_entries;
+	for (i = 0; i < BPRED_CONFIG.btb_entries; i++, p += 8) {
+		BP->btb[i].pc = mem_load_le32(p);
+		BP->btb[i].target = mem_load_le32(p + 4);
+	}
+	for (i = 0; i < BPRED_CONFIG.ras_depth; i++, p += 4) {
+		BP->ras[i] = mem_load_le32(p);
+	}
+	return TRUE;
+}
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Cache timing: split L1 instruction and data caches, optionally a unified */
+/* L2 behind them and the DRAM model (mu-dram.c) behind that.                     */
+/*                                                                                                                               */
+/* The caches only keep tags: the data always comes from guest memory, the */
+/* caches decide how many cycles an access takes. IF and MEM ask for the     */
+/* extra cycles an access costs beyond the single cycle the stage already     */
+/* takes and stall for that long. A write-back cache allocates on a write    */
+/* miss and writes a dirty line back when it is evicted; a write-through      */
+/* cache passes every write on and does not allocate on a write miss. Each  */
+/* level hands its misses and write-backs to the next enabled level, the last */
+/* one charges its own miss latency unless the DRAM model is on.                   */
+/*                                                                                                                               */
+/* The prefetchers (mu-prefetch.c) put lines into the D-cache that are still */
+/* on their way: a demand access that finds one waits until it is there.       */
+/*                                                                                                                               */
+/* With several cores every D-cache access also goes through the MESI      */
+/* directory (mu-multicore.c), which may turn a hit into a miss and adds     */
+/* the cycles spent on the other cores' copies.                                                */
+/***************************************************************/
+#define LINE_VALID 1
+#define LINE_DIRTY 2
+#define LINE_PREFETCHED 4	/* brought in by a prefetch, not used yet */
+#define LINE_BLOB 16		/* tag, flags, stamp, ready */
+
+typedef struct {
+	uint32_t tag;		/* line address (address >> line bits) */
+	uint32_t flags;		/* LINE_VALID, LINE_DIRTY */
+	uint32_t stamp;		/* last use (LRU) or fill (FIFO) */
+	uint32_t ready;		/* cycle a prefetched line arrives */
+} cache_line_t;
+
+typedef struct {
+	cache_line_t *lines;	/* sets * assoc, the ways of a set side by side */
+	uint32_t sets;
+	uint32_t line_bits;
+	uint32_t clock;		/* stamp source */
+	uint32_t seed;		/* random replacement */
+} cache_t;
+
+/* per simulator context (SIM->cache), allocated by the first access */
+struct cache_state {
+	cache_t icache, dcache, l2;
+};
+
+const char *CACHE_REPL_NAMES[NUM_REPL] = { "lru", "fifo", "random" };
+
+#define CACHES (SIM->cache)
+
+static uint32_t log2_of(uint32_t value)
+{
+	uint32_t bits = 0;
+	while ((1u << bits) < value) {
+		bits++;
+	}
+	return bits;
+}
+
+static void cache_init(cache_t *c, const cache_config_t *config)
+{
+	c->sets = config->size / (config->assoc * config->line);
+	c->line_bits = log2_of(config->line);
+	c->clock = 0;
+	c->seed = 0x9E3779B9;
+	c->lines = calloc(c->sets * config->assoc, sizeof(cache_line_t));
+	if (c->lines == NULL) {
+		printf("Error: out of host memory for the caches\n");
+		exit(-1);
+	}
+}
+
+static struct cache_state *cache_get()
+{
+	if (CACHES != NULL) {
+		return CACHES;
+	}
+	CACHES = calloc(1, sizeof(struct cache_state));
+	if (CACHES == NULL) {
+		printf("Error: out of host memory for the caches\n");
+		exit(-1);
+	}
+	cache_init(&CACHES->icache, &ICACHE_CONFIG);
+	cache_init(&CACHES->dcache, &DCACHE_CONFIG);
+	cache_init(&CACHES->l2, &L2_CONFIG);
+	return CACHES;
+}
+
+/***************************************************************/
+/* Drop the contents (configuration changes, reset, release of the context) */
+/***************************************************************/
+void cache_release()
+{
+	if (CACHES == NULL) {
+		return;
+	}
+	free(CACHES->icache.lines);
+	free(CACHES->dcache.lines);
+	free(CACHES->l2.lines);
+	free(CACHES);
+	CACHES = NULL;
+	//no copies left for the other cores to invalidate
+	coherence_forget();
+}
+
+/***************************************************************/
+/* Configuration                                                                                                             */
+/***************************************************************/
+static int power_of_two(uint32_t value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+int cache_config_valid(const cache_config_t *config)
+{
+	return power_of_two(config->size) && power_of_two(config->assoc) && power_of_two(config->line) &&
+		config->line >= 4 && config->assoc * config->line <= config->size &&
+		config->repl < NUM_REPL && config->hit_latency >= 1;
+}
+
+/***************************************************************/
+/* 'cache <icache|dcache|l2> <param> <value>', FALSE if that is not a setting */
+/***************************************************************/
+int cache_param(const char *which, const char *name, const char *value)
+{
+	cache_config_t *target, config;
+	uint32_t number = strtoul(value, NULL, 0);
+	int i;
+
+	if (strcmp(which, "icache") == 0) {
+		target = &ICACHE_CONFIG;
+	}else if (strcmp(which, "dcache") == 0) {
+		target = &DCACHE_CONFIG;
+	}else if (strcmp(which, "l2") == 0) {
+		target = &L2_CONFIG;
+	}else {
+		return FALSE;
+	}
+	config = *target;
+	if (strcmp(name, "enable") == 0) {
+		config.enabled = number != 0;
+	}else if (strcmp(name, "size") == 0) {
+		config.size = number;
+	}else if (strcmp(name, "assoc") == 0) {
+		config.assoc = number;
+	}else if (strcmp(name, "line") == 0) {
+		config.line = number;
+	}else if (strcmp(name, "hit") == 0) {
+		config.hit_latency = number;
+	}else if (strcmp(name, "miss") == 0) {
+		config.miss_latency = number;
+	}else if (strcmp(name, "write") == 0 && strcmp(value, "back") == 0) {
+		config.write_through = FALSE;
+	}else if (strcmp(name, "write") == 0 && strcmp(value, "through") == 0) {
+		config.write_through = TRUE;
+	}else if (strcmp(name, "policy") == 0) {
+		for (i = 0; i < NUM_REPL && strcmp(value, CACHE_REPL_NAMES[i]) != 0; i++) {
+		}
+		config.repl = i;
+	}else {
+		return FALSE;
+	}
+	if (!cache_config_valid(&config)) {
+		return FALSE;
+	}
+	*target = config;
+	cache_release();
+	return TRUE;
+}
+
+/***************************************************************/
+/* Access                                                                                                                        */
+/***************************************************************/
+static uint32_t cache_access(cache_t *c, const cache_config_t *config, cache_stats_t *stats,
+		uint32_t address, int write, uint32_t now);
+
+//What a request that reaches the next level at cycle now costs beyond this cache.
+static uint32_t cache_below(const cache_config_t *config, uint32_t address, int write, uint32_t now)
+{
+	if (config != &L2_CONFIG && L2_CONFIG.enabled) {
+		return cache_access(&CACHES->l2, &L2_CONFIG, &STATS.l2, address, write, now);
+	}
+	if (DRAM_CONFIG.enabled) {
+		return dram_access(address, write, now);
+	}
+	return config->miss_latency;
+}
+
+//The same for a miss or a write-back, which the access waits for.
+static uint32_t cache_next_level(const cache_config_t *config, uint32_t address, int write, uint32_t now)
+{
+	uint32_t latency = cache_below(config, address, write, now);
+	if (config != &L2_CONFIG && L2_CONFIG.enabled) {
+		STATS.l2.stall_cycles += latency;
+	}
+	return latency;
+}
+
+static cache_line_t *cache_victim(cache_t *c, const cache_config_t *config, cache_line_t *set)
+{
+	cache_line_t *victim = &set[0];
+	uint32_t way;
+
+	for (way = 0; way < config->assoc; way++) {
+		if (!(set[way].flags & LINE_VALID)) {
+			return &set[way];
+		}
+	}
+	if (config->repl == REPL_RANDOM) {
+		//xorshift, so runs are repeatable
+		c->seed ^= c->seed << 13;
+		c->seed ^= c->seed >> 17;
+		c->seed ^= c->seed << 5;
+		victim = &set[c->seed & (config->assoc - 1)];
+	}else {
+		//LRU stamps every use, FIFO only the fill, either way the oldest stamp goes
+		for (way = 1; way < config->assoc; way++) {
+			if (set[way].stamp < victim->stamp) {
+				victim = &set[way];
+			}
+		}
+	}
+	if (victim->flags & LINE_PREFETCHED) {
+		STATS.prefetch.useless++;
+	}
+	if (config == &DCACHE_CONFIG && SIM->multicore != NULL) {
+		coherence_evict(victim->tag << c->line_bits);
+	}
+	return victim;
+}
+
+//Cycles the access that arrives at cycle now takes in total, at least the hit latency.
+static uint32_t cache_access(cache_t *c, const cache_config_t *config, cache_stats_t *stats,
+		uint32_t address, int write, uint32_t now)
+{
+	uint32_t tag = address >> c->line_bits;
+	cache_line_t *set = &c->lines[(tag & (c->sets - 1)) * config->assoc];
+	cache_line_t *line;
+	uint32_t latency = config->hit_latency;
+	uint32_t way, fill;
+	int coherent = config == &DCACHE_CONFIG && SIM->multicore != NULL, present = FALSE, snooped = FALSE;
+
+	if (write) {
+		stats->writes++;
+	}else {
+		stats->reads++;
+	}
+	for (way = 0; way < config->assoc; way++) {
+		line = &set[way];
+		if ((line->flags & LINE_VALID) && line->tag == tag) {
+			if (coherent) {
+				present = TRUE;
+				snooped = TRUE;
+				latency += coherence_access(tag << c->line_bits, write, &present);
+				if (!present) {
+					//another core wrote the line since, our copy is gone
+					line->flags = 0;
+					break;
+				}
+			}
+			if (config->repl == REPL_LRU) {
+				line->stamp = ++c->clock;
+			}
+			if (line->flags & LINE_PREFETCHED) {
+				//first use of a prefetched line, which may not be there yet
+				line->flags &= ~LINE_PREFETCHED;
+				STATS.prefetch.useful++;
+				if (line->ready > now + latency) {
+					STATS.prefetch.late++;
+					STATS.prefetch.late_cycles += line->ready - now - latency;
+					latency = line->ready - now;
+				}
+			}
+			if (write && config->write_through) {
+				latency += cache_next_level(config, address, TRUE, now + latency);
+			}else if (write) {
+				line->flags |= LINE_DIRTY;
+			}
+			return latency;
+		}
+	}
+
+	if (write) {
+		stats->write_misses++;
+	}else {
+		stats->read_misses++;
+	}
+	//a copy found invalidated above has been through the directory already
+	if (coherent && !snooped) {
+		latency += coherence_access(tag << c->line_bits, write, &present);
+	}
+	if (write && config->write_through) {
+		//no write-allocate: the write goes on alone
+		return latency + cache_next_level(config, address, TRUE, now + latency);
+	}
+	line = cache_victim(c, config, set);
+	if ((line->flags & (LINE_VALID | LINE_DIRTY)) == (LINE_VALID | LINE_DIRTY)) {
+		stats->writebacks++;
+		latency += cache_next_level(config, line->tag << c->line_bits, TRUE, now + latency);
+	}
+	//a stream buffer may already hold the D-cache's line
+	if (config != &DCACHE_CONFIG || !prefetch_miss(address, now + latency, &fill)) {
+		fill = cache_next_level(config, address, FALSE, now + latency);
+	}
+	latency += fill;
+	line->tag = tag;
+	line->flags = LINE_VALID | (write ? LINE_DIRTY : 0);
+	line->stamp = ++c->clock;
+	line->ready = 0;
+	return latency;
+}
+
+/***************************************************************/
+/* Stall cycles for an instruction fetch at pc / a data access in MEM          */
+/***************************************************************/
+uint32_t cache_fetch(uint32_t pc)
+{
+	uint32_t latency;
+	cache_get();
+	latency = cache_access(&CACHES->icache, &ICACHE_CONFIG, &STATS.icache, pc, FALSE, CYCLE_COUNT) - 1;
+	STATS.icache.stall_cycles += latency;
+	return latency;
+}
+
+uint32_t cache_data(uint32_t pc, uint32_t address, int write)
+{
+	uint32_t latency = cache_data_access(pc, address, write, CYCLE_COUNT) - 1;
+	STATS.dcache.stall_cycles += latency;
+	return latency;
+}
+
+//Cycles a data access that reaches the D-cache at cycle now takes in total (also the store buffer's way in).
+uint32_t cache_data_access(uint32_t pc, uint32_t address, int write, uint32_t now)
+{
+	uint32_t misses = STATS.prefetch.misses, useful = STATS.prefetch.useful;
+	uint32_t latency;
+	cache_get();
+	latency = cache_access(&CACHES->dcache, &DCACHE_CONFIG, &STATS.dcache, address, write, now);
+	//the prefetchers learn from the loads: did this one miss, or use a prefetched line?
+	if (!write) {
+		prefetch_train(pc, address, STATS.prefetch.misses != misses, STATS.prefetch.useful != useful, now);
+	}
+	return latency;
+}
+
+/***************************************************************/
+/* Prefetches into the D-cache                                                                                   */
+/***************************************************************/
+//Start bringing in the line holding address at cycle now, FALSE if the D-cache has it already.
+int cache_prefetch(uint32_t address, uint32_t now)
+{
+	cache_t *c = &cache_get()->dcache;
+	uint32_t tag = address >> c->line_bits;
+	cache_line_t *set = &c->lines[(tag & (c->sets - 1)) * DCACHE_CONFIG.assoc];
+	cache_line_t *line;
+	uint32_t way, start = now;
+	int present = FALSE;
+
+	for (way = 0; way < DCACHE_CONFIG.assoc; way++) {
+		if ((set[way].flags & LINE_VALID) && set[way].tag == tag) {
+			return FALSE;
+		}
+	}
+	line = cache_victim(c, &DCACHE_CONFIG, set);
+	if ((line->flags & (LINE_VALID | LINE_DIRTY)) == (LINE_VALID | LINE_DIRTY)) {
+		STATS.dcache.writebacks++;
+		start += cache_below(&DCACHE_CONFIG, line->tag << c->line_bits, TRUE, now);
+	}
+	line->tag = tag;
+	line->flags = LINE_VALID | LINE_PREFETCHED;
+	line->stamp = ++c->clock;
+	line->ready = start + cache_below(&DCACHE_CONFIG, address, FALSE, start);
+	if (SIM->multicore != NULL) {
+		//a prefetch reads the line like a load would
+		line->ready += coherence_access(tag << c->line_bits, FALSE, &present);
+	}
+	return TRUE;
+}
+
+//Cycles the level below the D-cache takes to deliver a line requested at cycle now (stream buffers).
+uint32_t cache_fill(uint32_t address, uint32_t now)
+{
+	cache_get();
+	return cache_below(&DCACHE_CONFIG, address, FALSE, now);
+}
+
+/***************************************************************/
+/* Cache contents as blobs for checkpoints, the L1s in one and the L2 in   */
+/* another, each under the configuration that is stored next to it.              */
+/***************************************************************/
+static size_t cache_lines(const cache_config_t *config)
+{
+	return config->size / config->line;
+}
+
+static size_t cache_blob_size()
+{
+	return 4 * 4 + (cache_lines(&ICACHE_CONFIG) + cache_lines(&DCACHE_CONFIG)) * LINE_BLOB;
+}
+
+static uint8_t *cache_save(uint8_t *p, const cache_t *c, size_t lines)
+{
+	size_t i;
+	mem_store_le32(p, c->clock);
+	mem_store_le32(p + 4, c->seed);
+	p += 8;
+	for (i = 0; i < lines; i++, p += LINE_BLOB) {
+		mem_store_le32(p, c->lines[i].tag);
+		mem_store_le32(p + 4, c->lines[i].flags);
+		mem_store_le32(p + 8, c->lines[i].stamp);
+		mem_store_le32(p + 12, c->lines[i].ready);
+	}
+	return p;
+}
+
+static const uint8_t *cache_load(const uint8_t *p, cache_t *c, size_t lines)
+{
+	size_t i;
+	c->clock = mem_load_le32(p);
+	c->seed = mem_load_le32(p + 4);
+	p += 8;
+	for (i = 0; i < lines; i++, p += LINE_BLOB) {
+		c->lines[i].tag = mem_load_le32(p);
+		c->lines[i].flags = mem_load_le32(p + 4);
+		c->lines[i].stamp = mem_load_le32(p + 8);
+		c->lines[i].ready = mem_load_le32(p + 12);
+	}
+	return p;
+}
+
+uint8_t *cache_snapshot(size_t *size)
+{
+	uint8_t *blob;
+
+	cache_get();
+	*size = cache_blob_size();
+	blob = malloc(*size);
+	if (blob == NULL) {
+		printf("Error: out of host memory for the caches\n");
+		exit(-1);
+	}
+	cache_save(cache_save(blob, &CACHES->icache, cache_lines(&ICACHE_CONFIG)), &CACHES->dcache, cache_lines(&DCACHE_CONFIG));
+	return blob;
+}
+
+int cache_restore(const uint8_t *blob, size_t size)
+{
+	cache_release();
+	if (size != cache_blob_size()) {
+		return FALSE;
+	}
+	cache_get();
+	cache_load(cache_load(blob, &CACHES->icache, cache_lines(&ICACHE_CONFIG)), &CACHES->dcache, cache_lines(&DCACHE_CONFIG));
+	return TRUE;
+}
+
+uint8_t *cache_l2_snapshot(size_t *size)
+{
+	uint8_t *blob;
+
+	cache_get();
+	*size = 2 * 4 + cache_lines(&L2_CONFIG) * LINE_BLOB;
+	blob = malloc(*size);
+	if (blob == NULL) {
+		printf("Error: out of host memory for the caches\n");
+		exit(-1);
+	}
+	cache_save(blob, &CACHES->l2, cache_lines(&L2_CONFIG));
+	return blob;
+}
+
+//After cache_restore(), which sets up all levels under the current configuration.
+int cache_l2_restore(const uint8_t *blob, size_t size)
+{
+	if (size != 2 * 4 + cache_lines(&L2_CONFIG) * LINE_BLOB) {
+		return FALSE;
+	}
+	cache_get();
+	cache_load(blob, &CACHES->l2, cache_lines(&L2_CONFIG));
+	return TRUE;
+}
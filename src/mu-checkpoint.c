@@ -0,0 +1,610 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Checkpoints: the complete state of the selected machine in one file.       */
+/*                                                                                                                               */
+/* After an 8 byte magic and a version word the file is a list of sections,  */
+/* each a tag, a length in bytes and that many bytes of little-endian words   */
+/* (or raw page data). Unknown sections are skipped when loading, so newer     */
+/* simulators can add state without breaking older checkpoints. Memory is    */
+/* stored as the resident pages that hold anything but zeros. Loading reads    */
+/* and checks the whole file before it touches the machine.                             */
+/***************************************************************/
+#define CKPT_MAGIC "MURVCKPT"
+#define CKPT_VERSION 1
+
+#define CKPT_TAG(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define CKPT_CPU CKPT_TAG('C', 'P', 'U', ' ')	/* CURRENT_STATE, NEXT_STATE */
+#define CKPT_PIPE CKPT_TAG('P', 'I', 'P', 'E')	/* IF_ID, ID_EX, EX_MEM, MEM_WB */
+#define CKPT_CNTR CKPT_TAG('C', 'N', 'T', 'R')	/* counters and run state */
+#define CKPT_STAT CKPT_TAG('S', 'T', 'A', 'T')	/* performance counters, optional */
+#define CKPT_PRED CKPT_TAG('P', 'R', 'E', 'D')	/* prediction fields of the latches, optional */
+#define CKPT_BPRD CKPT_TAG('B', 'P', 'R', 'D')	/* predictor configuration and tables, optional */
+#define CKPT_CACH CKPT_TAG('C', 'A', 'C', 'H')	/* cache stalls, configuration and tags, optional */
+#define CKPT_L2 CKPT_TAG('L', '2', 'C', ' ')	/* L2 configuration and tags, optional */
+#define CKPT_DRAM CKPT_TAG('D', 'R', 'A', 'M')	/* DRAM configuration, banks and write queue, optional */
+#define CKPT_PFCH CKPT_TAG('P', 'F', 'C', 'H')	/* prefetcher configuration, table and stream buffers, optional */
+#define CKPT_SBUF CKPT_TAG('S', 'B', 'U', 'F')	/* store buffer configuration and entries, optional */
+#define CKPT_ISSU CKPT_TAG('I', 'S', 'S', 'U')	/* issue width and the second slot of the latches, optional */
+#define CKPT_OOO CKPT_TAG('O', 'O', 'O', 'C')	/* out-of-order core configuration, ROB and queues, optional */
+#define CKPT_MDIV CKPT_TAG('M', 'D', 'I', 'V')	/* multiply/divide configuration, EX stall and units, optional */
+#define CKPT_PAGE CKPT_TAG('P', 'A', 'G', 'E')	/* one non-zero page: base address + data */
+#define CKPT_END CKPT_TAG('E', 'N', 'D', ' ')
+
+#define CKPT_STATE_WORDS (RISCV_REGS + 3)
+#define CKPT_LATCH_WORDS 11
+#define CKPT_CNTR_WORDS 6
+#define CKPT_STAT_WORDS (sizeof(sim_stats_t) / 4)
+#define CKPT_PRED_WORDS 8
+#define CKPT_BPRD_WORDS (sizeof(bpred_config_t) / 4)
+#define CKPT_CACH_WORDS (3 + 2 * sizeof(cache_config_t) / 4)
+#define CKPT_L2_WORDS (sizeof(cache_config_t) / 4)
+#define CKPT_DRAM_WORDS (sizeof(dram_config_t) / 4)
+#define CKPT_PFCH_WORDS (sizeof(prefetch_config_t) / 4)
+#define CKPT_SBUF_WORDS (sizeof(storebuf_config_t) / 4)
+#define CKPT_OOO_WORDS (sizeof(ooo_config_t) / 4)
+#define CKPT_MDIV_WORDS (sizeof(muldiv_config_t) / 4)
+#define CKPT_ISSU_WORDS (1 + 4 * (CKPT_LATCH_WORDS + 2))
+
+/***************************************************************/
+/* Word (de)serialisation of the state structures                                                  */
+/***************************************************************/
+static void state_to_words(const CPU_State *state, uint32_t *w)
+{
+	w[0] = state->PC;
+	memcpy(&w[1], state->REGS, sizeof(state->REGS));
+	w[RISCV_REGS + 1] = state->HI;
+	w[RISCV_REGS + 2] = state->LO;
+}
+
+static void words_to_state(const uint32_t *w, CPU_State *state)
+{
+	state->PC = w[0];
+	memcpy(state->REGS, &w[1], sizeof(state->REGS));
+	state->HI = w[RISCV_REGS + 1];
+	state->LO = w[RISCV_REGS + 2];
+}
+
+static void latch_to_words(const CPU_Pipeline_Reg *reg, uint32_t *w)
+{
+	w[0] = reg->PC;
+	w[1] = reg->IR;
+	w[2] = reg->A;
+	w[3] = reg->B;
+	w[4] = reg->imm;
+	w[5] = reg->ALUOutput;
+	w[6] = reg->LMD;
+	w[7] = reg->RegWrite;
+	w[8] = reg->StallCount;
+	w[9] = reg->jumpDetected;
+	w[10] = reg->jumpStallCount;
+}
+
+static void words_to_latch(const uint32_t *w, CPU_Pipeline_Reg *reg)
+{
+	reg->PC = w[0];
+	reg->IR = w[1];
+	reg->A = w[2];
+	reg->B = w[3];
+	reg->imm = w[4];
+	reg->ALUOutput = w[5];
+	reg->LMD = w[6];
+	reg->RegWrite = w[7];
+	reg->StallCount = w[8];
+	reg->jumpDetected = w[9];
+	reg->jumpStallCount = w[10];
+	reg->predictedPC = 0;
+	reg->predictInfo = 0;
+	//the decoded record is derived from IR, a bubble carries an empty one
+	memset(&reg->D, 0, sizeof(reg->D));
+	if (reg->IR != 0) {
+		decode_instruction(reg->IR, &reg->D);
+	}
+}
+
+/***************************************************************/
+/* Save                                                                                                                            */
+/***************************************************************/
+static void ckpt_put32(FILE *fp, uint32_t value)
+{
+	uint8_t buf[4];
+	mem_store_le32(buf, value);
+	fwrite(buf, 1, sizeof(buf), fp);
+}
+
+static void ckpt_put_words(FILE *fp, uint32_t tag, const uint32_t *w, uint32_t n)
+{
+	uint32_t i;
+	ckpt_put32(fp, tag);
+	ckpt_put32(fp, n * 4);
+	for (i = 0; i < n; i++) {
+		ckpt_put32(fp, w[i]);
+	}
+}
+
+//A section of configuration words followed by a model's state blob, which is freed.
+static void ckpt_put_blob(FILE *fp, uint32_t tag, const uint32_t *w, uint32_t n, uint8_t *blob, size_t size)
+{
+	uint32_t i;
+	ckpt_put32(fp, tag);
+	ckpt_put32(fp, n * 4 + size);
+	for (i = 0; i < n; i++) {
+		ckpt_put32(fp, w[i]);
+	}
+	fwrite(blob, 1, size, fp);
+	free(blob);
+}
+
+static int page_is_zero(const uint8_t *data)
+{
+	static const uint8_t zero[MEM_PAGE_SIZE];
+	return memcmp(data, zero, MEM_PAGE_SIZE) == 0;
+}
+
+int checkpoint_save(const char *file)
+{
+	uint32_t w[2 * CKPT_STATE_WORDS];	/* big enough for the largest section */
+	uint32_t *pred;
+	uint32_t pages = 0;
+	uint8_t *blob;
+	size_t blob_size;
+	mem_page_t *page;
+	FILE *fp;
+
+	//the other cores' state is not part of the format
+	if (SIM->multicore != NULL) {
+		printf("Error: Checkpoints only cover a single core\n");
+		return FALSE;
+	}
+	//where a replay is in its trace is not part of it either
+	if (SIM->replay != NULL) {
+		printf("Error: Can't checkpoint a replay\n");
+		return FALSE;
+	}
+	fp = fopen(file, "wb");
+	if (fp == NULL) {
+		printf("Error: Can't write checkpoint %s\n", file);
+		return FALSE;
+	}
+	fwrite(CKPT_MAGIC, 1, 8, fp);
+	ckpt_put32(fp, CKPT_VERSION);
+
+	state_to_words(&CURRENT_STATE, w);
+	state_to_words(&NEXT_STATE, w + CKPT_STATE_WORDS);
+	ckpt_put_words(fp, CKPT_CPU, w, 2 * CKPT_STATE_WORDS);
+
+	latch_to_words(&IF_ID, w);
+	latch_to_words(&ID_EX, w + CKPT_LATCH_WORDS);
+	latch_to_words(&EX_MEM, w + 2 * CKPT_LATCH_WORDS);
+	latch_to_words(&MEM_WB, w + 3 * CKPT_LATCH_WORDS);
+	ckpt_put_words(fp, CKPT_PIPE, w, 4 * CKPT_LATCH_WORDS);
+
+	w[0] = CYCLE_COUNT;
+	w[1] = INSTRUCTION_COUNT;
+	w[2] = RUN_FLAG;
+	w[3] = PROGRAM_SIZE;
+	w[4] = PROGRAM_ENTRY;
+	w[5] = ENABLE_FORWARDING;
+	ckpt_put_words(fp, CKPT_CNTR, w, CKPT_CNTR_WORDS);
+	//sim_stats_t is nothing but uint32_t counters
+	ckpt_put_words(fp, CKPT_STAT, (const uint32_t *)&STATS, CKPT_STAT_WORDS);
+
+	w[0] = IF_ID.predictedPC;
+	w[1] = IF_ID.predictInfo;
+	w[2] = ID_EX.predictedPC;
+	w[3] = ID_EX.predictInfo;
+	w[4] = EX_MEM.predictedPC;
+	w[5] = EX_MEM.predictInfo;
+	w[6] = MEM_WB.predictedPC;
+	w[7] = MEM_WB.predictInfo;
+	ckpt_put_words(fp, CKPT_PRED, w, CKPT_PRED_WORDS);
+
+	//the configuration words, then the learned state as the model lays it out
+	blob = bpred_snapshot(&blob_size);
+	ckpt_put_blob(fp, CKPT_BPRD, (const uint32_t *)&BPRED_CONFIG, CKPT_BPRD_WORDS, blob, blob_size);
+
+	blob = cache_snapshot(&blob_size);
+	w[0] = FETCH_STALL;
+	w[1] = FETCH_FILLED_PC;
+	w[2] = MEM_STALL;
+	memcpy(&w[3], &ICACHE_CONFIG, sizeof(cache_config_t));
+	memcpy(&w[3 + sizeof(cache_config_t) / 4], &DCACHE_CONFIG, sizeof(cache_config_t));
+	ckpt_put_blob(fp, CKPT_CACH, w, CKPT_CACH_WORDS, blob, blob_size);
+
+	blob = cache_l2_snapshot(&blob_size);
+	ckpt_put_blob(fp, CKPT_L2, (const uint32_t *)&L2_CONFIG, CKPT_L2_WORDS, blob, blob_size);
+
+	blob = dram_snapshot(&blob_size);
+	ckpt_put_blob(fp, CKPT_DRAM, (const uint32_t *)&DRAM_CONFIG, CKPT_DRAM_WORDS, blob, blob_size);
+
+	blob = prefetch_snapshot(&blob_size);
+	ckpt_put_blob(fp, CKPT_PFCH, (const uint32_t *)&PREFETCH_CONFIG, CKPT_PFCH_WORDS, blob, blob_size);
+
+	blob = storebuf_snapshot(&blob_size);
+	ckpt_put_blob(fp, CKPT_SBUF, (const uint32_t *)&STOREBUF_CONFIG, CKPT_SBUF_WORDS, blob, blob_size);
+
+	blob = muldiv_snapshot(&blob_size);
+	ckpt_put_blob(fp, CKPT_MDIV, (const uint32_t *)&MULDIV_CONFIG, CKPT_MDIV_WORDS, blob, blob_size);
+
+	//latches and prediction fields of the younger slot, in the order of the PIPE and PRED sections
+	w[0] = ISSUE_WIDTH;
+	latch_to_words(&IF_ID_GROUP[1], w + 1);
+	latch_to_words(&ID_EX_GROUP[1], w + 1 + CKPT_LATCH_WORDS);
+	latch_to_words(&EX_MEM_GROUP[1], w + 1 + 2 * CKPT_LATCH_WORDS);
+	latch_to_words(&MEM_WB_GROUP[1], w + 1 + 3 * CKPT_LATCH_WORDS);
+	pred = w + 1 + 4 * CKPT_LATCH_WORDS;
+	pred[0] = IF_ID_GROUP[1].predictedPC;
+	pred[1] = IF_ID_GROUP[1].predictInfo;
+	pred[2] = ID_EX_GROUP[1].predictedPC;
+	pred[3] = ID_EX_GROUP[1].predictInfo;
+	pred[4] = EX_MEM_GROUP[1].predictedPC;
+	pred[5] = EX_MEM_GROUP[1].predictInfo;
+	pred[6] = MEM_WB_GROUP[1].predictedPC;
+	pred[7] = MEM_WB_GROUP[1].predictInfo;
+	ckpt_put_words(fp, CKPT_ISSU, w, CKPT_ISSU_WORDS);
+
+	blob = ooo_snapshot(&blob_size);
+	ckpt_put_blob(fp, CKPT_OOO, (const uint32_t *)&OOO_CONFIG, CKPT_OOO_WORDS, blob, blob_size);
+
+	for (page = MEM_RESIDENT_PAGES; page != NULL; page = page->next) {
+		if (page_is_zero(page->data)) {
+			continue;
+		}
+		ckpt_put32(fp, CKPT_PAGE);
+		ckpt_put32(fp, 4 + MEM_PAGE_SIZE);
+		ckpt_put32(fp, page->base);
+		fwrite(page->data, 1, MEM_PAGE_SIZE, fp);
+		pages++;
+	}
+	ckpt_put32(fp, CKPT_END);
+	ckpt_put32(fp, 0);
+
+	if (ferror(fp) | fclose(fp)) {
+		printf("Error: Can't write checkpoint %s\n", file);
+		return FALSE;
+	}
+	if (!QUIET) {
+		printf("Checkpoint saved to %s: cycle %u, PC 0x%08x, %u pages\n\n", file, CYCLE_COUNT, CURRENT_STATE.PC, pages);
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* Load                                                                                                                            */
+/***************************************************************/
+static int ckpt_words(const uint8_t *p, uint32_t len, uint32_t *w, uint32_t n)
+{
+	uint32_t i;
+	if (len != n * 4) {
+		return FALSE;
+	}
+	for (i = 0; i < n; i++) {
+		w[i] = mem_load_le32(p + i * 4);
+	}
+	return TRUE;
+}
+
+int checkpoint_load(const char *file)
+{
+	uint32_t cpu[2 * CKPT_STATE_WORDS], pipe[4 * CKPT_LATCH_WORDS], cntr[CKPT_CNTR_WORDS];
+	uint32_t pred[CKPT_PRED_WORDS];
+	sim_stats_t stats;
+	bpred_config_t bpred;
+	const uint8_t *bpred_blob = NULL, *cache_blob = NULL;
+	uint32_t bpred_size = 0, cache_size = 0;
+	uint32_t cache[CKPT_CACH_WORDS];
+	cache_config_t icache, dcache, l2;
+	dram_config_t dram;
+	const uint8_t *l2_blob = NULL, *dram_blob = NULL;
+	uint32_t l2_size = 0, dram_size = 0;
+	prefetch_config_t prefetch;
+	const uint8_t *prefetch_blob = NULL;
+	uint32_t prefetch_size = 0;
+	storebuf_config_t storebuf;
+	const uint8_t *storebuf_blob = NULL;
+	uint32_t storebuf_size = 0;
+	muldiv_config_t muldiv;
+	const uint8_t *muldiv_blob = NULL;
+	uint32_t muldiv_size = 0;
+	uint32_t issue[CKPT_ISSU_WORDS];
+	ooo_config_t ooo;
+	const uint8_t *ooo_blob = NULL;
+	uint32_t ooo_size = 0;
+	const uint32_t *issue_pred;
+	uint32_t tag, len, base, pages = 0, seen = 0;
+	uint8_t *buf = NULL, *p, *end;
+	mem_page_t *page;
+	long size;
+	FILE *fp;
+
+	if (SIM->multicore != NULL) {
+		printf("Error: Checkpoints only cover a single core\n");
+		return FALSE;
+	}
+	if (SIM->replay != NULL) {
+		printf("Error: Can't checkpoint a replay\n");
+		return FALSE;
+	}
+	fp = fopen(file, "rb");
+	if (fp == NULL) {
+		printf("Error: Can't open checkpoint %s\n", file);
+		return FALSE;
+	}
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 12 || fseek(fp, 0, SEEK_SET) != 0 ||
+			(buf = malloc(size)) == NULL || fread(buf, 1, size, fp) != (size_t)size) {
+		printf("Error: Can't read checkpoint %s\n", file);
+		fclose(fp);
+		free(buf);
+		return FALSE;
+	}
+	fclose(fp);
+	end = buf + size;
+
+	//first pass: check everything, the machine is only changed once the file is known to be good
+	if (memcmp(buf, CKPT_MAGIC, 8) != 0 || mem_load_le32(buf + 8) != CKPT_VERSION) {
+		printf("Error: %s is not a version %d checkpoint\n", file, CKPT_VERSION);
+		free(buf);
+		return FALSE;
+	}
+	for (p = buf + 12; ; p += 8 + len) {
+		if (end - p < 8) {
+			break;
+		}
+		tag = mem_load_le32(p);
+		len = mem_load_le32(p + 4);
+		if (len > (uint32_t)(end - p - 8)) {
+			break;
+		}
+		if (tag == CKPT_END) {
+			seen |= 16;
+			break;
+		}
+		if (tag == CKPT_CPU && ckpt_words(p + 8, len, cpu, 2 * CKPT_STATE_WORDS)) {
+			seen |= 1;
+		}else if (tag == CKPT_PIPE && ckpt_words(p + 8, len, pipe, 4 * CKPT_LATCH_WORDS)) {
+			seen |= 2;
+		}else if (tag == CKPT_CNTR && ckpt_words(p + 8, len, cntr, CKPT_CNTR_WORDS)) {
+			seen |= 4;
+		}else if (tag == CKPT_STAT && len <= sizeof(stats) && len % 4 == 0) {
+			//counters added since the checkpoint was written start from zero
+			memset(&stats, 0, sizeof(stats));
+			ckpt_words(p + 8, len, (uint32_t *)&stats, len / 4);
+			seen |= 8;
+		}else if (tag == CKPT_PRED && ckpt_words(p + 8, len, pred, CKPT_PRED_WORDS)) {
+			seen |= 32;
+		}else if (tag == CKPT_BPRD && len >= sizeof(bpred)) {
+			ckpt_words(p + 8, sizeof(bpred), (uint32_t *)&bpred, CKPT_BPRD_WORDS);
+			if (!bpred_config_valid(&bpred)) {
+				break;
+			}
+			bpred_blob = p + 8 + sizeof(bpred);
+			bpred_size = len - sizeof(bpred);
+			seen |= 64;
+		}else if (tag == CKPT_CACH && len >= CKPT_CACH_WORDS * 4) {
+			ckpt_words(p + 8, CKPT_CACH_WORDS * 4, cache, CKPT_CACH_WORDS);
+			memcpy(&icache, &cache[3], sizeof(icache));
+			memcpy(&dcache, &cache[3 + sizeof(icache) / 4], sizeof(dcache));
+			if (!cache_config_valid(&icache) || !cache_config_valid(&dcache)) {
+				break;
+			}
+			cache_blob = p + 8 + CKPT_CACH_WORDS * 4;
+			cache_size = len - CKPT_CACH_WORDS * 4;
+			seen |= 128;
+		}else if (tag == CKPT_L2 && len >= sizeof(l2)) {
+			ckpt_words(p + 8, sizeof(l2), (uint32_t *)&l2, CKPT_L2_WORDS);
+			if (!cache_config_valid(&l2)) {
+				break;
+			}
+			l2_blob = p + 8 + sizeof(l2);
+			l2_size = len - sizeof(l2);
+			seen |= 256;
+		}else if (tag == CKPT_DRAM && len >= sizeof(dram)) {
+			ckpt_words(p + 8, sizeof(dram), (uint32_t *)&dram, CKPT_DRAM_WORDS);
+			if (!dram_config_valid(&dram)) {
+				break;
+			}
+			dram_blob = p + 8 + sizeof(dram);
+			dram_size = len - sizeof(dram);
+			seen |= 512;
+		}else if (tag == CKPT_PFCH && len >= sizeof(prefetch)) {
+			ckpt_words(p + 8, sizeof(prefetch), (uint32_t *)&prefetch, CKPT_PFCH_WORDS);
+			if (!prefetch_config_valid(&prefetch)) {
+				break;
+			}
+			prefetch_blob = p + 8 + sizeof(prefetch);
+			prefetch_size = len - sizeof(prefetch);
+			seen |= 1024;
+		}else if (tag == CKPT_SBUF && len >= sizeof(storebuf)) {
+			ckpt_words(p + 8, sizeof(storebuf), (uint32_t *)&storebuf, CKPT_SBUF_WORDS);
+			if (!storebuf_config_valid(&storebuf)) {
+				break;
+			}
+			storebuf_blob = p + 8 + sizeof(storebuf);
+			storebuf_size = len - sizeof(storebuf);
+			seen |= 2048;
+		}else if (tag == CKPT_MDIV && len >= sizeof(muldiv)) {
+			ckpt_words(p + 8, sizeof(muldiv), (uint32_t *)&muldiv, CKPT_MDIV_WORDS);
+			if (!muldiv_config_valid(&muldiv)) {
+				break;
+			}
+			muldiv_blob = p + 8 + sizeof(muldiv);
+			muldiv_size = len - sizeof(muldiv);
+			seen |= 16384;
+		}else if (tag == CKPT_ISSU && ckpt_words(p + 8, len, issue, CKPT_ISSU_WORDS)) {
+			if (issue[0] < 1 || issue[0] > ISSUE_WIDTH_MAX) {
+				break;
+			}
+			seen |= 4096;
+		}else if (tag == CKPT_OOO && len >= sizeof(ooo)) {
+			ckpt_words(p + 8, sizeof(ooo), (uint32_t *)&ooo, CKPT_OOO_WORDS);
+			if (!ooo_config_valid(&ooo)) {
+				break;
+			}
+			ooo_blob = p + 8 + sizeof(ooo);
+			ooo_size = len - sizeof(ooo);
+			seen |= 8192;
+		}else if (tag == CKPT_PAGE) {
+			base = len == 4 + MEM_PAGE_SIZE ? mem_load_le32(p + 8) : 1;
+			if ((base & MEM_PAGE_MASK) != 0 || mem_region_index(base) < 0) {
+				break;
+			}
+		}else if (tag == CKPT_CPU || tag == CKPT_PIPE || tag == CKPT_CNTR || tag == CKPT_STAT || tag == CKPT_PRED || tag == CKPT_BPRD || tag == CKPT_CACH ||
+				tag == CKPT_L2 || tag == CKPT_DRAM || tag == CKPT_PFCH ||
+				tag == CKPT_SBUF || tag == CKPT_MDIV || tag == CKPT_ISSU || tag == CKPT_OOO) {
+			break;
+		}
+	}
+	if ((seen & (1 | 2 | 4 | 16)) != (1 | 2 | 4 | 16)) {
+		printf("Error: %s is truncated or damaged\n", file);
+		free(buf);
+		return FALSE;
+	}
+
+	//memory: everything not in the checkpoint is zero
+	for (page = MEM_RESIDENT_PAGES; page != NULL; page = page->next) {
+		if (!page_is_zero(page->data)) {
+			memset(page->data, 0, MEM_PAGE_SIZE);
+		}
+		page->dirty = TRUE;
+	}
+	for (p = buf + 12; (tag = mem_load_le32(p)) != CKPT_END; p += 8 + mem_load_le32(p + 4)) {
+		if (tag != CKPT_PAGE) {
+			continue;
+		}
+		page = mem_page_touch(mem_load_le32(p + 8));
+		memcpy(page->data, p + 12, MEM_PAGE_SIZE);
+		page->dirty = TRUE;
+		pages++;
+	}
+	//the page contents changed behind everything derived from them
+	mem_tlb_flush();
+	predecode_flush();
+	threaded_flush();
+	dbt_flush();
+
+	words_to_state(cpu, &CURRENT_STATE);
+	words_to_state(cpu + CKPT_STATE_WORDS, &NEXT_STATE);
+	words_to_latch(pipe, &IF_ID);
+	words_to_latch(pipe + CKPT_LATCH_WORDS, &ID_EX);
+	words_to_latch(pipe + 2 * CKPT_LATCH_WORDS, &EX_MEM);
+	words_to_latch(pipe + 3 * CKPT_LATCH_WORDS, &MEM_WB);
+	CYCLE_COUNT = cntr[0];
+	INSTRUCTION_COUNT = cntr[1];
+	RUN_FLAG = cntr[2];
+	PROGRAM_SIZE = cntr[3];
+	PROGRAM_ENTRY = cntr[4];
+	ENABLE_FORWARDING = cntr[5];
+	//counters start from zero when the checkpoint was written without them
+	if (seen & 8) {
+		STATS = stats;
+	}else {
+		stats_reset();
+	}
+	if (seen & 32) {
+		IF_ID.predictedPC = pred[0];
+		IF_ID.predictInfo = pred[1];
+		ID_EX.predictedPC = pred[2];
+		ID_EX.predictInfo = pred[3];
+		EX_MEM.predictedPC = pred[4];
+		EX_MEM.predictInfo = pred[5];
+		MEM_WB.predictedPC = pred[6];
+		MEM_WB.predictInfo = pred[7];
+	}
+	//without its tables the predictor starts cold, a jump or branch in flight then just mispredicts
+	bpred_release();
+	if (seen & 64) {
+		BPRED_CONFIG = bpred;
+		if (!bpred_restore(bpred_blob, bpred_size)) {
+			printf("Warning: branch predictor state in %s does not fit, starting it cold\n", file);
+		}
+	}
+	//the same for the caches, an access that was waiting then just finishes at once
+	cache_release();
+	FETCH_STALL = 0;
+	FETCH_FILLED_PC = MEM_TLB_INVALID;
+	MEM_STALL = 0;
+	if (seen & 256) {
+		L2_CONFIG = l2;
+	}
+	if (seen & 128) {
+		FETCH_STALL = cache[0];
+		FETCH_FILLED_PC = cache[1];
+		MEM_STALL = cache[2];
+		ICACHE_CONFIG = icache;
+		DCACHE_CONFIG = dcache;
+		if (!cache_restore(cache_blob, cache_size) || ((seen & 256) && !cache_l2_restore(l2_blob, l2_size))) {
+			printf("Warning: cache state in %s does not fit, starting the caches cold\n", file);
+			cache_release();
+		}
+	}
+	dram_release();
+	if (seen & 512) {
+		DRAM_CONFIG = dram;
+		if (!dram_restore(dram_blob, dram_size)) {
+			printf("Warning: DRAM state in %s does not fit, starting it idle\n", file);
+		}
+	}
+	prefetch_release();
+	if (seen & 1024) {
+		PREFETCH_CONFIG = prefetch;
+		if (!prefetch_restore(prefetch_blob, prefetch_size)) {
+			printf("Warning: prefetcher state in %s does not fit, starting it cold\n", file);
+		}
+	}
+	//buffered stores are already in guest memory, dropping them only loses their D-cache writes
+	storebuf_release();
+	if (seen & 2048) {
+		STOREBUF_CONFIG = storebuf;
+		if (!storebuf_restore(storebuf_blob, storebuf_size)) {
+			printf("Warning: store buffer state in %s does not fit, starting it empty\n", file);
+		}
+	}
+	//without it the units are idle, which only makes the next multiply or divide early
+	muldiv_release();
+	EX_STALL = FALSE;
+	if (seen & 16384) {
+		MULDIV_CONFIG = muldiv;
+		if (!muldiv_restore(muldiv_blob, muldiv_size)) {
+			printf("Warning: multiply/divide state in %s does not fit, starting the units idle\n", file);
+		}
+	}
+	//a checkpoint without it was written by a scalar pipeline, the second slot is then empty
+	if (!(seen & 4096)) {
+		memset(issue, 0, sizeof(issue));
+		issue[0] = ISSUE_WIDTH;
+	}
+	ISSUE_WIDTH = issue[0];
+	words_to_latch(issue + 1, &IF_ID_GROUP[1]);
+	words_to_latch(issue + 1 + CKPT_LATCH_WORDS, &ID_EX_GROUP[1]);
+	words_to_latch(issue + 1 + 2 * CKPT_LATCH_WORDS, &EX_MEM_GROUP[1]);
+	words_to_latch(issue + 1 + 3 * CKPT_LATCH_WORDS, &MEM_WB_GROUP[1]);
+	issue_pred = issue + 1 + 4 * CKPT_LATCH_WORDS;
+	IF_ID_GROUP[1].predictedPC = issue_pred[0];
+	IF_ID_GROUP[1].predictInfo = issue_pred[1];
+	ID_EX_GROUP[1].predictedPC = issue_pred[2];
+	ID_EX_GROUP[1].predictInfo = issue_pred[3];
+	EX_MEM_GROUP[1].predictedPC = issue_pred[4];
+	EX_MEM_GROUP[1].predictInfo = issue_pred[5];
+	MEM_WB_GROUP[1].predictedPC = issue_pred[6];
+	MEM_WB_GROUP[1].predictInfo = issue_pred[7];
+	//without it the checkpoint came from the pipeline, which is where it goes on then
+	ooo_release();
+	if (seen & 8192) {
+		OOO_CONFIG = ooo;
+		if (OOO_CONFIG.enabled && !ooo_restore(ooo_blob, ooo_size)) {
+			printf("Warning: out-of-order core state in %s does not fit, starting it from the committed state\n", file);
+		}
+	}else {
+		OOO_CONFIG.enabled = FALSE;
+	}
+	free(buf);
+	if (!QUIET) {
+		printf("Checkpoint loaded from %s: cycle %u, PC 0x%08x, %u pages\n\n", file, CYCLE_COUNT, CURRENT_STATE.PC, pages);
+	}
+	return TRUE;
+}
@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Basic-block dynamic binary translation to x86-64 (functional mode).         */
+/*                                                                                                                               */
+/* Blocks run from their entry PC up to and including the first branch, jal */
+/* or jalr (opcodes 99/111/103). A block is translated once the driver has    */
+/* entered it DBT_HOT_THRESHOLD times. The guest registers stay in            */
+/* CURRENT_STATE.REGS (rbx points at them) and the PC is written back on   */
+/* every exit, so the architectural state is coherent at each block boundary. */
+/* Exits to a direct target return the address of their jmp so that the       */
+/* driver can chain them straight to the translated successor. Loads and       */
+/* stores call back into MEM_load/MEM_store. A store to translated text   */
+/* leaves its block and the whole code cache is dropped.                               */
+/***************************************************************/
+#if defined(__x86_64__) && !defined(MU_NO_DBT)
+
+#include <sys/mman.h>
+
+#define DBT_CACHE_SIZE (4 << 20)	/* bytes of host code */
+#define DBT_MAX_BLOCK 64		/* guest instructions per block */
+#define DBT_MAX_INST_BYTES 160		/* worst case host bytes per guest instruction */
+#define DBT_HOT_THRESHOLD 16
+#define DBT_HASH_BITS 12
+#define DBT_HASH_ENTRIES (1 << DBT_HASH_BITS)
+
+typedef struct {
+	uint32_t pc;		/* guest PC to continue at, written on every exit */
+	uint32_t left;		/* instruction budget, blocks only run when it covers them */
+} dbt_frame_t;
+
+typedef struct {
+	uint32_t pc;		/* guest entry PC, MEM_TLB_INVALID if empty */
+	uint32_t length;	/* guest instructions */
+	uint8_t *code;	/* host entry point, NULL if the block can not be translated */
+} dbt_block_t;
+
+typedef uint64_t (*dbt_enter_fn)(uint32_t *regs, dbt_frame_t *state, uint8_t *code);
+
+/* per simulator context (SIM->dbt), the code embeds the context's TLB address */
+struct dbt_state {
+	uint8_t *cache;		/* RWX code cache */
+	uint8_t *cache_end;
+	uint8_t *emit;		/* next free byte */
+	uint8_t *epilogue;	/* restores host registers and returns rax */
+	dbt_enter_fn enter;
+	dbt_block_t blocks[DBT_HASH_ENTRIES];
+	uint16_t heat[DBT_HASH_ENTRIES];
+	uint32_t block_count;
+	uint32_t text_lo, text_hi;	/* guest range covered by translations */
+	uint32_t flush_pending;
+	uint32_t stop_pc;	/* blocks never run across the 'ff @<pc>' address */
+	uint32_t disabled;
+};
+
+#define DBT_CACHE (SIM->dbt->cache)
+#define DBT_CACHE_END (SIM->dbt->cache_end)
+#define DBT_EMIT (SIM->dbt->emit)
+#define DBT_EPILOGUE (SIM->dbt->epilogue)
+#define DBT_ENTER (SIM->dbt->enter)
+#define DBT_BLOCKS (SIM->dbt->blocks)
+#define DBT_HEAT (SIM->dbt->heat)
+#define DBT_BLOCK_COUNT (SIM->dbt->block_count)
+#define DBT_TEXT_LO (SIM->dbt->text_lo)
+#define DBT_TEXT_HI (SIM->dbt->text_hi)
+#define DBT_FLUSH_PENDING (SIM->dbt->flush_pending)
+#define DBT_STOP_PC (SIM->dbt->stop_pc)
+#define DBT_DISABLED (SIM->dbt->disabled)
+
+/***************************************************************/
+/* x86-64 emitter                                                                                                    */
+/***************************************************************/
+static void emit8(uint8_t b)
+{
+	*DBT_EMIT++ = b;
+}
+
+static void emit32(uint32_t v)
+{
+	memcpy(DBT_EMIT, &v, 4);
+	DBT_EMIT += 4;
+}
+
+static void emit64(uint64_t v)
+{
+	memcpy(DBT_EMIT, &v, 8);
+	DBT_EMIT += 8;
+}
+
+/* rel32 of a jump/jcc whose 4 byte displacement starts at site */
+static void patch_rel32(uint8_t *site, uint8_t *target)
+{
+	int32_t rel = (int32_t)(target - (site + 4));
+	memcpy(site, &rel, 4);
+}
+
+/* mov r32, [rbx + 4*reg], r is the x86 register number (eax=0, ecx=1, esi=6, edi=7) */
+static void emit_load_reg(uint32_t r, uint32_t reg)
+{
+	emit8(0x8B); emit8(0x43 | (r << 3)); emit8(reg * 4);
+}
+
+/* mov [rbx + 4*reg], eax */
+static void emit_store_eax(uint32_t reg)
+{
+	emit8(0x89); emit8(0x43); emit8(reg * 4);
+}
+
+/* mov dword [rbx + 4*reg], imm32 */
+static void emit_store_imm(uint32_t reg, uint32_t imm)
+{
+	emit8(0xC7); emit8(0x43); emit8(reg * 4); emit32(imm);
+}
+
+/* mov dword [rbp + off], imm32 (dbt_frame_t field) */
+static void emit_state_imm(uint32_t off, uint32_t imm)
+{
+	emit8(0xC7); emit8(0x45); emit8(off); emit32(imm);
+}
+
+/* mov rax, helper; call rax */
+static void emit_call(const void *helper)
+{
+	emit8(0x48); emit8(0xB8); emit64((uint64_t)(uintptr_t)helper);
+	emit8(0xFF); emit8(0xD0);
+}
+
+/* jmp epilogue with rax = 0 (no chaining) */
+static void emit_exit_unchained()
+{
+	emit8(0x31); emit8(0xC0);
+	emit8(0xE9); emit32(0);
+	patch_rel32(DBT_EMIT - 4, DBT_EPILOGUE);
+}
+
+/* leave for target_pc through a jmp the driver may later point at the successor block */
+static void emit_exit_chainable(uint32_t target_pc)
+{
+	emit_state_imm(offsetof(dbt_frame_t, pc), target_pc);
+	//lea rax, [rip+0] gives the address of the jmp that follows
+	emit8(0x48); emit8(0x8D); emit8(0x05); emit32(0);
+	emit8(0xE9); emit32(0);
+	patch_rel32(DBT_EMIT - 4, DBT_EPILOGUE);
+}
+
+/* Inline software TLB probe for the aligned word at edi (mem_read_32/mem_write_32 fast path). */
+/* Leaves the host address of the word in rdx+rcx and returns the rel32 of the miss jump.       */
+static uint8_t *emit_tlb_probe(const mem_tlb_entry_t *table)
+{
+	uint8_t *miss;
+	emit8(0x89); emit8(0xF8);				//mov eax, edi
+	emit8(0xC1); emit8(0xE8); emit8(MEM_PAGE_BITS);	//shr eax, page bits
+	emit8(0x25); emit32(MEM_TLB_ENTRIES - 1);		//and eax, entries - 1
+	emit8(0xC1); emit8(0xE0); emit8(4);			//shl eax, 4 (sizeof(mem_tlb_entry_t))
+	emit8(0x48); emit8(0xBA); emit64((uint64_t)(uintptr_t)table);	//mov rdx, table
+	emit8(0x48); emit8(0x01); emit8(0xC2);			//add rdx, rax
+	//a misaligned address keeps its low bits and can never match a tag
+	emit8(0x89); emit8(0xF9);				//mov ecx, edi
+	emit8(0x81); emit8(0xE1); emit32(~MEM_PAGE_MASK | 3);	//and ecx, ~page mask | 3
+	emit8(0x3B); emit8(0x0A);				//cmp ecx, [rdx]
+	emit8(0x0F); emit8(0x85); emit32(0);			//jne miss
+	miss = DBT_EMIT - 4;
+	emit8(0x48); emit8(0x8B); emit8(0x52); emit8(offsetof(mem_tlb_entry_t, host));	//mov rdx, [rdx+host]
+	emit8(0x89); emit8(0xF9);				//mov ecx, edi
+	emit8(0x81); emit8(0xE1); emit32(MEM_PAGE_MASK);	//and ecx, page mask
+	return miss;
+}
+
+/***************************************************************/
+/* Helpers called from translated code                                                                    */
+/***************************************************************/
+static uint32_t dbt_helper_load(uint32_t address, uint32_t op)
+{
+	decoded_inst_t d = { .op = op };
+	return MEM_load(&d, address);
+}
+
+//returns non-zero when the store hit translated code and the block has to stop
+static uint32_t dbt_helper_store(uint32_t address, uint32_t value, uint32_t op)
+{
+	decoded_inst_t d = { .op = op };
+	MEM_store(&d, address, value);
+	return DBT_FLUSH_PENDING;
+}
+
+/***************************************************************/
+/* Code cache management                                                                                   */
+/***************************************************************/
+static void dbt_reset_cache()
+{
+	int i;
+	DBT_EMIT = DBT_CACHE;
+	//entry trampoline: save callee saved registers, keep the stack 16 byte aligned for helper calls
+	emit8(0x53);						//push rbx
+	emit8(0x55);						//push rbp
+	emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08);	//sub rsp, 8
+	emit8(0x48); emit8(0x89); emit8(0xFB);			//mov rbx, rdi (guest registers)
+	emit8(0x48); emit8(0x89); emit8(0xF5);			//mov rbp, rsi (dbt_frame_t)
+	emit8(0xFF); emit8(0xE2);				//jmp rdx (block)
+	DBT_EPILOGUE = DBT_EMIT;
+	emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08);	//add rsp, 8
+	emit8(0x5D);						//pop rbp
+	emit8(0x5B);						//pop rbx
+	emit8(0xC3);						//ret
+	DBT_ENTER = (dbt_enter_fn)(uintptr_t)DBT_CACHE;
+
+	for (i = 0; i < DBT_HASH_ENTRIES; i++) {
+		DBT_BLOCKS[i].pc = MEM_TLB_INVALID;
+		DBT_BLOCKS[i].code = NULL;
+	}
+	DBT_BLOCK_COUNT = 0;
+	DBT_TEXT_LO = UINT32_MAX;
+	DBT_TEXT_HI = 0;
+	DBT_FLUSH_PENDING = FALSE;
+}
+
+static int dbt_init()
+{
+	if (SIM->dbt == NULL) {
+		SIM->dbt = calloc(1, sizeof(struct dbt_state));
+		if (SIM->dbt == NULL) {
+			printf("Error: out of host memory for the translator\n");
+			exit(-1);
+		}
+		DBT_TEXT_LO = UINT32_MAX;
+		DBT_STOP_PC = MEM_TLB_INVALID;
+	}
+	if (DBT_CACHE != NULL) {
+		return TRUE;
+	}
+	if (DBT_DISABLED) {
+		return FALSE;
+	}
+	DBT_CACHE = mmap(NULL, DBT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (DBT_CACHE == MAP_FAILED) {
+		if (!QUIET) {
+			printf("Warning: can't map an executable code cache, using the threaded engine instead\n");
+		}
+		DBT_CACHE = NULL;
+		DBT_DISABLED = TRUE;
+		return FALSE;
+	}
+	DBT_CACHE_END = DBT_CACHE + DBT_CACHE_SIZE;
+	dbt_reset_cache();
+	return TRUE;
+}
+
+/***************************************************************/
+/* Drop every translation (new program, or a store into translated text)  */
+/***************************************************************/
+void dbt_flush()
+{
+	if (SIM->dbt == NULL) {
+		return;
+	}
+	if (DBT_CACHE != NULL) {
+		dbt_reset_cache();
+	}
+	memset(DBT_HEAT, 0, sizeof(DBT_HEAT));
+}
+
+void dbt_release()
+{
+	if (SIM->dbt == NULL) {
+		return;
+	}
+	if (DBT_CACHE != NULL) {
+		munmap(DBT_CACHE, DBT_CACHE_SIZE);
+	}
+	free(SIM->dbt);
+	SIM->dbt = NULL;
+}
+
+void dbt_invalidate(uint32_t address)
+{
+	if (SIM->dbt == NULL) {
+		return;
+	}
+	//the cache can't be reset while a block is still running, the driver does it once control is back
+	if (address + 3 >= DBT_TEXT_LO && address < DBT_TEXT_HI) {
+		DBT_FLUSH_PENDING = TRUE;
+	}
+}
+
+static dbt_block_t *dbt_slot(uint32_t pc)
+{
+	uint32_t i = (pc >> 2) & (DBT_HASH_ENTRIES - 1);
+	//linear probing, dbt_translate() starts over before the table is half full
+	while (DBT_BLOCKS[i].pc != pc && DBT_BLOCKS[i].pc != MEM_TLB_INVALID) {
+		i = (i + 1) & (DBT_HASH_ENTRIES - 1);
+	}
+	return &DBT_BLOCKS[i];
+}
+
+/***************************************************************/
+/* Can this instruction be part of a translated block                                         */
+/***************************************************************/
+static int dbt_supported(const decoded_inst_t *d)
+{
+	switch (d->cls) {
+		case CLASS_ALU:
+		case CLASS_ALU_IMM:
+		case CLASS_LOAD:
+		case CLASS_STORE:
+		case CLASS_BRANCH:
+		case CLASS_JUMP:
+			//atomics, multiplies and divides are left to the interpreter
+			return d->op != OP_INVALID && !op_is_atomic(d->op) && !op_is_muldiv(d->op);
+		default:
+			return FALSE;
+	}
+}
+
+/***************************************************************/
+/* Translate one guest instruction, returns TRUE if it ended the block           */
+/***************************************************************/
+static int dbt_translate_inst(const decoded_inst_t *d, uint32_t pc, uint32_t index, uint32_t length)
+{
+	static const uint8_t r_ops[NUM_OPS] = {
+		[OP_ADD] = 0x01, [OP_SUB] = 0x29, [OP_XOR] = 0x31, [OP_OR] = 0x09, [OP_AND] = 0x21,
+	};
+	static const uint8_t i_ops[NUM_OPS] = {
+		[OP_ADDI] = 0x05, [OP_XORI] = 0x35, [OP_ORI] = 0x0D, [OP_ANDI] = 0x25,
+	};
+	/* modrm of the D3 (by cl) and C1 (by imm8) shift groups */
+	static const uint8_t shifts[NUM_OPS] = {
+		[OP_SLL] = 0xE0, [OP_SRL] = 0xE8, [OP_SRA] = 0xF8,
+		[OP_SLLI] = 0xE0, [OP_SRLI] = 0xE8, [OP_SRAI] = 0xF8,
+	};
+	/* jcc taken after cmp eax, rs2 */
+	static const uint8_t branches[NUM_OPS] = {
+		[OP_BEQ] = 0x84, [OP_BNE] = 0x85, [OP_BLT] = 0x8C, [OP_BGE] = 0x8D, [OP_BLTU] = 0x82, [OP_BGEU] = 0x83,
+	};
+	uint8_t *taken, *skip, *miss = NULL, *done = NULL;
+	//lw/sw probe the TLB inline (the entry layout is host specific), everything else calls MEM_load/MEM_store
+	int inline_tlb = sizeof(mem_tlb_entry_t) == 16 && (d->op == OP_LW || d->op == OP_SW);
+
+	switch (d->cls) {
+		case CLASS_ALU:
+			if (!d->writes_rd) {
+				break;
+			}
+			emit_load_reg(0, d->rs1);
+			emit_load_reg(1, d->rs2);
+			if (shifts[d->op]) {
+				emit8(0xD3); emit8(shifts[d->op]);	//shift eax by cl, x86 masks the count to 5 bits like RISC-V
+			}else {
+				emit8(r_ops[d->op]); emit8(0xC8);	//op eax, ecx
+			}
+			emit_store_eax(d->rd);
+			break;
+		case CLASS_ALU_IMM:
+			if (!d->writes_rd) {
+				break;
+			}
+			emit_load_reg(0, d->rs1);
+			if (shifts[d->op]) {
+				emit8(0xC1); emit8(shifts[d->op]); emit8(d->imm);
+			}else {
+				emit8(i_ops[d->op]); emit32(d->imm);
+			}
+			emit_store_eax(d->rd);
+			break;
+		case CLASS_LOAD:
+			if (!d->writes_rd) {
+				break;
+			}
+			emit_load_reg(7, d->rs1);
+			emit8(0x81); emit8(0xC7); emit32(d->imm);		//add edi, imm
+			if (inline_tlb) {
+				miss = emit_tlb_probe(MEM_TLB_READ);
+				emit8(0x8B); emit8(0x04); emit8(0x0A);		//mov eax, [rdx+rcx]
+				emit_store_eax(d->rd);
+				emit8(0xE9); emit32(0);				//jmp done
+				done = DBT_EMIT - 4;
+				patch_rel32(miss, DBT_EMIT);
+			}
+			emit8(0xBE); emit32(d->op);				//mov esi, op
+			emit_call(dbt_helper_load);
+			emit_store_eax(d->rd);
+			if (done != NULL) {
+				patch_rel32(done, DBT_EMIT);
+			}
+			break;
+		case CLASS_STORE:
+			emit_load_reg(7, d->rs1);
+			emit8(0x81); emit8(0xC7); emit32(d->imm);		//add edi, imm
+			if (inline_tlb) {
+				//text pages never get write entries, so this path can't modify code
+				miss = emit_tlb_probe(MEM_TLB_WRITE);
+				emit_load_reg(6, d->rs2);
+				emit8(0x89); emit8(0x34); emit8(0x0A);		//mov [rdx+rcx], esi
+				emit8(0xE9); emit32(0);				//jmp done
+				done = DBT_EMIT - 4;
+				patch_rel32(miss, DBT_EMIT);
+			}
+			emit_load_reg(6, d->rs2);
+			emit8(0xBA); emit32(d->op);				//mov edx, op
+			emit_call(dbt_helper_store);
+			//self-modifying store: give back the budget of the rest of the block and leave after this instruction
+			emit8(0x85); emit8(0xC0);				//test eax, eax
+			emit8(0x74); emit8(0);					//jz over the exit
+			skip = DBT_EMIT;
+			emit_state_imm(offsetof(dbt_frame_t, pc), pc + 4);
+			emit8(0x81); emit8(0x45); emit8(offsetof(dbt_frame_t, left)); emit32(length - index - 1);
+			emit_exit_unchained();
+			skip[-1] = (uint8_t)(DBT_EMIT - skip);
+			if (done != NULL) {
+				patch_rel32(done, DBT_EMIT);
+			}
+			break;
+		case CLASS_BRANCH:
+			emit_load_reg(0, d->rs1);
+			emit8(0x3B); emit8(0x43); emit8(d->rs2 * 4);	//cmp eax, [rs2]
+			emit8(0x0F); emit8(branches[d->op]); emit32(0);
+			taken = DBT_EMIT;
+			emit_exit_chainable(pc + 4);
+			patch_rel32(taken - 4, DBT_EMIT);
+			emit_exit_chainable(pc + d->imm);
+			return TRUE;
+		case CLASS_JUMP:
+			if (d->op == OP_JAL) {
+				if (d->writes_rd) {
+					emit_store_imm(d->rd, pc + 4);
+				}
+				emit_exit_chainable(pc + d->imm);
+				return TRUE;
+			}
+			//jalr: read rs1 before the link in case rd == rs1
+			emit_load_reg(0, d->rs1);
+			emit8(0x05); emit32(d->imm);				//add eax, imm
+			emit8(0x83); emit8(0xE0); emit8(0xFE);			//and eax, ~1
+			if (d->writes_rd) {
+				emit_store_imm(d->rd, pc + 4);
+			}
+			emit8(0x89); emit8(0x45); emit8(offsetof(dbt_frame_t, pc));	//mov [rbp+pc], eax
+			emit_exit_unchained();
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* Translate the block starting at pc                                                                      */
+/***************************************************************/
+static void dbt_translate(dbt_block_t *block, uint32_t pc)
+{
+	const decoded_inst_t *insts[DBT_MAX_BLOCK];
+	uint32_t length = 0, i, end;
+	uint8_t *bail;
+
+	if (DBT_BLOCK_COUNT >= DBT_HASH_ENTRIES / 2) {
+		dbt_reset_cache();
+		block = dbt_slot(pc);
+	}
+	DBT_BLOCK_COUNT++;
+	block->pc = pc;
+	block->code = NULL;
+	//find the extent of the block first, the budget check needs its length
+	while (length < DBT_MAX_BLOCK) {
+		end = pc + length * 4;
+		if (mem_region_index(end) != MEM_REGION_TEXT || (length > 0 && end == DBT_STOP_PC)) {
+			break;
+		}
+		insts[length] = predecode(end);
+		if (!dbt_supported(insts[length])) {
+			break;
+		}
+		length++;
+		if (insts[length - 1]->cls == CLASS_BRANCH || insts[length - 1]->cls == CLASS_JUMP) {
+			break;
+		}
+	}
+	block->length = length;
+	if (length == 0 || pc == DBT_STOP_PC) {
+		return;
+	}
+	if (DBT_EMIT + (length + 2) * DBT_MAX_INST_BYTES > DBT_CACHE_END) {
+		//full, start over (the block entry itself is gone as well)
+		dbt_reset_cache();
+		block = dbt_slot(pc);
+		block->pc = pc;
+		block->length = length;
+		DBT_BLOCK_COUNT = 1;
+	}
+	//the predecoded records may be replaced while we emit, keep copies
+	decoded_inst_t copies[DBT_MAX_BLOCK];
+	for (i = 0; i < length; i++) {
+		copies[i] = *insts[i];
+	}
+
+	block->code = DBT_EMIT;
+	//only run the block when the budget covers all of it
+	emit8(0x81); emit8(0x7D); emit8(offsetof(dbt_frame_t, left)); emit32(length);	//cmp dword [rbp+left], length
+	emit8(0x0F); emit8(0x82); emit32(0);							//jb bail
+	bail = DBT_EMIT;
+	emit8(0x81); emit8(0x6D); emit8(offsetof(dbt_frame_t, left)); emit32(length);	//sub dword [rbp+left], length
+	for (i = 0; i < length; i++) {
+		if (dbt_translate_inst(&copies[i], pc + i * 4, i, length)) {
+			break;
+		}
+	}
+	if (i == length) {
+		//ran out of instructions we can translate, fall through to the next one
+		emit_exit_chainable(pc + length * 4);
+	}
+	patch_rel32(bail - 4, DBT_EMIT);
+	emit_state_imm(offsetof(dbt_frame_t, pc), pc);
+	emit_exit_unchained();
+
+	if (pc < DBT_TEXT_LO) {
+		DBT_TEXT_LO = pc;
+	}
+	if (pc + length * 4 > DBT_TEXT_HI) {
+		DBT_TEXT_HI = pc + length * 4;
+	}
+}
+
+/***************************************************************/
+/* Fast-forward with translated blocks, returns instructions executed          */
+/***************************************************************/
+uint32_t dbt_run(uint32_t count, uint32_t stop_pc, int to_pc)
+{
+	uint32_t executed = 0, budget, pc, heat;
+	dbt_frame_t state;
+	dbt_block_t *block, *next;
+	uint64_t site;
+
+	if (!dbt_init()) {
+		return threaded_run(count, stop_pc, to_pc);
+	}
+	if (DBT_FLUSH_PENDING) {
+		dbt_flush();
+	}
+	if (to_pc && stop_pc != DBT_STOP_PC) {
+		//existing blocks may run straight across the new stop address
+		dbt_flush();
+		DBT_STOP_PC = stop_pc;
+	}
+	while (RUN_FLAG && (to_pc ? CURRENT_STATE.PC != stop_pc : executed < count)) {
+		pc = CURRENT_STATE.PC;
+		block = dbt_slot(pc);
+		if (block->pc != pc) {
+			heat = ++DBT_HEAT[(pc >> 2) & (DBT_HASH_ENTRIES - 1)];
+			if (heat >= DBT_HOT_THRESHOLD) {
+				dbt_translate(block, pc);
+				block = dbt_slot(pc);
+			}
+		}
+		if (block->pc == pc && block->code != NULL) {
+			budget = to_pc ? UINT32_MAX : count - executed;
+			state.pc = pc;
+			state.left = budget;
+			site = DBT_ENTER(CURRENT_STATE.REGS, &state, block->code);
+			CURRENT_STATE.PC = state.pc;
+			INSTRUCTION_COUNT += budget - state.left;
+			executed += budget - state.left;
+			if (DBT_FLUSH_PENDING) {
+				dbt_flush();
+				continue;
+			}
+			if (site != 0) {
+				//chain the exit we left through to its target if that is translated already
+				next = dbt_slot(state.pc);
+				if (next->pc == state.pc && next->code != NULL) {
+					patch_rel32((uint8_t *)(uintptr_t)site + 1, next->code);
+				}
+			}
+			if (budget != state.left) {
+				continue;
+			}
+			//the block did not fit in the budget, finish instruction by instruction
+		}
+		if (!func_step()) {
+			RUN_FLAG = FALSE;
+			break;
+		}
+		executed++;
+	}
+	return executed;
+}
+
+#else
+
+/* no x86-64 host: the engine is the threaded interpreter */
+uint32_t dbt_run(uint32_t count, uint32_t stop_pc, int to_pc)
+{
+	return threaded_run(count, stop_pc, to_pc);
+}
+
+void dbt_flush()
+{
+}
+
+void dbt_release()
+{
+}
+
+void dbt_invalidate(uint32_t address)
+{
+}
+
+#endif
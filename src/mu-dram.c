@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Banked DRAM timing under the caches.                                                                 */
+/*                                                                                                                               */
+/* Guest addresses are split row:bank:column, each bank keeps its last row   */
+/* open. A read costs tCAS on a row hit, tRCD + tCAS on a closed bank and    */
+/* tRP + tRCD + tCAS on a row conflict, plus tBURST on the shared data bus. */
+/* Writes (cache write-backs and write-throughs) are posted to a queue and  */
+/* only stall the requester when the queue is full. The queue is scheduled  */
+/* FR-FCFS: writes that hit an open row go first, otherwise the oldest. It is */
+/* worked off in the background whenever a bank is free before a read      */
+/* arrives, and a read that would conflict waits for the row hits queued for  */
+/* its bank. All times are in CPU cycles.                                                               */
+/***************************************************************/
+#define DRAM_ROW_CLOSED 0xFFFFFFFF
+
+typedef struct {
+	uint32_t open_row;	/* DRAM_ROW_CLOSED before the first access */
+	uint32_t ready;		/* cycle the bank can start the next access */
+} dram_bank_t;
+
+typedef struct {
+	uint32_t address;
+	uint32_t arrival;	/* cycle the write was posted */
+} dram_request_t;
+
+/* per simulator context (SIM->dram), allocated by the first access */
+struct dram_state {
+	dram_bank_t *banks;
+	dram_request_t *queue;	/* oldest first */
+	uint32_t count;
+	uint32_t bus_ready;	/* cycle the data bus is free */
+};
+
+#define DRAM (SIM->dram)
+
+static struct dram_state *dram_get()
+{
+	uint32_t i;
+	if (DRAM != NULL) {
+		return DRAM;
+	}
+	DRAM = calloc(1, sizeof(struct dram_state));
+	if (DRAM != NULL) {
+		DRAM->banks = calloc(DRAM_CONFIG.banks, sizeof(dram_bank_t));
+		DRAM->queue = calloc(DRAM_CONFIG.queue_depth, sizeof(dram_request_t));
+	}
+	if (DRAM == NULL || DRAM->banks == NULL || DRAM->queue == NULL) {
+		printf("Error: out of host memory for the DRAM model\n");
+		exit(-1);
+	}
+	for (i = 0; i < DRAM_CONFIG.banks; i++) {
+		DRAM->banks[i].open_row = DRAM_ROW_CLOSED;
+	}
+	return DRAM;
+}
+
+void dram_release()
+{
+	if (DRAM == NULL) {
+		return;
+	}
+	free(DRAM->banks);
+	free(DRAM->queue);
+	free(DRAM);
+	DRAM = NULL;
+}
+
+/***************************************************************/
+/* Configuration: 'dram <param> <n>'                                                                     */
+/***************************************************************/
+static int power_of_two(uint32_t value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+int dram_config_valid(const dram_config_t *config)
+{
+	return power_of_two(config->banks) && power_of_two(config->row_size) && config->row_size >= 64 &&
+		config->queue_depth >= 1 && config->t_burst >= 1;
+}
+
+int dram_param(const char *name, uint32_t value)
+{
+	dram_config_t config = DRAM_CONFIG;
+	if (strcmp(name, "enable") == 0) {
+		config.enabled = value != 0;
+	}else if (strcmp(name, "banks") == 0) {
+		config.banks = value;
+	}else if (strcmp(name, "row") == 0) {
+		config.row_size = value;
+	}else if (strcmp(name, "queue") == 0) {
+		config.queue_depth = value;
+	}else if (strcmp(name, "tcas") == 0) {
+		config.t_cas = value;
+	}else if (strcmp(name, "trcd") == 0) {
+		config.t_rcd = value;
+	}else if (strcmp(name, "trp") == 0) {
+		config.t_rp = value;
+	}else if (strcmp(name, "tburst") == 0) {
+		config.t_burst = value;
+	}else {
+		return FALSE;
+	}
+	if (!dram_config_valid(&config)) {
+		return FALSE;
+	}
+	DRAM_CONFIG = config;
+	dram_release();
+	return TRUE;
+}
+
+/***************************************************************/
+/* Scheduling                                                                                                                  */
+/***************************************************************/
+static uint32_t dram_bank(uint32_t address)
+{
+	return (address / DRAM_CONFIG.row_size) & (DRAM_CONFIG.banks - 1);
+}
+
+static uint32_t dram_row(uint32_t address)
+{
+	return address / DRAM_CONFIG.row_size / DRAM_CONFIG.banks;
+}
+
+static uint32_t max_u32(uint32_t a, uint32_t b)
+{
+	return a > b ? a : b;
+}
+
+//Carry out one access that arrives at the given cycle, returns the cycle its data is through.
+static uint32_t dram_issue(uint32_t address, uint32_t arrival)
+{
+	dram_bank_t *bank = &DRAM->banks[dram_bank(address)];
+	uint32_t row = dram_row(address);
+	uint32_t start = max_u32(arrival, bank->ready);
+	uint32_t latency, done;
+
+	if (bank->open_row == row) {
+		latency = DRAM_CONFIG.t_cas;
+		STATS.dram.row_hits++;
+	}else if (bank->open_row == DRAM_ROW_CLOSED) {
+		latency = DRAM_CONFIG.t_rcd + DRAM_CONFIG.t_cas;
+		STATS.dram.row_misses++;
+	}else {
+		latency = DRAM_CONFIG.t_rp + DRAM_CONFIG.t_rcd + DRAM_CONFIG.t_cas;
+		STATS.dram.row_conflicts++;
+	}
+	done = max_u32(start + latency, DRAM->bus_ready) + DRAM_CONFIG.t_burst;
+	DRAM->bus_ready = done;
+	STATS.dram.bus_busy_cycles += DRAM_CONFIG.t_burst;
+	bank->open_row = row;
+	bank->ready = done;
+	return done;
+}
+
+static uint32_t dram_service(uint32_t i)
+{
+	uint32_t done = dram_issue(DRAM->queue[i].address, DRAM->queue[i].arrival);
+	memmove(&DRAM->queue[i], &DRAM->queue[i + 1], (DRAM->count - i - 1) * sizeof(dram_request_t));
+	DRAM->count--;
+	return done;
+}
+
+//FR-FCFS pick: the oldest write hitting an open row (of one bank, or any if bank is -1), else the oldest.
+static int dram_pick(int bank, int row_hits_only)
+{
+	uint32_t i, b;
+	for (i = 0; i < DRAM->count; i++) {
+		b = dram_bank(DRAM->queue[i].address);
+		if ((bank < 0 || b == (uint32_t)bank) && DRAM->banks[b].open_row == dram_row(DRAM->queue[i].address)) {
+			return i;
+		}
+	}
+	return row_hits_only || DRAM->count == 0 ? -1 : 0;
+}
+
+/***************************************************************/
+/* Cycles from now until a read's data is there, or the stall of a write   */
+/***************************************************************/
+uint32_t dram_access(uint32_t address, int write, uint32_t now)
+{
+	int region = mem_region_index(address);
+	uint32_t done, row = 0, bank = 0;
+	int i;
+
+	dram_get();
+	if (region >= 0) {
+		STATS.dram.region_accesses[region]++;
+	}
+	//writes the scheduler got to while nothing else needed the banks
+	while ((i = dram_pick(-1, FALSE)) >= 0 &&
+			max_u32(DRAM->queue[i].arrival, DRAM->banks[dram_bank(DRAM->queue[i].address)].ready) < now) {
+		dram_service(i);
+	}
+
+	if (write) {
+		STATS.dram.writes++;
+		done = now;
+		if (DRAM->count == DRAM_CONFIG.queue_depth) {
+			//full: the oldest write has to go out before this one fits
+			STATS.dram.queue_full_stalls++;
+			done = max_u32(dram_service(0), now);
+		}
+		DRAM->queue[DRAM->count].address = address;
+		DRAM->queue[DRAM->count].arrival = done;
+		DRAM->count++;
+		return done - now;
+	}
+
+	STATS.dram.reads++;
+	bank = dram_bank(address);
+	row = dram_row(address);
+	//first ready: queued row hits on this bank go ahead of a read that would close their row
+	if (DRAM->banks[bank].open_row != row) {
+		while ((i = dram_pick(bank, TRUE)) >= 0) {
+			dram_service(i);
+		}
+	}
+	done = dram_issue(address, now);
+	STATS.dram.read_latency += done - now;
+	return done - now;
+}
+
+/***************************************************************/
+/* Bank and queue state as one blob for checkpoints                                              */
+/***************************************************************/
+static size_t dram_blob_size()
+{
+	return 2 * 4 + DRAM_CONFIG.banks * 8 + DRAM_CONFIG.queue_depth * 8;
+}
+
+uint8_t *dram_snapshot(size_t *size)
+{
+	uint8_t *blob, *p;
+	uint32_t i;
+
+	dram_get();
+	*size = dram_blob_size();
+	blob = p = calloc(1, *size);
+	if (blob == NULL) {
+		printf("Error: out of host memory for the DRAM model\n");
+		exit(-1);
+	}
+	mem_store_le32(p, DRAM->count);
+	mem_store_le32(p + 4, DRAM->bus_ready);
+	p += 8;
+	for (i = 0; i < DRAM_CONFIG.banks; i++, p += 8) {
+		mem_store_le32(p, DRAM->banks[i].open_row);
+		mem_store_le32(p + 4, DRAM->banks[i].ready);
+	}
+	for (i = 0; i < DRAM->count; i++, p += 8) {
+		mem_store_le32(p, DRAM->queue[i].address);
+		mem_store_le32(p + 4, DRAM->queue[i].arrival);
+	}
+	return blob;
+}
+
+int dram_restore(const uint8_t *blob, size_t size)
+{
+	const uint8_t *p = blob;
+	uint32_t i;
+
+	dram_release();
+	if (size != dram_blob_size() || mem_load_le32(p) > DRAM_CONFIG.queue_depth) {
+		return FALSE;
+	}
+	dram_get();
+	DRAM->count = mem_load_le32(p);
+	DRAM->bus_ready = mem_load_le32(p + 4);
+	p += 8;
+	for (i = 0; i < DRAM_CONFIG.banks; i++, p += 8) {
+		DRAM->banks[i].open_row = mem_load_le32(p);
+		DRAM->banks[i].ready = mem_load_le32(p + 4);
+	}
+	for (i = 0; i < DRAM->count; i++, p += 8) {
+		DRAM->queue[i].address = mem_load_le32(p);
+		DRAM->queue[i].arrival = mem_load_le32(p + 4);
+	}
+	return TRUE;
+}
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Host-side microbenchmarks: the hot paths under cycle() run on their own */
+/* against synthetic instruction streams. Every benchmark gets a fresh     */
+/* machine, runs its warmup repetitions untimed and reports the mean,      */
+/* standard deviation and minimum ns/op of the timed ones.                       */
+/***************************************************************/
+#define STREAM_LENGTH 256		/* synthetic instructions, power of two */
+#define SCATTER_SPAN (4 << 20)	/* bytes the scattered accesses spread over */
+
+typedef struct {
+	const char *name;
+	void (*setup)();
+	void (*run)(uint32_t ops);
+} microbench_t;
+
+static volatile uint32_t sink;	/* results go here so the compiler keeps the work */
+static uint32_t stream_raw[STREAM_LENGTH];
+static decoded_inst_t stream[STREAM_LENGTH];
+static uint8_t stream_regs[STREAM_LENGTH][2];
+
+/***************************************************************/
+/* Instruction encoders for the synthetic streams and programs              */
+/***************************************************************/
+static uint32_t enc_r(uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd)
+{
+	return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | 0x33;
+}
+
+static uint32_t enc_i(uint32_t opcode, int32_t imm, uint32_t rs1, uint32_t funct3, uint32_t rd)
+{
+	return ((uint32_t)imm & 0xFFF) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t enc_s(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3)
+{
+	uint32_t i = (uint32_t)imm & 0xFFF;
+	return (i >> 5) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (i & 31) << 7 | 0x23;
+}
+
+static uint32_t enc_b(int32_t offset, uint32_t rs2, uint32_t rs1, uint32_t funct3)
+{
+	uint32_t i = (uint32_t)offset & 0x1FFF;
+	return (i >> 12) << 31 | ((i >> 5) & 0x3F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+			((i >> 1) & 0xF) << 8 | ((i >> 11) & 1) << 7 | 0x63;
+}
+
+static uint32_t enc_jal(int32_t offset, uint32_t rd)
+{
+	uint32_t i = (uint32_t)offset & 0x1FFFFF;
+	return (i >> 20) << 31 | ((i >> 1) & 0x3FF) << 21 | ((i >> 11) & 1) << 20 | ((i >> 12) & 0xFF) << 12 | rd << 7 | 0x6F;
+}
+
+/***************************************************************/
+/* A fresh machine for each benchmark                                                            */
+/***************************************************************/
+static uint32_t rng_state;
+
+static uint32_t rng()
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static void machine()
+{
+	if (SIM != NULL) {
+		sim_destroy(SIM);
+	}
+	SIM = sim_create();
+	QUIET = TRUE;
+	BATCH_MODE = TRUE;
+	initialize();
+	rng_state = 0x5A5;
+}
+
+//The mix a compiled RV32I loop body has: mostly ALU and loads, some stores, branches and jumps.
+static uint32_t random_instruction()
+{
+	uint32_t rd = 5 + rng() % 10, rs1 = 5 + rng() % 10, rs2 = 5 + rng() % 10;
+	switch (rng() % 10) {
+		case 0:
+		case 1:
+			return enc_r(rng() & 1 ? 0x20 : 0, rs2, rs1, 0, rd);	/* add/sub */
+		case 2:
+			return enc_r(0, rs2, rs1, 4 + rng() % 4, rd);	/* xor/srl/or/and */
+		case 3:
+		case 4:
+			return enc_i(0x13, (int32_t)(rng() % 256) - 128, rs1, 0, rd);	/* addi */
+		case 5:
+			return enc_i(0x13, rng() % 32, rs1, 1, rd);	/* slli */
+		case 6:
+		case 7:
+			return enc_i(0x03, (rng() % 64) * 4, rs1, 2, rd);	/* lw */
+		case 8:
+			return enc_s((rng() % 64) * 4, rs2, rs1, 2);	/* sw */
+		default:
+			return rng() & 1 ? enc_b(-16, rs2, rs1, rng() % 2) : enc_jal(64, 1);
+	}
+}
+
+static void stream_setup()
+{
+	uint32_t i;
+	machine();
+	for (i = 1; i < RISCV_REGS; i++) {
+		CURRENT_STATE.REGS[i] = rng();
+	}
+	for (i = 0; i < STREAM_LENGTH; i++) {
+		stream_raw[i] = random_instruction();
+		decode_instruction(stream_raw[i], &stream[i]);
+	}
+}
+
+/***************************************************************/
+/* Guest memory                                                                                                     */
+/***************************************************************/
+static void memory_setup()
+{
+	uint32_t offset;
+	machine();
+	//every page is resident, so the scattered runs measure translation and not allocation
+	for (offset = 0; offset < SCATTER_SPAN; offset += MEM_PAGE_SIZE) {
+		mem_write_32(MEM_DATA_BEGIN + offset, offset);
+	}
+}
+
+static void read_page(uint32_t ops)
+{
+	uint32_t i, sum = 0;
+	for (i = 0; i < ops; i++) {
+		sum += mem_read_32(MEM_DATA_BEGIN + ((i * 4) & (MEM_PAGE_SIZE - 1)));
+	}
+	sink = sum;
+}
+
+static void read_scatter(uint32_t ops)
+{
+	uint32_t i, sum = 0;
+	for (i = 0; i < ops; i++) {
+		sum += mem_read_32(MEM_DATA_BEGIN + ((i * 0x9E3779B1u) & (SCATTER_SPAN - 4)));
+	}
+	sink = sum;
+}
+
+static void write_page(uint32_t ops)
+{
+	uint32_t i;
+	for (i = 0; i < ops; i++) {
+		mem_write_32(MEM_DATA_BEGIN + ((i * 4) & (MEM_PAGE_SIZE - 1)), i);
+	}
+}
+
+static void write_scatter(uint32_t ops)
+{
+	uint32_t i;
+	for (i = 0; i < ops; i++) {
+		mem_write_32(MEM_DATA_BEGIN + ((i * 0x9E3779B1u) & (SCATTER_SPAN - 4)), i);
+	}
+}
+
+/***************************************************************/
+/* Decode                                                                                                                 */
+/***************************************************************/
+static void decode(uint32_t ops)
+{
+	decoded_inst_t d;
+	uint32_t i, sum = 0;
+	for (i = 0; i < ops; i++) {
+		decode_instruction(stream_raw[i & (STREAM_LENGTH - 1)], &d);
+		sum += d.op;
+	}
+	sink = sum;
+}
+
+//ID on an otherwise empty pipeline: register reads, the hazard checks finding nothing.
+static void id_stage(uint32_t ops)
+{
+	uint32_t i, sum = 0;
+	for (i = 0; i < ops; i++) {
+		IF_ID.D = stream[i & (STREAM_LENGTH - 1)];
+		IF_ID.IR = IF_ID.D.raw;
+		IF_ID.StallCount = 0;
+		ID();
+		sum += ID_EX.A;
+	}
+	sink = sum;
+}
+
+/***************************************************************/
+/* Hazard detection                                                                                                 */
+/***************************************************************/
+//x5 is written by an ALU instruction in EX_MEM, x6 by a load in EX_MEM, x7 and x8 by an ALU instruction and a
+//load in MEM_WB; the operands are drawn from those and two registers nothing writes.
+static void hazard_setup(int forwarding)
+{
+	static const uint8_t regs[6] = { 5, 6, 7, 8, 9, 0 };
+	uint32_t i;
+
+	machine();
+	ENABLE_FORWARDING = forwarding;
+	ISSUE_WIDTH = 2;
+	decode_instruction(enc_r(0, 2, 1, 0, 5), &EX_MEM_GROUP[0].D);
+	decode_instruction(enc_i(0x03, 0, 1, 2, 6), &EX_MEM_GROUP[1].D);
+	decode_instruction(enc_r(0, 2, 1, 0, 7), &MEM_WB_GROUP[0].D);
+	decode_instruction(enc_i(0x03, 0, 1, 2, 8), &MEM_WB_GROUP[1].D);
+	for (i = 0; i < STREAM_LENGTH; i++) {
+		stream_regs[i][0] = regs[rng() % 6];
+		stream_regs[i][1] = regs[rng() % 6];
+	}
+}
+
+static void hazard_forwarding_setup()
+{
+	hazard_setup(TRUE);
+}
+
+static void hazard_stalling_setup()
+{
+	hazard_setup(FALSE);
+}
+
+static void hazard(uint32_t ops)
+{
+	uint32_t i, sum = 0;
+	for (i = 0; i < ops; i++) {
+		IF_ID.StallCount = 0;
+		sum += detect_hazard(&ID_EX, stream_regs[i & (STREAM_LENGTH - 1)][0], stream_regs[i & (STREAM_LENGTH - 1)][1]);
+	}
+	sink = sum;
+}
+
+/***************************************************************/
+/* Whole pipeline cycles on programs that loop forever                                        */
+/***************************************************************/
+static void program(const uint32_t *words, uint32_t count, int forwarding)
+{
+	uint32_t i;
+	machine();
+	ENABLE_FORWARDING = forwarding;
+	for (i = 0; i < count; i++) {
+		mem_write_32(MEM_TEXT_BEGIN + i * 4, words[i]);
+	}
+	PROGRAM_SIZE = count;
+	PROGRAM_ENTRY = MEM_TEXT_BEGIN;
+	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
+	NEXT_STATE = CURRENT_STATE;
+}
+
+//Independent ALU work, the pipeline never stalls for data.
+static void alu_loop_setup()
+{
+	uint32_t words[16], i;
+	for (i = 0; i < 15; i++) {
+		words[i] = enc_i(0x13, i, 0, 0, 5 + i);
+	}
+	words[15] = enc_jal(-60, 0);
+	program(words, 16, TRUE);
+}
+
+//Loads, stores, dependent ALU work and a data-dependent branch.
+static const uint32_t *mixed_loop()
+{
+	static uint32_t words[12];
+	words[0] = enc_i(0x13, 0x401, 0, 0, 5);	/* addi x5, x0, 0x401 */
+	words[1] = enc_i(0x13, 18, 5, 1, 5);		/* slli x5, x5, 18 */
+	words[2] = enc_i(0x03, 0, 5, 2, 6);		/* loop: lw x6, 0(x5) */
+	words[3] = enc_i(0x13, 1, 6, 0, 6);		/* addi x6, x6, 1 */
+	words[4] = enc_s(0, 6, 5, 2);			/* sw x6, 0(x5) */
+	words[5] = enc_r(0, 6, 7, 0, 7);		/* add x7, x7, x6 */
+	words[6] = enc_r(0, 6, 7, 4, 8);		/* xor x8, x7, x6 */
+	words[7] = enc_i(0x13, 3, 8, 7, 9);		/* andi x9, x8, 3 */
+	words[8] = enc_b(8, 0, 9, 0);			/* beq x9, x0, skip */
+	words[9] = enc_i(0x13, 1, 10, 0, 10);	/* addi x10, x10, 1 */
+	words[10] = enc_i(0x13, 4, 5, 0, 5);	/* skip: addi x5, x5, 4 */
+	words[11] = enc_jal(-36, 0);			/* jal x0, loop */
+	return words;
+}
+
+static void mixed_loop_setup()
+{
+	program(mixed_loop(), 12, TRUE);
+}
+
+static void mixed_loop_stalling_setup()
+{
+	program(mixed_loop(), 12, FALSE);
+}
+
+static void cycles(uint32_t ops)
+{
+	uint32_t i;
+	for (i = 0; i < ops; i++) {
+		cycle();
+	}
+	sink = INSTRUCTION_COUNT;
+}
+
+static const microbench_t BENCHMARKS[] = {
+	{ "mem_read_32/page", memory_setup, read_page },
+	{ "mem_read_32/scatter", memory_setup, read_scatter },
+	{ "mem_write_32/page", memory_setup, write_page },
+	{ "mem_write_32/scatter", memory_setup, write_scatter },
+	{ "decode_instruction/mixed", stream_setup, decode },
+	{ "ID/mixed", stream_setup, id_stage },
+	{ "detect_hazard/forwarding", hazard_forwarding_setup, hazard },
+	{ "detect_hazard/stalling", hazard_stalling_setup, hazard },
+	{ "cycle/alu-loop", alu_loop_setup, cycles },
+	{ "cycle/mixed-loop", mixed_loop_setup, cycles },
+	{ "cycle/mixed-loop-no-fwd", mixed_loop_stalling_setup, cycles },
+};
+#define NUM_BENCHMARKS (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+
+/***************************************************************/
+/* Timing                                                                                                                  */
+/***************************************************************/
+static double now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void measure(const microbench_t *bench, uint32_t ops, uint32_t warmup, uint32_t reps)
+{
+	double *ns = malloc(reps * sizeof(double));
+	double start, mean = 0, variance = 0, min;
+	uint32_t i;
+
+	if (ns == NULL) {
+		printf("Error: Out of memory for the timings\n");
+		exit(-1);
+	}
+	bench->setup();
+	for (i = 0; i < warmup; i++) {
+		bench->run(ops);
+	}
+	for (i = 0; i < reps; i++) {
+		start = now_ns();
+		bench->run(ops);
+		ns[i] = (now_ns() - start) / ops;
+		mean += ns[i];
+	}
+	mean /= reps;
+	min = ns[0];
+	for (i = 0; i < reps; i++) {
+		variance += (ns[i] - mean) * (ns[i] - mean);
+		min = ns[i] < min ? ns[i] : min;
+	}
+	variance = reps > 1 ? variance / (reps - 1) : 0;
+	printf("%-26s %10.2f %10.2f %7.1f%% %10.2f\n", bench->name, mean, sqrt(variance),
+			mean > 0 ? sqrt(variance) / mean * 100 : 0, min);
+	free(ns);
+}
+
+static void usage(const char *name)
+{
+	uint32_t i;
+	printf("Usage: %s [-n <ops>] [-w <warmup>] [-r <repetitions>] [benchmark ...]\n", name);
+	printf("  -n <ops>\t\toperations per repetition (default 1000000)\n");
+	printf("  -w <warmup>\t\tuntimed repetitions first (default 3)\n");
+	printf("  -r <repetitions>\ttimed repetitions (default 10)\n");
+	printf("A benchmark name selects every benchmark starting with it:\n");
+	for (i = 0; i < NUM_BENCHMARKS; i++) {
+		printf("  %s\n", BENCHMARKS[i].name);
+	}
+}
+
+/***************************************************************/
+/* main                                                                                                                   */
+/***************************************************************/
+int main(int argc, char *argv[])
+{
+	uint32_t ops = 1000000, warmup = 3, reps = 10, i;
+	int arg, selected, first = 1;
+
+	while (first < argc && argv[first][0] == '-') {
+		if (first + 1 >= argc || strlen(argv[first]) != 2) {
+			usage(argv[0]);
+			exit(1);
+		}
+		switch (argv[first][1]) {
+			case 'n':
+				ops = strtoul(argv[first + 1], NULL, 10);
+				break;
+			case 'w':
+				warmup = strtoul(argv[first + 1], NULL, 10);
+				break;
+			case 'r':
+				reps = strtoul(argv[first + 1], NULL, 10);
+				break;
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+		first += 2;
+	}
+	if (ops == 0 || reps == 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+	printf("%u ops per repetition, %u warmup, %u timed repetitions\n\n", ops, warmup, reps);
+	printf("%-26s %10s %10s %8s %10s\n", "benchmark", "ns/op", "stddev", "cv", "min");
+	for (i = 0; i < NUM_BENCHMARKS; i++) {
+		selected = first == argc;
+		for (arg = first; arg < argc; arg++) {
+			selected |= strncmp(BENCHMARKS[i].name, argv[arg], strlen(argv[arg])) == 0;
+		}
+		if (selected) {
+			measure(&BENCHMARKS[i], ops, warmup, reps);
+		}
+	}
+	if (SIM != NULL) {
+		sim_destroy(SIM);
+	}
+	return 0;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Multiply and divide units of the M extension.                                                      */
+/*                                                                                                                               */
+/* EX_R_Processing() computes the result when the instruction is in EX, the */
+/* units only decide how long that takes. mul, mulh, mulhsu and mulhu go to */
+/* the multiply unit, div, divu, rem and remu to the divide unit. A unit    */
+/* with latency L has the result ready for the instruction that needs it L   */
+/* cycles after it started, 1 being the ALU's forwarding. A pipelined unit   */
+/* starts a new operation every cycle, an iterative one only when the last  */
+/* one is done. EX holds an M instruction while its unit cannot take it     */
+/* (a structural stall), ID holds one that needs a result still in a unit   */
+/* (a data stall). All times are absolute cycles, so a D-cache stall that    */
+/* freezes the pipeline lets the units go on.                                                        */
+/***************************************************************/
+#define MULDIV_MAX_LATENCY 255
+
+enum { UNIT_MUL = 0, UNIT_DIV, NUM_UNITS };
+
+/* per simulator context (SIM->muldiv), allocated by the first M instruction or a checkpoint restore */
+struct muldiv_state {
+	uint32_t free[NUM_UNITS];	/* cycle each unit can start the next operation */
+	uint32_t ready[RISCV_REGS];	/* cycle from which EX can have the register, 0 when it already can */
+};
+
+#define MD (SIM->muldiv)
+
+static struct muldiv_state *muldiv_get()
+{
+	if (MD != NULL) {
+		return MD;
+	}
+	MD = calloc(1, sizeof(struct muldiv_state));
+	if (MD == NULL) {
+		printf("Error: out of host memory for the multiply/divide units\n");
+		exit(-1);
+	}
+	return MD;
+}
+
+void muldiv_release()
+{
+	free(MD);
+	MD = NULL;
+}
+
+/***************************************************************/
+/* Configuration: 'muldiv <mul|div|mulpipe|divpipe> <n>'                                         */
+/***************************************************************/
+int muldiv_config_valid(const muldiv_config_t *config)
+{
+	return config->mul_latency >= 1 && config->mul_latency <= MULDIV_MAX_LATENCY &&
+			config->div_latency >= 1 && config->div_latency <= MULDIV_MAX_LATENCY &&
+			config->mul_pipelined <= 1 && config->div_pipelined <= 1;
+}
+
+int muldiv_param(const char *name, uint32_t value)
+{
+	muldiv_config_t config = MULDIV_CONFIG;
+	if (strcmp(name, "mul") == 0) {
+		config.mul_latency = value;
+	}else if (strcmp(name, "div") == 0) {
+		config.div_latency = value;
+	}else if (strcmp(name, "mulpipe") == 0) {
+		config.mul_pipelined = value != 0;
+	}else if (strcmp(name, "divpipe") == 0) {
+		config.div_pipelined = value != 0;
+	}else {
+		return FALSE;
+	}
+	if (!muldiv_config_valid(&config)) {
+		return FALSE;
+	}
+	//whatever is in the units now finishes as it was started
+	MULDIV_CONFIG = config;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Timing                                                                                                                         */
+/***************************************************************/
+static uint32_t muldiv_unit(const decoded_inst_t *d)
+{
+	return d->op >= OP_DIV ? UNIT_DIV : UNIT_MUL;
+}
+
+//Cycles until the unit of the M instruction d can start it, 0 if it can now.
+uint32_t muldiv_busy(const decoded_inst_t *d)
+{
+	uint32_t free;
+	if (MD == NULL) {
+		return 0;
+	}
+	free = MD->free[muldiv_unit(d)];
+	return free > CYCLE_COUNT ? free - CYCLE_COUNT : 0;
+}
+
+//d is in EX this cycle: start it on its unit if it is an M instruction, returns the cycles until its result is ready.
+uint32_t muldiv_execute(const decoded_inst_t *d)
+{
+	uint32_t unit, latency, pipelined;
+
+	if (!op_is_muldiv(d->op)) {
+		//a later writer of the register replaces a result still in a unit, none before the first M instruction
+		if (MD != NULL && d->writes_rd) {
+			MD->ready[d->rd] = 0;
+		}
+		return 1;
+	}
+	muldiv_get();
+	unit = muldiv_unit(d);
+	if (unit == UNIT_MUL) {
+		latency = MULDIV_CONFIG.mul_latency;
+		pipelined = MULDIV_CONFIG.mul_pipelined;
+		STATS.mul_ops++;
+	}else {
+		latency = MULDIV_CONFIG.div_latency;
+		pipelined = MULDIV_CONFIG.div_pipelined;
+		STATS.div_ops++;
+	}
+	MD->free[unit] = CYCLE_COUNT + (pipelined ? 1 : latency);
+	if (d->writes_rd) {
+		MD->ready[d->rd] = CYCLE_COUNT + latency;
+	}
+	return latency;
+}
+
+//Bubbles the instruction d needs in ID before it can go into EX with the results of the units it reads.
+uint32_t muldiv_wait(const decoded_inst_t *d)
+{
+	//going ahead it would be in EX next cycle
+	uint32_t next = CYCLE_COUNT + 1, wait = 0;
+	if (MD == NULL) {
+		return 0;
+	}
+	if (d->rs1 != 0 && MD->ready[d->rs1] > next) {
+		wait = MD->ready[d->rs1] - next;
+	}
+	if (d->rs2 != 0 && MD->ready[d->rs2] > next + wait) {
+		wait = MD->ready[d->rs2] - next;
+	}
+	return wait;
+}
+
+/***************************************************************/
+/* Checkpoints: EX_STALL, then the units and the registers as le32 words   */
+/***************************************************************/
+#define MULDIV_BLOB_WORDS (1 + NUM_UNITS + RISCV_REGS)
+
+uint8_t *muldiv_snapshot(size_t *size)
+{
+	uint8_t *blob, *p;
+	uint32_t i;
+
+	*size = MULDIV_BLOB_WORDS * 4;
+	blob = p = calloc(1, *size);
+	if (blob == NULL) {
+		printf("Error: out of host memory for the multiply/divide units\n");
+		exit(-1);
+	}
+	mem_store_le32(p, EX_STALL);
+	p += 4;
+	//no M instruction yet: idle units, all zero
+	if (MD == NULL) {
+		return blob;
+	}
+	for (i = 0; i < NUM_UNITS; i++, p += 4) {
+		mem_store_le32(p, MD->free[i]);
+	}
+	for (i = 0; i < RISCV_REGS; i++, p += 4) {
+		mem_store_le32(p, MD->ready[i]);
+	}
+	return blob;
+}
+
+//After the pipeline latches have been restored.
+int muldiv_restore(const uint8_t *blob, size_t size)
+{
+	const uint8_t *p = blob;
+	uint32_t i;
+
+	muldiv_release();
+	EX_STALL = FALSE;
+	if (size != MULDIV_BLOB_WORDS * 4 || mem_load_le32(p) > 1) {
+		return FALSE;
+	}
+	muldiv_get();
+	EX_STALL = mem_load_le32(p);
+	p += 4;
+	for (i = 0; i < NUM_UNITS; i++, p += 4) {
+		MD->free[i] = mem_load_le32(p);
+	}
+	for (i = 0; i < RISCV_REGS; i++, p += 4) {
+		MD->ready[i] = mem_load_le32(p);
+	}
+	return TRUE;
+}
@@ -0,0 +1,617 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Multicore machine: 'cores count <n>' gives the context the commands   */
+/* work on (core 0) n - 1 more, each with its own CPU state, pipeline or    */
+/* out-of-order core, caches and counters. They all use core 0's guest      */
+/* memory (memory_home) and are configured like core 0 whenever a run    */
+/* starts. Core k starts at the program entry with a0 = k.                       */
+/*                                                                                                                               */
+/* A run gives every core a host thread of its own. The threads run a     */
+/* quantum of cycles each, meet at a barrier, and go on until every core    */
+/* has halted or run its cycles. Within a quantum the cores run at whatever */
+/* speed their host threads get, so with more than one core the cycle counts */
+/* depend on the host; the results of data-race-free programs do not. Stores */
+/* to code reach the other cores' predecoded instructions at the barrier.       */
+/*                                                                                                                               */
+/* The D-caches are kept coherent with MESI through a directory that records */
+/* per line which cores have a copy and whether one of them has it exclusive */
+/* or modified. As the caches only keep tags, a core never touches another   */
+/* core's cache: an invalidated copy is only dropped when its own core next  */
+/* finds it gone from the directory. The L2 and DRAM models stay per core.   */
+/***************************************************************/
+#define DIR_BUCKETS 4096
+#define DIR_LOCKS 64		/* bucket i is guarded by lock i % DIR_LOCKS */
+
+typedef enum {
+	DIR_SHARED = 0,		/* the sharers have clean copies */
+	DIR_EXCLUSIVE,		/* the one sharer has the only copy, clean */
+	DIR_MODIFIED		/* the one sharer has the only copy, dirty */
+} dir_state_t;
+
+typedef struct dir_entry {
+	uint32_t line;		/* address of the line */
+	uint32_t sharers;		/* one bit per core with a copy */
+	uint32_t state;		/* dir_state_t */
+	struct dir_entry *next;
+} dir_entry_t;
+
+/* shared by all cores, owned by core 0 */
+struct multicore_state {
+	sim_context_t *core[MULTICORE_MAX];
+	uint32_t count;
+	pthread_mutex_t memory_lock;	/* page allocation */
+	uint32_t text_generation;	/* bumped by every store to code */
+	dir_entry_t *directory[DIR_BUCKETS];
+	pthread_mutex_t directory_lock[DIR_LOCKS];
+	/* the run in progress */
+	pthread_barrier_t barrier;
+	uint32_t quantum;
+	uint32_t cycles;		/* per core, unless to_completion */
+	uint32_t to_completion;
+	uint32_t active[MULTICORE_MAX];	/* the core still has cycles to run */
+	uint32_t stop;		/* set between the two barriers of a quantum */
+};
+
+#define MC (SIM->multicore)
+
+/***************************************************************/
+/* Locks and hooks for the rest of the simulator, no-ops with one core        */
+/***************************************************************/
+void multicore_lock_memory()
+{
+	if (MC != NULL) {
+		pthread_mutex_lock(&MC->memory_lock);
+	}
+}
+
+void multicore_unlock_memory()
+{
+	if (MC != NULL) {
+		pthread_mutex_unlock(&MC->memory_lock);
+	}
+}
+
+void multicore_text_modified()
+{
+	if (MC != NULL) {
+		__atomic_add_fetch(&MC->text_generation, 1, __ATOMIC_RELAXED);
+	}
+}
+
+//At a barrier: code some core wrote since the last one is decoded again.
+static void multicore_sync_text()
+{
+	uint32_t generation = __atomic_load_n(&MC->text_generation, __ATOMIC_RELAXED);
+	if (generation != SIM->text_generation) {
+		SIM->text_generation = generation;
+		predecode_flush();
+		threaded_flush();
+		dbt_flush();
+	}
+}
+
+/***************************************************************/
+/* MESI directory                                                                                                           */
+/***************************************************************/
+static uint32_t popcount(uint32_t bits)
+{
+	uint32_t n = 0;
+	for (; bits != 0; bits &= bits - 1) {
+		n++;
+	}
+	return n;
+}
+
+//The entry of a line with its lock held, created on first use.
+static dir_entry_t *dir_lookup(uint32_t line, pthread_mutex_t **lock)
+{
+	uint32_t bucket = (line >> 4) % DIR_BUCKETS;
+	dir_entry_t *e;
+
+	*lock = &MC->directory_lock[bucket % DIR_LOCKS];
+	pthread_mutex_lock(*lock);
+	for (e = MC->directory[bucket]; e != NULL; e = e->next) {
+		if (e->line == line) {
+			return e;
+		}
+	}
+	e = calloc(1, sizeof(dir_entry_t));
+	if (e == NULL) {
+		printf("Error: out of host memory for the coherence directory\n");
+		exit(-1);
+	}
+	e->line = line;
+	e->next = MC->directory[bucket];
+	MC->directory[bucket] = e;
+	return e;
+}
+
+/***************************************************************/
+/* The D-cache accesses line (its address). *present says whether the     */
+/* cache has it, and comes back FALSE if another core has invalidated it  */
+/* since, in which case the access is handled as the miss it then is.        */
+/* Returns the cycles the access spends on the other cores' copies.          */
+/***************************************************************/
+uint32_t coherence_access(uint32_t line, int write, int *present)
+{
+	uint32_t me = 1u << CORE_ID, others, latency = 0;
+	pthread_mutex_t *lock;
+	dir_entry_t *e = dir_lookup(line, &lock);
+
+	others = e->sharers & ~me;
+	if (*present && !(e->sharers & me)) {
+		STATS.coherence.coherence_misses++;
+		*present = FALSE;
+	}
+	if (*present) {
+		//E and M are written without asking anyone, S has to invalidate the other copies first
+		if (write && e->state == DIR_SHARED && others != 0) {
+			STATS.coherence.upgrades++;
+			STATS.coherence.invalidations_sent += popcount(others);
+			latency = MULTICORE_CONFIG.snoop_latency;
+		}
+		if (write) {
+			e->sharers = me;
+			e->state = DIR_MODIFIED;
+		}
+	}else if (write) {
+		//read for ownership
+		if (others != 0) {
+			if (e->state == DIR_MODIFIED) {
+				STATS.coherence.interventions++;
+			}
+			STATS.coherence.invalidations_sent += popcount(others);
+			latency = MULTICORE_CONFIG.snoop_latency;
+		}
+		e->sharers = me;
+		e->state = DIR_MODIFIED;
+	}else {
+		if (others != 0 && e->state == DIR_MODIFIED) {
+			//the owner supplies the line and keeps a clean copy
+			STATS.coherence.interventions++;
+			latency = MULTICORE_CONFIG.snoop_latency;
+		}
+		if (others != 0) {
+			STATS.coherence.shared_fills++;
+			e->state = DIR_SHARED;
+		}else {
+			STATS.coherence.exclusive_fills++;
+			e->state = DIR_EXCLUSIVE;
+		}
+		e->sharers |= me;
+	}
+	pthread_mutex_unlock(lock);
+	STATS.coherence.snoop_cycles += latency;
+	return latency;
+}
+
+//The D-cache evicted its copy of line.
+void coherence_evict(uint32_t line)
+{
+	pthread_mutex_t *lock;
+	dir_entry_t *e = dir_lookup(line, &lock);
+
+	e->sharers &= ~(1u << CORE_ID);
+	if (e->sharers == 0) {
+		e->state = DIR_SHARED;
+	}
+	pthread_mutex_unlock(lock);
+}
+
+//The D-cache of this core was emptied (reset, reconfiguration).
+void coherence_forget()
+{
+	dir_entry_t *e;
+	uint32_t i;
+
+	if (MC == NULL) {
+		return;
+	}
+	for (i = 0; i < DIR_BUCKETS; i++) {
+		pthread_mutex_lock(&MC->directory_lock[i % DIR_LOCKS]);
+		for (e = MC->directory[i]; e != NULL; e = e->next) {
+			e->sharers &= ~(1u << CORE_ID);
+			if (e->sharers == 0) {
+				e->state = DIR_SHARED;
+			}
+		}
+		pthread_mutex_unlock(&MC->directory_lock[i % DIR_LOCKS]);
+	}
+}
+
+static void dir_clear(struct multicore_state *mc)
+{
+	dir_entry_t *e, *next;
+	uint32_t i;
+
+	for (i = 0; i < DIR_BUCKETS; i++) {
+		for (e = mc->directory[i]; e != NULL; e = next) {
+			next = e->next;
+			free(e);
+		}
+		mc->directory[i] = NULL;
+	}
+}
+
+/***************************************************************/
+/* Creating and dropping the other cores (called on core 0)                      */
+/***************************************************************/
+void multicore_release()
+{
+	struct multicore_state *mc = MC;
+	sim_context_t *home = SIM;
+	uint32_t k, i;
+
+	if (mc == NULL || CORE_ID != 0) {
+		return;
+	}
+	for (k = 1; k < mc->count; k++) {
+		//a core on its own no longer has anything to coordinate with
+		mc->core[k]->multicore = NULL;
+		sim_destroy(mc->core[k]);
+	}
+	SIM = home;
+	dir_clear(mc);
+	for (i = 0; i < DIR_LOCKS; i++) {
+		pthread_mutex_destroy(&mc->directory_lock[i]);
+	}
+	pthread_mutex_destroy(&mc->memory_lock);
+	free(mc);
+	MC = NULL;
+}
+
+static void multicore_create(uint32_t cores)
+{
+	sim_context_t *home = SIM, *core;
+	struct multicore_state *mc = calloc(1, sizeof(struct multicore_state));
+	uint32_t k, i;
+
+	if (mc == NULL) {
+		printf("Error: out of host memory for the cores\n");
+		exit(-1);
+	}
+	pthread_mutex_init(&mc->memory_lock, NULL);
+	for (i = 0; i < DIR_LOCKS; i++) {
+		pthread_mutex_init(&mc->directory_lock[i], NULL);
+	}
+	mc->count = cores;
+	mc->core[0] = home;
+	home->multicore = mc;
+	for (k = 1; k < cores; k++) {
+		core = sim_create();
+		core->memory_home = home;
+		core->multicore = mc;
+		core->core_id = k;
+		core->multicore_config = home->multicore_config;
+		memcpy(core->program_file, home->program_file, sizeof(core->program_file));
+		core->program_size = home->program_size;
+		core->program_entry = home->program_entry;
+		core->cycle_count = home->cycle_count;
+		//nothing is translated yet, the zeroed entries would point at guest address 0
+		SIM = core;
+		mem_tlb_flush();
+		predecode_flush();
+		SIM = home;
+		mc->core[k] = core;
+	}
+}
+
+/***************************************************************/
+/* After core 0 has been reset: the others start over at the entry           */
+/***************************************************************/
+void multicore_reset()
+{
+	struct multicore_state *mc = MC;
+	sim_context_t *home = SIM;
+	uint32_t k;
+
+	if (mc == NULL) {
+		return;
+	}
+	//the cores' caches start cold, so nothing has a copy any more
+	dir_clear(mc);
+	mc->text_generation = 0;
+	for (k = 0; k < mc->count; k++) {
+		SIM = mc->core[k];
+		SIM->text_generation = 0;
+		//the loader may have put other host pages behind the program
+		mem_tlb_flush();
+		predecode_flush();
+		threaded_flush();
+		dbt_flush();
+		if (k == 0) {
+			continue;
+		}
+		memset(&CURRENT_STATE, 0, sizeof(CURRENT_STATE));
+		CURRENT_STATE.REGS[10] = k;
+		CURRENT_STATE.PC = PROGRAM_ENTRY;
+		NEXT_STATE = CURRENT_STATE;
+		memset(SIM->if_id, 0, sizeof(SIM->if_id));
+		memset(SIM->id_ex, 0, sizeof(SIM->id_ex));
+		memset(SIM->ex_mem, 0, sizeof(SIM->ex_mem));
+		memset(SIM->mem_wb, 0, sizeof(SIM->mem_wb));
+		INSTRUCTION_COUNT = 0;
+		stats_reset();
+		bpred_release();
+		cache_release();
+		dram_release();
+		prefetch_release();
+		storebuf_release();
+		muldiv_release();
+		ooo_release();
+		FETCH_STALL = 0;
+		FETCH_FILLED_PC = MEM_TLB_INVALID;
+		MEM_STALL = 0;
+		EX_STALL = FALSE;
+		SIM->reservation = MEM_TLB_INVALID;
+		RUN_FLAG = TRUE;
+	}
+	SIM = home;
+}
+
+/***************************************************************/
+/* Configuration: 'cores <count|quantum|snoop> <n>'                                             */
+/***************************************************************/
+int multicore_config_valid(const multicore_config_t *config)
+{
+	return config->cores >= 1 && config->cores <= MULTICORE_MAX && config->quantum >= 1;
+}
+
+int multicore_param(const char *name, uint32_t value)
+{
+	multicore_config_t config = MULTICORE_CONFIG;
+	uint32_t k;
+
+	if (strcmp(name, "count") == 0) {
+		config.cores = value;
+	}else if (strcmp(name, "quantum") == 0) {
+		config.quantum = value;
+	}else if (strcmp(name, "snoop") == 0) {
+		config.snoop_latency = value;
+	}else {
+		return FALSE;
+	}
+	if (!multicore_config_valid(&config) || CORE_ID != 0) {
+		return FALSE;
+	}
+	//a trace follows a single core, so does a replay
+	if (config.cores > 1 && (SIM->trace != NULL || SIM->replay != NULL)) {
+		return FALSE;
+	}
+	if (config.cores != MULTICORE_CONFIG.cores) {
+		//a different machine: every core starts over at the program entry
+		multicore_release();
+		MULTICORE_CONFIG = config;
+		if (config.cores > 1) {
+			multicore_create(config.cores);
+		}
+		reset();
+		return TRUE;
+	}
+	MULTICORE_CONFIG = config;
+	for (k = 1; MC != NULL && k < MC->count; k++) {
+		MC->core[k]->multicore_config = config;
+	}
+	return TRUE;
+}
+
+//The other cores take core 0's configuration, dropping whatever depended on one that changed.
+static void multicore_sync_config()
+{
+	sim_context_t *home = SIM;
+	uint32_t k;
+
+	for (k = 1; k < MC->count; k++) {
+		SIM = MC->core[k];
+		if (memcmp(&BPRED_CONFIG, &home->bpred_config, sizeof(bpred_config_t)) != 0) {
+			bpred_release();
+			BPRED_CONFIG = home->bpred_config;
+		}
+		if (memcmp(&ICACHE_CONFIG, &home->icache_config, sizeof(cache_config_t)) != 0 ||
+				memcmp(&DCACHE_CONFIG, &home->dcache_config, sizeof(cache_config_t)) != 0 ||
+				memcmp(&L2_CONFIG, &home->l2_config, sizeof(cache_config_t)) != 0) {
+			cache_release();
+			ICACHE_CONFIG = home->icache_config;
+			DCACHE_CONFIG = home->dcache_config;
+			L2_CONFIG = home->l2_config;
+		}
+		if (memcmp(&DRAM_CONFIG, &home->dram_config, sizeof(dram_config_t)) != 0) {
+			dram_release();
+			DRAM_CONFIG = home->dram_config;
+		}
+		if (memcmp(&PREFETCH_CONFIG, &home->prefetch_config, sizeof(prefetch_config_t)) != 0) {
+			prefetch_release();
+			PREFETCH_CONFIG = home->prefetch_config;
+		}
+		if (memcmp(&STOREBUF_CONFIG, &home->storebuf_config, sizeof(storebuf_config_t)) != 0) {
+			storebuf_release();
+			STOREBUF_CONFIG = home->storebuf_config;
+		}
+		MULDIV_CONFIG = home->muldiv_config;
+		if (memcmp(&OOO_CONFIG, &home->ooo_config, sizeof(ooo_config_t)) != 0 || ISSUE_WIDTH != home->issue_width) {
+			//the core picks up at its oldest instruction not done, the same as on core 0
+			pipeline_drain();
+			OOO_CONFIG = home->ooo_config;
+			ISSUE_WIDTH = home->issue_width;
+		}
+		ENABLE_FORWARDING = home->enable_forwarding;
+		FF_ENGINE = home->ff_engine;
+		QUIET = home->quiet;
+		MAX_CYCLES = home->max_cycles;
+	}
+	SIM = home;
+}
+
+/***************************************************************/
+/* Running                                                                                                                         */
+/***************************************************************/
+static int multicore_core_active(uint32_t ran)
+{
+	return RUN_FLAG && (MC->to_completion || ran < MC->cycles) && (MAX_CYCLES == 0 || CYCLE_COUNT < MAX_CYCLES);
+}
+
+static void *multicore_worker(void *arg)
+{
+	struct multicore_state *mc;
+	uint32_t ran = 0, i, k;
+
+	SIM = arg;
+	mc = MC;
+	for (;;) {
+		for (i = 0; i < mc->quantum && multicore_core_active(ran); i++, ran++) {
+			cycle();
+		}
+		mc->active[CORE_ID] = multicore_core_active(ran);
+		//one thread looks at all cores while the others wait at the second barrier
+		if (pthread_barrier_wait(&mc->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			mc->stop = TRUE;
+			for (k = 0; k < mc->count; k++) {
+				if (mc->active[k]) {
+					mc->stop = FALSE;
+				}
+			}
+		}
+		pthread_barrier_wait(&mc->barrier);
+		if (mc->stop) {
+			break;
+		}
+		multicore_sync_text();
+	}
+	multicore_sync_text();
+	return NULL;
+}
+
+//run <n> (cycles per core) or sim (to_completion) on all cores.
+void multicore_run(uint32_t cycles, int to_completion)
+{
+	struct multicore_state *mc = MC;
+	sim_context_t *home = SIM;
+	pthread_t threads[MULTICORE_MAX];
+	uint32_t k, running = 0, limited = FALSE;
+
+	for (k = 0; k < mc->count; k++) {
+		running += mc->core[k]->run_flag ? 1 : 0;
+	}
+	if (running == 0) {
+		if (!QUIET) {
+			printf("Simulation Stopped.\n\n");
+		}
+		return;
+	}
+	multicore_sync_config();
+	if (!QUIET) {
+		if (to_completion) {
+			printf("Simulation Started on %u cores...\n\n", mc->count);
+		}else {
+			printf("Running simulator for %u cycles on %u cores...\n\n", cycles, mc->count);
+		}
+	}
+	mc->quantum = MULTICORE_CONFIG.quantum;
+	mc->cycles = cycles;
+	mc->to_completion = to_completion;
+	mc->stop = FALSE;
+	if (pthread_barrier_init(&mc->barrier, NULL, mc->count) != 0) {
+		printf("Error: can't set up the barrier for %u cores\n", mc->count);
+		exit(-1);
+	}
+	for (k = 0; k < mc->count; k++) {
+		if (pthread_create(&threads[k], NULL, multicore_worker, mc->core[k]) != 0) {
+			printf("Error: can't start a host thread for core %u\n", k);
+			exit(-1);
+		}
+	}
+	for (k = 0; k < mc->count; k++) {
+		pthread_join(threads[k], NULL);
+	}
+	pthread_barrier_destroy(&mc->barrier);
+	SIM = home;
+
+	running = 0;
+	for (k = 0; k < mc->count; k++) {
+		running += mc->core[k]->run_flag ? 1 : 0;
+		if (MAX_CYCLES != 0 && mc->core[k]->run_flag && mc->core[k]->cycle_count >= MAX_CYCLES) {
+			limited = TRUE;
+		}
+	}
+	if (!QUIET) {
+		if (limited && to_completion) {
+			printf("Stopped at the %u cycle limit.\n\n", MAX_CYCLES);
+		}else if (to_completion || running == 0) {
+			printf("Simulation Finished.\n\n");
+		}
+	}
+}
+
+/***************************************************************/
+/* Reports: core 0 is reported the usual way, these add the other cores    */
+/***************************************************************/
+void multicore_rdump()
+{
+	struct multicore_state *mc = MC;
+	sim_context_t *home = SIM;
+	uint32_t k;
+
+	for (k = 1; k < mc->count; k++) {
+		SIM = mc->core[k];
+		rdump();
+	}
+	SIM = home;
+}
+
+static uint32_t ipc_milli(const sim_stats_t *stats)
+{
+	if (stats->cycles == 0) {
+		return 0;
+	}
+	return (uint32_t)(((uint64_t)stats->committed * 1000 + stats->cycles / 2) / stats->cycles);
+}
+
+void multicore_report()
+{
+	const sim_context_t *core;
+	const coherence_stats_t *c;
+	uint32_t k, ipc;
+
+	printf("Cores\t\t\t: %u, %u cycle quantum, %u cycle snoops\n", MC->count, MULTICORE_CONFIG.quantum,
+			MULTICORE_CONFIG.snoop_latency);
+	printf("-------------------------------------\n");
+	printf("[Core]\t[Committed]\t[Cycles]\t[IPC]\t[Fills E/S/M]\t[Upgrades]\t[Invalidated]\t[Coherence misses]\t[SC failed]\n");
+	printf("-------------------------------------\n");
+	for (k = 0; k < MC->count; k++) {
+		core = MC->core[k];
+		c = &core->stats.coherence;
+		ipc = ipc_milli(&core->stats);
+		printf("%u\t%u\t\t%u\t\t%u.%03u\t%u/%u/%u\t\t%u\t\t%u\t\t%u\t\t\t%u of %u\n", k, core->stats.committed,
+				core->stats.cycles, ipc / 1000, ipc % 1000, c->exclusive_fills, c->shared_fills, c->interventions,
+				c->upgrades, c->invalidations_sent, c->coherence_misses, c->sc_failures, c->atomics);
+	}
+	printf("-------------------------------------\n");
+}
+
+void multicore_write_json(FILE *out)
+{
+	const sim_context_t *core;
+	const coherence_stats_t *c;
+	uint32_t k;
+
+	fprintf(out, ",\n  \"quantum\": %u,\n  \"cores\": [\n", MULTICORE_CONFIG.quantum);
+	for (k = 0; k < MC->count; k++) {
+		core = MC->core[k];
+		c = &core->stats.coherence;
+		fprintf(out, "    { \"core\": %u, \"completed\": %s, \"cycles\": %u, \"instructions\": %u, \"pc\": %u, "
+				"\"ipc_milli\": %u, \"coherence\": { \"exclusive_fills\": %u, \"shared_fills\": %u, "
+				"\"interventions\": %u, \"upgrades\": %u, \"invalidations_sent\": %u, \"coherence_misses\": %u, "
+				"\"snoop_cycles\": %u, \"atomics\": %u, \"sc_failures\": %u } }%s\n", k, core->run_flag ? "false" : "true",
+				core->cycle_count, core->instruction_count, core->current_state.PC, ipc_milli(&core->stats),
+				c->exclusive_fills, c->shared_fills, c->interventions, c->upgrades, c->invalidations_sent,
+				c->coherence_misses, c->snoop_cycles, c->atomics, c->sc_failures, k == MC->count - 1 ? "" : ",");
+	}
+	fprintf(out, "  ]");
+}
@@ -0,0 +1,731 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Out-of-order core: a Tomasulo-style engine next to the 5-stage pipeline. */
+/*                                                                                                                               */
+/* Fetch follows the branch predictor into a small queue. Rename moves up   */
+/* to width instructions a cycle from there into the reorder buffer and the  */
+/* reservation stations of their functional unit class, taking each source  */
+/* from the register file or, through the rename table, from the ROB entry    */
+/* that produces it. Loads and stores also take a load/store queue entry.     */
+/* Every cycle the oldest instructions whose sources are there issue, up to   */
+/* width of them with at most one jump/branch and one memory access, and     */
+/* their results reach the waiting ones the cycle they are done. The ALU,      */
+/* branch and load semantics are the pipeline's own. A load issues once all */
+/* older stores know their address and takes its data from the youngest     */
+/* older store that covers it, from memory when none overlaps it, or waits  */
+/* for a store that covers only part of it to commit. Commit retires up to   */
+/* width done instructions in program order and is the only place registers */
+/* and memory change, so the results are those of the pipeline. A jump or    */
+/* branch that does not go where fetch went squashes everything younger when */
+/* it executes, a committed store to an instruction that has already been     */
+/* fetched everything from that instruction on.                                                       */
+/***************************************************************/
+#define OOO_MAX_ROB 256
+#define OOO_MAX_RS 64
+#define OOO_MAX_LSQ 64
+#define OOO_MAX_WIDTH 8
+#define OOO_QUEUE (2 * OOO_MAX_WIDTH)	/* fetched, not renamed yet */
+#define OOO_NO_LINE 1u		/* never a line address */
+
+typedef struct {
+	uint32_t pc;
+	uint32_t ir;
+	uint32_t issued;		/* TRUE once it left its reservation station */
+	uint32_t ready;		/* cycle its result is there, once issued */
+	uint32_t tag[2];		/* ROB index + 1 of the producer of rs1/rs2, 0 once the value is in src */
+	uint32_t src[2];
+	uint32_t value;		/* result, the data of a store */
+	uint32_t address;		/* loads and stores */
+	uint32_t predicted;	/* where fetch went on after it */
+	uint32_t info;		/* predictor state at fetch */
+	uint32_t taken;		/* jumps and branches */
+	uint32_t actual;		/* ... and where they really go */
+	uint32_t forwarded;	/* a load that got its data from a store */
+} rob_entry_t;
+
+typedef struct {
+	uint32_t pc;
+	uint32_t ir;
+	uint32_t predicted;
+	uint32_t info;
+} fetch_entry_t;
+
+/* per simulator context (SIM->ooo), allocated by the first cycle. Everything */
+/* up to rob is words, which is what a checkpoint holds.                                     */
+struct ooo_state {
+	uint32_t head, count;	/* ROB, oldest first */
+	uint32_t map[RISCV_REGS];	/* ROB index + 1 of the youngest writer, 0 for the register file */
+	uint32_t rs_used[NUM_FU];
+	uint32_t lsq_used;
+	uint32_t queue_head, queue_count;
+	uint32_t fetch_pc;
+	uint32_t fetch_stall;	/* I-cache miss cycles left */
+	uint32_t filled_line;	/* line the last miss brought in */
+	uint32_t halted;		/* fetch reached an empty word */
+	uint32_t commit_stall;	/* cycles a committed store still holds commit */
+	fetch_entry_t queue[OOO_QUEUE];
+	rob_entry_t *rob;
+	decoded_inst_t *decoded;	/* rob[i].ir decoded */
+	uint32_t stall_pc;		/* the store holding commit, for the profiler */
+	uint32_t unit_blocked;	/* a multiply or divide found its unit busy this cycle */
+};
+
+#define OOO_STATE_WORDS (offsetof(struct ooo_state, rob) / 4)
+#define ROB_WORDS (sizeof(rob_entry_t) / 4)
+
+const char *FU_NAMES[NUM_FU] = { "alu", "branch", "mem" };
+
+#define O (SIM->ooo)
+#define ROB_INDEX(n) ((O->head + (n)) % OOO_CONFIG.rob_entries)
+
+static struct ooo_state *ooo_get()
+{
+	if (O != NULL) {
+		return O;
+	}
+	O = calloc(1, sizeof(struct ooo_state));
+	if (O != NULL) {
+		O->rob = calloc(OOO_CONFIG.rob_entries, sizeof(rob_entry_t));
+		O->decoded = calloc(OOO_CONFIG.rob_entries, sizeof(decoded_inst_t));
+	}
+	if (O == NULL || O->rob == NULL || O->decoded == NULL) {
+		printf("Error: out of host memory for the out-of-order core\n");
+		exit(-1);
+	}
+	//an empty core starts from the architectural state
+	O->fetch_pc = CURRENT_STATE.PC;
+	O->filled_line = OOO_NO_LINE;
+	return O;
+}
+
+//Drops whatever is in flight, CURRENT_STATE.PC already is the oldest instruction not committed.
+void ooo_release()
+{
+	if (O == NULL) {
+		return;
+	}
+	free(O->rob);
+	free(O->decoded);
+	free(O);
+	O = NULL;
+}
+
+/***************************************************************/
+/* Configuration: 'ooo <enable|rob|rs|lsq|width> <n>'                                           */
+/***************************************************************/
+int ooo_config_valid(const ooo_config_t *config)
+{
+	return config->enabled <= 1 && config->rob_entries >= 1 && config->rob_entries <= OOO_MAX_ROB &&
+		config->rs_entries >= 1 && config->rs_entries <= OOO_MAX_RS && config->lsq_entries >= 1 &&
+		config->lsq_entries <= OOO_MAX_LSQ && config->width >= 1 && config->width <= OOO_MAX_WIDTH;
+}
+
+int ooo_param(const char *name, uint32_t value)
+{
+	ooo_config_t config = OOO_CONFIG;
+	if (strcmp(name, "enable") == 0) {
+		config.enabled = value != 0;
+	}else if (strcmp(name, "rob") == 0) {
+		config.rob_entries = value;
+	}else if (strcmp(name, "rs") == 0) {
+		config.rs_entries = value;
+	}else if (strcmp(name, "lsq") == 0) {
+		config.lsq_entries = value;
+	}else if (strcmp(name, "width") == 0) {
+		config.width = value;
+	}else {
+		return FALSE;
+	}
+	if (!ooo_config_valid(&config)) {
+		return FALSE;
+	}
+	//a replay only drives the in-order pipeline
+	if (config.enabled && SIM->replay != NULL) {
+		return FALSE;
+	}
+	//the other core, or this one resized, picks up at the oldest instruction not committed
+	pipeline_drain();
+	OOO_CONFIG = config;
+	return TRUE;
+}
+
+static uint32_t fu_class(const decoded_inst_t *d)
+{
+	switch (d->cls) {
+		case CLASS_LOAD:
+		case CLASS_STORE:
+			return FU_MEM;
+		case CLASS_BRANCH:
+		case CLASS_JUMP:
+			return FU_BRANCH;
+		default:
+			return FU_ALU;
+	}
+}
+
+/***************************************************************/
+/* Squashing                                                                                                                    */
+/***************************************************************/
+//Drop the ROB entries from position n (0 is the head) on and everything fetched after them, fetch goes on at pc.
+static void ooo_squash(uint32_t n, uint32_t pc)
+{
+	const decoded_inst_t *d;
+	uint32_t i, idx;
+
+	for (i = n; i < O->count; i++) {
+		d = &O->decoded[ROB_INDEX(i)];
+		if (!O->rob[ROB_INDEX(i)].issued) {
+			O->rs_used[fu_class(d)]--;
+		}
+		if (d->cls == CLASS_LOAD || d->cls == CLASS_STORE) {
+			O->lsq_used--;
+		}
+	}
+	STATS.ooo.squashed += O->count - n + O->queue_count;
+	O->count = n;
+	O->queue_count = 0;
+	O->fetch_pc = pc;
+	O->fetch_stall = 0;
+	O->filled_line = OOO_NO_LINE;
+	O->halted = FALSE;
+	//the youngest writer left of each register is its producer again
+	memset(O->map, 0, sizeof(O->map));
+	for (i = 0; i < O->count; i++) {
+		idx = ROB_INDEX(i);
+		if (O->decoded[idx].writes_rd) {
+			O->map[O->decoded[idx].rd] = idx + 1;
+		}
+	}
+}
+
+static int overlaps(uint32_t a, uint32_t a_size, uint32_t b, uint32_t b_size)
+{
+	return a < b + b_size && b < a + a_size;
+}
+
+//A committed store of size bytes at address: instructions fetched from there are stale.
+static void ooo_code_check(uint32_t address, uint32_t size)
+{
+	uint32_t i;
+
+	for (i = 0; i < O->count; i++) {
+		if (overlaps(address, size, O->rob[ROB_INDEX(i)].pc, 4)) {
+			STATS.ooo.code_flushes++;
+			ooo_squash(i, O->rob[ROB_INDEX(i)].pc);
+			return;
+		}
+	}
+	for (i = 0; i < O->queue_count; i++) {
+		if (overlaps(address, size, O->queue[(O->queue_head + i) % OOO_QUEUE].pc, 4)) {
+			STATS.ooo.code_flushes++;
+			ooo_squash(O->count, O->queue[O->queue_head].pc);
+			return;
+		}
+	}
+	//the empty word fetch stopped at may not be empty any more
+	if (O->halted && overlaps(address, size, O->fetch_pc, 4)) {
+		O->halted = FALSE;
+	}
+}
+
+/***************************************************************/
+/* Commit                                                                                                                          */
+/***************************************************************/
+static void ooo_commit(uint32_t now)
+{
+	const decoded_inst_t *d;
+	rob_entry_t *e, *w;
+	uint32_t n, i, k, idx;
+
+	if (O->commit_stall > 0) {
+		O->commit_stall--;
+		return;
+	}
+	for (n = 0; n < OOO_CONFIG.width && O->count > 0 && O->commit_stall == 0; n++) {
+		idx = O->head;
+		e = &O->rob[idx];
+		d = &O->decoded[idx];
+		if (!e->issued || e->ready > now) {
+			break;
+		}
+		if (d->writes_rd) {
+			CURRENT_STATE.REGS[d->rd] = e->value;
+			if (O->map[d->rd] == idx + 1) {
+				O->map[d->rd] = 0;
+			}
+			//anything still waiting for it takes the value now, the entry is about to be reused
+			for (i = 1; i < O->count; i++) {
+				w = &O->rob[ROB_INDEX(i)];
+				for (k = 0; k < 2; k++) {
+					if (w->tag[k] == idx + 1) {
+						w->src[k] = e->value;
+						w->tag[k] = 0;
+					}
+				}
+			}
+		}
+		if (d->cls == CLASS_STORE) {
+			MEM_store(d, e->address, e->value);
+			//the D-cache takes the store now, the same way MEM hands it over in the pipeline
+			if (DCACHE_CONFIG.enabled) {
+				if (STOREBUF_CONFIG.depth == 0) {
+					O->commit_stall = cache_data(e->pc, e->address, TRUE);
+				}else {
+					O->commit_stall = storebuf_store(e->address, MEM_access_size(d));
+				}
+				O->stall_pc = e->pc;
+			}
+		}
+		if ((d->cls == CLASS_BRANCH || d->cls == CLASS_JUMP) && BPRED_CONFIG.scheme != BPRED_NONE) {
+			//trained in program order, only on the path that was really taken
+			bpred_update(e->pc, d, e->info, e->taken, e->actual);
+			STATS.bp_resolved++;
+			if (e->actual != e->predicted) {
+				STATS.bp_mispredicts++;
+			}
+		}
+		if (d->cls == CLASS_LOAD || d->cls == CLASS_STORE) {
+			O->lsq_used--;
+		}
+		if (SIM->trace != NULL) {
+			trace_retire(e->pc, d, e->value, e->address, e->value);
+		}
+		INSTRUCTION_COUNT++;
+		STATS.committed++;
+		STATS.class_committed[d->cls]++;
+		if (SIM->profile != NULL) {
+			profile_retire(e->pc, d);
+		}
+		O->head = (O->head + 1) % OOO_CONFIG.rob_entries;
+		O->count--;
+		if (d->cls == CLASS_STORE || op_is_atomic(d->op)) {
+			ooo_code_check(e->address, MEM_access_size(d));
+		}
+	}
+}
+
+/***************************************************************/
+/* Issue and execute                                                                                                      */
+/***************************************************************/
+static int operand_ready(rob_entry_t *e, int k, uint32_t now)
+{
+	const rob_entry_t *p;
+	if (e->tag[k] == 0) {
+		return TRUE;
+	}
+	p = &O->rob[e->tag[k] - 1];
+	if (!p->issued || p->ready > now) {
+		return FALSE;
+	}
+	e->src[k] = p->value;
+	e->tag[k] = 0;
+	return TRUE;
+}
+
+//Where the load at position n gets its size bytes at address from: ROB index + 1 of the older store that covers
+//them all, 0 for memory, -1 while an older store's address is not known or one covers only part of them.
+static int ooo_load_source(uint32_t n, uint32_t address, uint32_t size, uint32_t now)
+{
+	const rob_entry_t *s;
+	uint32_t i, idx, s_size;
+
+	for (i = n; i-- > 0; ) {
+		idx = ROB_INDEX(i);
+		s = &O->rob[idx];
+		if (op_is_atomic(O->decoded[idx].op)) {
+			//an atomic has done all it does to memory once it has executed
+			if (!s->issued) {
+				return -1;
+			}
+			continue;
+		}
+		if (O->decoded[idx].cls != CLASS_STORE) {
+			continue;
+		}
+		if (!s->issued || s->ready > now) {
+			return -1;
+		}
+		s_size = MEM_access_size(&O->decoded[idx]);
+		if (!overlaps(address, size, s->address, s_size)) {
+			continue;
+		}
+		if (s->address <= address && address + size <= s->address + s_size) {
+			return idx + 1;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+//Execute the entry at position n, FALSE if it is a load that has to wait.
+static int ooo_execute(uint32_t n, uint32_t now)
+{
+	uint32_t idx = ROB_INDEX(n);
+	rob_entry_t *e = &O->rob[idx];
+	const decoded_inst_t *d = &O->decoded[idx];
+	const rob_entry_t *s;
+	uint32_t a = e->src[0], b = e->src[1], latency = 1;
+	int from;
+
+	switch (d->cls) {
+		case CLASS_ALU:
+			if (op_is_muldiv(d->op)) {
+				//waits in its reservation station while the unit cannot start it
+				if (muldiv_busy(d) > 0) {
+					O->unit_blocked = TRUE;
+					return FALSE;
+				}
+				latency = muldiv_execute(d);
+			}
+			e->value = EX_R_Processing(d, a, b);
+			break;
+		case CLASS_ALU_IMM:
+			e->value = EX_Iimm_Processing(d, a);
+			break;
+		case CLASS_STORE:
+			e->address = a + d->imm;
+			e->value = b;
+			break;
+		case CLASS_LOAD:
+			if (op_is_atomic(d->op)) {
+				//reads and writes memory straight away, so only once nothing older can still be squashed
+				if (n != 0) {
+					return FALSE;
+				}
+				e->address = a;
+				e->value = MEM_atomic(d, a, b);
+				latency = 2;
+				if (DCACHE_CONFIG.enabled) {
+					if (STOREBUF_CONFIG.depth == 0) {
+						latency += cache_data(e->pc, e->address, TRUE);
+					}else {
+						latency += storebuf_store(e->address, 4);
+					}
+				}
+				break;
+			}
+			e->address = a + d->imm;
+			from = ooo_load_source(n, e->address, MEM_access_size(d), now);
+			if (from < 0) {
+				STATS.ooo.load_waits++;
+				return FALSE;
+			}
+			//address generation, then the D-cache or the store's data
+			latency = 2;
+			if (from > 0) {
+				s = &O->rob[from - 1];
+				e->value = MEM_extend(d, s->value >> (8 * (e->address - s->address)));
+				e->forwarded = TRUE;
+				STATS.ooo.forwarded++;
+				break;
+			}
+			e->value = MEM_load(d, e->address);
+			if (DCACHE_CONFIG.enabled) {
+				if (STOREBUF_CONFIG.depth == 0) {
+					latency += cache_data(e->pc, e->address, FALSE);
+				}else {
+					latency += storebuf_load(e->pc, e->address, MEM_access_size(d));
+				}
+			}
+			break;
+		case CLASS_BRANCH:
+			e->taken = EX_Branch_Processing(d, a, b);
+			e->actual = e->taken ? e->pc + d->imm : e->pc + 4;
+			break;
+		case CLASS_JUMP:
+			e->value = e->pc + 4;
+			e->taken = TRUE;
+			e->actual = d->op == OP_JAL ? e->pc + d->imm : (a + d->imm) & ~1u;
+			break;
+	}
+	e->ready = now + latency;
+	if ((d->cls == CLASS_BRANCH || d->cls == CLASS_JUMP) && e->actual != e->predicted) {
+		//fetch went the wrong way: squash what came after it and fetch from where it really goes
+		if (BPRED_CONFIG.scheme != BPRED_NONE) {
+			bpred_recover(e->info);
+		}
+		ooo_squash(n + 1, e->actual);
+		STATS.control_events++;
+		STATS.control_cls = d->cls;
+	}
+	return TRUE;
+}
+
+static void ooo_issue(uint32_t now)
+{
+	uint32_t units[NUM_FU] = { OOO_CONFIG.width, 1, 1 };
+	uint32_t i, fu, issued = 0, was_blocked = O->unit_blocked;
+	rob_entry_t *e;
+
+	O->unit_blocked = FALSE;
+	//oldest first, a squash shortens the ROB under the loop
+	for (i = 0; i < O->count && issued < OOO_CONFIG.width; i++) {
+		e = &O->rob[ROB_INDEX(i)];
+		fu = fu_class(&O->decoded[ROB_INDEX(i)]);
+		if (e->issued || units[fu] == 0) {
+			continue;
+		}
+		if (!operand_ready(e, 0, now) || !operand_ready(e, 1, now) || !ooo_execute(i, now)) {
+			continue;
+		}
+		e->issued = TRUE;
+		O->rs_used[fu]--;
+		units[fu]--;
+		issued++;
+		STATS.ooo.issued[fu]++;
+	}
+	//counted like the pipeline's: the cycles, and the waits they make up
+	if (O->unit_blocked) {
+		STATS.structural_stall_cycles++;
+		if (!was_blocked) {
+			STATS.structural_stalls++;
+		}
+	}
+}
+
+/***************************************************************/
+/* Rename and fetch                                                                                                         */
+/***************************************************************/
+static void ooo_rename()
+{
+	const fetch_entry_t *q;
+	decoded_inst_t d;
+	rob_entry_t *e;
+	uint32_t n, k, idx, fu, reg;
+
+	for (n = 0; n < OOO_CONFIG.width && O->queue_count > 0; n++) {
+		q = &O->queue[O->queue_head];
+		decode_instruction(q->ir, &d);
+		fu = fu_class(&d);
+		if (O->count == OOO_CONFIG.rob_entries) {
+			STATS.ooo.rob_full++;
+			break;
+		}
+		if (O->rs_used[fu] == OOO_CONFIG.rs_entries) {
+			STATS.ooo.rs_full++;
+			break;
+		}
+		if ((d.cls == CLASS_LOAD || d.cls == CLASS_STORE) && O->lsq_used == OOO_CONFIG.lsq_entries) {
+			STATS.ooo.lsq_full++;
+			break;
+		}
+		idx = ROB_INDEX(O->count);
+		e = &O->rob[idx];
+		memset(e, 0, sizeof(*e));
+		O->decoded[idx] = d;
+		e->pc = q->pc;
+		e->ir = q->ir;
+		e->predicted = q->predicted;
+		e->info = q->info;
+		//a register no older instruction in flight writes is read from the register file, x0 always is
+		for (k = 0; k < 2; k++) {
+			reg = k == 0 ? d.rs1 : d.rs2;
+			e->tag[k] = O->map[reg];
+			e->src[k] = CURRENT_STATE.REGS[reg];
+		}
+		if (d.writes_rd) {
+			O->map[d.rd] = idx + 1;
+		}
+		O->rs_used[fu]++;
+		if (d.cls == CLASS_LOAD || d.cls == CLASS_STORE) {
+			O->lsq_used++;
+		}
+		O->count++;
+		O->queue_head = (O->queue_head + 1) % OOO_QUEUE;
+		O->queue_count--;
+		STATS.ooo.renamed++;
+	}
+}
+
+static void ooo_fetch()
+{
+	const decoded_inst_t *d;
+	fetch_entry_t *q;
+	uint32_t n, line = OOO_NO_LINE, latency;
+
+	if (O->halted) {
+		return;
+	}
+	if (O->fetch_stall > 0) {
+		O->fetch_stall--;
+		return;
+	}
+	for (n = 0; n < OOO_CONFIG.width && O->queue_count < OOO_QUEUE; n++) {
+		//one I-cache access per line and cycle, the first one after a miss is the line arriving
+		if (ICACHE_CONFIG.enabled && (O->fetch_pc & ~(ICACHE_CONFIG.line - 1)) != line) {
+			line = O->fetch_pc & ~(ICACHE_CONFIG.line - 1);
+			if (line != O->filled_line && (latency = cache_fetch(O->fetch_pc)) > 0) {
+				O->filled_line = line;
+				O->fetch_stall = latency - 1;
+				return;
+			}
+			O->filled_line = OOO_NO_LINE;
+		}
+		d = predecode(O->fetch_pc);
+		if (d->raw == 0) {
+			//where the pipeline would drain, unless an older jump or branch turns out to go elsewhere
+			O->halted = TRUE;
+			return;
+		}
+		q = &O->queue[(O->queue_head + O->queue_count) % OOO_QUEUE];
+		q->pc = O->fetch_pc;
+		q->ir = d->raw;
+		q->predicted = bpred_predict(O->fetch_pc, d, &q->info);
+		O->queue_count++;
+		O->fetch_pc = q->predicted;
+		//a taken jump or branch ends the fetch group
+		if (q->predicted != q->pc + 4) {
+			break;
+		}
+	}
+}
+
+/***************************************************************/
+/* One cycle, stages in reverse order so each sees the last cycle's work  */
+/***************************************************************/
+//The cycle goes to the oldest instruction committing in it, or to what holds the ROB head.
+static void ooo_profile(uint32_t head_pc, uint32_t committed, uint32_t stalled)
+{
+	const rob_entry_t *e = &O->rob[O->head];
+	const decoded_inst_t *d = &O->decoded[O->head];
+
+	if (committed) {
+		profile_cycle(head_pc, PROFILE_BUSY);
+	}else if (stalled) {
+		profile_cycle(O->stall_pc, PROFILE_MEMORY);
+	}else if (O->count == 0) {
+		profile_cycle(O->fetch_pc, O->fetch_stall > 0 ? PROFILE_FETCH : PROFILE_FILL);
+	}else if (!e->issued) {
+		profile_cycle(e->pc, PROFILE_DATA);
+	}else {
+		profile_cycle(e->pc, d->cls == CLASS_LOAD || d->cls == CLASS_STORE ? PROFILE_MEMORY : PROFILE_BUSY);
+	}
+}
+
+void ooo_cycle()
+{
+	uint32_t now = CYCLE_COUNT, head_pc, committed, stalled;
+
+	ooo_get();
+	head_pc = O->count > 0 ? O->rob[O->head].pc : 0;
+	committed = INSTRUCTION_COUNT;
+	stalled = O->commit_stall > 0;
+	ooo_commit(now);
+	if (SIM->profile != NULL) {
+		ooo_profile(head_pc, committed != INSTRUCTION_COUNT, stalled);
+	}
+	ooo_issue(now);
+	ooo_rename();
+	ooo_fetch();
+	STATS.ooo.rob_occupancy += O->count;
+	//the architectural PC is the oldest instruction not committed yet
+	if (O->count > 0) {
+		CURRENT_STATE.PC = O->rob[O->head].pc;
+	}else if (O->queue_count > 0) {
+		CURRENT_STATE.PC = O->queue[O->queue_head].pc;
+	}else {
+		CURRENT_STATE.PC = O->fetch_pc;
+	}
+	NEXT_STATE = CURRENT_STATE;
+	if (O->halted && O->count == 0 && O->queue_count == 0) {
+		if (!QUIET) {
+			printf("Reorder buffer empty, program execution complete!\n");
+		}
+		RUN_FLAG = FALSE;
+	}
+}
+
+/***************************************************************/
+/* The ROB for 'show'                                                                                                        */
+/***************************************************************/
+void ooo_show()
+{
+	const rob_entry_t *e;
+	char text[64];
+	uint32_t i;
+
+	ooo_get();
+	printf("ROB: %u of %u entries, fetch PC 0x%08x%s\n", O->count, OOO_CONFIG.rob_entries, O->fetch_pc,
+			O->halted ? " (halted)" : "");
+	for (i = 0; i < O->count; i++) {
+		e = &O->rob[ROB_INDEX(i)];
+		disasm_instruction(&O->decoded[ROB_INDEX(i)], text, sizeof(text));
+		printf("  [%3u] 0x%08x  %-28s %s\n", ROB_INDEX(i), e->pc, text,
+				!e->issued ? "waiting" : e->ready > CYCLE_COUNT ? "executing" : "done");
+	}
+	printf("\n");
+}
+
+/***************************************************************/
+/* The core's state as one blob for checkpoints                                                     */
+/***************************************************************/
+static size_t ooo_blob_size()
+{
+	return 4 * (OOO_STATE_WORDS + OOO_CONFIG.rob_entries * ROB_WORDS);
+}
+
+uint8_t *ooo_snapshot(size_t *size)
+{
+	uint8_t *blob;
+	uint32_t i;
+
+	ooo_get();
+	*size = ooo_blob_size();
+	blob = malloc(*size);
+	if (blob == NULL) {
+		printf("Error: out of host memory for the out-of-order core\n");
+		exit(-1);
+	}
+	for (i = 0; i < OOO_STATE_WORDS; i++) {
+		mem_store_le32(blob + 4 * i, ((const uint32_t *)O)[i]);
+	}
+	for (i = 0; i < OOO_CONFIG.rob_entries * ROB_WORDS; i++) {
+		mem_store_le32(blob + 4 * (OOO_STATE_WORDS + i), ((const uint32_t *)O->rob)[i]);
+	}
+	return blob;
+}
+
+//After the configuration has been restored.
+int ooo_restore(const uint8_t *blob, size_t size)
+{
+	uint32_t i;
+
+	ooo_release();
+	if (size != ooo_blob_size()) {
+		return FALSE;
+	}
+	ooo_get();
+	for (i = 0; i < OOO_STATE_WORDS; i++) {
+		((uint32_t *)O)[i] = mem_load_le32(blob + 4 * i);
+	}
+	for (i = 0; i < OOO_CONFIG.rob_entries * ROB_WORDS; i++) {
+		((uint32_t *)O->rob)[i] = mem_load_le32(blob + 4 * (OOO_STATE_WORDS + i));
+	}
+	if (O->head >= OOO_CONFIG.rob_entries || O->count > OOO_CONFIG.rob_entries || O->queue_head >= OOO_QUEUE ||
+			O->queue_count > OOO_QUEUE || O->lsq_used > OOO_CONFIG.lsq_entries) {
+		ooo_release();
+		return FALSE;
+	}
+	for (i = 0; i < RISCV_REGS; i++) {
+		if (O->map[i] > OOO_CONFIG.rob_entries) {
+			ooo_release();
+			return FALSE;
+		}
+	}
+	//the decoded records are derived from the instruction words
+	for (i = 0; i < O->count; i++) {
+		if (O->rob[ROB_INDEX(i)].tag[0] > OOO_CONFIG.rob_entries || O->rob[ROB_INDEX(i)].tag[1] > OOO_CONFIG.rob_entries) {
+			ooo_release();
+			return FALSE;
+		}
+		decode_instruction(O->rob[ROB_INDEX(i)].ir, &O->decoded[ROB_INDEX(i)]);
+	}
+	return TRUE;
+}
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Data prefetchers in front of the D-cache.                                                              */
+/*                                                                                                                               */
+/* cache_data() reports every load to prefetch_train(). The next-line scheme */
+/* fetches the lines after a load that missed or was the first to use a       */
+/* prefetched line (tagged prefetching). The stride scheme keeps the last     */
+/* address and stride per load PC and, once the same stride was seen twice in */
+/* a row, fetches along it; strides shorter than a line step a whole line in  */
+/* their direction. Both put the lines straight into the D-cache, marked as    */
+/* prefetched until a demand access uses them. Stream buffers keep their lines */
+/* outside the cache instead: a miss no buffer can serve starts a stream at   */
+/* the next line in the least recently used buffer, a miss one can serve takes */
+/* the line out and the buffer tops up again. A buffer holds distance +        */
+/* degree - 1 lines, so it reaches as far ahead as the other two schemes.     */
+/* Prefetches go to the level below the D-cache like any miss and so compete   */
+/* with demand misses for the L2 and the DRAM banks.                                        */
+/***************************************************************/
+#define PREFETCH_MAX_DEGREE 16
+#define PREFETCH_MAX_DISTANCE 64
+#define STREAM_ENTRIES (PREFETCH_MAX_DEGREE + PREFETCH_MAX_DISTANCE)
+#define PREFETCH_MAX_STREAMS 16
+#define PREFETCH_CONFIDENT 2	/* stride confidence that starts prefetching */
+
+typedef struct {
+	uint32_t pc;
+	uint32_t last;		/* address of the last load */
+	uint32_t stride;		/* signed */
+	uint32_t confidence;	/* 0..3, up on a repeated stride, down otherwise */
+} stride_entry_t;
+
+typedef struct {
+	uint32_t address;		/* line address */
+	uint32_t ready;		/* cycle the line arrives */
+} stream_entry_t;
+
+typedef struct {
+	stream_entry_t entries[STREAM_ENTRIES];	/* oldest first */
+	uint32_t count;
+	uint32_t next;		/* line address the buffer fetches next */
+	uint32_t stamp;		/* last use, the oldest buffer is reallocated */
+} stream_buffer_t;
+
+/* per simulator context (SIM->prefetch), allocated by the first load */
+struct prefetch_state {
+	stride_entry_t *table;
+	stream_buffer_t streams[PREFETCH_MAX_STREAMS];
+	uint32_t clock;		/* stream buffer stamps */
+};
+
+const char *PREFETCH_NAMES[NUM_PREFETCH] = { "none", "nextline", "stride", "stream" };
+
+#define PF (SIM->prefetch)
+
+static struct prefetch_state *prefetch_get()
+{
+	if (PF != NULL) {
+		return PF;
+	}
+	PF = calloc(1, sizeof(struct prefetch_state));
+	if (PF != NULL) {
+		PF->table = calloc(PREFETCH_CONFIG.table_entries, sizeof(stride_entry_t));
+	}
+	if (PF == NULL || PF->table == NULL) {
+		printf("Error: out of host memory for the prefetcher\n");
+		exit(-1);
+	}
+	return PF;
+}
+
+void prefetch_release()
+{
+	if (PF == NULL) {
+		return;
+	}
+	free(PF->table);
+	free(PF);
+	PF = NULL;
+}
+
+/***************************************************************/
+/* Configuration: a scheme by name, or one of its parameters                          */
+/***************************************************************/
+int prefetch_set(const char *name)
+{
+	int i;
+	for (i = 0; i < NUM_PREFETCH; i++) {
+		if (strcmp(name, PREFETCH_NAMES[i]) == 0) {
+			PREFETCH_CONFIG.scheme = i;
+			prefetch_release();
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static int power_of_two(uint32_t value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+int prefetch_config_valid(const prefetch_config_t *config)
+{
+	return config->scheme < NUM_PREFETCH && config->degree >= 1 && config->degree <= PREFETCH_MAX_DEGREE &&
+		config->distance >= 1 && config->distance <= PREFETCH_MAX_DISTANCE && power_of_two(config->table_entries) &&
+		config->streams >= 1 && config->streams <= PREFETCH_MAX_STREAMS;
+}
+
+int prefetch_param(const char *name, uint32_t value)
+{
+	prefetch_config_t config = PREFETCH_CONFIG;
+	if (strcmp(name, "degree") == 0) {
+		config.degree = value;
+	}else if (strcmp(name, "distance") == 0) {
+		config.distance = value;
+	}else if (strcmp(name, "table") == 0) {
+		config.table_entries = value;
+	}else if (strcmp(name, "streams") == 0) {
+		config.streams = value;
+	}else {
+		return FALSE;
+	}
+	if (!prefetch_config_valid(&config)) {
+		return FALSE;
+	}
+	PREFETCH_CONFIG = config;
+	prefetch_release();
+	return TRUE;
+}
+
+/***************************************************************/
+/* Stream buffers                                                                                                            */
+/***************************************************************/
+static void stream_top_up(stream_buffer_t *b, uint32_t now)
+{
+	while (b->count < PREFETCH_CONFIG.distance + PREFETCH_CONFIG.degree - 1) {
+		b->entries[b->count].address = b->next;
+		b->entries[b->count].ready = now + cache_fill(b->next, now);
+		b->count++;
+		b->next += DCACHE_CONFIG.line;
+		STATS.prefetch.issued++;
+	}
+}
+
+static void stream_allocate(uint32_t line, uint32_t now)
+{
+	stream_buffer_t *b = &PF->streams[0];
+	uint32_t i;
+
+	for (i = 1; i < PREFETCH_CONFIG.streams; i++) {
+		if (PF->streams[i].stamp < b->stamp) {
+			b = &PF->streams[i];
+		}
+	}
+	STATS.prefetch.useless += b->count;
+	b->count = 0;
+	b->next = line + DCACHE_CONFIG.line;
+	b->stamp = ++PF->clock;
+	stream_top_up(b, now);
+}
+
+/***************************************************************/
+/* A demand access missed the D-cache at cycle now: TRUE with the cycles    */
+/* until the line is there if a stream buffer has it.                                               */
+/***************************************************************/
+int prefetch_miss(uint32_t address, uint32_t now, uint32_t *latency)
+{
+	uint32_t line = address & ~(DCACHE_CONFIG.line - 1);
+	stream_buffer_t *b;
+	uint32_t i, j;
+
+	if (PREFETCH_CONFIG.scheme == PREFETCH_NONE) {
+		return FALSE;
+	}
+	if (PREFETCH_CONFIG.scheme == PREFETCH_STREAM) {
+		prefetch_get();
+		for (i = 0; i < PREFETCH_CONFIG.streams; i++) {
+			b = &PF->streams[i];
+			for (j = 0; j < b->count && b->entries[j].address != line; j++) {
+			}
+			if (j == b->count) {
+				continue;
+			}
+			//the lines in front of it were skipped by the stream
+			STATS.prefetch.useless += j;
+			STATS.prefetch.useful++;
+			*latency = 0;
+			if (b->entries[j].ready > now) {
+				STATS.prefetch.late++;
+				STATS.prefetch.late_cycles += b->entries[j].ready - now;
+				*latency = b->entries[j].ready - now;
+			}
+			b->count -= j + 1;
+			memmove(&b->entries[0], &b->entries[j + 1], b->count * sizeof(stream_entry_t));
+			b->stamp = ++PF->clock;
+			stream_top_up(b, now);
+			return TRUE;
+		}
+	}
+	STATS.prefetch.misses++;
+	return FALSE;
+}
+
+/***************************************************************/
+/* Training on a load from pc: missed is set when no prefetch covered it, */
+/* used when it was the first access to a prefetched line.                            */
+/***************************************************************/
+static void prefetch_lines(uint32_t address, int32_t step, uint32_t now)
+{
+	uint32_t k;
+	for (k = 0; k < PREFETCH_CONFIG.degree; k++) {
+		if (cache_prefetch(address + (uint32_t)step * (PREFETCH_CONFIG.distance + k), now)) {
+			STATS.prefetch.issued++;
+		}
+	}
+}
+
+void prefetch_train(uint32_t pc, uint32_t address, int missed, int used, uint32_t now)
+{
+	uint32_t line = address & ~(DCACHE_CONFIG.line - 1);
+	stride_entry_t *e;
+	int32_t stride, step;
+
+	switch (PREFETCH_CONFIG.scheme) {
+		case PREFETCH_NEXT_LINE:
+			if (missed || used) {
+				prefetch_lines(line, DCACHE_CONFIG.line, now);
+			}
+			break;
+		case PREFETCH_STRIDE:
+			e = &prefetch_get()->table[(pc >> 2) & (PREFETCH_CONFIG.table_entries - 1)];
+			if (e->pc != pc) {
+				e->pc = pc;
+				e->last = address;
+				e->stride = 0;
+				e->confidence = 0;
+				break;
+			}
+			stride = (int32_t)(address - e->last);
+			e->last = address;
+			if (stride == (int32_t)e->stride) {
+				e->confidence += e->confidence < 3;
+			}else if (e->confidence > 0) {
+				e->confidence--;
+			}else {
+				e->stride = stride;
+			}
+			stride = (int32_t)e->stride;
+			if (e->confidence < PREFETCH_CONFIDENT || stride == 0) {
+				break;
+			}
+			step = stride;
+			if (stride > -(int32_t)DCACHE_CONFIG.line && stride < (int32_t)DCACHE_CONFIG.line) {
+				step = stride > 0 ? (int32_t)DCACHE_CONFIG.line : -(int32_t)DCACHE_CONFIG.line;
+				address = line;
+			}
+			prefetch_lines(address, step, now);
+			break;
+		case PREFETCH_STREAM:
+			if (missed) {
+				prefetch_get();
+				stream_allocate(line, now);
+			}
+			break;
+	}
+}
+
+/***************************************************************/
+/* Stride table and stream buffers as one blob for checkpoints                      */
+/***************************************************************/
+static size_t prefetch_blob_size()
+{
+	return 4 + PREFETCH_CONFIG.table_entries * 16 + PREFETCH_MAX_STREAMS * (12 + STREAM_ENTRIES * 8);
+}
+
+uint8_t *prefetch_snapshot(size_t *size)
+{
+	uint8_t *blob, *p;
+	uint32_t i, j;
+
+	prefetch_get();
+	*size = prefetch_blob_size();
+	blob = p = malloc(*size);
+	if (blob == NULL) {
+		printf("Error: out of host memory for the prefetcher\n");
+		exit(-1);
+	}
+	mem_store_le32(p, PF->clock);
+	p += 4;
+	for (i = 0; i < PREFETCH_CONFIG.table_entries; i++, p += 16) {
+		mem_store_le32(p, PF->table[i].pc);
+		mem_store_le32(p + 4, PF->table[i].last);
+		mem_store_le32(p + 8, PF->table[i].stride);
+		mem_store_le32(p + 12, PF->table[i].confidence);
+	}
+	for (i = 0; i < PREFETCH_MAX_STREAMS; i++) {
+		mem_store_le32(p, PF->streams[i].count);
+		mem_store_le32(p + 4, PF->streams[i].next);
+		mem_store_le32(p + 8, PF->streams[i].stamp);
+		p += 12;
+		for (j = 0; j < STREAM_ENTRIES; j++, p += 8) {
+			mem_store_le32(p, PF->streams[i].entries[j].address);
+			mem_store_le32(p + 4, PF->streams[i].entries[j].ready);
+		}
+	}
+	return blob;
+}
+
+int prefetch_restore(const uint8_t *blob, size_t size)
+{
+	const uint8_t *p = blob;
+	uint32_t i, j;
+
+	prefetch_release();
+	if (size != prefetch_blob_size()) {
+		return FALSE;
+	}
+	prefetch_get();
+	PF->clock = mem_load_le32(p);
+	p += 4;
+	for (i = 0; i < PREFETCH_CONFIG.table_entries; i++, p += 16) {
+		PF->table[i].pc = mem_load_le32(p);
+		PF->table[i].last = mem_load_le32(p + 4);
+		PF->table[i].stride = mem_load_le32(p + 8);
+		PF->table[i].confidence = mem_load_le32(p + 12);
+	}
+	for (i = 0; i < PREFETCH_MAX_STREAMS; i++) {
+		PF->streams[i].count = mem_load_le32(p);
+		PF->streams[i].next = mem_load_le32(p + 4);
+		PF->streams[i].stamp = mem_load_le32(p + 8);
+		p += 12;
+		if (PF->streams[i].count > STREAM_ENTRIES) {
+			prefetch_release();
+			return FALSE;
+		}
+		for (j = 0; j < STREAM_ENTRIES; j++, p += 8) {
+			PF->streams[i].entries[j].address = mem_load_le32(p);
+			PF->streams[i].entries[j].ready = mem_load_le32(p + 4);
+		}
+	}
+	return TRUE;
+}
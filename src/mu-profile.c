@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Guest profiler: every simulated cycle is charged to one instruction,  */
+/* the one retiring in it, or for a bubble the one that caused it (the    */
+/* stalled instruction, the jump or branch behind which fetch was      */
+/* redirected, the load or store waiting for memory, the fetch that missed */
+/* in the I-cache). The pipeline passes the cause down with each bubble,   */
+/* see blamePC/blameCause. The out-of-order core charges the ROB head.      */
+/*                                                                                                                               */
+/* The call stack is rebuilt from retired jumps the way the return address */
+/* stack hints of the ISA read them: a jal/jalr that links x1 or x5 is a    */
+/* call, a jalr through x1 or x5 that does not link is a return. Frames   */
+/* are named by the address of the function's first instruction, the root  */
+/* by the entry point. Cycles are kept per PC (the hot-PC listing) and per */
+/* call stack and PC (the folded stacks for flamegraph.pl and the like).   */
+/* Fast-forwarded instructions are neither charged nor seen by the stack.  */
+/***************************************************************/
+#define PROFILE_DEPTH 256		/* frames kept, deeper calls are only counted */
+#define PROFILE_ROOT 0		/* frame index of the entry point */
+
+typedef struct {
+	uint32_t pc;
+	uint32_t retired;
+	uint32_t cycles[NUM_PROFILE_CAUSES];
+} profile_pc_t;
+
+typedef struct {
+	uint32_t parent;		/* frame index, the root is its own */
+	uint32_t entry;		/* the function's first instruction */
+} profile_frame_t;
+
+typedef struct {
+	uint32_t frame;
+	uint32_t pc;
+	uint32_t cycles;
+} profile_sample_t;
+
+/* open addressing from a 64 bit key to an index into one of the arrays */
+typedef struct {
+	uint64_t *keys;
+	uint32_t *slots;		/* index + 1, 0 for empty */
+	uint32_t size;		/* power of two */
+	uint32_t count;
+} profile_map_t;
+
+/* per simulator context (SIM->profile), allocated by profile_start */
+struct profile_state {
+	char folded_file[256];	/* written when profiling stops, empty for none */
+	profile_map_t pc_map, frame_map, sample_map;
+	profile_pc_t *pcs;
+	profile_frame_t *frames;
+	profile_sample_t *samples;
+	uint32_t stack[PROFILE_DEPTH];	/* frame indexes, stack[0] is the root */
+	uint32_t depth;		/* frames above the root */
+	uint32_t max_depth;
+	uint32_t lost;		/* calls deeper than PROFILE_DEPTH not returned from yet */
+	uint32_t pending_pop;	/* the last retired instruction returned ... */
+	uint32_t pending_call;	/* ... or called, the next one is where it went */
+	uint32_t cycles;
+	uint32_t retired;
+};
+
+#define P (SIM->profile)
+
+static const char *PROFILE_CAUSE_NAMES[NUM_PROFILE_CAUSES] = { "fill", "busy", "data", "control", "memory", "fetch", "unit" };
+
+static void *profile_alloc(void *old, size_t count, size_t size)
+{
+	void *p = realloc(old, count * size);
+	if (p == NULL) {
+		printf("Error: out of host memory for the profile\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/***************************************************************/
+/* Hash maps                                                                                                                 */
+/***************************************************************/
+static uint32_t profile_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (uint32_t)key;
+}
+
+static void profile_map_init(profile_map_t *m, uint32_t size)
+{
+	m->keys = profile_alloc(NULL, size, sizeof(uint64_t));
+	m->slots = profile_alloc(NULL, size, sizeof(uint32_t));
+	memset(m->slots, 0, size * sizeof(uint32_t));
+	m->size = size;
+	m->count = 0;
+}
+
+static void profile_map_free(profile_map_t *m)
+{
+	free(m->keys);
+	free(m->slots);
+}
+
+static uint32_t *profile_map_slot(const profile_map_t *m, uint64_t key)
+{
+	uint32_t i = profile_hash(key) & (m->size - 1);
+	while (m->slots[i] != 0 && m->keys[i] != key) {
+		i = (i + 1) & (m->size - 1);
+	}
+	return &m->slots[i];
+}
+
+//Index of key, *created is set when it had to be added as count (the next free one in its array).
+static uint32_t profile_map_find(profile_map_t *m, uint64_t key, int *created)
+{
+	profile_map_t grown;
+	uint32_t *slot, i;
+
+	slot = profile_map_slot(m, key);
+	*created = *slot == 0;
+	if (!*created) {
+		return *slot - 1;
+	}
+	//kept at most half full
+	if (2 * (m->count + 1) > m->size) {
+		profile_map_init(&grown, 2 * m->size);
+		for (i = 0; i < m->size; i++) {
+			if (m->slots[i] != 0) {
+				slot = profile_map_slot(&grown, m->keys[i]);
+				*slot = m->slots[i];
+				grown.keys[slot - grown.slots] = m->keys[i];
+			}
+		}
+		grown.count = m->count;
+		profile_map_free(m);
+		*m = grown;
+		slot = profile_map_slot(m, key);
+	}
+	m->keys[slot - m->slots] = key;
+	*slot = ++m->count;
+	return m->count - 1;
+}
+
+//Room for entry index of an array that starts with 16 and doubles whenever it is full.
+static void profile_grow(void **array, uint32_t index, size_t size)
+{
+	if (index >= 16 && (index & (index - 1)) == 0) {
+		*array = profile_alloc(*array, 2 * index, size);
+	}
+}
+
+/***************************************************************/
+/* Starting and stopping                                                                                                */
+/***************************************************************/
+static void profile_free()
+{
+	profile_map_free(&P->pc_map);
+	profile_map_free(&P->frame_map);
+	profile_map_free(&P->sample_map);
+	free(P->pcs);
+	free(P->frames);
+	free(P->samples);
+	free(P);
+	P = NULL;
+}
+
+//Empty tables and a stack with only the entry point on it.
+static void profile_init()
+{
+	int created;
+
+	profile_map_init(&P->pc_map, 64);
+	profile_map_init(&P->frame_map, 64);
+	profile_map_init(&P->sample_map, 64);
+	P->pcs = profile_alloc(NULL, 16, sizeof(profile_pc_t));
+	P->frames = profile_alloc(NULL, 16, sizeof(profile_frame_t));
+	P->samples = profile_alloc(NULL, 16, sizeof(profile_sample_t));
+	//no call has that key, a function at the entry point called again gets a frame of its own
+	profile_map_find(&P->frame_map, (uint64_t)UINT32_MAX << 32 | PROGRAM_ENTRY, &created);
+	P->frames[PROFILE_ROOT].parent = PROFILE_ROOT;
+	P->frames[PROFILE_ROOT].entry = PROGRAM_ENTRY;
+	P->stack[0] = PROFILE_ROOT;
+}
+
+//folded_file is written by profile_stop(), NULL for none.
+void profile_start(const char *folded_file)
+{
+	if (P != NULL) {
+		profile_stop();
+	}
+	P = calloc(1, sizeof(struct profile_state));
+	if (P == NULL) {
+		printf("Error: out of host memory for the profile\n");
+		exit(-1);
+	}
+	if (folded_file != NULL) {
+		snprintf(P->folded_file, sizeof(P->folded_file), "%s", folded_file);
+	}
+	profile_init();
+	if (!QUIET) {
+		printf("Profiling cycles by PC\n");
+	}
+}
+
+void profile_stop()
+{
+	if (P == NULL) {
+		return;
+	}
+	if (P->folded_file[0] != '\0') {
+		profile_folded(P->folded_file);
+	}
+	profile_free();
+}
+
+//A reset starts the counts over along with the other statistics, the profile stays on.
+void profile_clear()
+{
+	char folded_file[256];
+
+	if (P == NULL) {
+		return;
+	}
+	memcpy(folded_file, P->folded_file, sizeof(folded_file));
+	profile_free();
+	P = calloc(1, sizeof(struct profile_state));
+	if (P == NULL) {
+		printf("Error: out of host memory for the profile\n");
+		exit(-1);
+	}
+	memcpy(P->folded_file, folded_file, sizeof(folded_file));
+	profile_init();
+}
+
+/***************************************************************/
+/* Counting                                                                                                                    */
+/***************************************************************/
+static profile_pc_t *profile_pc(uint32_t pc)
+{
+	int created;
+	uint32_t i = profile_map_find(&P->pc_map, pc, &created);
+	if (created) {
+		profile_grow((void **)&P->pcs, i, sizeof(profile_pc_t));
+		memset(&P->pcs[i], 0, sizeof(profile_pc_t));
+		P->pcs[i].pc = pc;
+	}
+	return &P->pcs[i];
+}
+
+void profile_cycle(uint32_t pc, uint32_t cause)
+{
+	uint32_t frame = P->stack[P->depth], i;
+	int created;
+
+	P->cycles++;
+	profile_pc(pc)->cycles[cause]++;
+	i = profile_map_find(&P->sample_map, (uint64_t)frame << 32 | pc, &created);
+	if (created) {
+		profile_grow((void **)&P->samples, i, sizeof(profile_sample_t));
+		P->samples[i].frame = frame;
+		P->samples[i].pc = pc;
+		P->samples[i].cycles = 0;
+	}
+	P->samples[i].cycles++;
+}
+
+static int profile_link(uint32_t reg)
+{
+	return reg == 1 || reg == 5;
+}
+
+static void profile_call(uint32_t entry)
+{
+	uint32_t parent = P->stack[P->depth], i;
+	int created;
+
+	if (P->depth + 1 == PROFILE_DEPTH) {
+		P->lost++;
+		return;
+	}
+	i = profile_map_find(&P->frame_map, (uint64_t)parent << 32 | entry, &created);
+	if (created) {
+		profile_grow((void **)&P->frames, i, sizeof(profile_frame_t));
+		P->frames[i].parent = parent;
+		P->frames[i].entry = entry;
+	}
+	P->stack[++P->depth] = i;
+	if (P->depth > P->max_depth) {
+		P->max_depth = P->depth;
+	}
+}
+
+static void profile_return()
+{
+	if (P->lost > 0) {
+		P->lost--;
+	}else if (P->depth > 0) {
+		P->depth--;
+	}
+}
+
+//In program order, before the cycle it retires in is charged, which is then charged to the function it is in.
+void profile_retire(uint32_t pc, const decoded_inst_t *d)
+{
+	//where the last jump went is only known now
+	if (P->pending_pop) {
+		profile_return();
+	}
+	if (P->pending_call) {
+		profile_call(pc);
+	}
+	P->pending_pop = FALSE;
+	P->pending_call = FALSE;
+	P->retired++;
+	profile_pc(pc)->retired++;
+	if (d->cls != CLASS_JUMP) {
+		return;
+	}
+	//a jalr that links the other one of x1 and x5 returns and calls (a coroutine swap)
+	if (d->op == OP_JALR && profile_link(d->rs1) && d->rd != d->rs1) {
+		P->pending_pop = TRUE;
+	}
+	if (profile_link(d->rd)) {
+		P->pending_call = TRUE;
+	}
+}
+
+/***************************************************************/
+/* Output: 'profile top <n>' and 'profile folded <file>'                                      */
+/***************************************************************/
+static uint32_t profile_total(const profile_pc_t *p)
+{
+	uint32_t i, total = 0;
+	for (i = 0; i < NUM_PROFILE_CAUSES; i++) {
+		total += p->cycles[i];
+	}
+	return total;
+}
+
+static int profile_hotter(const void *a, const void *b)
+{
+	const profile_pc_t *x = a, *y = b;
+	uint32_t tx = profile_total(x), ty = profile_total(y);
+	if (tx != ty) {
+		return tx > ty ? -1 : 1;
+	}
+	return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+//The n PCs with the most cycles, each disassembled the way print_instruction() does it.
+void profile_top(uint32_t n)
+{
+	profile_pc_t *sorted;
+	char text[64];
+	uint32_t i, total, cause;
+
+	if (P == NULL) {
+		printf("Error: The profiler is off\n");
+		return;
+	}
+	sorted = profile_alloc(NULL, P->pc_map.count + 1, sizeof(profile_pc_t));
+	memcpy(sorted, P->pcs, P->pc_map.count * sizeof(profile_pc_t));
+	qsort(sorted, P->pc_map.count, sizeof(profile_pc_t), profile_hotter);
+	printf("-------------------------------------------------------------\n");
+	printf("Profile: %u cycles, %u instructions retired at %u PCs, %u calls deep at most\n",
+			P->cycles, P->retired, P->pc_map.count, P->max_depth + P->lost);
+	printf("-------------------------------------------------------------\n");
+	printf("%-10s %10s %6s %9s %6s", "PC", "cycles", "%", "retired", "CPI");
+	for (cause = 0; cause < NUM_PROFILE_CAUSES; cause++) {
+		if (cause != PROFILE_BUSY) {
+			printf(" %8s", PROFILE_CAUSE_NAMES[cause]);
+		}
+	}
+	printf("  instruction\n");
+	for (i = 0; i < n && i < P->pc_map.count; i++) {
+		total = profile_total(&sorted[i]);
+		disasm_instruction(predecode(sorted[i].pc), text, sizeof(text));
+		printf("0x%08x %10u %5.1f%% %9u", sorted[i].pc, total, P->cycles ? 100.0 * total / P->cycles : 0.0, sorted[i].retired);
+		if (sorted[i].retired > 0) {
+			printf(" %6.2f", (double)total / sorted[i].retired);
+		}else {
+			printf(" %6s", "-");
+		}
+		for (cause = 0; cause < NUM_PROFILE_CAUSES; cause++) {
+			if (cause != PROFILE_BUSY) {
+				printf(" %8u", sorted[i].cycles[cause]);
+			}
+		}
+		printf("  %s\n", text);
+	}
+	printf("\n");
+	free(sorted);
+}
+
+static void profile_write_frames(FILE *out, uint32_t frame)
+{
+	if (frame != PROFILE_ROOT) {
+		profile_write_frames(out, P->frames[frame].parent);
+	}
+	fprintf(out, "0x%08x;", P->frames[frame].entry);
+}
+
+//One 'caller;...;function;pc instruction cycles' line per call stack and PC, the format flamegraph.pl reads.
+int profile_folded(const char *file)
+{
+	FILE *out;
+	char text[64];
+	uint32_t i;
+
+	if (P == NULL) {
+		printf("Error: The profiler is off\n");
+		return FALSE;
+	}
+	out = fopen(file, "w");
+	if (out == NULL) {
+		printf("Error: Can't write profile %s\n", file);
+		return FALSE;
+	}
+	for (i = 0; i < P->sample_map.count; i++) {
+		disasm_instruction(predecode(P->samples[i].pc), text, sizeof(text));
+		profile_write_frames(out, P->samples[i].frame);
+		fprintf(out, "0x%08x %s %u\n", P->samples[i].pc, text, P->samples[i].cycles);
+	}
+	if (fclose(out) != 0) {
+		printf("Error: Can't write profile %s\n", file);
+		return FALSE;
+	}
+	if (!QUIET) {
+		printf("Folded stacks written to %s\n", file);
+	}
+	return TRUE;
+}
@@ -3,9 +3,145 @@
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <elf.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #include "mu-riscv.h"
 
+/***************************************************************/
+/* Simulator state (declared in mu-riscv.h)                                                          */
+/***************************************************************/
+_Thread_local sim_context_t *SIM;
+
+static const mem_region_t MEM_REGION_LAYOUT[NUM_MEM_REGION] = {
+	{ MEM_TEXT_BEGIN, MEM_TEXT_END, "text", 0 },
+	{ MEM_DATA_BEGIN, MEM_DATA_END, "data", 0 },
+	{ MEM_KDATA_BEGIN, MEM_KDATA_END, "kdata", 0 },
+	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, "ktext", 0 }
+};
+const char *ENGINE_NAMES[NUM_ENGINES] = { "interp", "threaded", "dbt" };
+
+#define PROGRAM_MAP (SIM->program_map)
+#define PROGRAM_MAP_SIZE (SIM->program_map_size)
+
+/***************************************************************/
+/* A fresh machine with the default configuration, not yet selected       */
+/***************************************************************/
+sim_context_t *sim_create() {
+	sim_context_t *ctx = calloc(1, sizeof(sim_context_t));
+	if (ctx == NULL) {
+		printf("Error: out of host memory for a simulator context\n");
+		exit(-1);
+	}
+	memcpy(ctx->mem_regions, MEM_REGION_LAYOUT, sizeof(MEM_REGION_LAYOUT));
+	ctx->memory_home = ctx;
+	ctx->program_entry = MEM_TEXT_BEGIN;
+	ctx->ff_engine = ENGINE_THREADED;
+	ctx->bpred_config.scheme = BPRED_NONE;
+	ctx->bpred_config.table_entries = 4096;
+	ctx->bpred_config.history_bits = 12;
+	ctx->bpred_config.btb_entries = 512;
+	ctx->bpred_config.ras_depth = 16;
+	ctx->icache_config.size = 16384;
+	ctx->icache_config.assoc = 4;
+	ctx->icache_config.line = 64;
+	ctx->icache_config.repl = REPL_LRU;
+	ctx->icache_config.hit_latency = 1;
+	ctx->icache_config.miss_latency = 20;
+	ctx->dcache_config = ctx->icache_config;
+	ctx->l2_config = ctx->icache_config;
+	ctx->l2_config.size = 262144;
+	ctx->l2_config.assoc = 8;
+	ctx->l2_config.hit_latency = 10;
+	ctx->l2_config.miss_latency = 100;
+	ctx->dram_config.banks = 8;
+	ctx->dram_config.row_size = 2048;
+	ctx->dram_config.queue_depth = 16;
+	ctx->dram_config.t_cas = 14;
+	ctx->dram_config.t_rcd = 14;
+	ctx->dram_config.t_rp = 14;
+	ctx->dram_config.t_burst = 4;
+	ctx->prefetch_config.scheme = PREFETCH_NONE;
+	ctx->prefetch_config.degree = 2;
+	ctx->prefetch_config.distance = 1;
+	ctx->prefetch_config.table_entries = 64;
+	ctx->prefetch_config.streams = 4;
+	ctx->issue_width = 1;
+	ctx->storebuf_config.depth = 0;
+	ctx->storebuf_config.merge = TRUE;
+	ctx->muldiv_config.mul_latency = 3;
+	ctx->muldiv_config.mul_pipelined = TRUE;
+	ctx->muldiv_config.div_latency = 32;
+	ctx->muldiv_config.div_pipelined = FALSE;
+	ctx->ooo_config.enabled = FALSE;
+	ctx->ooo_config.rob_entries = 64;
+	ctx->ooo_config.rs_entries = 16;
+	ctx->ooo_config.lsq_entries = 16;
+	ctx->ooo_config.width = 4;
+	ctx->multicore_config.cores = 1;
+	ctx->multicore_config.quantum = 1000;
+	ctx->multicore_config.snoop_latency = 20;
+	ctx->reservation = MEM_TLB_INVALID;
+	ctx->fetch_filled_pc = MEM_TLB_INVALID;
+	ctx->command_input = stdin;
+	return ctx;
+}
+
+/***************************************************************/
+/* Release a machine and all the guest memory it holds                            */
+/***************************************************************/
+void sim_destroy(sim_context_t *ctx) {
+	sim_context_t *prev = SIM;
+	mem_page_t *page, *next;
+	int i;
+
+	SIM = ctx;
+	trace_stop();
+	replay_stop();
+	profile_stop();
+	//core 0 takes the other cores with it
+	multicore_release();
+	threaded_release();
+	dbt_release();
+	bpred_release();
+	cache_release();
+	dram_release();
+	prefetch_release();
+	storebuf_release();
+	muldiv_release();
+	ooo_release();
+	for (page = ctx->mem_resident_pages; page != NULL; page = next) {
+		next = page->next;
+		if (!page->mapped) {
+			free(page->data);
+		}
+		free(page);
+	}
+	for (i = 0; i < MEM_L1_ENTRIES; i++) {
+		free(ctx->mem_page_table[i]);
+	}
+	if (PROGRAM_MAP != NULL) {
+		munmap(PROGRAM_MAP, PROGRAM_MAP_SIZE);
+	}
+	SIM = prev == ctx ? NULL : prev;
+	free(ctx);
+}
+
+/***************************************************************/
+/* Load a program into the selected machine and point the PC at its entry */
+/***************************************************************/
+void sim_start(const char *program) {
+	snprintf(prog_file, sizeof(prog_file), "%s", program);
+	initialize();
+	load_program();
+	CURRENT_STATE.PC = PROGRAM_ENTRY;
+	NEXT_STATE = CURRENT_STATE;
+	clock_gettime(CLOCK_MONOTONIC, &SIM->host_start);
+}
+
 /***************************************************************/
 /* Print out a list of commands available                                                                  */
 /***************************************************************/
@@ -22,28 +158,279 @@ void help() {
 	printf("low <val>\t-- set the LO register to <val>\n");
 	printf("print\t-- print the program loaded into memory\n");
 	printf("show\t-- print the current content of the pipeline registers\n");
+	printf("pages\t-- report resident guest memory pages\n");
+	printf("stats\t-- print the performance counters\n");
 	printf("forwarding <0-1>\t-- turn data forwarding on/off\n");
+	printf("width <1-2>\t-- issue up to this many instructions per cycle\n");
+	printf("ooo <enable|rob|rs|lsq|width> <n>\t-- run the out-of-order core instead of the pipeline, size its ROB, reservation stations, load/store queue and width\n");
+	printf("ff <n> | ff @<pc>\t-- execute <n> instructions or up to <pc> functionally, then resume the pipeline\n");
+	printf("engine <interp|threaded|dbt>\t-- select the fast-forward execution engine\n");
+	printf("bpred <none|static|bimodal|gshare|tournament>\t-- select the branch predictor\n");
+	printf("bpred <table|history|btb|ras> <n>\t-- size the predictor tables, history, BTB or return-address stack\n");
+	printf("cache <icache|dcache|l2> <enable|size|assoc|line|hit|miss> <n>\t-- configure a cache (sizes in bytes, latencies in cycles)\n");
+	printf("cache <icache|dcache|l2> policy <lru|fifo|random> | write <back|through>\t-- cache replacement and write policy\n");
+	printf("dram <enable|banks|row|queue|tcas|trcd|trp|tburst> <n>\t-- configure the DRAM behind the caches\n");
+	printf("prefetch <none|nextline|stride|stream>\t-- select the prefetcher in front of the D-cache (needs the D-cache enabled)\n");
+	printf("prefetch <degree|distance|table|streams> <n>\t-- prefetch degree and distance in lines, stride table size, stream buffers\n");
+	printf("storebuf <depth|merge> <n>\t-- store buffer in front of the D-cache (0 entries: stores wait for the D-cache)\n");
+	printf("muldiv <mul|div> <n> | <mulpipe|divpipe> <0-1>\t-- multiply/divide latency in cycles, pipelined or iterative units\n");
+	printf("cores <count|quantum|snoop> <n>\t-- simulate <n> cores sharing memory (resets the machine), cycles between their barriers, coherence latency\n");
+	printf("checkpoint save|load <file>\t-- save the simulator state to <file> or restore it\n");
+	printf("trace <file> | trace off\t-- record every retired instruction to <file>, or stop recording\n");
+	printf("replay <file> | replay off\t-- drive the pipeline from a recorded trace instead of executing (resets the machine)\n");
+	printf("profile on|off\t-- charge every cycle to the instruction responsible for it, or stop and drop the profile\n");
+	printf("profile top <n> | folded <file>\t-- list the <n> hottest PCs, or write the cycles per call stack for flamegraph tools\n");
 	printf("?\t-- display help menu\n");
 	printf("quit\t-- exit the simulator\n\n");
 	printf("------------------------------------------------------------------\n\n");
 }
 
 /***************************************************************/
-/* Read a 32-bit word from memory                                                                            */
+/* Find the memory region an address belongs to (-1 if unmapped)                  */
 /***************************************************************/
-uint32_t mem_read_32(uint32_t address)
+int mem_region_index(uint32_t address)
 {
 	int i;
 	for (i = 0; i < NUM_MEM_REGION; i++) {
 		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
-			uint32_t offset = address - MEM_REGIONS[i].begin;
-			return (MEM_REGIONS[i].mem[offset+3] << 24) |
-					(MEM_REGIONS[i].mem[offset+2] << 16) |
-					(MEM_REGIONS[i].mem[offset+1] <<  8) |
-					(MEM_REGIONS[i].mem[offset+0] <<  0);
+			return i;
 		}
 	}
-	return 0;
+	return -1;
+}
+
+/***************************************************************/
+/* Return the resident page holding an address, NULL if never touched         */
+/***************************************************************/
+mem_page_t *mem_page_lookup(uint32_t address)
+{
+	//pairs with the release in mem_page_insert, another core may be filling the table in
+	mem_page_t **l2 = __atomic_load_n(&MEM_PAGE_TABLE[address >> (32 - MEM_L1_BITS)], __ATOMIC_ACQUIRE);
+	if (l2 == NULL) {
+		return NULL;
+	}
+	return __atomic_load_n(&l2[(address >> MEM_PAGE_BITS) & (MEM_L2_ENTRIES - 1)], __ATOMIC_ACQUIRE);
+}
+
+/***************************************************************/
+/* Return the page holding an address, allocating it on first touch              */
+/* (with fresh zeroed data, or the caller's host memory if data != NULL)  */
+/***************************************************************/
+static mem_page_t *mem_page_insert(uint32_t address, uint8_t *data)
+{
+	uint32_t l1 = address >> (32 - MEM_L1_BITS);
+	uint32_t l2 = (address >> MEM_PAGE_BITS) & (MEM_L2_ENTRIES - 1);
+	mem_page_t *page;
+	int region;
+
+	mem_page_t **table;
+
+	if (MEM_PAGE_TABLE[l1] == NULL) {
+		table = calloc(MEM_L2_ENTRIES, sizeof(mem_page_t *));
+		if (table == NULL) {
+			printf("Error: out of host memory for the page table\n");
+			exit(-1);
+		}
+		//other cores look pages up without the lock, they must never see a table before it is cleared
+		__atomic_store_n(&MEM_PAGE_TABLE[l1], table, __ATOMIC_RELEASE);
+	}
+	page = MEM_PAGE_TABLE[l1][l2];
+	if (page != NULL) {
+		return page;
+	}
+
+	region = mem_region_index(address);
+	if (region < 0) {
+		return NULL;
+	}
+	page = calloc(1, sizeof(mem_page_t));
+	if (page != NULL) {
+		page->mapped = data != NULL;
+		page->data = data != NULL ? data : calloc(1, MEM_PAGE_SIZE);
+	}
+	if (page == NULL || page->data == NULL) {
+		printf("Error: out of host memory for guest page 0x%08x\n", address & ~MEM_PAGE_MASK);
+		exit(-1);
+	}
+	page->base = address & ~MEM_PAGE_MASK;
+	page->region = region;
+	//reads of this page may have been translated to the shared zero page
+	if (MEM_TLB_READ[(address >> MEM_PAGE_BITS) & (MEM_TLB_ENTRIES - 1)].tag == page->base) {
+		MEM_TLB_READ[(address >> MEM_PAGE_BITS) & (MEM_TLB_ENTRIES - 1)].tag = MEM_TLB_INVALID;
+	}
+	page->next = MEM_RESIDENT_PAGES;
+	MEM_RESIDENT_PAGES = page;
+	MEM_RESIDENT_COUNT++;
+	MEM_REGIONS[region].resident_pages++;
+	__atomic_store_n(&MEM_PAGE_TABLE[l1][l2], page, __ATOMIC_RELEASE);
+	return page;
+}
+
+static mem_page_t *mem_page_alloc(uint32_t address, uint8_t *data)
+{
+	mem_page_t *page;
+	//the other cores of a multicore machine may be touching pages at the same time
+	multicore_lock_memory();
+	page = mem_page_insert(address, data);
+	multicore_unlock_memory();
+	return page;
+}
+
+mem_page_t *mem_page_touch(uint32_t address)
+{
+	return mem_page_alloc(address, NULL);
+}
+
+/***************************************************************/
+/* Back a guest page with host memory we don't own (a page of the program  */
+/* file mapped copy-on-write), replacing whatever the page held before     */
+/***************************************************************/
+void mem_page_map(uint32_t address, uint8_t *data)
+{
+	mem_page_t *page = mem_page_lookup(address);
+	if (page == NULL) {
+		page = mem_page_alloc(address, data);
+	}else {
+		if (!page->mapped) {
+			free(page->data);
+		}
+		page->data = data;
+		page->mapped = TRUE;
+	}
+	//nothing to clear on reset, the loader maps the file again
+	page->dirty = FALSE;
+}
+
+/***************************************************************/
+/* Give a mapped page its own copy of the data (before the mapping goes)   */
+/***************************************************************/
+void mem_page_own(mem_page_t *page)
+{
+	uint8_t *data;
+	if (!page->mapped) {
+		return;
+	}
+	data = malloc(MEM_PAGE_SIZE);
+	if (data == NULL) {
+		printf("Error: out of host memory for guest page 0x%08x\n", page->base);
+		exit(-1);
+	}
+	memcpy(data, page->data, MEM_PAGE_SIZE);
+	page->data = data;
+	page->mapped = FALSE;
+}
+
+/***************************************************************/
+/* Byte accessors, used when a word straddles a page boundary                  */
+/***************************************************************/
+static uint8_t mem_read_8(uint32_t address)
+{
+	//untouched or unmapped pages read as zero without being allocated
+	mem_page_t *page = mem_page_lookup(address);
+	return page == NULL ? 0 : page->data[address & MEM_PAGE_MASK];
+}
+
+static void mem_write_8(uint32_t address, uint8_t value)
+{
+	mem_page_t *page = mem_page_touch(address);
+	if (page == NULL) {
+		return;
+	}
+	page->data[address & MEM_PAGE_MASK] = value;
+	page->dirty = TRUE;
+	if (page->region == MEM_REGION_TEXT) {
+		text_modified(address);
+	}
+}
+
+/***************************************************************/
+/* TLB refill: translate a page on a miss and install it                                    */
+/***************************************************************/
+static const uint8_t MEM_ZERO_PAGE[MEM_PAGE_SIZE];
+
+static uint32_t mem_read_32_slow(uint32_t address)
+{
+	uint32_t offset = address & MEM_PAGE_MASK;
+	mem_tlb_entry_t *entry;
+	mem_page_t *page;
+
+	if (offset > MEM_PAGE_SIZE - 4) {
+		return (mem_read_8(address+3) << 24) |
+				(mem_read_8(address+2) << 16) |
+				(mem_read_8(address+1) <<  8) |
+				(mem_read_8(address+0) <<  0);
+	}
+	page = mem_page_lookup(address);
+	//another core may write an untouched page at any time, so with several cores reads allocate it as well
+	if (page == NULL && SIM->multicore != NULL) {
+		page = mem_page_touch(address);
+	}
+	entry = &MEM_TLB_READ[(address >> MEM_PAGE_BITS) & (MEM_TLB_ENTRIES - 1)];
+	if (page != NULL) {
+		entry->tag = page->base;
+		entry->host = page->data;
+	}else if (mem_region_index(address) >= 0) {
+		//untouched pages are translated to the zero page until they are first written
+		entry->tag = address & ~MEM_PAGE_MASK;
+		entry->host = (uint8_t *)MEM_ZERO_PAGE;
+	}else {
+		return 0;
+	}
+	return mem_load_le32(entry->host + offset);
+}
+
+static void mem_write_32_slow(uint32_t address, uint32_t value)
+{
+	uint32_t offset = address & MEM_PAGE_MASK;
+	mem_tlb_entry_t *entry;
+	mem_page_t *page;
+
+	if (offset > MEM_PAGE_SIZE - 4) {
+		mem_write_8(address+3, (value >> 24) & 0xFF);
+		mem_write_8(address+2, (value >> 16) & 0xFF);
+		mem_write_8(address+1, (value >>  8) & 0xFF);
+		mem_write_8(address+0, (value >>  0) & 0xFF);
+		return;
+	}
+	page = mem_page_touch(address);
+	if (page == NULL) {
+		return;
+	}
+	page->dirty = TRUE;
+	mem_store_le32(page->data + offset, value);
+	//text pages never get a write translation so every store to them drops stale predecoded words
+	if (page->region == MEM_REGION_TEXT) {
+		text_modified(address);
+		return;
+	}
+	entry = &MEM_TLB_WRITE[(address >> MEM_PAGE_BITS) & (MEM_TLB_ENTRIES - 1)];
+	entry->tag = page->base;
+	entry->host = page->data;
+}
+
+/***************************************************************/
+/* Drop all cached translations                                                                             */
+/***************************************************************/
+void mem_tlb_flush()
+{
+	int i;
+	for (i = 0; i < MEM_TLB_ENTRIES; i++) {
+		MEM_TLB_READ[i].tag = MEM_TLB_INVALID;
+		MEM_TLB_WRITE[i].tag = MEM_TLB_INVALID;
+	}
+}
+
+/***************************************************************/
+/* Read a 32-bit word from memory                                                                            */
+/***************************************************************/
+uint32_t mem_read_32(uint32_t address)
+{
+	const mem_tlb_entry_t *entry = &MEM_TLB_READ[(address >> MEM_PAGE_BITS) & (MEM_TLB_ENTRIES - 1)];
+	//aligned word with a cached translation never leaves the page
+	if ((address & 3) == 0 && entry->tag == (address & ~MEM_PAGE_MASK)) {
+		return mem_load_le32(entry->host + (address & MEM_PAGE_MASK));
+	}
+	return mem_read_32_slow(address);
 }
 
 /***************************************************************/
@@ -51,18 +438,127 @@ uint32_t mem_read_32(uint32_t address)
 /***************************************************************/
 void mem_write_32(uint32_t address, uint32_t value)
 {
+	const mem_tlb_entry_t *entry = &MEM_TLB_WRITE[(address >> MEM_PAGE_BITS) & (MEM_TLB_ENTRIES - 1)];
+	if ((address & 3) == 0 && entry->tag == (address & ~MEM_PAGE_MASK)) {
+		mem_store_le32(entry->host + (address & MEM_PAGE_MASK), value);
+		return;
+	}
+	mem_write_32_slow(address, value);
+}
+
+/***************************************************************/
+/* Write the low size bytes of a value and leave the rest of the word alone   */
+/* (cores on other host threads may be writing the bytes next to them)      */
+/***************************************************************/
+void mem_write_sub(uint32_t address, uint32_t value, uint32_t size)
+{
+	uint32_t offset = address & MEM_PAGE_MASK;
+	mem_tlb_entry_t *entry = &MEM_TLB_WRITE[(address >> MEM_PAGE_BITS) & (MEM_TLB_ENTRIES - 1)];
+	mem_page_t *page;
+	uint8_t bytes[4];
+	uint32_t i;
+
+	mem_store_le32(bytes, value);
+	if (entry->tag == (address & ~MEM_PAGE_MASK) && offset + size <= MEM_PAGE_SIZE) {
+		memcpy(entry->host + offset, bytes, size);
+		return;
+	}
+	page = offset + size <= MEM_PAGE_SIZE ? mem_page_touch(address) : NULL;
+	if (page == NULL || page->region == MEM_REGION_TEXT) {
+		for (i = 0; i < size; i++) {
+			mem_write_8(address + i, bytes[i]);
+		}
+		return;
+	}
+	page->dirty = TRUE;
+	memcpy(page->data + offset, bytes, size);
+	entry->tag = page->base;
+	entry->host = page->data;
+}
+
+/***************************************************************/
+/* Replace the aligned word at address with value if it still holds expected, */
+/* in one step as far as the other host threads are concerned                       */
+/***************************************************************/
+int mem_cas_32(uint32_t address, uint32_t expected, uint32_t value)
+{
+	mem_page_t *page = mem_page_touch(address);
+	uint32_t old, new;
+
+	if (page == NULL) {
+		//outside the regions writes are dropped and reads give 0
+		return expected == 0;
+	}
+	//compare and swap the words in guest byte order
+	mem_store_le32((uint8_t *)&old, expected);
+	mem_store_le32((uint8_t *)&new, value);
+	if (!__atomic_compare_exchange_n((uint32_t *)(page->data + (address & MEM_PAGE_MASK)), &old, new, FALSE,
+			__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		return FALSE;
+	}
+	page->dirty = TRUE;
+	if (page->region == MEM_REGION_TEXT) {
+		text_modified(address);
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* A store hit the text segment: drop everything derived from the old words */
+/***************************************************************/
+void text_modified(uint32_t address)
+{
+	predecode_invalidate(address);
+	threaded_invalidate(address);
+	dbt_invalidate(address);
+	//the other cores drop theirs at the end of the quantum
+	multicore_text_modified();
+}
+
+/***************************************************************/
+/* Zero every page written since the last reset                                             */
+/***************************************************************/
+void mem_clear_dirty()
+{
+	mem_page_t *page;
+	int i;
+	//write translations imply a dirty page, so they have to go with the dirty bits
+	for (i = 0; i < MEM_TLB_ENTRIES; i++) {
+		MEM_TLB_WRITE[i].tag = MEM_TLB_INVALID;
+	}
+	for (page = MEM_RESIDENT_PAGES; page != NULL; page = page->next) {
+		if (page->dirty) {
+			memset(page->data, 0, MEM_PAGE_SIZE);
+			page->dirty = FALSE;
+		}
+	}
+}
+
+/***************************************************************/
+/* Report how much guest memory is backed by host pages                            */
+/***************************************************************/
+void mem_report()
+{
+	mem_page_t *page;
+	uint32_t dirty = 0;
 	int i;
-	uint32_t offset;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
-			offset = address - MEM_REGIONS[i].begin;
 
-			MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-			MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-			MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-			MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+	for (page = MEM_RESIDENT_PAGES; page != NULL; page = page->next) {
+		if (page->dirty) {
+			dirty++;
 		}
 	}
+	printf("-------------------------------------\n");
+	printf("Resident Guest Pages (%d KiB each)\n", MEM_PAGE_SIZE / 1024);
+	printf("-------------------------------------\n");
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		printf("%s\t: %u pages (%u KiB)\n", MEM_REGIONS[i].name, MEM_REGIONS[i].resident_pages,
+				MEM_REGIONS[i].resident_pages * (MEM_PAGE_SIZE / 1024));
+	}
+	printf("-------------------------------------\n");
+	printf("total\t: %u pages (%u KiB), %u dirty\n", MEM_RESIDENT_COUNT,
+			MEM_RESIDENT_COUNT * (MEM_PAGE_SIZE / 1024), dirty);
+	printf("-------------------------------------\n");
 }
 
 /***************************************************************/
@@ -72,6 +568,7 @@ void cycle() {
 	handle_pipeline();
 	CURRENT_STATE = NEXT_STATE;
 	CYCLE_COUNT++;
+	STATS.cycles++;
 }
 
 /***************************************************************/
@@ -79,16 +576,27 @@ void cycle() {
 /***************************************************************/
 void run(int num_cycles) {
 
+	//every core of a multicore machine runs that long, each on its own host thread
+	if (SIM->multicore != NULL) {
+		multicore_run(num_cycles, FALSE);
+		return;
+	}
 	if (RUN_FLAG == FALSE) {
-		printf("Simulation Stopped\n\n");
+		if (!QUIET) {
+			printf("Simulation Stopped\n\n");
+		}
 		return;
 	}
 
-	printf("Running simulator for %d cycles...\n\n", num_cycles);
+	if (!QUIET) {
+		printf("Running simulator for %d cycles...\n\n", num_cycles);
+	}
 	int i;
 	for (i = 0; i < num_cycles; i++) {
 		if (RUN_FLAG == FALSE) {
-			printf("Simulation Stopped.\n\n");
+			if (!QUIET) {
+				printf("Simulation Stopped.\n\n");
+			}
 			break;
 		}
 		cycle();
@@ -99,16 +607,33 @@ void run(int num_cycles) {
 /* simulate to completion                                                                                               */
 /***************************************************************/
 void runAll() {
+	if (SIM->multicore != NULL) {
+		multicore_run(0, TRUE);
+		return;
+	}
 	if (RUN_FLAG == FALSE) {
-		printf("Simulation Stopped.\n\n");
+		if (!QUIET) {
+			printf("Simulation Stopped.\n\n");
+		}
 		return;
 	}
 
-	printf("Simulation Started...\n\n");
+	if (!QUIET) {
+		printf("Simulation Started...\n\n");
+	}
 	while (RUN_FLAG){
+		//a batch run must not hang the nightly regression on a program that never ends
+		if (MAX_CYCLES != 0 && CYCLE_COUNT >= MAX_CYCLES) {
+			if (!QUIET) {
+				printf("Stopped at the %u cycle limit.\n\n", MAX_CYCLES);
+			}
+			return;
+		}
 		cycle();
 	}
-	printf("Simulation Finished.\n\n");
+	if (!QUIET) {
+		printf("Simulation Finished.\n\n");
+	}
 }
 
 /***************************************************************/
@@ -133,6 +658,9 @@ void mdump(uint32_t start, uint32_t stop) {
 void rdump() {
 	int i;
 	printf("-------------------------------------\n");
+	if (SIM->multicore != NULL) {
+		printf("Core %u\n", CORE_ID);
+	}
 	printf("Dumping Register Content\n");
 	printf("-------------------------------------\n");
 	printf("# Instructions Executed\t: %u\n", INSTRUCTION_COUNT);
@@ -147,22 +675,53 @@ void rdump() {
 	printf("[HI]\t: 0x%08x\n", CURRENT_STATE.HI);
 	printf("[LO]\t: 0x%08x\n", CURRENT_STATE.LO);
 	printf("-------------------------------------\n");
+	//core 0 is the one the commands work on, the others follow it
+	if (SIM->multicore != NULL && CORE_ID == 0) {
+		multicore_rdump();
+	}
+}
+
+/***************************************************************/
+/* Select the fast-forward engine by name, FALSE if there is no such engine */
+/***************************************************************/
+int set_engine(const char *name) {
+	int i;
+	for (i = 0; i < NUM_ENGINES; i++) {
+		if (strcmp(name, ENGINE_NAMES[i]) == 0) {
+			FF_ENGINE = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* ff argument: a decimal instruction count or @<hex pc>                                 */
+/***************************************************************/
+void ff_command(const char *arg) {
+	if (arg[0] == '@') {
+		fast_forward(0, strtoul(arg + 1, NULL, 16), TRUE);
+	}else {
+		fast_forward(strtoul(arg, NULL, 10), 0, FALSE);
+	}
 }
 
 /***************************************************************/
 /* Read a command from standard input.                                                               */
 /***************************************************************/
-void handle_command() {
-	char buffer[20];
+int handle_command() {
+	char buffer[20], arg[20], value[20], file[256];
 	uint32_t start, stop, cycles;
 	uint32_t register_no;
 	int register_value;
 	int hi_reg_value, lo_reg_value;
 
-	printf("MU-RISCV SIM:> ");
+	if (!BATCH_MODE) {
+		printf("MU-RISCV SIM:> ");
+	}
 
-	if (scanf("%s", buffer) == EOF){
-		exit(0);
+	if (fscanf(COMMAND_INPUT, "%19s", buffer) != 1){
+		return FALSE;
 	}
 
 	switch(buffer[0]) {
@@ -170,13 +729,31 @@ void handle_command() {
 		case 's':
 			if (buffer[1] == 'h' || buffer[1] == 'H'){
 				show_pipeline();
+			}else if ((buffer[1] == 't' || buffer[1] == 'T') && (buffer[2] == 'o' || buffer[2] == 'O')){
+				if (fscanf(COMMAND_INPUT, "%19s %u", arg, &start) != 2) {
+					break;
+				}
+				if (!storebuf_param(arg, start)) {
+					printf("Invalid store buffer setting %s %u\n", arg, start);
+				}
+			}else if (buffer[1] == 't' || buffer[1] == 'T'){
+				stats_report();
 			}else {
 				runAll();
 			}
 			break;
 		case 'M':
 		case 'm':
-			if (scanf("%x %x", &start, &stop) != 2){
+			if (buffer[1] == 'u' || buffer[1] == 'U') {
+				if (fscanf(COMMAND_INPUT, "%19s %u", arg, &start) != 2) {
+					break;
+				}
+				if (!muldiv_param(arg, start)) {
+					printf("Invalid multiply/divide setting %s %u\n", arg, start);
+				}
+				break;
+			}
+			if (fscanf(COMMAND_INPUT, "%x %x", &start, &stop) != 2){
 				break;
 			}
 			mdump(start, stop);
@@ -184,8 +761,101 @@ void handle_command() {
 		case '?':
 			help();
 			break;
+		case 'E':
+		case 'e':
+			if (fscanf(COMMAND_INPUT, "%19s", arg) != 1) {
+				break;
+			}
+			if (!set_engine(arg)) {
+				printf("Unknown engine %s\n", arg);
+				break;
+			}
+			if (!QUIET) {
+				printf("Fast-forward engine: %s\n", arg);
+			}
+			break;
+		case 'B':
+		case 'b':
+			if (fscanf(COMMAND_INPUT, "%19s", arg) != 1) {
+				break;
+			}
+			if (bpred_set(arg)) {
+				if (!QUIET) {
+					printf("Branch predictor: %s\n", arg);
+				}
+				break;
+			}
+			if (strcmp(arg, "table") != 0 && strcmp(arg, "history") != 0 && strcmp(arg, "btb") != 0 && strcmp(arg, "ras") != 0) {
+				printf("Unknown branch predictor %s\n", arg);
+				break;
+			}
+			if (fscanf(COMMAND_INPUT, "%u", &start) != 1 || !bpred_param(arg, start)) {
+				printf("Invalid branch predictor %s size\n", arg);
+			}
+			break;
+		case 'D':
+		case 'd':
+			if (fscanf(COMMAND_INPUT, "%19s %u", arg, &start) != 2) {
+				break;
+			}
+			if (!dram_param(arg, start)) {
+				printf("Invalid DRAM setting %s %u\n", arg, start);
+			}
+			break;
+		case 'C':
+		case 'c':
+			if (buffer[1] == 'a' || buffer[1] == 'A') {
+				if (fscanf(COMMAND_INPUT, "%19s %19s %255s", arg, value, file) != 3) {
+					break;
+				}
+				if (!cache_param(arg, value, file)) {
+					printf("Invalid cache setting %s %s %s\n", arg, value, file);
+				}
+				break;
+			}
+			if (buffer[1] == 'o' || buffer[1] == 'O') {
+				if (fscanf(COMMAND_INPUT, "%19s %u", arg, &start) != 2) {
+					break;
+				}
+				if (!multicore_param(arg, start)) {
+					printf("Invalid multicore setting %s %u\n", arg, start);
+				}
+				break;
+			}
+			if (fscanf(COMMAND_INPUT, "%19s %255s", arg, file) != 2) {
+				break;
+			}
+			if (strcmp(arg, "save") == 0) {
+				checkpoint_save(file);
+			}else if (strcmp(arg, "load") == 0) {
+				checkpoint_load(file);
+			}else {
+				printf("Unknown checkpoint operation %s\n", arg);
+			}
+			break;
+		case 'T':
+		case 't':
+			if (fscanf(COMMAND_INPUT, "%255s", file) != 1) {
+				break;
+			}
+			if (strcmp(file, "off") == 0) {
+				trace_stop();
+			}else {
+				trace_start(file);
+			}
+			break;
+		case '#':
+			//comment in a command script
+			fscanf(COMMAND_INPUT, "%*[^\n]");
+			break;
 		case 'Q':
 		case 'q':
+			//in batch mode quit only ends the script, the results still have to be written
+			if (BATCH_MODE) {
+				return FALSE;
+			}
+			trace_stop();
+			profile_stop();
 			printf("**************************\n");
 			printf("Exiting MU-RISCV! Good Bye...\n");
 			printf("**************************\n");
@@ -194,11 +864,21 @@ void handle_command() {
 		case 'r':
 			if (buffer[1] == 'd' || buffer[1] == 'D'){
 				rdump();
+			}else if((buffer[1] == 'e' || buffer[1] == 'E') && (buffer[2] == 'p' || buffer[2] == 'P')){
+				if (fscanf(COMMAND_INPUT, "%255s", file) != 1) {
+					break;
+				}
+				if (strcmp(file, "off") == 0) {
+					replay_stop();
+					reset();
+				}else {
+					replay_start(file);
+				}
 			}else if(buffer[1] == 'e' || buffer[1] == 'E'){
 				reset();
 			}
 			else {
-				if (scanf("%d", &cycles) != 1) {
+				if (fscanf(COMMAND_INPUT, "%d", &cycles) != 1) {
 					break;
 				}
 				run(cycles);
@@ -206,7 +886,7 @@ void handle_command() {
 			break;
 		case 'I':
 		case 'i':
-			if (scanf("%u %i", &register_no, &register_value) != 2){
+			if (fscanf(COMMAND_INPUT, "%u %i", &register_no, &register_value) != 2){
 				break;
 			}
 			CURRENT_STATE.REGS[register_no] = register_value;
@@ -214,7 +894,7 @@ void handle_command() {
 			break;
 		case 'H':
 		case 'h':
-			if (scanf("%i", &hi_reg_value) != 1){
+			if (fscanf(COMMAND_INPUT, "%i", &hi_reg_value) != 1){
 				break;
 			}
 			CURRENT_STATE.HI = hi_reg_value;
@@ -222,7 +902,7 @@ void handle_command() {
 			break;
 		case 'L':
 		case 'l':
-			if (scanf("%i", &lo_reg_value) != 1){
+			if (fscanf(COMMAND_INPUT, "%i", &lo_reg_value) != 1){
 				break;
 			}
 			CURRENT_STATE.LO = lo_reg_value;
@@ -230,19 +910,87 @@ void handle_command() {
 			break;
 		case 'P':
 		case 'p':
-			print_program();
+			if (buffer[1] == 'a' || buffer[1] == 'A'){
+				mem_report();
+			}else if (buffer[2] == 'o' || buffer[2] == 'O') {
+				if (fscanf(COMMAND_INPUT, "%19s", arg) != 1) {
+					break;
+				}
+				if (strcmp(arg, "on") == 0) {
+					profile_start(NULL);
+				}else if (strcmp(arg, "off") == 0) {
+					profile_stop();
+				}else if (strcmp(arg, "top") == 0) {
+					if (fscanf(COMMAND_INPUT, "%u", &start) == 1) {
+						profile_top(start);
+					}
+				}else if (strcmp(arg, "folded") == 0) {
+					if (fscanf(COMMAND_INPUT, "%255s", file) == 1) {
+						profile_folded(file);
+					}
+				}else {
+					printf("Unknown profile operation %s\n", arg);
+				}
+			}else if (buffer[2] == 'e' || buffer[2] == 'E') {
+				if (fscanf(COMMAND_INPUT, "%19s", arg) != 1) {
+					break;
+				}
+				if (prefetch_set(arg)) {
+					if (!QUIET) {
+						printf("Prefetcher: %s\n", arg);
+					}
+					break;
+				}
+				if (fscanf(COMMAND_INPUT, "%u", &start) != 1 || !prefetch_param(arg, start)) {
+					printf("Invalid prefetcher setting %s\n", arg);
+				}
+			}else {
+				print_program();
+			}
 			break;
-		case 'f':
+		case 'O':
+		case 'o':
+			if (fscanf(COMMAND_INPUT, "%19s %u", arg, &start) != 2) {
+				break;
+			}
+			if (!ooo_param(arg, start)) {
+				printf("Invalid out-of-order core setting %s %u\n", arg, start);
+			}
+			break;
+		case 'W':
+		case 'w':
+			if (fscanf(COMMAND_INPUT, "%u", &start) != 1) {
+				break;
+			}
+			if (!set_issue_width(start)) {
+				printf("Invalid issue width %u\n", start);
+				break;
+			}
+			if (!QUIET) {
+				printf("Issue width: %u\n", start);
+			}
+			break;
+		case 'f':
 		case 'F':
-			if(scanf("%d",&ENABLE_FORWARDING) != 1) {
+			if (buffer[1] == 'f' || buffer[1] == 'F'){
+				if (fscanf(COMMAND_INPUT, "%19s", arg) != 1) {
+					break;
+				}
+				ff_command(arg);
+				break;
+			}
+			if(fscanf(COMMAND_INPUT, "%d",&ENABLE_FORWARDING) != 1) {
 				break;
 			}
-		ENABLE_FORWARDING == 0 ? printf("Forwarding OFF\n") : printf("Forwarding ON\n");
+		if (!QUIET) {
+			ENABLE_FORWARDING == 0 ? printf("Forwarding OFF\n") : printf("Forwarding ON\n");
+		}
 		break;
 		default:
 			printf("Invalid Command.\n");
 			break;
 	}
+	return TRUE;
 }
 
 /***************************************************************/
@@ -257,30 +1005,160 @@ void reset() {
 	CURRENT_STATE.HI = 0;
 	CURRENT_STATE.LO = 0;
 
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
-	}
+	/*only pages written since the last reset need to be cleared*/
+	mem_clear_dirty();
 
 	/*load program*/
 	load_program();
 
 	/*reset PC*/
 	INSTRUCTION_COUNT = 0;
-	CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
+	stats_reset();
+	profile_clear();
+	/*a reset run starts cold, the same as the first one*/
+	bpred_release();
+	cache_release();
+	dram_release();
+	prefetch_release();
+	storebuf_release();
+	muldiv_release();
+	ooo_release();
+	//whatever a stopped run left in flight belongs to the program before the reset
+	pipeline_flush();
+	SIM->reservation = MEM_TLB_INVALID;
+	//a replay starts over where its trace does
+	CURRENT_STATE.PC = SIM->replay != NULL ? replay_restart() : PROGRAM_ENTRY;
 	NEXT_STATE = CURRENT_STATE;
 	RUN_FLAG = TRUE;
+	//the other cores start over with core 0
+	if (SIM->multicore != NULL) {
+		multicore_reset();
+	}
 }
 
 /***************************************************************/
-/* Allocate and set memory to zero                                                                            */
+/* Start with an empty page table, pages are allocated on first touch          */
 /***************************************************************/
 void init_memory() {
 	int i;
+	memset(MEM_PAGE_TABLE, 0, sizeof(MEM_PAGE_TABLE));
+	MEM_RESIDENT_PAGES = NULL;
+	MEM_RESIDENT_COUNT = 0;
 	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+		MEM_REGIONS[i].resident_pages = 0;
+	}
+	mem_tlb_flush();
+	predecode_flush();
+}
+
+/**************************************************************/
+/* ELF32 loading: the file is mapped copy-on-write and every guest page    */
+/* fully covered by file bytes points straight into that mapping. Partial  */
+/* pages at segment edges are copied, bss is left to read as zero.           */
+/**************************************************************/
+static void load_elf_error(const char *what)
+{
+	printf("Error: %s: %s\n", prog_file, what);
+	exit(-1);
+}
+
+static void load_elf_segment(const uint8_t *map, const Elf32_Phdr *ph, uint32_t *mapped, uint32_t *copied)
+{
+	uint32_t base, lo, hi, file_hi;
+	uint32_t mem_end = ph->p_vaddr + ph->p_memsz;
+	uint32_t file_end = ph->p_vaddr + ph->p_filesz;
+	mem_page_t *page;
+
+	for (base = ph->p_vaddr & ~MEM_PAGE_MASK; base < mem_end && base >= (ph->p_vaddr & ~MEM_PAGE_MASK); base += MEM_PAGE_SIZE) {
+		lo = base > ph->p_vaddr ? base : ph->p_vaddr;
+		hi = mem_end - base > MEM_PAGE_SIZE ? base + MEM_PAGE_SIZE : mem_end;
+		file_hi = file_end < hi ? file_end : hi;
+		if (file_hi < lo) {
+			file_hi = lo;
+		}
+		if (lo == base && file_hi - base == MEM_PAGE_SIZE) {
+			mem_page_map(base, (uint8_t *)map + ph->p_offset + (base - ph->p_vaddr));
+			(*mapped)++;
+			continue;
+		}
+		//untouched bss pages already read as zero
+		page = file_hi > lo ? mem_page_touch(base) : mem_page_lookup(base);
+		if (page == NULL) {
+			continue;
+		}
+		mem_page_own(page);
+		memcpy(page->data + (lo - base), map + ph->p_offset + (lo - ph->p_vaddr), file_hi - lo);
+		memset(page->data + (file_hi - base), 0, hi - file_hi);
+		page->dirty = TRUE;
+		(*copied)++;
+	}
+}
+
+static void load_elf(FILE *fp)
+{
+	struct stat st;
+	const Elf32_Ehdr *eh;
+	const Elf32_Phdr *ph;
+	uint8_t *map;
+	uint32_t text_end = MEM_TEXT_BEGIN, mapped = 0, copied = 0, segments = 0;
+	mem_page_t *page;
+	int i, region;
+
+	if (fstat(fileno(fp), &st) != 0 || (size_t)st.st_size < sizeof(Elf32_Ehdr)) {
+		load_elf_error("truncated ELF header");
+	}
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+	if (map == MAP_FAILED) {
+		load_elf_error("can't map the file");
+	}
+	eh = (const Elf32_Ehdr *)map;
+	if (eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+			eh->e_machine != EM_RISCV || eh->e_type != ET_EXEC) {
+		load_elf_error("not a little-endian RV32 executable");
+	}
+	if (eh->e_phentsize != sizeof(Elf32_Phdr) || eh->e_phoff > (size_t)st.st_size ||
+			eh->e_phnum > ((size_t)st.st_size - eh->e_phoff) / sizeof(Elf32_Phdr)) {
+		load_elf_error("bad program header table");
+	}
+	for (i = 0; i < eh->e_phnum; i++) {
+		ph = (const Elf32_Phdr *)(map + eh->e_phoff) + i;
+		if (ph->p_type != PT_LOAD || ph->p_memsz == 0) {
+			continue;
+		}
+		if (ph->p_filesz > ph->p_memsz || ph->p_offset > (size_t)st.st_size || ph->p_filesz > (size_t)st.st_size - ph->p_offset) {
+			load_elf_error("segment lies outside the file");
+		}
+		region = mem_region_index(ph->p_vaddr);
+		if (region < 0 || ph->p_memsz - 1 > MEM_REGIONS[region].end - ph->p_vaddr) {
+			printf("Error: %s: segment 0x%08x-0x%08x is outside the simulated memory regions\n",
+					prog_file, ph->p_vaddr, ph->p_vaddr + ph->p_memsz - 1);
+			exit(-1);
+		}
+		load_elf_segment(map, ph, &mapped, &copied);
+		if (region == MEM_REGION_TEXT && ph->p_vaddr + ph->p_memsz > text_end) {
+			text_end = ph->p_vaddr + ph->p_memsz;
+		}
+		segments++;
+	}
+	//pages of the previous load that were not mapped again keep their contents until reset clears them
+	if (PROGRAM_MAP != NULL) {
+		for (page = MEM_RESIDENT_PAGES; page != NULL; page = page->next) {
+			if (page->mapped && page->data >= PROGRAM_MAP && page->data < PROGRAM_MAP + PROGRAM_MAP_SIZE) {
+				mem_page_own(page);
+			}
+		}
+		munmap(PROGRAM_MAP, PROGRAM_MAP_SIZE);
+	}
+	PROGRAM_MAP = map;
+	PROGRAM_MAP_SIZE = st.st_size;
+	//page data moved under the TLB and the predecoded words
+	mem_tlb_flush();
+	predecode_flush();
+	PROGRAM_SIZE = (text_end - MEM_TEXT_BEGIN + 3) / 4;
+	PROGRAM_ENTRY = eh->e_entry;
+	if (!QUIET) {
+		printf("ELF program loaded into memory.\n%u segments, %u pages mapped from the file, %u pages copied, entry 0x%08x\n\n",
+				segments, mapped, copied, PROGRAM_ENTRY);
 	}
 }
 
@@ -291,6 +1169,7 @@ void load_program() {
 	FILE * fp;
 	int i, word;
 	uint32_t address;
+	unsigned char magic[SELFMAG];
 
 	/* Open program file. */
 	fp = fopen(prog_file, "r");
@@ -299,73 +1178,194 @@ void load_program() {
 		exit(-1);
 	}
 
-	/* Read in the program. */
-
-	i = 0;
-	while( fscanf(fp, "%x\n", &word) != EOF ) {
-		address = MEM_TEXT_BEGIN + i;
-		mem_write_32(address, word);
-		printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
-		i += 4;
+	/* ELF executables are mapped, anything else is read as hex words. */
+	if (fread(magic, 1, SELFMAG, fp) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0) {
+		load_elf(fp);
+	}else {
+		rewind(fp);
+		i = 0;
+		while( fscanf(fp, "%x\n", &word) == 1 ) {
+			address = MEM_TEXT_BEGIN + i;
+			mem_write_32(address, word);
+			if (!QUIET) {
+				printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
+			}
+			i += 4;
+		}
+		PROGRAM_SIZE = i/4;
+		PROGRAM_ENTRY = MEM_TEXT_BEGIN;
+		if (!QUIET) {
+			printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
+		}
 	}
-	PROGRAM_SIZE = i/4;
-	printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
+	//the text segment changed size, translations are rebuilt on the next fast-forward
+	threaded_flush();
+	dbt_flush();
 	fclose(fp);
 }
 
 /************************************************************/
 /* maintain the pipeline                                                                                           */
 /************************************************************/
+static int pipeline_empty()
+{
+	uint32_t i;
+	for(i = 0; i < ISSUE_WIDTH_MAX; i++) {
+		if(IF_ID_GROUP[i].IR != 0 || ID_EX_GROUP[i].IR != 0 || EX_MEM_GROUP[i].IR != 0 || MEM_WB_GROUP[i].IR != 0) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/************************************************************/
+/* Charge the cycle to an instruction for the profiler, after WB                               */
+/************************************************************/
+static void pipeline_profile(int frozen)
+{
+	const CPU_Pipeline_Reg *oldest = &MEM_WB;
+	uint32_t i;
+	//a D-cache miss is the memory access's, the only one in its group
+	if(frozen) {
+		for(i = 0; i < ISSUE_WIDTH; i++) {
+			if(MEM_WB_GROUP[i].D.cls == CLASS_LOAD || MEM_WB_GROUP[i].D.cls == CLASS_STORE) {
+				oldest = &MEM_WB_GROUP[i];
+			}
+		}
+		profile_cycle(oldest->PC, PROFILE_MEMORY);
+		return;
+	}
+	//the oldest instruction retiring, a bubble is charged to what caused it
+	if(oldest->IR != 0) {
+		profile_cycle(oldest->PC, PROFILE_BUSY);
+	}else if(oldest->blameCause != PROFILE_FILL) {
+		profile_cycle(oldest->blamePC, oldest->blameCause);
+	}else if(EX_MEM.IR != 0) {
+		profile_cycle(EX_MEM.PC, PROFILE_FILL);
+	}else if(ID_EX.IR != 0) {
+		profile_cycle(ID_EX.PC, PROFILE_FILL);
+	}else if(IF_ID.IR != 0) {
+		profile_cycle(IF_ID.PC, PROFILE_FILL);
+	}else {
+		profile_cycle(CURRENT_STATE.PC, PROFILE_FILL);
+	}
+}
+
 void handle_pipeline()
 {
 	/*INSTRUCTION_COUNT should be incremented when instruction is done*/
 
+	//the out-of-order core replaces the whole pipeline
+	if(OOO_CONFIG.enabled) {
+		ooo_cycle();
+		return;
+	}
+	//a D-cache miss holds the whole pipeline until the data is there
+	if(MEM_STALL > 0) {
+		MEM_STALL--;
+		if(SIM->profile != NULL) {
+			pipeline_profile(TRUE);
+		}
+		return;
+	}
+
 	WB();
+	if(SIM->profile != NULL) {
+		pipeline_profile(FALSE);
+	}
 	MEM();
 	EX();
 	ID();
 	IF();
 	//To stop execution when no syscalls are in the program. We assume the program has finished excution when the pipeline registers are completely flushed.
-	if(IF_ID.IR == 0 && MEM_WB.IR == 0 && ID_EX.IR == 0 && EX_MEM.IR == 0) {
-		printf("All pipeline registers empty, program execution complete!\n");
+	if(pipeline_empty() && FETCH_FILLED_PC == MEM_TLB_INVALID) {
+		if (!QUIET) {
+			printf("All pipeline registers empty, program execution complete!\n");
+		}
 		RUN_FLAG = FALSE;
 	}
 }
 
+/************************************************************/
+/* Turn a pipeline register into a nop                                                                       */
+/************************************************************/
+static void pipeline_bubble(CPU_Pipeline_Reg *reg) {
+	reg->A = 0;
+	reg->B = 0;
+	reg->ALUOutput = 0;
+	reg->PC = 0;
+	reg->imm = 0;
+	reg->IR = 0;
+	reg->RegWrite = 0;
+	reg->LMD = 0;
+	reg->predictedPC = 0;
+	reg->predictInfo = 0;
+	reg->traceSeq = 0;
+	reg->blamePC = 0;
+	reg->blameCause = PROFILE_FILL;
+	memset(&reg->D, 0, sizeof(reg->D));
+}
+
+//Every slot of an issue group, whatever the issue width.
+static void pipeline_bubble_group(CPU_Pipeline_Reg *group) {
+	uint32_t i;
+	for(i = 0; i < ISSUE_WIDTH_MAX; i++) {
+		pipeline_bubble(&group[i]);
+	}
+}
+
+//Bubbles for a stall, the profiler charges the cycle they take to the instruction at pc.
+static void pipeline_stall_group(CPU_Pipeline_Reg *group, uint32_t pc, uint32_t cause) {
+	pipeline_bubble_group(group);
+	group[0].blamePC = pc;
+	group[0].blameCause = cause;
+}
+
 /************************************************************/
 /* writeback (WB) pipeline stage:                                                                          */
 /************************************************************/
 
-void WB(){
-	if(MEM_WB.RegWrite == FALSE) {
-		//increment instruction count
+//A bubble is not an instruction, only real ones count as committed.
+static void WB_commit(const CPU_Pipeline_Reg *mem_wb, uint32_t slot){
+	if(mem_wb->IR != 0) {
+		if(SIM->trace != NULL) {
+			trace_retire(mem_wb->PC, &mem_wb->D, mem_wb->D.cls == CLASS_LOAD ? mem_wb->LMD : mem_wb->ALUOutput,
+					mem_wb->ALUOutput, mem_wb->D.cls == CLASS_STORE ? mem_wb->B : mem_wb->LMD);
+		}
 		INSTRUCTION_COUNT++;
+		STATS.committed++;
+		STATS.class_committed[mem_wb->D.cls]++;
+		STATS.issue.slot_committed[slot]++;
+		if(SIM->profile != NULL) {
+			profile_retire(mem_wb->PC, &mem_wb->D);
+		}
+	}
+}
+
+static void WB_slot(const CPU_Pipeline_Reg *mem_wb, uint32_t slot){
+	if(mem_wb->RegWrite == FALSE) {
+		WB_commit(mem_wb, slot);
 		return;
 	}
-	//extract current instruction from pipeline reg.
-	uint32_t instruction = MEM_WB.IR;
-	uint32_t opcode = instruction & 127;
-	uint32_t rd = (instruction & 4095) >> 7;
-	if(instruction){
-		switch(opcode){
-			case(3): //load
-				//write back result to both current and next, as the results might be used earlier in the pipeline as well
-				NEXT_STATE.REGS[rd] = MEM_WB.LMD;
-				CURRENT_STATE.REGS[rd] = MEM_WB.LMD;
-				break;
-			case(19): //register-immediate
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				CURRENT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				break;
-			case(51): //register-register
-			case(103): //jal, jalr
-			case(111):
-				NEXT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				CURRENT_STATE.REGS[rd] = MEM_WB.ALUOutput;
-				break;
-		}
-		//increment instruction count
-		INSTRUCTION_COUNT++;
+	//RegWrite comes from the decoded record, so the destination is known to be a real register
+	const decoded_inst_t *d = &mem_wb->D;
+	//write back result to both current and next, as the results might be used earlier in the pipeline as well
+	if(d->cls == CLASS_LOAD) {
+		NEXT_STATE.REGS[d->rd] = mem_wb->LMD;
+		CURRENT_STATE.REGS[d->rd] = mem_wb->LMD;
+	}
+	else {
+		NEXT_STATE.REGS[d->rd] = mem_wb->ALUOutput;
+		CURRENT_STATE.REGS[d->rd] = mem_wb->ALUOutput;
+	}
+	WB_commit(mem_wb, slot);
+}
+
+void WB(){
+	uint32_t i;
+	//oldest first, so the younger of two writes to one register wins
+	for(i = 0; i < ISSUE_WIDTH; i++) {
+		WB_slot(&MEM_WB_GROUP[i], i);
 	}
 }
 
@@ -373,509 +1373,715 @@ void WB(){
 /* memory access (MEM) pipeline stage:                                                          */
 /************************************************************/
 
-void MEM_load(uint32_t instruction){
-	uint32_t funct3 = (instruction & 28672) >> 12;
-	//need to pull out funct3 so we know if it is a lb, lh, or lw
-	switch(funct3){
-		case(0): //lb - 8 bits
-			//read from memory based on address calculated, only pull out first byte.
-			MEM_WB.LMD = mem_read_32(MEM_WB.ALUOutput) & 255;
-			break;
+//Load semantics shared by the MEM stage and the functional interpreter.
+uint32_t MEM_load(const decoded_inst_t *d, uint32_t address){
+	//mem_read_32 handles any alignment, so sub-word loads just take the low bytes of the word
+	return MEM_extend(d, mem_read_32(address));
+}
 
-		case(1): //lh - 16 bits
-			MEM_WB.LMD = mem_read_32(MEM_WB.ALUOutput) & 65535;
-			break;
+//The loaded value from the word starting at its address (also what the out-of-order core forwards).
+uint32_t MEM_extend(const decoded_inst_t *d, uint32_t word){
+	switch(d->op){
+		case OP_LB: //lb - 8 bits, sign extended
+			return (int32_t)(int8_t)(word & 255);
 
-		case(2): //lw - 32 bits
-			MEM_WB.LMD = mem_read_32(MEM_WB.ALUOutput);
-			break;
-		
-		case(4): //lbu - 8 bits
-			MEM_WB.LMD = mem_read_32(MEM_WB.ALUOutput) & 255;
-			break;
+		case OP_LH: //lh - 16 bits, sign extended
+			return (int32_t)(int16_t)(word & 65535);
 
-		case(5): //lhu - 16 bits
-			MEM_WB.LMD = mem_read_32(MEM_WB.ALUOutput) & 65535;
-			break;
+		case OP_LBU: //lbu - 8 bits
+			return word & 255;
+
+		case OP_LHU: //lhu - 16 bits
+			return word & 65535;
+
+		default: //lw - 32 bits
+			return word;
 	}
 }
 
-void MEM_store(uint32_t instruction){
-	uint32_t funct3 = (instruction & 28672) >> 12;
+//Bytes a load or store touches.
+uint32_t MEM_access_size(const decoded_inst_t *d){
+	switch(d->op){
+		case OP_LB:
+		case OP_LBU:
+		case OP_SB:
+			return 1;
+		case OP_LH:
+		case OP_LHU:
+		case OP_SH:
+			return 2;
+		default:
+			return 4;
+	}
+}
 
-	switch(funct3){
-		case(0): //sb - 8 bits
-			//write data stored in Temp B into the address calculated .
-			mem_write_32(EX_MEM.ALUOutput, EX_MEM.B & 255);
+void MEM_store(const decoded_inst_t *d, uint32_t address, uint32_t value){
+	switch(d->op){
+		case OP_SB: //sb - 8 bits
+			//only the byte is written, so the neighbouring bytes are left alone (also by other cores).
+			mem_write_sub(address, value, 1);
 			break;
-		case(1): //sh - 16 bits
-			mem_write_32(EX_MEM.ALUOutput, EX_MEM.B & 65535);
+		case OP_SH: //sh - 16 bits
+			mem_write_sub(address, value, 2);
 			break;
-		case(2): //sw - 32 bits
-			mem_write_32(EX_MEM.ALUOutput, EX_MEM.B);
+		case OP_SW: //sw - 32 bits
+			mem_write_32(address, value);
 			break;
-		
+
 	}
 }
 
-void MEM(){
-	uint32_t instruction = EX_MEM.IR;
-	uint32_t opcode = instruction & 127;
+//What an AMO writes back given the old word and rs2.
+static uint32_t MEM_amo_result(const decoded_inst_t *d, uint32_t old, uint32_t value){
+	switch(d->op){
+		case OP_AMOADD_W:
+			return old + value;
+		case OP_AMOXOR_W:
+			return old ^ value;
+		case OP_AMOAND_W:
+			return old & value;
+		case OP_AMOOR_W:
+			return old | value;
+		case OP_AMOMIN_W:
+			return (int32_t)old < (int32_t)value ? old : value;
+		case OP_AMOMAX_W:
+			return (int32_t)old > (int32_t)value ? old : value;
+		case OP_AMOMINU_W:
+			return old < value ? old : value;
+		case OP_AMOMAXU_W:
+			return old > value ? old : value;
+		default: //amoswap
+			return value;
+	}
+}
+
+//LR/SC and the AMOs, returns what goes to rd. The read-modify-write is a compare-and-swap on the host word,
+//so the cores on other host threads never see one half done.
+uint32_t MEM_atomic(const decoded_inst_t *d, uint32_t address, uint32_t value){
+	uint32_t old;
+
+	STATS.coherence.atomics++;
+	if(address & 3) {
+		//a misaligned atomic traps, without traps the program ends the way it does on an invalid instruction
+		printf("Misaligned atomic access at 0x%08x\n", address);
+		RUN_FLAG = FALSE;
+		return 0;
+	}
+	switch(d->op){
+		case OP_LR_W:
+			old = mem_read_32(address);
+			SIM->reservation = address;
+			SIM->reservation_value = old;
+			return old;
+		case OP_SC_W:
+			//the word must still hold what LR read (a store of the same value in between goes unnoticed)
+			old = SIM->reservation == address && mem_cas_32(address, SIM->reservation_value, value) ? 0 : 1;
+			SIM->reservation = MEM_TLB_INVALID;
+			STATS.coherence.sc_failures += old;
+			return old;
+	}
+	do {
+		old = mem_read_32(address);
+	} while(!mem_cas_32(address, old, MEM_amo_result(d, old, value)));
+	return old;
+}
+
+//A replayed load or atomic takes its data from the trace, memory is left alone.
+static void MEM_replay(const CPU_Pipeline_Reg *ex_mem, CPU_Pipeline_Reg *mem_wb){
+	const trace_record_t *r = replay_record(ex_mem->traceSeq);
+	if(ex_mem->D.cls != CLASS_LOAD) {
+		return;
+	}
+	mem_wb->LMD = r->data;
+	if(op_is_atomic(ex_mem->D.op)) {
+		STATS.coherence.atomics++;
+		STATS.coherence.sc_failures += ex_mem->D.op == OP_SC_W && r->data != 0;
+	}
+}
+
+static void MEM_slot(const CPU_Pipeline_Reg *ex_mem, CPU_Pipeline_Reg *mem_wb){
 	//Update pipeline regs.
-	MEM_WB.PC = EX_MEM.PC;
-	MEM_WB.RegWrite = EX_MEM.RegWrite;
-	MEM_WB.IR = EX_MEM.IR;
-	MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-	MEM_WB.B = EX_MEM.B;
-	switch(opcode){
-		case(3): //load
-			MEM_load(instruction);
+	mem_wb->PC = ex_mem->PC;
+	mem_wb->RegWrite = ex_mem->RegWrite;
+	mem_wb->IR = ex_mem->IR;
+	mem_wb->D = ex_mem->D;
+	mem_wb->ALUOutput = ex_mem->ALUOutput;
+	mem_wb->B = ex_mem->B;
+	mem_wb->traceSeq = ex_mem->traceSeq;
+	mem_wb->blamePC = ex_mem->blamePC;
+	mem_wb->blameCause = ex_mem->blameCause;
+	if(ex_mem->traceSeq != 0) {
+		MEM_replay(ex_mem, mem_wb);
+	}
+	else switch(ex_mem->D.cls){
+		case CLASS_LOAD:
+			if(op_is_atomic(ex_mem->D.op)) {
+				mem_wb->LMD = MEM_atomic(&ex_mem->D, ex_mem->ALUOutput, ex_mem->B);
+				break;
+			}
+			mem_wb->LMD = MEM_load(&ex_mem->D, ex_mem->ALUOutput);
 			break;
-		case(35): //store
-			MEM_store(instruction);
+		case CLASS_STORE:
+			MEM_store(&ex_mem->D, ex_mem->ALUOutput, ex_mem->B);
 			break;
 	}
+	//an atomic needs its line the way a store does
+	int write = ex_mem->D.cls == CLASS_STORE || op_is_atomic(ex_mem->D.op);
+	if(DCACHE_CONFIG.enabled && (ex_mem->D.cls == CLASS_LOAD || ex_mem->D.cls == CLASS_STORE)) {
+		if (STOREBUF_CONFIG.depth == 0) {
+			MEM_STALL = cache_data(ex_mem->PC, ex_mem->ALUOutput, write);
+		}else if (write) {
+			MEM_STALL = storebuf_store(ex_mem->ALUOutput, MEM_access_size(&ex_mem->D));
+		}else {
+			MEM_STALL = storebuf_load(ex_mem->PC, ex_mem->ALUOutput, MEM_access_size(&ex_mem->D));
+		}
+	}
+}
+
+//An issue group holds at most one memory access, so only one slot can stall for the D-cache.
+void MEM(){
+	uint32_t i;
+	for(i = 0; i < ISSUE_WIDTH; i++) {
+		MEM_slot(&EX_MEM_GROUP[i], &MEM_WB_GROUP[i]);
+	}
 }
 
 /************************************************************/
 /* execution (EX) pipeline stage:                                                                          */
 /************************************************************/
 
-//Processing any R instructions in execution stage.
-void EX_R_Processing(uint32_t instruction) {
-	uint32_t funct3 = (instruction & 28672) >> 12;
-	uint32_t funct7 = (instruction & 4261412864) >> 25;
-	switch(funct3){
-		case 0:
-			switch(funct7){
-				case 0:		//add
-				//for each operation, store in ALU Output pipeline reg. and do the given operation.
-					EX_MEM.ALUOutput = ID_EX.A + ID_EX.B;
-					break;
-				case 32:	//sub
-					EX_MEM.ALUOutput = ID_EX.A - ID_EX.B;
-					break;
-				default:
-					RUN_FLAG = FALSE;
-					break;
-				}	
-			break;
-		case 6: 			//or
-			EX_MEM.ALUOutput = ID_EX.A | ID_EX.B;
-			break;
-		case 7:				//and
-			EX_MEM.ALUOutput = ID_EX.A & ID_EX.B;
-			break;
-		case 4:		//xor
-			EX_MEM.ALUOutput = ID_EX.A ^ ID_EX.B;
-			break;
-		case 1: //sll
-			EX_MEM.ALUOutput = ID_EX.A << ID_EX.B;
-			break;
-		case 5: 
-			switch(funct7) {
-				case 0: //srl
-					EX_MEM.ALUOutput = ID_EX.A >> ID_EX.B;
-					break;
-				case 32: //sra
-					EX_MEM.ALUOutput = ID_EX.A >> ID_EX.B;
-					break;
+//Processing any R instructions in execution stage. The ALU helpers only compute values so the functional interpreter can share them.
+uint32_t EX_R_Processing(const decoded_inst_t *d, uint32_t a, uint32_t b) {
+	//shift amounts only use the low 5 bits of rs2
+	uint32_t shamt = b & 31;
+	switch(d->op){
+		case OP_ADD:		//add
+			return a + b;
+		case OP_SUB:		//sub
+			return a - b;
+		case OP_OR: 			//or
+			return a | b;
+		case OP_AND:				//and
+			return a & b;
+		case OP_XOR:		//xor
+			return a ^ b;
+		case OP_SLL: //sll
+			return a << shamt;
+		case OP_SRL: //srl
+			return a >> shamt;
+		case OP_SRA: //sra
+			return (uint32_t)((int32_t)a >> shamt);
+		//M extension: the high halves come from the 64-bit product
+		case OP_MUL: //mul
+			return a * b;
+		case OP_MULH: //mulh
+			return (uint32_t)(((int64_t)(int32_t)a * (int64_t)(int32_t)b) >> 32);
+		case OP_MULHSU: //mulhsu
+			return (uint32_t)(((int64_t)(int32_t)a * (int64_t)b) >> 32);
+		case OP_MULHU: //mulhu
+			return (uint32_t)(((uint64_t)a * (uint64_t)b) >> 32);
+		//division by zero and the one signed overflow do not trap, they give the results the ISA defines
+		case OP_DIV: //div
+			if(b == 0) {
+				return 0xFFFFFFFF;
 			}
-			break;
+			if(a == 0x80000000 && b == 0xFFFFFFFF) {
+				return a;
+			}
+			return (uint32_t)((int32_t)a / (int32_t)b);
+		case OP_DIVU: //divu
+			return b == 0 ? 0xFFFFFFFF : a / b;
+		case OP_REM: //rem
+			if(b == 0) {
+				return a;
+			}
+			if(a == 0x80000000 && b == 0xFFFFFFFF) {
+				return 0;
+			}
+			return (uint32_t)((int32_t)a % (int32_t)b);
+		case OP_REMU: //remu
+			return b == 0 ? a : a % b;
 		default:
 			RUN_FLAG = FALSE;
-			break;
+			return 0;
 	}
 }
-void EX_Branch_Processing(uint32_t instruction) {
-	uint32_t funct3 = (instruction & 28672) >> 12;
-	//need to recombine imm
-	uint32_t imm4_1and11 = (instruction & 3968) >> 7;
-	uint32_t imm12and10_5 = (instruction & 4261412864) >> 25;
-	uint32_t bit11 = (imm4_1and11 & 1) << 11;
-	uint32_t bits4_1 = imm4_1and11 & 30;
-	uint32_t bit12 = (imm12and10_5 & 64) << 6;
-	uint32_t bits10_5 = (imm12and10_5 & 63) << 5;
-	int32_t immediate = bit11 | bits4_1 | bit12 | bits10_5;
-	//if true, number is negative, so fill bits 13-31 with 1s
-	if((immediate & 4096) >> 12 == 1) {
-		immediate |= 4294959104;
-	}
-	switch(funct3) {
-		case 0: //beq
-			if(ID_EX.A == ID_EX.B){
-				//if these are the same, then jump will be done. Update the following cycle's PC with the new old PC + the data in immediate
-				IF_ID.jumpDetected = TRUE;
-				NEXT_STATE.PC = ID_EX.PC + immediate;
-			}
-			//Since we need to stall the following 2 instructions in every case for just 1 cycle, this will always be set to one, if the branch is taken or not
-			IF_ID.jumpStallCount = 1;
-		break;
-		case 1: //bne
-		//The following instructions are identical to beq besides the condition for comparing A & B
-			if(ID_EX.A != ID_EX.B){
-				IF_ID.jumpDetected = TRUE;
-				NEXT_STATE.PC = ID_EX.PC + immediate;
-			}
-			IF_ID.jumpStallCount = 1;
-		break;
-		case 4: //blt
-			if(ID_EX.A < ID_EX.B){
-				IF_ID.jumpDetected = TRUE;
-				NEXT_STATE.PC = ID_EX.PC + immediate;
-
-			}
-			IF_ID.jumpStallCount = 1;
-		break;
-		case 5: //bge
-			if(ID_EX.A >= ID_EX.B){
-				IF_ID.jumpDetected = TRUE;
-				NEXT_STATE.PC = ID_EX.PC + immediate;
-			}
-			IF_ID.jumpStallCount = 1;
-		break;
-		case 6: //bltu
-			if(ID_EX.A < ID_EX.B){
-				IF_ID.jumpDetected = TRUE;
-				NEXT_STATE.PC = ID_EX.PC + immediate;
-			}
-			IF_ID.jumpStallCount = 1;
-		break;
-		case 7: //bgtu
-			if(ID_EX.A >= ID_EX.B){
-				IF_ID.jumpDetected = TRUE;
-				NEXT_STATE.PC = ID_EX.PC + immediate;
-			}
-			IF_ID.jumpStallCount = 1;
-		break;
+//Returns TRUE when the branch is taken.
+uint32_t EX_Branch_Processing(const decoded_inst_t *d, uint32_t a, uint32_t b) {
+	switch(d->op) {
+		case OP_BEQ: //beq
+			return a == b;
+		case OP_BNE: //bne
+			return a != b;
+		case OP_BLT: //blt
+			return (int32_t)a < (int32_t)b;
+		case OP_BGE: //bge
+			return (int32_t)a >= (int32_t)b;
+		case OP_BLTU: //bltu
+			return a < b;
+		case OP_BGEU: //bgeu
+			return a >= b;
 		default:
 			printf("Invalid instruction");
 			RUN_FLAG = FALSE;
-		break;
+			return FALSE;
 	}
 }
-void EX_Iimm_Processing(uint32_t instruction) {
-	uint32_t funct3 = (instruction & 28672) >> 12;
-	uint32_t imm5_11 = (instruction & 0xFE000000) >> 25;
-	switch (funct3)
+uint32_t EX_Iimm_Processing(const decoded_inst_t *d, uint32_t a) {
+	//the immediate of the shifts is the shift amount, the funct7 bits were stripped off in decode
+	uint32_t imm = d->imm;
+	switch (d->op)
 	{
-	case 0: //addi
+	case OP_ADDI: //addi
 		//Combine reg. A with Imm when processing I-Imm.
-		EX_MEM.ALUOutput = ID_EX.A + ID_EX.imm;
-		break;
+		return a + imm;
 
-	case 4: //xori
-		EX_MEM.ALUOutput = ID_EX.A ^ ID_EX.imm;
-		break;
+	case OP_XORI: //xori
+		return a ^ imm;
 
-	case 6: //ori
-		EX_MEM.ALUOutput = ID_EX.A | ID_EX.imm;
-		break;
+	case OP_ORI: //ori
+		return a | imm;
 
-	case 7: //andi
-		EX_MEM.ALUOutput = ID_EX.A & ID_EX.imm;
-		break;
+	case OP_ANDI: //andi
+		return a & imm;
 
-	case 1: //slli
-		EX_MEM.ALUOutput = ID_EX.A << ID_EX.imm;
-		break;
+	case OP_SLLI: //slli
+		return a << imm;
 
-	case 5: //srli and srai
-		switch (imm5_11)
-		{
-		case 0: //srli
-			EX_MEM.ALUOutput = ID_EX.A >> ID_EX.imm;
-			break;
+	case OP_SRLI: //srli
+		return a >> imm;
 
-		case 32: //srai
-			EX_MEM.ALUOutput = ID_EX.A >> ID_EX.imm;
-			break;
+	case OP_SRAI: //srai
+		return (uint32_t)((int32_t)a >> imm);
+
+	default:
+		printf("Invalid instruction");
+		RUN_FLAG = FALSE;
+		return 0;
+	}
+}
 
+//Fetch starts over behind a redirected jump or branch, so a replay goes back to the record after it.
+static void EX_redirect_replay(const CPU_Pipeline_Reg *id_ex) {
+	if(id_ex->traceSeq != 0) {
+		replay_rewind(id_ex->traceSeq + 1);
+	}
+}
+
+//Redirect fetch for the jump or branch in id_ex when IF did not already go to where it really goes.
+static void EX_resolve(const CPU_Pipeline_Reg *id_ex, int taken, uint32_t target) {
+	const decoded_inst_t *d = &id_ex->D;
+	uint32_t actual = taken ? target : id_ex->PC + 4;
+	if(BPRED_CONFIG.scheme == BPRED_NONE) {
+		//no prediction: a taken one flushes, and we need to stall the following instruction for 1 cycle whether it is taken or not
+		if(taken) {
+			IF_ID.jumpDetected = TRUE;
+			NEXT_STATE.PC = target;
+			EX_redirect_replay(id_ex);
+		}
+		IF_ID.jumpStallCount = 1;
+		IF_ID.jumpPC = id_ex->PC;
+		STATS.control_events++;
+		STATS.control_cls = d->cls;
+		return;
+	}
+	bpred_update(id_ex->PC, d, id_ex->predictInfo, taken, actual);
+	STATS.bp_resolved++;
+	if(actual != id_ex->predictedPC) {
+		//mispredicted: squash what was fetched after it, the same way an unpredicted jump flushes
+		bpred_recover(id_ex->predictInfo);
+		IF_ID.jumpDetected = TRUE;
+		IF_ID.jumpStallCount = 1;
+		IF_ID.jumpPC = id_ex->PC;
+		NEXT_STATE.PC = actual;
+		EX_redirect_replay(id_ex);
+		STATS.bp_mispredicts++;
+		STATS.control_events++;
+		STATS.control_cls = d->cls;
+	}
+}
+
+//A replayed instruction takes its results, address and where it went from the trace instead of computing them.
+static void EX_replay(const CPU_Pipeline_Reg *id_ex, CPU_Pipeline_Reg *ex_mem)
+{
+	const decoded_inst_t *d = &id_ex->D;
+	const trace_record_t *r = replay_record(id_ex->traceSeq);
+	uint32_t next;
+	//only the last record of a trace does not know, its operands are all there is
+	int known = replay_next_pc(id_ex->traceSeq, &next);
+	switch(d->cls) {
+		case CLASS_LOAD:
+		case CLASS_STORE:
+			ex_mem->ALUOutput = r->address;
+			ex_mem->B = r->data;
+			break;
+		case CLASS_JUMP:
+			ex_mem->ALUOutput = id_ex->PC + 4;
+			if(d->op == OP_JAL) {
+				EX_resolve(id_ex, TRUE, id_ex->PC + id_ex->imm);
+			}
+			else {
+				EX_resolve(id_ex, TRUE, known ? next : (id_ex->A + id_ex->imm) & ~1u);
+			}
+			break;
+		case CLASS_BRANCH:
+			//a branch to the next word gets there taken or not, which way it went is in the operands
+			if(known && d->imm != 4) {
+				EX_resolve(id_ex, next != id_ex->PC + 4, id_ex->PC + id_ex->imm);
+			}
+			else {
+				EX_resolve(id_ex, EX_Branch_Processing(d, id_ex->A, id_ex->B), id_ex->PC + id_ex->imm);
+			}
+			break;
 		default:
-			RUN_FLAG = FALSE;
+			ex_mem->ALUOutput = r->value;
 			break;
+	}
+}
+
+static void EX_slot(const CPU_Pipeline_Reg *id_ex, CPU_Pipeline_Reg *ex_mem)
+{
+	//Set appropriate registers
+	const decoded_inst_t *d = &id_ex->D;
+	ex_mem->PC = id_ex->PC;
+	ex_mem->IR = id_ex->IR;
+	ex_mem->D = id_ex->D;
+	ex_mem->RegWrite = id_ex->RegWrite;
+	ex_mem->traceSeq = id_ex->traceSeq;
+	ex_mem->blamePC = id_ex->blamePC;
+	ex_mem->blameCause = id_ex->blameCause;
+	//the units only keep time, a replayed instruction takes as long as an executed one
+	if(op_is_muldiv(d->op) || (SIM->muldiv != NULL && d->writes_rd)) {
+		muldiv_execute(d);
+	}
+	if(id_ex->traceSeq != 0) {
+		EX_replay(id_ex, ex_mem);
+		return;
+	}
+	//wrong paths never get this far, so a replay that has one here ran out of trace before the program ended
+	if(SIM->replay != NULL && id_ex->IR != 0) {
+		if(!QUIET) {
+			printf("Replay of %s is over\n", replay_file());
 		}
-		break;
-	default:
-		printf("Invalid instruction");
+		pipeline_bubble(ex_mem);
 		RUN_FLAG = FALSE;
-		break;
+		return;
+	}
+	switch(d->cls) {
+		//Memory reference, so calculate address jump and store in ALU output
+		case CLASS_LOAD:
+		case CLASS_STORE:
+			ex_mem->ALUOutput = id_ex->A + id_ex->imm;
+			ex_mem->B = id_ex->B;
+			break;
+		case CLASS_JUMP:
+			//Store old PC+4 in the WB register so program can return if needed
+			ex_mem->ALUOutput = id_ex->PC + 4;
+			if(d->op == OP_JAL) {
+				//jal: PC += imm
+				EX_resolve(id_ex, TRUE, id_ex->PC + id_ex->imm);
+			}
+			else {
+				//jalr: pc = rs1 + imm with the lowest bit cleared
+				EX_resolve(id_ex, TRUE, (id_ex->A + id_ex->imm) & ~1u);
+			}
+			break;
+		//register-immediate, so go to functions above.
+		case CLASS_ALU_IMM:
+			ex_mem->ALUOutput = EX_Iimm_Processing(d, id_ex->A);
+			break;
+		//register-register or branch
+		case CLASS_ALU:
+			ex_mem->ALUOutput = EX_R_Processing(d, id_ex->A, id_ex->B);
+			break;
+		case CLASS_BRANCH:
+			//if the condition holds the branch goes to its PC + the immediate
+			EX_resolve(id_ex, EX_Branch_Processing(d, id_ex->A, id_ex->B), id_ex->PC + id_ex->imm);
+			break;
 	}
 }
 
+//A jump or branch always ends its issue group, so resolving it never squashes a slot of the same group.
 void EX()
 {
+	uint32_t i, held = EX_STALL;
+	EX_STALL = FALSE;
 	//flushing previous instruction
 	if(IF_ID.jumpDetected == TRUE) {
 		//stall detected!
-		EX_MEM.A = 0;
-		EX_MEM.B = 0;
-		EX_MEM.ALUOutput = 0;
-		EX_MEM.PC = 0;
-		EX_MEM.imm = 0;
-		EX_MEM.IR = 0;
-		EX_MEM.RegWrite = 0;
-		EX_MEM.LMD = 0;
+		pipeline_stall_group(EX_MEM_GROUP, IF_ID.jumpPC, PROFILE_CONTROL);
 		return;
 	}
-	//Set appropriate registers
-	uint32_t instruction = ID_EX.IR;
-	EX_MEM.PC = ID_EX.PC;
-	EX_MEM.IR = ID_EX.IR;
-	EX_MEM.RegWrite = ID_EX.RegWrite;
-	uint32_t opcode = instruction & 127;
-	//Memory reference, so calculate address jump and store in ALU output
-	if(opcode == 3 || opcode == 35) {
-		EX_MEM.ALUOutput = ID_EX.A + ID_EX.imm;
-		EX_MEM.B = ID_EX.B;
-	}
-	//jal
-	else if(opcode == 111) {
-		//Store old PC+4 in the WB register so program can return if needed
-		EX_MEM.ALUOutput = ID_EX.PC + 4;
-		//update PC += imm, flush previous instruction.
-		NEXT_STATE.PC = ID_EX.PC + ID_EX.imm;
-		//since this is a jump, the jump will always occur, so we tell the later instructions that a jump was detected so they know to stall/not proceed.
-		IF_ID.jumpStallCount = 1;
-		IF_ID.jumpDetected = TRUE;
-	}
-	//jalr
-	else if(opcode == 103) {
-		//store old PC+4 to rd
-		EX_MEM.ALUOutput = ID_EX.PC + 4;
-		//update pc = rs1 + imm, so program can get
-		NEXT_STATE.PC = ID_EX.A + ID_EX.imm;
-		IF_ID.jumpStallCount = 1;
-		IF_ID.jumpDetected = TRUE;
-	}
-	//register-immediate, so go to functions above.
-	else if(opcode == 19) {
-		EX_Iimm_Processing(instruction);
-	}
-	//register-register or branch
-	else if(opcode == 51) {
-		EX_R_Processing(instruction);
+	//a multiply or divide whose unit is still busy keeps the group in ID_EX and the stages before it where they are
+	for(i = 0; i < ISSUE_WIDTH; i++) {
+		if(op_is_muldiv(ID_EX_GROUP[i].D.op) && muldiv_busy(&ID_EX_GROUP[i].D) > 0) {
+			pipeline_stall_group(EX_MEM_GROUP, ID_EX_GROUP[i].PC, PROFILE_UNIT);
+			STATS.structural_stall_cycles++;
+			if(!held) {
+				STATS.structural_stalls++;
+			}
+			EX_STALL = TRUE;
+			return;
+		}
 	}
-	else if(opcode == 99) {
-		EX_Branch_Processing(instruction);
+	for(i = 0; i < ISSUE_WIDTH; i++) {
+		EX_slot(&ID_EX_GROUP[i], &EX_MEM_GROUP[i]);
 	}
 }
 
 /************************************************************/
 /* instruction decode (ID) pipeline stage:                                                         */
 /************************************************************/
-void detect_hazard(uint32_t rs, uint32_t rt) {
-	//figure out destination register for the two stages where a hazard could be
-	uint32_t EX_MEM_RD = (EX_MEM.IR  & 4095) >> 7;
-	uint32_t MEM_WB_RD = (MEM_WB.IR  & 4095) >> 7;
-	if(MEM_WB.RegWrite && EX_MEM_RD != 0 && (EX_MEM_RD == rs)) {
+
+//Stalls only ever get longer, a later check must not shorten one requested earlier in the same cycle.
+static void request_stall(uint32_t count) {
+	if(IF_ID.StallCount < count) {
+		IF_ID.StallCount = count;
+	}
+}
+
+//The youngest instruction of an issue group that writes reg, NULL if none does. writes_rd is never set for x0.
+static const CPU_Pipeline_Reg *group_writer(const CPU_Pipeline_Reg *group, uint32_t reg) {
+	uint32_t i;
+	for(i = ISSUE_WIDTH; i-- > 0; ) {
+		if(group[i].D.writes_rd && group[i].D.rd == reg) {
+			return &group[i];
+		}
+	}
+	return NULL;
+}
+
+static uint32_t longer_stall(uint32_t stall, uint32_t count) {
+	return stall > count ? stall : count;
+}
+
+//Forward what the instruction going into id_ex needs, returns the stall it asks for instead (0 if none).
+uint32_t detect_hazard(CPU_Pipeline_Reg *id_ex, uint32_t rs, uint32_t rt) {
+	//figure out which instruction in the two stages where a hazard could be writes each source register.
+	const CPU_Pipeline_Reg *ex_mem_rs = group_writer(EX_MEM_GROUP, rs);
+	const CPU_Pipeline_Reg *ex_mem_rt = group_writer(EX_MEM_GROUP, rt);
+	const CPU_Pipeline_Reg *mem_wb_rs = group_writer(MEM_WB_GROUP, rs);
+	const CPU_Pipeline_Reg *mem_wb_rt = group_writer(MEM_WB_GROUP, rt);
+	uint32_t stall = 0;
+	if(ex_mem_rs != NULL && rs != 0) {
 		//hazard forwardA = 10
-		if(ENABLE_FORWARDING == TRUE) {
+		if(ENABLE_FORWARDING == TRUE && ex_mem_rs->D.cls == CLASS_LOAD) {
+			//a load only has its data after MEM, so wait one cycle and pick it up from MEM_WB.LMD.
+			stall = longer_stall(stall, 1);
+		}
+		else if(ENABLE_FORWARDING == TRUE) {
 			//If we are forwarding, we directly get the ouput from that pipeline register and set it to our ID_EX pipeline reg.
-			ID_EX.A = EX_MEM.ALUOutput;
+			id_ex->A = ex_mem_rs->ALUOutput;
 		}
 		else {
 			//Otherwise, since this insturction that is a hazard is in the EX_MEM stage, we need to do two nops (which since this is decremented later before a nop is done, is set to 3 to start.).
-			IF_ID.StallCount = 3;
+			stall = longer_stall(stall, 3);
 		}
 	}
 	//Taking into account if we use an immediate instruction, which passes 0 into rt, so we don't want to check for a hazard if the register is not in use.
 	if(rt != 0) {
-		if(MEM_WB.RegWrite && EX_MEM_RD != 0 && (EX_MEM_RD == rt)) {
+		if(ex_mem_rt != NULL) {
 			//hazard forwardB = 10
-			if(ENABLE_FORWARDING == TRUE) {
-				ID_EX.B = EX_MEM.ALUOutput;
+			if(ENABLE_FORWARDING == TRUE && ex_mem_rt->D.cls == CLASS_LOAD) {
+				stall = longer_stall(stall, 1);
+			}
+			else if(ENABLE_FORWARDING == TRUE) {
+				id_ex->B = ex_mem_rt->ALUOutput;
 			}
 			else {
-				IF_ID.StallCount = 3;
+				stall = longer_stall(stall, 3);
 			}
 		}
 	}
-	uint32_t instopcode = EX_MEM.IR & 127;
 	//Catching double hazards with this if statement
-	if(MEM_WB.RegWrite && MEM_WB_RD != 0 && !(EX_MEM.RegWrite && (EX_MEM_RD != 0) && (EX_MEM_RD == rs)) && (MEM_WB_RD == rs)) {
+	if(rs != 0 && ex_mem_rs == NULL && mem_wb_rs != NULL) {
 		//hazard forwarda = 01
 		if(ENABLE_FORWARDING == TRUE) {
-			if(instopcode == 3) {
-				//If the instruction opcode is for a load, the thing that needs to be forwarded is in LMD, not ALU output, so we take that result
-				ID_EX.A = MEM_WB.LMD;
+			if(mem_wb_rs->D.cls == CLASS_LOAD) {
+				//If the instruction is a load, the thing that needs to be forwarded is in LMD, not ALU output, so we take that result
+				id_ex->A = mem_wb_rs->LMD;
 			}
 			else {
-				ID_EX.A = MEM_WB.ALUOutput;
+				id_ex->A = mem_wb_rs->ALUOutput;
 			}
 		}
 		else {
 			//Since this hazard occurs in the MEM_WB phase, we only need one nop to continue (set to one more since this is decremented immediately later)
-			IF_ID.StallCount = 2;
+			stall = longer_stall(stall, 2);
 		}
 	}
 	if(rt != 0) {
-		if(MEM_WB.RegWrite && MEM_WB_RD != 0 && !(EX_MEM.RegWrite && (EX_MEM_RD != 0) && (EX_MEM_RD == rt)) && (MEM_WB_RD == rt)) {
+		if(ex_mem_rt == NULL && mem_wb_rt != NULL) {
 			//hazard forwardB = 01
 			if(ENABLE_FORWARDING == TRUE) {
-				if(instopcode == 3) {
-					ID_EX.B = MEM_WB.LMD;
+				if(mem_wb_rt->D.cls == CLASS_LOAD) {
+					id_ex->B = mem_wb_rt->LMD;
 				}
 				else {
-					ID_EX.B = MEM_WB.ALUOutput;
+					id_ex->B = mem_wb_rt->ALUOutput;
 				}
 			}
 			else {
-				IF_ID.StallCount = 2;
+				stall = longer_stall(stall, 2);
 			}
 		}
 	}
+	request_stall(stall);
+	return stall;
+}
+
+static uint32_t ID_slot(const CPU_Pipeline_Reg *if_id, CPU_Pipeline_Reg *id_ex)
+{
+	//The fields were pulled out of the instruction once when it was predecoded, so all formats are handled the same way.
+	const decoded_inst_t *d = &if_id->D;
+	uint32_t stall;
+	//Update next stage pipeline reg.
+	id_ex->IR = if_id->IR;
+	id_ex->PC = if_id->PC;
+	id_ex->D = if_id->D;
+	id_ex->A = CURRENT_STATE.REGS[d->rs1];
+	id_ex->B = CURRENT_STATE.REGS[d->rs2];
+	id_ex->imm = d->imm;
+	id_ex->RegWrite = d->writes_rd;
+	id_ex->predictedPC = if_id->predictedPC;
+	id_ex->predictInfo = if_id->predictInfo;
+	id_ex->traceSeq = if_id->traceSeq;
+	id_ex->blamePC = if_id->blamePC;
+	id_ex->blameCause = if_id->blameCause;
+	//look for hazards based on rs1 and rs2 reg numbers, formats without rs2 have it set to 0
+	if(d->cls == CLASS_NONE) {
+		return 0;
+	}
+	stall = detect_hazard(id_ex, d->rs1, d->rs2);
+	//a result still in a multiply/divide unit cannot be forwarded yet
+	if(SIM->muldiv != NULL) {
+		stall = longer_stall(stall, muldiv_wait(d));
+		request_stall(stall);
+	}
+	return stall;
 }
+
 void ID()
-{	
+{
+	uint32_t i, cls = NUM_CLASSES, pc = IF_ID.PC;
+	//EX did not take what is in ID_EX, so there is no room for the next group
+	if(EX_STALL) {
+		return;
+	}
 	//This covers stalls/flushes. If either conditions are true, this stage will be skipped/stalled & a nop will be simulated
 	if(IF_ID.jumpStallCount > 0 || IF_ID.jumpDetected == TRUE) {
-		ID_EX.A = 0;
-		ID_EX.B = 0;
-		ID_EX.ALUOutput = 0;
-		ID_EX.PC = 0;
-		ID_EX.imm = 0;
-		ID_EX.IR = 0;
-		ID_EX.RegWrite = 0;
-		ID_EX.LMD = 0;
+		pipeline_stall_group(ID_EX_GROUP, IF_ID.jumpPC, PROFILE_CONTROL);
+		STATS.control_stall_cycles++;
+		STATS.class_control_stall_cycles[STATS.control_cls]++;
 		return;
 	}
-	uint32_t instruction = IF_ID.IR;
-	//Update next stage pipeline reg.
-	ID_EX.IR = IF_ID.IR;
-	ID_EX.PC = IF_ID.PC;
-	uint32_t rs1 = 0;
-	uint32_t rs2 = 0;
-	uint32_t imm = 0;
-	uint32_t imm2 = 0;
-	//127 in base-10 is = 1111111 in base 2, which will allow us to extract the opcode from the instruction
-	uint32_t opcode = instruction & 127;
-	switch(opcode) {
-		//R-type instructions
-		case(51):
-		//Pull out rs1 & rs2, update pipeline regs w/ it.
-			rs1 = (instruction & 1015808) >> 15;
-			rs2 = (instruction & 32505856) >> 20;
-			//detect hazard here
-			ID_EX.A = CURRENT_STATE.REGS[rs1];
-			ID_EX.B = CURRENT_STATE.REGS[rs2];
-			ID_EX.RegWrite = TRUE;
-			//look for hazards based on rs1 and rs2 reg numbers
-			detect_hazard(rs1,rs2);
-			break;
-		//I-type Instructions
-		case(19):
-			rs1 = (instruction & 1015808) >> 15;
-			imm = (instruction & 4293918720) >> 20;
-			//If this bit is a 1, it is a negative number, so we extend the sign bit all the way over.
-			if((imm & 4096) == 4096) {
-				imm |= 0xFFFFE000;
-			}
-			ID_EX.A = CURRENT_STATE.REGS[rs1];
-			ID_EX.imm = imm;
-			ID_EX.RegWrite = TRUE;
-			//Since we have no rs2, we pass a 0 in to let the function know that this is the case.
-			detect_hazard(rs1,0);
-			break;
-		//I-type load instructions
-		case(3):
-			rs1 = (instruction & 1015808) >> 15;
-			imm = (instruction & 4293918720) >> 20;
-			//If this bit is a 1, it is a negative number, so we extend the sign bit all the way over.
-			if((imm & 4096) == 4096) {
-				imm |= 0xFFFFE000;
-			}
-			ID_EX.A = CURRENT_STATE.REGS[rs1];
-			ID_EX.imm = imm;
-			ID_EX.RegWrite = TRUE;
-			detect_hazard(rs1,0);
-			break;
-		//S-type instructions
-		case(35):
-			imm2 = (instruction & 3968) >> 7;
-			rs1 = (instruction & 1015808) >> 15;
-			rs2 = (instruction & 32505856) >> 20;
-			imm = (instruction & 4261412864) >> 25;
-			// Recombine immediate
-			uint32_t combinedimm = (imm << 5) + imm2;
-			//If this bit is a 1, it is a negative number, so we extend the sign bit all the way over.
-			if((combinedimm & 4096) == 4096) {
-				combinedimm |= 0xFFFFE000;
-			}
-			ID_EX.A = CURRENT_STATE.REGS[rs1];
-			ID_EX.B = CURRENT_STATE.REGS[rs2];
-			ID_EX.imm = combinedimm;
-			ID_EX.RegWrite = TRUE;
-			detect_hazard(rs1,rs2);
-			break;
-		//b-type
-		case(99):{
-			rs1 = (instruction & 1015808) >> 15;
-			rs2 = (instruction & 32505856) >> 20;
-			int32_t imm11 = (instruction & 128) >> 7;
-			int32_t imm4_1 = (instruction & 3840) >> 7;
-			int32_t imm10_5 = (instruction & 2113929216) >> 25;
-			int32_t imm12 = (instruction & 2147483648) >> 31;
-			//recombined immediate
-			imm = (imm12 << 12) | (imm11 << 11) | (imm10_5 << 5) | (imm4_1); //13 bits long
-			if(imm12 == 1){
-				imm = 0xFFFFE000 | imm;
-			}
-			ID_EX.RegWrite = FALSE;
-			ID_EX.imm = imm;
-			ID_EX.A = CURRENT_STATE.REGS[rs1];
-			ID_EX.B = CURRENT_STATE.REGS[rs2];
-			detect_hazard(rs1,rs2);
-			break;
+	//a stall carried over from an earlier cycle is not a new one
+	uint32_t stalled = IF_ID.StallCount > 0;
+	//the group moves on or stalls as a whole, a stall is charged to the oldest instruction that asks for one
+	for(i = 0; i < ISSUE_WIDTH; i++) {
+		if(ID_slot(&IF_ID_GROUP[i], &ID_EX_GROUP[i]) > 0 && cls == NUM_CLASSES) {
+			cls = IF_ID_GROUP[i].D.cls;
+			pc = IF_ID_GROUP[i].PC;
 		}
-		//j-type
-		case(111):
-			uint32_t fullimm = (instruction & 0xFFFFF000) >> 12;
-			uint32_t bit20 = (fullimm & 0x80000);
-			uint32_t bit10_1 = (fullimm & 0x7FE00) >> 9;
-			uint32_t bit11 = (fullimm & 0x100) << 4;
-			uint32_t bit19_12 = (fullimm & 0xFF) << 12;
-			ID_EX.imm = bit20 | bit10_1 | bit11 | bit19_12;
-			if((ID_EX.imm & 0x80000) == 0x80000) {
-				ID_EX.imm |= 0xFFF00000;
-			}
-			ID_EX.RegWrite = TRUE;
-			break;
-		//jalr
-		case(103):
-			rs1 = (instruction & 1015808) >> 15;
-			imm = (instruction & 4293918720) >> 20;
-			//If this bit is a 1, it is a negative number, so we extend the sign bit all the way over.
-			if((imm & 4096) == 4096) {
-				imm |= 0xFFFFE000;
-			}
-			ID_EX.A = CURRENT_STATE.REGS[rs1];
-			ID_EX.imm = imm;
-			ID_EX.RegWrite = TRUE;
-			//Since we have no rs2, we pass a 0 in to let the function know that this is the case.
-			detect_hazard(rs1,0);
-			break;
-		default:
-			break;
+	}
+	if(cls == NUM_CLASSES) {
+		cls = IF_ID.D.cls;
 	}
 	//If a stall is detected, then we need to forward 0 control signals to the ID_EX pipeline reg. to simulate a nop
 	if(IF_ID.StallCount > 0) {
-		ID_EX.A = 0;
-		ID_EX.B = 0;
-		ID_EX.ALUOutput = 0;
-		ID_EX.PC = 0;
-		ID_EX.imm = 0;
-		ID_EX.IR = 0;
-		ID_EX.RegWrite = 0;
-		ID_EX.LMD = 0;
+		pipeline_stall_group(ID_EX_GROUP, pc, PROFILE_DATA);
+		STATS.data_stall_cycles++;
+		STATS.class_data_stall_cycles[cls]++;
+		if(!stalled) {
+			STATS.data_stalls++;
+		}
 	}
 }
 
 /************************************************************/
 /* instruction fetch (IF) pipeline stage:                                                              */
 /************************************************************/
+
+//Why the instruction d at pc cannot go into the issue group after first, -1 if it can.
+static int IF_pair_split(const CPU_Pipeline_Reg *first, const decoded_inst_t *d, uint32_t pc) {
+	const decoded_inst_t *f = &first->D;
+	if(f->cls == CLASS_BRANCH || f->cls == CLASS_JUMP) {
+		return PAIR_CONTROL;
+	}
+	if(f->cls == CLASS_SYSTEM || f->cls == CLASS_NONE || d->cls == CLASS_SYSTEM || d->cls == CLASS_NONE) {
+		return PAIR_SYSTEM;
+	}
+	if((f->cls == CLASS_LOAD || f->cls == CLASS_STORE) && (d->cls == CLASS_LOAD || d->cls == CLASS_STORE)) {
+		return PAIR_MEMORY;
+	}
+	if(f->writes_rd && (d->rs1 == f->rd || d->rs2 == f->rd)) {
+		return PAIR_DEPENDENCE;
+	}
+	//each unit starts at most one operation a cycle
+	if(op_is_muldiv(f->op) && op_is_muldiv(d->op) && (f->op >= OP_DIV) == (d->op >= OP_DIV)) {
+		return PAIR_MULDIV;
+	}
+	//one I-cache access delivers the whole group
+	if(ICACHE_CONFIG.enabled && (pc & ~(ICACHE_CONFIG.line - 1)) != (first->PC & ~(ICACHE_CONFIG.line - 1))) {
+		return PAIR_LINE;
+	}
+	return -1;
+}
+
+//The instruction at pc. A replay has the recorded one when pc is where the trace goes next (seq is then
+//its record), memory's is only fetched down a wrong path or past the end of the trace.
+static const decoded_inst_t *IF_word(uint32_t pc, decoded_inst_t *replayed, uint32_t *seq) {
+	const decoded_inst_t *d = predecode(pc);
+	uint32_t raw;
+	*seq = 0;
+	if(SIM->replay == NULL || !replay_fetch(pc, &raw, seq) || raw == d->raw) {
+		return d;
+	}
+	decode_instruction(raw, replayed);
+	return replayed;
+}
+
+//Fill the second slot with the next instruction when the pairing rules allow it.
+static void IF_pair() {
+	CPU_Pipeline_Reg *second = &IF_ID_GROUP[1];
+	uint32_t pc = IF_ID.PC + 4, seq;
+	decoded_inst_t replayed;
+	const decoded_inst_t *d;
+	int split;
+
+	pipeline_bubble(second);
+	if(IF_ID.IR == 0) {
+		return;
+	}
+	STATS.issue.groups++;
+	d = IF_word(pc, &replayed, &seq);
+	split = IF_pair_split(&IF_ID, d, pc);
+	if(split >= 0) {
+		STATS.issue.split[split]++;
+		return;
+	}
+	if(seq != 0) {
+		replay_take(seq);
+	}
+	second->IR = d->raw;
+	second->D = *d;
+	second->PC = pc;
+	second->traceSeq = seq;
+	//a jump or branch may end the group, the predictor then says where the next one starts
+	NEXT_STATE.PC = bpred_predict(pc, d, &second->predictInfo);
+	second->predictedPC = NEXT_STATE.PC;
+	STATS.issue.dual++;
+}
+
 void IF()
 {
+	//ID has not moved on, so neither can IF. An I-cache miss is served in the meantime.
+	if(EX_STALL) {
+		if(FETCH_STALL > 0) {
+			FETCH_STALL--;
+		}
+		return;
+	}
 	//catching stalls for jump related instructions in similar way as hazard stalls
 	if(IF_ID.jumpStallCount > 0) {
 		IF_ID.jumpStallCount--;
@@ -890,307 +2096,477 @@ void IF()
 		IF_ID.StallCount--;
 		return;
 	}
-	uint32_t instruction;
-	//Read in instruction based on PC
-	instruction = mem_read_32(CURRENT_STATE.PC);
-	IF_ID.IR = instruction;
+	//An I-cache miss leaves IF_ID empty until the line is there, then the fetch goes ahead without a second lookup
+	if(ICACHE_CONFIG.enabled) {
+		if(FETCH_STALL > 0) {
+			FETCH_STALL--;
+			pipeline_stall_group(IF_ID_GROUP, CURRENT_STATE.PC, PROFILE_FETCH);
+			return;
+		}
+		if(FETCH_FILLED_PC != CURRENT_STATE.PC) {
+			FETCH_STALL = cache_fetch(CURRENT_STATE.PC);
+			if(FETCH_STALL > 0) {
+				FETCH_STALL--;
+				FETCH_FILLED_PC = CURRENT_STATE.PC;
+				pipeline_stall_group(IF_ID_GROUP, CURRENT_STATE.PC, PROFILE_FETCH);
+				return;
+			}
+		}
+		FETCH_FILLED_PC = MEM_TLB_INVALID;
+	}
+	//Read in instruction based on PC, already decoded if it was fetched before
+	decoded_inst_t replayed;
+	uint32_t seq;
+	const decoded_inst_t *d = IF_word(CURRENT_STATE.PC, &replayed, &seq);
+	if(seq != 0) {
+		replay_take(seq);
+	}
+	IF_ID.IR = d->raw;
+	IF_ID.D = *d;
 	IF_ID.PC = CURRENT_STATE.PC;
-	NEXT_STATE.PC += 4; 
+	IF_ID.traceSeq = seq;
+	IF_ID.blamePC = 0;
+	IF_ID.blameCause = PROFILE_FILL;
+	//without a predictor this is always the next word
+	NEXT_STATE.PC = bpred_predict(CURRENT_STATE.PC, d, &IF_ID.predictInfo);
+	IF_ID.predictedPC = NEXT_STATE.PC;
+	if(ISSUE_WIDTH > 1) {
+		IF_pair();
+	}
 }
 
 /************************************************************/
-/* Initialize Memory                                                                                                    */
+/* Empty the pipeline without finishing anything in it                                               */
 /************************************************************/
-void initialize() {
-	init_memory();
-	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
+void pipeline_flush() {
+	pipeline_bubble_group(IF_ID_GROUP);
+	pipeline_bubble_group(ID_EX_GROUP);
+	pipeline_bubble_group(EX_MEM_GROUP);
+	pipeline_bubble_group(MEM_WB_GROUP);
+	IF_ID.StallCount = 0;
+	IF_ID.jumpStallCount = 0;
+	IF_ID.jumpDetected = FALSE;
+	FETCH_STALL = 0;
+	FETCH_FILLED_PC = MEM_TLB_INVALID;
+	MEM_STALL = 0;
+	EX_STALL = FALSE;
+}
+
+/************************************************************/
+/* Retire what is past EX, squash the rest and empty the pipeline                          */
+/************************************************************/
+void pipeline_drain() {
+	uint32_t resume, seq = 0;
+	//the out-of-order core keeps CURRENT_STATE.PC at its oldest uncommitted instruction, so it only has to let go
+	ooo_release();
+	//the oldest instruction that has not executed yet is where execution picks up again
+	if(IF_ID.jumpDetected == TRUE) {
+		//the jump in EX_MEM already redirected the PC, whatever was fetched after it is on the wrong path
+		resume = CURRENT_STATE.PC;
+	}
+	else if(ID_EX.IR != 0) {
+		resume = ID_EX.PC;
+		seq = ID_EX.traceSeq;
+	}
+	else if(IF_ID.IR != 0) {
+		resume = IF_ID.PC;
+		seq = IF_ID.traceSeq;
+	}
+	else {
+		resume = CURRENT_STATE.PC;
+	}
+	//a replay fetches the squashed ones again
+	if(seq != 0) {
+		replay_rewind(seq);
+	}
+	//MEM_WB and EX_MEM have done their work in EX, so finish them the same way the pipeline would
+	WB();
+	MEM();
+	WB();
+	pipeline_flush();
+	CURRENT_STATE.PC = resume;
 	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
 }
 
 /************************************************************/
-/* Print the program loaded into memory (in RISCV assembly format)    */
+/* Issue up to width instructions per cycle, the pipeline is drained first                       */
 /************************************************************/
-void print_program(){
-	//implementation taken from lab 1.
-	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
-	NEXT_STATE.PC = MEM_TEXT_BEGIN + 4;
-	
-	uint32_t addressMemory;
-	int i = 0;
-	while(RUN_FLAG == TRUE){
-		addressMemory = CURRENT_STATE.PC;
-		
-		print_instruction(addressMemory);
-		
-		NEXT_STATE.PC += 4;
-		i++;
+int set_issue_width(uint32_t width) {
+	if(width < 1 || width > ISSUE_WIDTH_MAX) {
+		return FALSE;
+	}
+	if(width != ISSUE_WIDTH) {
+		pipeline_drain();
+		ISSUE_WIDTH = width;
 	}
+	return TRUE;
 }
 
-void R_Print(uint32_t rd, uint32_t f3, uint32_t rs1, uint32_t rs2, uint32_t f7) {
-	switch(f3){
-		case 0:
-			switch(f7){
-				case 0:		//add
-					printf("add x%d, x%d, x%d\n\n", rd, rs1, rs2);
-					break;
-				case 32:	//sub
-					printf("sub x%d, x%d, x%d\n\n", rd, rs1, rs2);
-					break;
-				default:
-					RUN_FLAG = FALSE;
-					break;
-				}	
-			break;
-		case 6: 			//or
-			printf("or x%d, x%d, x%d\n\n", rd, rs1, rs2);
+/************************************************************/
+/* Execute the instruction at PC in one go (functional mode)                                       */
+/************************************************************/
+int func_step() {
+	const decoded_inst_t *d = predecode(CURRENT_STATE.PC);
+	uint32_t a = CURRENT_STATE.REGS[d->rs1];
+	uint32_t b = CURRENT_STATE.REGS[d->rs2];
+	uint32_t next = CURRENT_STATE.PC + 4;
+	uint32_t result = 0;
+
+	switch(d->cls) {
+		case CLASS_NONE:
+			//an empty word is where the pipeline would have drained, anything else is skipped like a nop
+			if(d->raw == 0) {
+				return FALSE;
+			}
 			break;
-		case 7:				//and
-			printf("and x%d, x%d, x%d\n\n", rd, rs1, rs2);
+		case CLASS_ALU:
+			result = EX_R_Processing(d, a, b);
 			break;
-		default:
-			RUN_FLAG = FALSE;
+		case CLASS_ALU_IMM:
+			result = EX_Iimm_Processing(d, a);
 			break;
-	}
-
-}
-
-void S_Print(uint32_t imm11, uint32_t f3, uint32_t rs1, uint32_t rs2, uint32_t imm4){
-	uint32_t imm = (imm4<< 5) + imm11;
-
-	switch (f3)
-		{
-		case 0: //sb
-			printf("sb x%d, %d(x%d)\n\n", rs2, imm, rs1);
+		case CLASS_LOAD:
+			result = op_is_atomic(d->op) ? MEM_atomic(d, a, b) : MEM_load(d, a + d->imm);
 			break;
-		
-		case 1: //sh		
-			printf("sh x%d, %d(x%d)\n\n", rs2, imm, rs1);
+		case CLASS_STORE:
+			MEM_store(d, a + d->imm, b);
 			break;
-
-		case 2: //sw
-			printf("sw x%d, %d(x%d)\n\n", rs2, imm, rs1);
+		case CLASS_BRANCH:
+			if(EX_Branch_Processing(d, a, b)) {
+				next = CURRENT_STATE.PC + d->imm;
+			}
 			break;
-
-		default:
-			RUN_FLAG = FALSE;
+		case CLASS_JUMP:
+			result = CURRENT_STATE.PC + 4;
+			next = d->op == OP_JAL ? CURRENT_STATE.PC + d->imm : (a + d->imm) & ~1u;
 			break;
 	}
-	
-
+	if(d->writes_rd) {
+		CURRENT_STATE.REGS[d->rd] = result;
+	}
+	if(SIM->trace != NULL) {
+		trace_retire(CURRENT_STATE.PC, d, result, op_is_atomic(d->op) ? a : a + d->imm, d->cls == CLASS_STORE ? b : result);
+	}
+	CURRENT_STATE.PC = next;
+	INSTRUCTION_COUNT++;
+	return RUN_FLAG;
 }
 
-void I_Print(uint32_t imm, uint32_t f3, uint32_t rs1, uint32_t rd){
-	switch (f3)
-	{
-	case 0: //lb
-		printf("lb x%d, %d(x%d)\n\n", rd, imm, rs1);
-		break;
-
-	case 1: //lh
-		printf("lh x%d, %d(x%d)\n\n", rd, imm, rs1);
-		
-		break;
+/************************************************************/
+/* Fast-forward functionally for n instructions or up to a PC                                          */
+/************************************************************/
+void fast_forward(uint32_t count, uint32_t stop_pc, int to_pc) {
+	uint32_t executed = 0;
 
-	case 2: //lw
-		printf("lw x%d, %d(x%d)\n\n", rd, imm, rs1);
-		break;
-	
-	default:
-		printf("Invalid instruction");
-		RUN_FLAG = FALSE;
-		break;
+	//a replay has no functional state to run on
+	if (SIM->replay != NULL) {
+		printf("Error: Can't fast-forward a replay\n");
+		return;
+	}
+	if (RUN_FLAG == FALSE) {
+		if (!QUIET) {
+			printf("Simulation Stopped\n\n");
+		}
+		return;
+	}
+	pipeline_drain();
+	//the translating engines don't stop per instruction, a trace is recorded by the interpreter
+	if(FF_ENGINE == ENGINE_THREADED && SIM->trace == NULL) {
+		executed = threaded_run(count, stop_pc, to_pc);
+	}
+	else if(FF_ENGINE == ENGINE_DBT && SIM->trace == NULL) {
+		executed = dbt_run(count, stop_pc, to_pc);
+	}
+	else {
+		while(to_pc ? CURRENT_STATE.PC != stop_pc : executed < count) {
+			if(!func_step()) {
+				RUN_FLAG = FALSE;
+				break;
+			}
+			executed++;
+		}
+	}
+	//the pipeline starts out empty from the architectural state we reached
+	NEXT_STATE = CURRENT_STATE;
+	if(!QUIET) {
+		printf("Fast-forwarded %u instructions, PC = 0x%08x\n\n", executed, CURRENT_STATE.PC);
+		if(RUN_FLAG == FALSE) {
+			printf("Program execution complete!\n");
+		}
 	}
 }
 
-void Iimm_Print(uint32_t rd, uint32_t f3, uint32_t rs1, uint32_t imm){
-	uint32_t imm0_4 = (imm << 7) >> 7;
-	uint32_t imm5_11 = imm >> 5;
-	switch (f3)
-	{
-	case 0: //addi
-		printf("addi x%d, x%d, %d\n\n", rd, rs1, imm);
-		break;
+/************************************************************/
+/* Initialize Memory                                                                                                    */
+/************************************************************/
+void initialize() {
+	init_memory();
+	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
+	NEXT_STATE = CURRENT_STATE;
+	RUN_FLAG = TRUE;
+}
 
-	case 4: //xori
-		printf("xori x%d, x%d, %d\n\n", rd, rs1, imm);
-		break;
-	
-	case 6: //ori
-		printf("ori x%d, x%d, %d\n\n", rd, rs1, imm);
-		break;
-	
-	case 7: //andi
-		printf("andi x%d, x%d, %d\n\n", rd, rs1, imm);
-		break;
-	
-	case 1: //slli
-		printf("slli x%d, x%d, %d\n\n", rd, rs1, imm0_4); 
-		break;
-	
-	case 5: //srli and srai
-		switch (imm5_11)
-		{
-		case 0: //srli
-			printf("srli x%d, x%d, %d\n\n", rd, rs1, imm0_4); 
+/************************************************************/
+/* Decode one instruction word into a decoded record                                             */
+/************************************************************/
+void decode_instruction(uint32_t instruction, decoded_inst_t *d) {
+	uint32_t opcode = instruction & 0x7F;
+	uint32_t rd = (instruction & 0xF80) >> 7;
+	uint32_t funct3 = (instruction & 0x7000) >> 12;
+	uint32_t rs1 = (instruction & 0xF8000) >> 15;
+	uint32_t rs2 = (instruction & 0x1F00000) >> 20;
+	uint32_t funct7 = (instruction & 0xFE000000) >> 25;
+	//I-type immediate is bits 31:20, the arithmetic shift sign extends it
+	int32_t imm_i = (int32_t)instruction >> 20;
+
+	memset(d, 0, sizeof(*d));
+	d->raw = instruction;
+	switch(opcode) {
+		case 51: { //R-type
+			static const uint8_t r_ops[8] = { OP_ADD, OP_SLL, OP_INVALID, OP_INVALID, OP_XOR, OP_SRL, OP_OR, OP_AND };
+			if(funct7 == 0) {
+				d->op = r_ops[funct3];
+			}
+			else if(funct7 == 32 && funct3 == 0) {
+				d->op = OP_SUB;
+			}
+			else if(funct7 == 32 && funct3 == 5) {
+				d->op = OP_SRA;
+			}
+			else if(funct7 == 1) {
+				//M extension, funct3 picks the operation in the order of op_t
+				d->op = OP_MUL + funct3;
+			}
+			d->cls = CLASS_ALU;
+			d->rd = rd;
+			d->rs1 = rs1;
+			d->rs2 = rs2;
 			break;
-
-		case 32: //srai
-			printf("srai x%d, x%d, %d\n\n", rd, rs1, imm0_4); 
+		}
+		case 19: { //I-type
+			static const uint8_t i_ops[8] = { OP_ADDI, OP_SLLI, OP_INVALID, OP_INVALID, OP_XORI, OP_SRLI, OP_ORI, OP_ANDI };
+			d->op = i_ops[funct3];
+			d->imm = imm_i;
+			if(funct3 == 1 || funct3 == 5) {
+				//shifts keep the shift amount in the immediate and funct7 above it
+				d->imm = rs2;
+				if(funct3 == 5 && funct7 == 32) {
+					d->op = OP_SRAI;
+				}
+				else if(funct7 != 0) {
+					d->op = OP_INVALID;
+				}
+			}
+			d->cls = CLASS_ALU_IMM;
+			d->rd = rd;
+			d->rs1 = rs1;
 			break;
-		
-		default:
-			RUN_FLAG = FALSE;
+		}
+		case 3: { //I-type load
+			static const uint8_t l_ops[8] = { OP_LB, OP_LH, OP_LW, OP_INVALID, OP_LBU, OP_LHU, OP_INVALID, OP_INVALID };
+			d->op = l_ops[funct3];
+			d->cls = CLASS_LOAD;
+			d->rd = rd;
+			d->rs1 = rs1;
+			d->imm = imm_i;
 			break;
 		}
-		break;
-	
-	case 2:
-		break;
+		case 35: { //S-type
+			static const uint8_t s_ops[8] = { OP_SB, OP_SH, OP_SW, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID, OP_INVALID };
+			d->op = s_ops[funct3];
+			d->cls = CLASS_STORE;
+			d->rs1 = rs1;
+			d->rs2 = rs2;
+			//recombine imm[11:5] and imm[4:0]
+			d->imm = (((int32_t)instruction >> 25) << 5) | rd;
+			break;
+		}
+		case 99: { //B-type
+			static const uint8_t b_ops[8] = { OP_BEQ, OP_BNE, OP_INVALID, OP_INVALID, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU };
+			d->op = b_ops[funct3];
+			d->cls = CLASS_BRANCH;
+			d->rs1 = rs1;
+			d->rs2 = rs2;
+			//recombine imm[12|10:5] and imm[4:1|11]
+			d->imm = (int32_t)(((instruction >> 31) ? 0xFFFFF000u : 0) | ((instruction & 0x80) << 4) |
+					((instruction & 0x7E000000) >> 20) | ((instruction & 0xF00) >> 7));
+			break;
+		}
+		case 111: //jal
+			d->op = OP_JAL;
+			d->cls = CLASS_JUMP;
+			d->rd = rd;
+			//recombine imm[20|10:1|11|19:12]
+			d->imm = (int32_t)(((instruction >> 31) ? 0xFFF00000u : 0) | (instruction & 0xFF000) |
+					((instruction & 0x100000) >> 9) | ((instruction & 0x7FE00000) >> 20));
+			break;
+		case 103: //jalr
+			d->op = funct3 == 0 ? OP_JALR : OP_INVALID;
+			d->cls = CLASS_JUMP;
+			d->rd = rd;
+			d->rs1 = rs1;
+			d->imm = imm_i;
+			break;
+		case 115: //ecall
+			d->op = OP_ECALL;
+			d->cls = CLASS_SYSTEM;
+			break;
+		case 47: { //A extension, funct5 picks the operation and the aq/rl bits below it do not matter here
+			static const uint8_t a_ops[32] = {
+				[0] = OP_AMOADD_W, [1] = OP_AMOSWAP_W, [2] = OP_LR_W, [3] = OP_SC_W, [4] = OP_AMOXOR_W,
+				[8] = OP_AMOOR_W, [12] = OP_AMOAND_W, [16] = OP_AMOMIN_W, [20] = OP_AMOMAX_W,
+				[24] = OP_AMOMINU_W, [28] = OP_AMOMAXU_W,
+			};
+			d->op = funct3 == 2 ? a_ops[funct7 >> 2] : OP_INVALID;
+			if(d->op == OP_LR_W && rs2 != 0) {
+				d->op = OP_INVALID;
+			}
+			d->cls = CLASS_LOAD;
+			d->rd = rd;
+			d->rs1 = rs1;
+			d->rs2 = rs2;
+			break;
+		}
+	}
+	if(d->op == OP_INVALID) {
+		//the class is kept so EX can stop on it, but it must never write a register
+		return;
+	}
+	d->writes_rd = d->rd != 0 && d->cls != CLASS_STORE && d->cls != CLASS_BRANCH && d->cls != CLASS_SYSTEM;
+}
 
-	case 3:
-		break;
+/************************************************************/
+/* Return the decoded instruction at a PC, decoding it on a miss                              */
+/************************************************************/
+const decoded_inst_t *predecode(uint32_t pc) {
+	predecode_entry_t *entry = &PREDECODE_CACHE[(pc >> 2) & (PREDECODE_ENTRIES - 1)];
+	if(entry->pc != pc) {
+		decode_instruction(mem_read_32(pc), &entry->d);
+		entry->pc = pc;
+	}
+	return &entry->d;
+}
 
-	default:
-		printf("Invalid instruction");
-		RUN_FLAG = FALSE;
-		break;
+/************************************************************/
+/* Drop predecoded words overlapping a written address                                              */
+/************************************************************/
+void predecode_invalidate(uint32_t address) {
+	//an unaligned word written at address can cover two instruction words
+	uint32_t first = address & ~3u;
+	uint32_t last = (address + 3) & ~3u;
+	predecode_entry_t *entry = &PREDECODE_CACHE[(first >> 2) & (PREDECODE_ENTRIES - 1)];
+	if(entry->pc == first) {
+		entry->pc = MEM_TLB_INVALID;
 	}
+	entry = &PREDECODE_CACHE[(last >> 2) & (PREDECODE_ENTRIES - 1)];
+	if(entry->pc == last) {
+		entry->pc = MEM_TLB_INVALID;
+	}
+}
 
+void predecode_flush() {
+	int i;
+	for(i = 0; i < PREDECODE_ENTRIES; i++) {
+		PREDECODE_CACHE[i].pc = MEM_TLB_INVALID;
+	}
 }
 
-void B_Print(int32_t imm, uint32_t funct3, uint32_t rs1, uint32_t rs2){
-	switch(funct3) {
-		case 0: //beq
-			printf("beq x%d, x%d, %d\n\n", rs1, rs2, imm);
-			break;
+/************************************************************/
+/* Print the program loaded into memory (in RISCV assembly format)    */
+/************************************************************/
+void print_program(){
+	//walk the text segment until the first word that is not an instruction, the machine state is left alone
+	uint32_t addressMemory = MEM_TEXT_BEGIN;
+	const decoded_inst_t *d;
+	do {
+		d = predecode(addressMemory);
+		print_instruction(addressMemory);
+		addressMemory += 4;
+	} while(d->op != OP_INVALID && d->op != OP_ECALL);
+}
 
-		case 1: //bne
-			printf("bne x%d, x%d, %d\n\n", rs1, rs2, imm);
-			break;
+static const char *OP_NAMES[NUM_OPS] = {
+	[OP_INVALID] = "invalid",
+	[OP_ADD] = "add", [OP_SUB] = "sub", [OP_SLL] = "sll", [OP_XOR] = "xor",
+	[OP_SRL] = "srl", [OP_SRA] = "sra", [OP_OR] = "or", [OP_AND] = "and",
+	[OP_ADDI] = "addi", [OP_XORI] = "xori", [OP_ORI] = "ori", [OP_ANDI] = "andi",
+	[OP_SLLI] = "slli", [OP_SRLI] = "srli", [OP_SRAI] = "srai",
+	[OP_LB] = "lb", [OP_LH] = "lh", [OP_LW] = "lw", [OP_LBU] = "lbu", [OP_LHU] = "lhu",
+	[OP_SB] = "sb", [OP_SH] = "sh", [OP_SW] = "sw",
+	[OP_BEQ] = "beq", [OP_BNE] = "bne", [OP_BLT] = "blt", [OP_BGE] = "bge",
+	[OP_BLTU] = "bltu", [OP_BGEU] = "bgeu",
+	[OP_JAL] = "jal", [OP_JALR] = "jalr",
+	[OP_ECALL] = "ecall",
+	[OP_LR_W] = "lr.w", [OP_SC_W] = "sc.w", [OP_AMOSWAP_W] = "amoswap.w", [OP_AMOADD_W] = "amoadd.w",
+	[OP_AMOXOR_W] = "amoxor.w", [OP_AMOAND_W] = "amoand.w", [OP_AMOOR_W] = "amoor.w", [OP_AMOMIN_W] = "amomin.w",
+	[OP_AMOMAX_W] = "amomax.w", [OP_AMOMINU_W] = "amominu.w", [OP_AMOMAXU_W] = "amomaxu.w",
+	[OP_MUL] = "mul", [OP_MULH] = "mulh", [OP_MULHSU] = "mulhsu", [OP_MULHU] = "mulhu",
+	[OP_DIV] = "div", [OP_DIVU] = "divu", [OP_REM] = "rem", [OP_REMU] = "remu",
+};
 
-		case 4: //blt
-			printf("blt x%d, x%d, %d\n\n", rs1, rs2, imm);
+/************************************************************/
+/* Format a decoded instruction in RISCV assembly                                                  */
+/************************************************************/
+void disasm_instruction(const decoded_inst_t *d, char *buf, size_t len){
+	const char *name = OP_NAMES[d->op];
+	switch(d->cls) {
+		case CLASS_ALU:
+			snprintf(buf, len, "%s x%d, x%d, x%d", name, d->rd, d->rs1, d->rs2);
 			break;
-
-		case 5: //bgt
-			printf("bgt x%d, x%d, %d\n\n", rs1, rs2, imm);
+		case CLASS_ALU_IMM:
+			snprintf(buf, len, "%s x%d, x%d, %d", name, d->rd, d->rs1, d->imm);
 			break;
-
-		case 6: //bltu
-			printf("bltu x%d, x%d, %d\n\n", rs1, rs2, imm);
+		case CLASS_LOAD:
+			if(d->op == OP_LR_W) {
+				snprintf(buf, len, "%s x%d, (x%d)", name, d->rd, d->rs1);
+			}
+			else if(op_is_atomic(d->op)) {
+				snprintf(buf, len, "%s x%d, x%d, (x%d)", name, d->rd, d->rs2, d->rs1);
+			}
+			else {
+				snprintf(buf, len, "%s x%d, %d(x%d)", name, d->rd, d->imm, d->rs1);
+			}
 			break;
-
-		case 7: //bgtu
-			printf("bgtu x%d, x%d, %d\n\n", rs1, rs2, imm);
+		case CLASS_STORE:
+			snprintf(buf, len, "%s x%d, %d(x%d)", name, d->rs2, d->imm, d->rs1);
+			break;
+		case CLASS_BRANCH:
+			snprintf(buf, len, "%s x%d, x%d, %d", name, d->rs1, d->rs2, d->imm);
+			break;
+		case CLASS_JUMP:
+			if(d->op == OP_JAL) {
+				snprintf(buf, len, "jal x%d, %d", d->rd, d->imm);
+			}
+			else {
+				snprintf(buf, len, "jalr x%d, x%d, %d", d->rd, d->rs1, d->imm);
+			}
+			break;
+		case CLASS_SYSTEM:
+			snprintf(buf, len, "%s", name);
 			break;
-		
 		default:
-			printf("Invalid instruction");
-			RUN_FLAG = FALSE;
+			snprintf(buf, len, "Instruction not found or at EOF!");
 			break;
 	}
-
 }
 
 /************************************************************/
 /* Print the instruction at given memory address (in RISCV assembly format)    */
 /************************************************************/
 void print_instruction(uint32_t addr){
-
-	uint32_t instruction = mem_read_32(addr);
-	uint32_t maskopcode = 0x7F;
-	uint32_t opcode = instruction & maskopcode;
-	if(opcode == 51) { //R-type
-		uint32_t maskrd = 0xF80;
-		uint32_t rd = instruction & maskrd;
-		rd = rd >> 7;
-		uint32_t maskf3 = 0x7000;
-		uint32_t f3 = instruction & maskf3;
-		f3 = f3 >> 12;
-		uint32_t maskrs1 = 0xF8000;
-		uint32_t rs1 = instruction & maskrs1;
-		rs1 = rs1 >> 15;
-		uint32_t maskrs2 = 0x1F00000;
-		uint32_t rs2 = instruction & maskrs2;
-		rs2 = rs2 >> 20;
-		uint32_t maskf7 = 0xFE000000;
-		uint32_t f7 = instruction & maskf7;
-		f7 = f7 >> 25;
-		R_Print(rd,f3,rs1,rs2,f7);
-	} else if(opcode == 3) { // I-type load
-		uint32_t rd = (instruction & 3968) >> 7;
-		uint32_t funct3 = (instruction & 28672) >> 12;
-		uint32_t rs1 = (instruction & 1015808) >> 15;
-		uint32_t imm = (instruction & 4293918720) >> 20;
-		I_Print(imm, funct3, rs1, rd);
-	} else if(opcode == 19){ //I-type 
-		uint32_t rd = (instruction & 3968) >> 7;
-		uint32_t funct3 = (instruction & 28672) >> 12;
-		uint32_t rs1 = (instruction & 1015808) >> 15;
-		uint32_t imm = (instruction & 4293918720) >> 20;
-		Iimm_Print(rd, funct3, rs1, imm);
-	} else if(opcode == 35){ //S-type
-		uint32_t imm = (instruction & 3968) >> 7;
-		uint32_t funct3 = (instruction & 28672) >> 12;
-		uint32_t rs1 = (instruction & 1015808) >> 15;
-		uint32_t rs2 = (instruction & 32505856) >> 20;
-		uint32_t imm2 = (instruction & 4261412864) >> 25;
-		S_Print(imm2, funct3, rs1, rs2, imm);
-	}  else if(opcode == 99){
-		
-		uint32_t funct3 = (instruction & 28672) >> 12;
-		uint32_t rs1 = (instruction & 1015808) >> 15;
-		uint32_t rs2 = (instruction & 32505856) >> 20;
-		int32_t imm11 = (instruction & 128) >> 7;
-		int32_t imm4_1 = (instruction & 3840) >> 7;
-		int32_t imm10_5 = (instruction & 2113929216) >> 25;
-		int32_t imm12 = (instruction & 2147483648) >> 31;
-		int32_t imm = (imm12 << 12) | (imm11 << 11) | (imm10_5 << 5) | (imm4_1); //13 bits long
-		if(imm12 == 1){
-			imm = 0xFFFFE000 | imm;
-		}
-		B_Print(imm, funct3, rs1, rs2);
-
-	} 
-	else if(opcode == 111) {
-		uint32_t fullimm = (instruction & 0xFFFFF000) >> 12;
-		uint32_t bit20 = (fullimm & 0x80000);
-		uint32_t bit10_1 = (fullimm & 0x7FE00) >> 9;
-		uint32_t bit11 = (fullimm & 0x100) << 4;
-		uint32_t bit19_12 = (fullimm & 0xFF) << 12;
-		uint32_t convertedimm = bit20 | bit10_1 | bit11 | bit19_12;
-			if((convertedimm & 0x80000) == 0x80000) {
-				convertedimm |= 0xFFF00000;
-			}
-		uint32_t rd = (instruction & 3968) >> 7;
-		printf("jal x%d, %d\n\n",rd,convertedimm);
-	}
-	else if(opcode == 103) {
-		uint32_t rs1 = (instruction & 1015808) >> 15;
-		uint32_t rd = (instruction & 3968) >> 7;
-		uint32_t imm = (instruction & 4293918720) >> 20;
-		//If this bit is a 1, it is a negative number, so we extend the sign bit all the way over.
-		if((imm & 4096) == 4096) {
-			imm |= 0xFFFFE000;
-		}
-		printf("jalr x%d, x%d, %d\n\n", rd, rs1, imm);
-	}
-	else if (opcode==115) {
-		printf("ecall\n\n");
-		RUN_FLAG = FALSE;
-	} else{
-		printf("Instruction not found or at EOF!\n");
-		RUN_FLAG = FALSE;
-	}
-	CURRENT_STATE = NEXT_STATE;
-	return;
+	char buf[64];
+	disasm_instruction(predecode(addr), buf, sizeof(buf));
+	printf("%s\n\n", buf);
 }
 /************************************************************/
 /* Print the current pipeline                                                                                    */
 /************************************************************/
 void show_pipeline(){
+	//the out-of-order core has no latches, its ROB is what is in flight
+	if(OOO_CONFIG.enabled) {
+		ooo_show();
+		return;
+	}
 	//printing out current pipeline
 	printf("Current PC:\t0x%x\n",CURRENT_STATE.PC);
 	printf("IF/ID.IR\t0x%x\n",IF_ID.IR);
@@ -1209,27 +2585,344 @@ void show_pipeline(){
 	printf("MEM/WB.IR\t0x%x\n",MEM_WB.IR);
 	printf("MEM/WB.ALUOutput\t%d\n",MEM_WB.ALUOutput);
 	printf("MEM/WB.LMD\t%d\n\n",MEM_WB.LMD);
+
+	//the younger slot of each issue group
+	if(ISSUE_WIDTH > 1) {
+		printf("IF/ID[1].IR\t0x%x\n",IF_ID_GROUP[1].IR);
+		printf("IF/ID[1].PC\t0x%x\n",IF_ID_GROUP[1].PC);
+		printf("ID/EX[1].IR\t0x%x\n",ID_EX_GROUP[1].IR);
+		printf("EX/MEM[1].IR\t0x%x\n",EX_MEM_GROUP[1].IR);
+		printf("EX/MEM[1].ALUOutput\t%d\n",EX_MEM_GROUP[1].ALUOutput);
+		printf("MEM/WB[1].IR\t0x%x\n",MEM_WB_GROUP[1].IR);
+		printf("MEM/WB[1].ALUOutput\t%d\n\n",MEM_WB_GROUP[1].ALUOutput);
+	}
+}
+
+/***************************************************************/
+/* Batch results as one JSON object. Keys are always written in the same */
+/* order and every number is a plain unsigned integer, so results can be  */
+/* diffed and parsed without caring which simulator version wrote them.  */
+/***************************************************************/
+static void json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(out, "\\%c", *str);
+		}else if ((unsigned char)*str < 0x20) {
+			fprintf(out, "\\u%04x", *str);
+		}else {
+			fputc(*str, out);
+		}
+	}
+	fputc('"', out);
+}
+
+//How fast the host simulated since the program was loaded, and the most memory the process ever held.
+static void write_host_json(FILE *out)
+{
+	struct timespec now;
+	struct rusage usage;
+	double seconds;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	seconds = (now.tv_sec - SIM->host_start.tv_sec) + (now.tv_nsec - SIM->host_start.tv_nsec) / 1e9;
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(out, ",\n  \"host\": { \"seconds\": %.6f, \"mips\": %.3f, \"cycles_per_second\": %.0f, \"peak_rss_kib\": %ld }",
+			seconds, seconds > 0 ? INSTRUCTION_COUNT / seconds / 1e6 : 0.0, seconds > 0 ? CYCLE_COUNT / seconds : 0.0,
+			usage.ru_maxrss);
 }
 
+void write_results_json(FILE *out, int dump_regs)
+{
+	int i;
+	fprintf(out, "{\n");
+	fprintf(out, "  \"program\": ");
+	json_string(out, prog_file);
+	fprintf(out, ",\n");
+	fprintf(out, "  \"forwarding\": %u,\n", ENABLE_FORWARDING ? 1 : 0);
+	fprintf(out, "  \"engine\": \"%s\",\n", ENGINE_NAMES[FF_ENGINE]);
+	fprintf(out, "  \"bpred\": \"%s\",\n", BPRED_NAMES[BPRED_CONFIG.scheme]);
+	fprintf(out, "  \"prefetch\": \"%s\",\n", PREFETCH_NAMES[PREFETCH_CONFIG.scheme]);
+	fprintf(out, "  \"issue_width\": %u,\n", ISSUE_WIDTH);
+	fprintf(out, "  \"core\": \"%s\",\n", OOO_CONFIG.enabled ? "ooo" : "pipeline");
+	if (replay_file() != NULL) {
+		fprintf(out, "  \"replay\": ");
+		json_string(out, replay_file());
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "  \"completed\": %s,\n", RUN_FLAG ? "false" : "true");
+	fprintf(out, "  \"cycles\": %u,\n", CYCLE_COUNT);
+	fprintf(out, "  \"instructions\": %u,\n", INSTRUCTION_COUNT);
+	fprintf(out, "  \"pc\": %u", CURRENT_STATE.PC);
+	if (dump_regs) {
+		fprintf(out, ",\n  \"regs\": [");
+		for (i = 0; i < RISCV_REGS; i++) {
+			fprintf(out, "%s%u", i == 0 ? "" : ", ", CURRENT_STATE.REGS[i]);
+		}
+		fprintf(out, "],\n");
+		fprintf(out, "  \"hi\": %u,\n", CURRENT_STATE.HI);
+		fprintf(out, "  \"lo\": %u", CURRENT_STATE.LO);
+	}
+	//everything else is core 0's, the other cores get a summary each
+	if (SIM->multicore != NULL) {
+		multicore_write_json(out);
+	}
+	write_host_json(out);
+	fprintf(out, ",\n  \"stats\": ");
+	stats_write_json(out);
+	fprintf(out, "\n}\n");
+}
+
+/***************************************************************/
+/* Command line (left out of builds that bring their own main)                                */
+/***************************************************************/
+#ifndef MU_NO_MAIN
+enum {
+	OPT_FORWARDING = 256,
+	OPT_ENGINE,
+	OPT_RUN,
+	OPT_FF,
+	OPT_RUN_TO_COMPLETION,
+	OPT_MAX_CYCLES,
+	OPT_DUMP_REGS,
+	OPT_STATS_JSON,
+	OPT_SWEEP,
+	OPT_THREADS,
+	OPT_CSV,
+	OPT_CORES,
+	OPT_TRACE,
+	OPT_REPLAY,
+	OPT_PROFILE,
+};
+
+static const struct option LONG_OPTIONS[] = {
+	{ "quiet", no_argument, NULL, 'q' },
+	{ "batch", no_argument, NULL, 'b' },
+	{ "script", required_argument, NULL, 's' },
+	{ "help", no_argument, NULL, 'h' },
+	{ "forwarding", required_argument, NULL, OPT_FORWARDING },
+	{ "engine", required_argument, NULL, OPT_ENGINE },
+	{ "run", required_argument, NULL, OPT_RUN },
+	{ "ff", required_argument, NULL, OPT_FF },
+	{ "run-to-completion", no_argument, NULL, OPT_RUN_TO_COMPLETION },
+	{ "max-cycles", required_argument, NULL, OPT_MAX_CYCLES },
+	{ "dump-regs", no_argument, NULL, OPT_DUMP_REGS },
+	{ "stats-json", required_argument, NULL, OPT_STATS_JSON },
+	{ "sweep", required_argument, NULL, OPT_SWEEP },
+	{ "threads", required_argument, NULL, OPT_THREADS },
+	{ "csv", required_argument, NULL, OPT_CSV },
+	{ "cores", required_argument, NULL, OPT_CORES },
+	{ "trace", required_argument, NULL, OPT_TRACE },
+	{ "replay", required_argument, NULL, OPT_REPLAY },
+	{ "profile", required_argument, NULL, OPT_PROFILE },
+	{ NULL, 0, NULL, 0 }
+};
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options] <input program (hex words or RV32 ELF)>\n", name);
+	printf("       %s --sweep <jobs file> [--threads <n>] [--csv <file>]\n\n", name);
+	printf("  -q, --quiet\t\t\tno loader or status messages\n");
+	printf("  -b, --batch\t\t\tread commands from stdin without prompts or banners\n");
+	printf("  -s, --script <file>\t\trun the commands in <file> (implies --batch)\n");
+	printf("      --forwarding <0-1>\tturn data forwarding on/off\n");
+	printf("      --engine <name>\t\tfast-forward engine (interp, threaded, dbt)\n");
+	printf("      --run <n>\t\t\tsimulate <n> cycles\n");
+	printf("      --ff <n>|@<pc>\t\tfast-forward <n> instructions or up to <pc>\n");
+	printf("      --run-to-completion\tsimulate until the program ends\n");
+	printf("      --max-cycles <n>\t\tgive up running to completion after <n> cycles\n");
+	printf("      --cores <n>\t\tsimulate <n> cores sharing the program's memory\n");
+	printf("      --trace <file>\t\trecord every retired instruction to <file>\n");
+	printf("      --replay <file>\t\tdrive the pipeline from the trace in <file> instead of executing\n");
+	printf("      --profile <file>\t\tprofile cycles by PC and write the folded call stacks to <file> at the end\n");
+	printf("      --dump-regs\t\tinclude the register file in the results\n");
+	printf("      --stats-json <file>\twrite the results as JSON to <file> (- for stdout)\n");
+	printf("      --sweep <jobs file>\trun every '<program> [command; command ...]' line of <file>\n");
+	printf("      --threads <n>\t\tsweep worker threads (default: all cores)\n");
+	printf("      --csv <file>\t\twrite the sweep results to <file> (default: stdout)\n\n");
+	printf("--script, --run, --ff and --run-to-completion are carried out in the order given,\n");
+	printf("any of them (or --dump-regs/--stats-json) runs the simulator in batch mode.\n\n");
+}
+
+/* a script, run, ff or run-to-completion, carried out after the program is loaded */
+typedef struct {
+	int opt;
+	const char *arg;
+} batch_action_t;
+
 /***************************************************************/
 /* main                                                                                                                                   */
 /***************************************************************/
 int main(int argc, char *argv[]) {
-	printf("\n**************************\n");
-	printf("Welcome to MU-RISCV SIM...\n");
-	printf("**************************\n\n");
+	batch_action_t *actions = calloc(argc, sizeof(batch_action_t));
+	const char *json_file = NULL, *sweep_file = NULL, *csv_file = NULL, *trace_file = NULL;
+	const char *replay_name = NULL, *profile_file = NULL;
+	int num_actions = 0, dump_regs = FALSE, threads = 0, cores = 1, opt, i;
+	FILE *out;
+
+	SIM = sim_create();
+	while ((opt = getopt_long(argc, argv, "qbs:h", LONG_OPTIONS, NULL)) != -1) {
+		switch (opt) {
+			case 'q':
+				QUIET = TRUE;
+				break;
+			case 'b':
+				BATCH_MODE = TRUE;
+				break;
+			case OPT_FORWARDING:
+				ENABLE_FORWARDING = strtoul(optarg, NULL, 10) != 0;
+				break;
+			case OPT_ENGINE:
+				if (!set_engine(optarg)) {
+					printf("Error: Unknown engine %s\n", optarg);
+					exit(1);
+				}
+				break;
+			case OPT_MAX_CYCLES:
+				MAX_CYCLES = strtoul(optarg, NULL, 10);
+				break;
+			case OPT_DUMP_REGS:
+				dump_regs = TRUE;
+				BATCH_MODE = TRUE;
+				break;
+			case OPT_STATS_JSON:
+				json_file = optarg;
+				BATCH_MODE = TRUE;
+				break;
+			case OPT_SWEEP:
+				sweep_file = optarg;
+				break;
+			case OPT_THREADS:
+				threads = strtoul(optarg, NULL, 10);
+				break;
+			case OPT_CSV:
+				csv_file = optarg;
+				break;
+			case OPT_CORES:
+				cores = strtoul(optarg, NULL, 10);
+				break;
+			case OPT_TRACE:
+				trace_file = optarg;
+				break;
+			case OPT_REPLAY:
+				replay_name = optarg;
+				break;
+			case OPT_PROFILE:
+				profile_file = optarg;
+				break;
+			case 's':
+			case OPT_RUN:
+			case OPT_FF:
+			case OPT_RUN_TO_COMPLETION:
+				actions[num_actions].opt = opt;
+				actions[num_actions].arg = optarg;
+				num_actions++;
+				BATCH_MODE = TRUE;
+				break;
+			case 'h':
+				usage(argv[0]);
+				exit(0);
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+	if (sweep_file != NULL) {
+		out = csv_file == NULL || strcmp(csv_file, "-") == 0 ? stdout : fopen(csv_file, "w");
+		if (out == NULL) {
+			printf("Error: Can't write %s\n", csv_file);
+			exit(1);
+		}
+		free(actions);
+		i = sweep_run(sweep_file, threads, out);
+		if (out != stdout && fclose(out) != 0) {
+			printf("Error: Can't write %s\n", csv_file);
+			exit(1);
+		}
+		return i;
+	}
+	if (optind != argc - 1) {
+		printf("Error: You should provide input file.\n");
+		usage(argv[0]);
+		exit(1);
+	}
+	if (BATCH_MODE) {
+		QUIET = TRUE;
+	}else {
+		printf("\n**************************\n");
+		printf("Welcome to MU-RISCV SIM...\n");
+		printf("**************************\n\n");
+	}
 
-	if (argc < 2) {
-		printf("Error: You should provide input file.\nUsage: %s <input program> \n\n",  argv[0]);
+	sim_start(argv[optind]);
+	if (cores != 1 && !multicore_param("count", cores)) {
+		printf("Error: Can't simulate %d cores\n", cores);
+		exit(1);
+	}
+	if (trace_file != NULL && !trace_start(trace_file)) {
+		exit(1);
+	}
+	if (replay_name != NULL && !replay_start(replay_name)) {
 		exit(1);
 	}
+	if (profile_file != NULL) {
+		profile_start(profile_file);
+	}
+	if (!BATCH_MODE) {
+		help();
+		while (handle_command()) {
+		}
+		trace_stop();
+		profile_stop();
+		return 0;
+	}
 
-	strcpy(prog_file, argv[1]);
-	initialize();
-	load_program();
-	help();
-	while (1){
-		handle_command();
+	//without actions a batch run takes its commands from stdin
+	if (num_actions == 0) {
+		while (handle_command()) {
+		}
+	}
+	for (i = 0; i < num_actions; i++) {
+		switch (actions[i].opt) {
+			case 's':
+				COMMAND_INPUT = fopen(actions[i].arg, "r");
+				if (COMMAND_INPUT == NULL) {
+					printf("Error: Can't open script %s\n", actions[i].arg);
+					exit(1);
+				}
+				while (handle_command()) {
+				}
+				fclose(COMMAND_INPUT);
+				COMMAND_INPUT = stdin;
+				break;
+			case OPT_RUN:
+				run(strtoul(actions[i].arg, NULL, 10));
+				break;
+			case OPT_FF:
+				ff_command(actions[i].arg);
+				break;
+			case OPT_RUN_TO_COMPLETION:
+				runAll();
+				break;
+		}
+	}
+	free(actions);
+	trace_stop();
+	profile_stop();
+
+	if (json_file != NULL || dump_regs) {
+		out = json_file == NULL || strcmp(json_file, "-") == 0 ? stdout : fopen(json_file, "w");
+		if (out == NULL) {
+			printf("Error: Can't write %s\n", json_file);
+			exit(1);
+		}
+		write_results_json(out, dump_regs);
+		if (out != stdout && fclose(out) != 0) {
+			printf("Error: Can't write %s\n", json_file);
+			exit(1);
+		}
 	}
 	return 0;
 }
+#endif
@@ -1,4 +1,11 @@
+#ifndef MU_RISCV_H
+#define MU_RISCV_H
+
+#include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
 
 #define FALSE 0
 #define TRUE  1
@@ -24,21 +31,65 @@
 
 typedef struct {
 	uint32_t begin, end;
-	uint8_t *mem;
+	const char *name;
+	uint32_t resident_pages;	/* pages of this region currently backed by host memory */
 } mem_region_t;
 
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-	{ MEM_TEXT_BEGIN, MEM_TEXT_END, NULL },
-	{ MEM_DATA_BEGIN, MEM_DATA_END, NULL },
-	{ MEM_KDATA_BEGIN, MEM_KDATA_END, NULL },
-	{ MEM_KTEXT_BEGIN, MEM_KTEXT_END, NULL }
-};
-
 #define NUM_MEM_REGION 4
-#define RISCV_REGS 32
+#define MEM_REGION_TEXT 0
+
+/* guest memory is little-endian, words are moved with one native access on little-endian hosts */
+static inline uint32_t mem_load_le32(const uint8_t *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	value = __builtin_bswap32(value);
+#endif
+	return value;
+}
+
+static inline void mem_store_le32(uint8_t *p, uint32_t value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	value = __builtin_bswap32(value);
+#endif
+	memcpy(p, &value, sizeof(value));
+}
+
+/******************************************************************************/
+/* Sparse guest memory: a two level page table of 4 KiB pages                                       */
+/******************************************************************************/
+#define MEM_PAGE_BITS 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_L1_BITS 10
+#define MEM_L2_BITS (32 - MEM_L1_BITS - MEM_PAGE_BITS)
+#define MEM_L1_ENTRIES (1 << MEM_L1_BITS)
+#define MEM_L2_ENTRIES (1 << MEM_L2_BITS)
+
+typedef struct mem_page_struct {
+	uint8_t *data;		/* MEM_PAGE_SIZE bytes of guest memory */
+	uint32_t base;		/* guest address of the first byte of the page */
+	uint32_t dirty;		/* written since the last reset */
+	uint32_t mapped;	/* data points into the mmap'd program file rather than our own allocation */
+	int region;		/* index into MEM_REGIONS */
+	struct mem_page_struct *next;	/* list of all resident pages */
+} mem_page_t;
+
+/******************************************************************************/
+/* Software TLB: direct mapped guest page -> host pointer translations              */
+/******************************************************************************/
+#define MEM_TLB_BITS 8
+#define MEM_TLB_ENTRIES (1 << MEM_TLB_BITS)
+#define MEM_TLB_INVALID 0xFFFFFFFF	/* never a page aligned address */
+
+typedef struct {
+	uint32_t tag;		/* guest address of the page, MEM_TLB_INVALID if empty */
+	uint8_t *host;		/* host copy of the page */
+} mem_tlb_entry_t;
 
-uint32_t ENABLE_FORWARDING = FALSE;
+#define RISCV_REGS 32
 
 typedef struct CPU_State_Struct {
 
@@ -47,9 +98,89 @@ typedef struct CPU_State_Struct {
   uint32_t HI, LO;                          /* special regs for mult/div. */
 } CPU_State;
 
+/***************************************************************/
+/* Predecoded instructions                                                                                              */
+/***************************************************************/
+typedef enum {
+	OP_INVALID = 0,
+	/* register-register */
+	OP_ADD, OP_SUB, OP_SLL, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+	/* register-immediate */
+	OP_ADDI, OP_XORI, OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI, OP_SRAI,
+	/* loads */
+	OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU,
+	/* stores */
+	OP_SB, OP_SH, OP_SW,
+	/* branches */
+	OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+	/* jumps */
+	OP_JAL, OP_JALR,
+	OP_ECALL,
+	/* A extension, word sized. They are loads that also write memory (their */
+	/* class is CLASS_LOAD) and take the value to store or combine from rs2. */
+	OP_LR_W, OP_SC_W, OP_AMOSWAP_W, OP_AMOADD_W, OP_AMOXOR_W, OP_AMOAND_W,
+	OP_AMOOR_W, OP_AMOMIN_W, OP_AMOMAX_W, OP_AMOMINU_W, OP_AMOMAXU_W,
+	/* M extension, register-register (CLASS_ALU) on the multiply/divide units */
+	OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU,
+	NUM_OPS
+} op_t;
+
+typedef enum {
+	CLASS_NONE = 0,	/* bubble or undecodable word */
+	CLASS_ALU,		/* register-register */
+	CLASS_ALU_IMM,	/* register-immediate */
+	CLASS_LOAD,
+	CLASS_STORE,
+	CLASS_BRANCH,
+	CLASS_JUMP,
+	CLASS_SYSTEM,
+	NUM_CLASSES
+} op_class_t;
+
+typedef struct {
+	uint32_t raw;		/* instruction word as fetched */
+	uint8_t op;		/* op_t */
+	uint8_t cls;		/* op_class_t */
+	uint8_t rd, rs1, rs2;	/* unused source registers are 0 */
+	uint8_t writes_rd;	/* TRUE when the instruction writes a register other than x0 */
+	int32_t imm;		/* sign extended, already shifted into place */
+} decoded_inst_t;
+
+static inline int op_is_atomic(uint32_t op)
+{
+	return op >= OP_LR_W && op <= OP_AMOMAXU_W;
+}
+
+static inline int op_is_muldiv(uint32_t op)
+{
+	return op >= OP_MUL && op <= OP_REMU;
+}
+
+#define PREDECODE_BITS 12
+#define PREDECODE_ENTRIES (1 << PREDECODE_BITS)
+
+typedef struct {
+	uint32_t pc;		/* MEM_TLB_INVALID if empty */
+	decoded_inst_t d;
+} predecode_entry_t;
+
+/* What a cycle is charged to by the profiler (mu-profile.c). A bubble */
+/* carries the cause and the instruction it is charged to down the pipeline. */
+typedef enum {
+	PROFILE_FILL = 0,	/* nothing to blame: the pipeline filling or draining */
+	PROFILE_BUSY,		/* the instruction retired */
+	PROFILE_DATA,		/* it waited in ID for an operand */
+	PROFILE_CONTROL,	/* fetch was redirected behind it */
+	PROFILE_MEMORY,	/* its D-cache or store buffer access held the pipeline */
+	PROFILE_FETCH,		/* its I-cache miss */
+	PROFILE_UNIT,		/* it waited in EX for a busy multiply/divide unit */
+	NUM_PROFILE_CAUSES
+} profile_cause_t;
+
 typedef struct CPU_Pipeline_Reg_Struct{
 	uint32_t PC;
 	uint32_t IR;
+	decoded_inst_t D;
 	uint32_t A;
 	uint32_t B;
 	uint32_t imm;
@@ -59,29 +190,428 @@ typedef struct CPU_Pipeline_Reg_Struct{
 	uint32_t StallCount;
 	uint32_t jumpDetected;
 	uint32_t jumpStallCount;
+	uint32_t jumpPC;	/* the jump or branch that set jumpDetected */
+	uint32_t predictedPC;	/* where IF went on after this instruction */
+	uint32_t predictInfo;	/* predictor state at fetch, for the update and recovery in EX */
+	uint32_t traceSeq;	/* trace record a replay fetched it from, 0 for none */
+	uint32_t blamePC;	/* a bubble: the instruction it is charged to, 0 for the oldest in flight */
+	uint32_t blameCause;	/* ... and why, profile_cause_t */
 	
 } CPU_Pipeline_Reg;
 
 /***************************************************************/
-/* CPU State info.                                                                                                               */
+/* Cache and DRAM timing (mu-cache.c, mu-dram.c)                                                */
+/***************************************************************/
+typedef enum {
+	REPL_LRU = 0,
+	REPL_FIFO,
+	REPL_RANDOM,
+	NUM_REPL
+} cache_repl_t;
+
+typedef struct {
+	uint32_t enabled;		/* FALSE: every access takes the stage's single cycle */
+	uint32_t size;		/* bytes, power of two */
+	uint32_t assoc;		/* ways, power of two */
+	uint32_t line;		/* bytes, power of two */
+	uint32_t repl;		/* cache_repl_t */
+	uint32_t write_through;	/* FALSE: write-back + write-allocate, TRUE: write-through, no allocate */
+	uint32_t hit_latency;	/* cycles, 1 = no stall */
+	uint32_t miss_latency;	/* cycles the next level adds */
+} cache_config_t;
+
+typedef struct {
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t read_misses;
+	uint32_t write_misses;
+	uint32_t writebacks;		/* dirty lines evicted */
+	uint32_t stall_cycles;	/* L1: cycles the stage waited beyond its own, L2: cycles the L1s waited on it */
+} cache_stats_t;
+
+typedef struct {
+	uint32_t enabled;		/* FALSE: the last cache level charges its miss latency */
+	uint32_t banks;		/* power of two */
+	uint32_t row_size;		/* bytes per row and bank, power of two */
+	uint32_t queue_depth;	/* posted writes */
+	uint32_t t_cas, t_rcd, t_rp, t_burst;	/* cycles */
+} dram_config_t;
+
+typedef struct {
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t row_hits;
+	uint32_t row_misses;		/* bank had no open row */
+	uint32_t row_conflicts;	/* another row had to be closed first */
+	uint32_t queue_full_stalls;	/* writes that found the queue full */
+	uint32_t read_latency;	/* summed over all reads */
+	uint32_t bus_busy_cycles;	/* cycles the data bus was transferring */
+	uint32_t region_accesses[NUM_MEM_REGION];	/* by MEM_REGIONS entry */
+} dram_stats_t;
+
+extern const char *CACHE_REPL_NAMES[NUM_REPL];
+
+struct cache_state;		/* mu-cache.c */
+struct dram_state;		/* mu-dram.c */
+
+/***************************************************************/
+/* Data prefetching (mu-prefetch.c), trained on the loads MEM sends to the */
+/* D-cache.                                                                                                                   */
+/***************************************************************/
+typedef enum {
+	PREFETCH_NONE = 0,
+	PREFETCH_NEXT_LINE,		/* the lines after a miss or the first use of a prefetched line */
+	PREFETCH_STRIDE,		/* per load PC reference prediction table */
+	PREFETCH_STREAM,		/* stream buffers beside the D-cache */
+	NUM_PREFETCH
+} prefetch_scheme_t;
+
+typedef struct {
+	uint32_t scheme;		/* prefetch_scheme_t */
+	uint32_t degree;		/* lines per trigger */
+	uint32_t distance;		/* lines (strides) between the trigger and the first prefetch */
+	uint32_t table_entries;	/* stride table, power of two */
+	uint32_t streams;		/* stream buffers */
+} prefetch_config_t;
+
+typedef struct {
+	uint32_t issued;		/* lines requested from the level below the D-cache */
+	uint32_t useful;		/* ... that a demand access used */
+	uint32_t late;		/* ... while they were still on their way */
+	uint32_t late_cycles;	/* cycles those accesses waited for them */
+	uint32_t useless;		/* ... dropped without being used */
+	uint32_t misses;		/* demand line fills no prefetch covered */
+} prefetch_stats_t;
+
+extern const char *PREFETCH_NAMES[NUM_PREFETCH];
+
+struct prefetch_state;	/* mu-prefetch.c */
+
+/***************************************************************/
+/* Store buffer between MEM and the D-cache (mu-storebuf.c)                          */
+/***************************************************************/
+typedef struct {
+	uint32_t depth;		/* entries, 0 = stores go to the D-cache in MEM */
+	uint32_t merge;		/* stores to a line that is already buffered join its entry */
+} storebuf_config_t;
+
+typedef struct {
+	uint32_t stores;
+	uint32_t merged;		/* stores that joined a buffered line */
+	uint32_t drained;		/* entries written to the D-cache */
+	uint32_t forwarded;		/* loads served entirely from the buffer */
+	uint32_t conflicts;		/* loads that had to wait for a partly overlapping store */
+	uint32_t conflict_cycles;
+	uint32_t port_cycles;	/* cycles loads waited for a write to the D-cache to finish */
+	uint32_t full_stalls;	/* stores that found the buffer full */
+	uint32_t full_stall_cycles;
+} storebuf_stats_t;
+
+struct storebuf_state;	/* mu-storebuf.c */
+
+/***************************************************************/
+/* Superscalar issue: with an issue width of 2 every pipeline latch holds */
+/* a group of up to two instructions, slot 0 being the older one. IF only  */
+/* pairs two instructions when none of these holds.                                          */
+/***************************************************************/
+#define ISSUE_WIDTH_MAX 2
+
+typedef enum {
+	PAIR_CONTROL = 0,		/* the first is a jump or branch */
+	PAIR_MEMORY,		/* both access memory, there is one D-cache port */
+	PAIR_DEPENDENCE,		/* the second reads what the first writes */
+	PAIR_LINE,		/* the second is in the next I-cache line */
+	PAIR_SYSTEM,		/* either is a system call or not an instruction */
+	PAIR_MULDIV,		/* both go to the same multiply/divide unit */
+	NUM_PAIR_SPLIT
+} pair_split_t;
+
+typedef struct {
+	uint32_t groups;		/* issue groups IF sent on */
+	uint32_t dual;		/* ... with both slots filled */
+	uint32_t slot_committed[ISSUE_WIDTH_MAX];
+	uint32_t split[NUM_PAIR_SPLIT];	/* why the second slot stayed empty */
+} issue_stats_t;
+
+/***************************************************************/
+/* Out-of-order core (mu-ooo.c), runs instead of the 5-stage pipeline    */
+/* while it is enabled                                                                                                  */
+/***************************************************************/
+typedef enum {
+	FU_ALU = 0,		/* alu, alu-imm, system calls and undecodable words */
+	FU_BRANCH,		/* jumps and branches */
+	FU_MEM,		/* address generation and the D-cache port */
+	NUM_FU
+} fu_class_t;
+
+typedef struct {
+	uint32_t enabled;
+	uint32_t rob_entries;	/* reorder buffer */
+	uint32_t rs_entries;	/* reservation stations per functional unit class */
+	uint32_t lsq_entries;	/* loads and stores between rename and commit */
+	uint32_t width;		/* fetched, renamed, issued and committed per cycle */
+} ooo_config_t;
+
+typedef struct {
+	uint32_t renamed;
+	uint32_t issued[NUM_FU];	/* by fu_class_t */
+	uint32_t squashed;		/* fetched or renamed on a wrong path, or before their code changed */
+	uint32_t rob_full;		/* cycles rename waited for a ROB entry */
+	uint32_t rs_full;		/* ... for a reservation station */
+	uint32_t lsq_full;		/* ... for a load/store queue entry */
+	uint32_t forwarded;		/* loads that got their data from an older store */
+	uint32_t load_waits;	/* cycles ready loads waited for older stores */
+	uint32_t rob_occupancy;	/* entries in use, summed over the cycles */
+	uint32_t code_flushes;	/* committed stores to instructions already fetched */
+} ooo_stats_t;
+
+extern const char *FU_NAMES[NUM_FU];
+
+struct ooo_state;		/* mu-ooo.c */
+
+/***************************************************************/
+/* Multicore (mu-multicore.c): cores sharing guest memory, each a context */
+/* of its own run by its own host thread, with MESI-coherent D-caches          */
+/***************************************************************/
+#define MULTICORE_MAX 32
+
+typedef struct {
+	uint32_t cores;		/* 1 .. MULTICORE_MAX */
+	uint32_t quantum;		/* cycles each core runs between two barriers */
+	uint32_t snoop_latency;	/* cycles to invalidate other copies or fetch a modified one */
+} multicore_config_t;
+
+typedef struct {
+	uint32_t exclusive_fills;	/* D-cache misses no other core held the line for (E) */
+	uint32_t shared_fills;	/* ... some other core held it clean (S) */
+	uint32_t interventions;	/* ... another core held it modified and supplied it */
+	uint32_t upgrades;		/* writes to a shared line that had to invalidate the others */
+	uint32_t invalidations_sent;	/* copies in other cores this core's writes invalidated */
+	uint32_t coherence_misses;	/* lines found invalidated by another core */
+	uint32_t snoop_cycles;	/* cycles spent on upgrades and interventions */
+	uint32_t atomics;		/* LR, SC and AMO instructions */
+	uint32_t sc_failures;
+} coherence_stats_t;
+
+struct multicore_state;	/* mu-multicore.c */
+
+/***************************************************************/
+/* Multiply/divide units of the M extension (mu-muldiv.c)      */
 /***************************************************************/
+typedef struct {
+	uint32_t mul_latency;	/* cycles until the result can be forwarded, 1 = like the ALU */
+	uint32_t mul_pipelined;	/* TRUE: takes one operation a cycle, FALSE: iterative, one at a time */
+	uint32_t div_latency;	/* the same for div, divu, rem and remu */
+	uint32_t div_pipelined;
+} muldiv_config_t;
 
-CPU_State CURRENT_STATE, NEXT_STATE;
-int RUN_FLAG;	/* run flag*/
-uint32_t INSTRUCTION_COUNT;
-uint32_t CYCLE_COUNT;
-uint32_t PROGRAM_SIZE; /*in words*/
+struct muldiv_state;	/* mu-muldiv.c */
 
+/***************************************************************/
+/* Performance counters (mu-stats.c). Cycles lost to a stall are counted  */
+/* where the bubble enters ID_EX, by cause and by the opcode class the     */
+/* bubble is charged to.                                                                                                */
+/***************************************************************/
+typedef struct {
+	uint32_t cycles;		/* pipeline cycles since the last reset */
+	uint32_t committed;		/* instructions retired by WB, bubbles excluded */
+	uint32_t data_stalls;		/* stalls started by detect_hazard */
+	uint32_t data_stall_cycles;	/* bubbles while IF_ID.StallCount was set */
+	uint32_t control_events;	/* jumps and branches that held the front end */
+	uint32_t control_stall_cycles;	/* bubbles while jumpDetected/jumpStallCount were set */
+	uint32_t control_cls;		/* class of the jump or branch being charged */
+	uint32_t structural_stalls;	/* multiplies and divides that found their unit busy */
+	uint32_t structural_stall_cycles;	/* bubbles while EX held one for its unit */
+	uint32_t mul_ops;		/* started on the multiply unit */
+	uint32_t div_ops;		/* ... and on the divide unit */
+	uint32_t bp_resolved;		/* jumps and branches resolved against a prediction */
+	uint32_t bp_mispredicts;	/* ... that sent fetch down the wrong path */
+	uint32_t class_committed[NUM_CLASSES];
+	uint32_t class_data_stall_cycles[NUM_CLASSES];	/* by the class of the stalled instruction */
+	uint32_t class_control_stall_cycles[NUM_CLASSES];	/* by the class of the jump or branch */
+	cache_stats_t icache, dcache;
+	cache_stats_t l2;
+	dram_stats_t dram;
+	prefetch_stats_t prefetch;
+	storebuf_stats_t storebuf;
+	issue_stats_t issue;
+	ooo_stats_t ooo;
+	coherence_stats_t coherence;
+} sim_stats_t;
 
 /***************************************************************/
-/* Pipeline Registers.                                                                                                        */
+/* Branch prediction (mu-bpred.c). 'none' keeps the original front end,  */
+/* which holds fetch for a cycle behind every jump and branch.                 */
 /***************************************************************/
-CPU_Pipeline_Reg IF_ID;
-CPU_Pipeline_Reg ID_EX;
-CPU_Pipeline_Reg EX_MEM;
-CPU_Pipeline_Reg MEM_WB;
+typedef enum {
+	BPRED_NONE = 0,
+	BPRED_STATIC,		/* backward taken, forward not taken */
+	BPRED_BIMODAL,
+	BPRED_GSHARE,
+	BPRED_TOURNAMENT,
+	NUM_BPRED
+} bpred_scheme_t;
+
+typedef struct {
+	uint32_t scheme;		/* bpred_scheme_t */
+	uint32_t table_entries;	/* per direction table, power of two */
+	uint32_t history_bits;	/* gshare global history */
+	uint32_t btb_entries;	/* power of two */
+	uint32_t ras_depth;
+} bpred_config_t;
+
+extern const char *BPRED_NAMES[NUM_BPRED];
+
+struct bpred_state;		/* mu-bpred.c */
+
+/***************************************************************/
+/* Simulator context: everything one simulated machine owns. Each host   */
+/* thread works on the context SIM points to, so several programs can be */
+/* simulated by one process (see mu-sweep.c). The macros below keep the  */
+/* old global names.                                                                                                        */
+/***************************************************************/
+struct threaded_state;	/* mu-threaded.c */
+struct dbt_state;		/* mu-dbt.c */
+struct trace_state;		/* mu-trace.c */
+struct replay_state;		/* mu-trace.c */
+struct profile_state;		/* mu-profile.c */
+
+/* A retired instruction as a replay reads it back from a trace. */
+typedef struct {
+	uint32_t pc;
+	uint32_t raw;
+	uint32_t value;		/* written to rd (the data for a load) */
+	uint32_t address;	/* of a load or store */
+	uint32_t data;		/* loaded or stored, the old word for an atomic */
+} trace_record_t;
+
+typedef struct sim_context_struct {
+	/* CPU State info. */
+	CPU_State current_state, next_state;
+	int run_flag;	/* run flag*/
+	uint32_t instruction_count;
+	uint32_t cycle_count;
+	uint32_t program_size; /*in words*/
+	uint32_t program_entry; /*PC after load/reset*/
+
+	/* Pipeline Registers, each an issue group. */
+	CPU_Pipeline_Reg if_id[ISSUE_WIDTH_MAX], id_ex[ISSUE_WIDTH_MAX], ex_mem[ISSUE_WIDTH_MAX], mem_wb[ISSUE_WIDTH_MAX];
+	uint32_t issue_width;	/* 1 .. ISSUE_WIDTH_MAX */
+	uint32_t enable_forwarding;
+	sim_stats_t stats;
+	bpred_config_t bpred_config;
+	struct bpred_state *bpred;	/* allocated on first use */
+	cache_config_t icache_config, dcache_config, l2_config;
+	struct cache_state *cache;	/* allocated on first use */
+	dram_config_t dram_config;
+	struct dram_state *dram;	/* allocated on first use */
+	prefetch_config_t prefetch_config;
+	struct prefetch_state *prefetch;	/* allocated on first use */
+	storebuf_config_t storebuf_config;
+	struct storebuf_state *storebuf;	/* allocated on first use */
+	ooo_config_t ooo_config;
+	struct ooo_state *ooo;	/* allocated on first use */
+	multicore_config_t multicore_config;	/* only core 0's counts */
+	struct multicore_state *multicore;	/* shared by all cores, NULL while there is one */
+	uint32_t core_id;
+	uint32_t reservation;	/* address LR reserved, MEM_TLB_INVALID if none */
+	uint32_t reservation_value;	/* ... and the word it read there */
+	uint32_t text_generation;	/* stores to code by other cores seen so far */
+	uint32_t fetch_stall;	/* cycles IF still waits for the I-cache */
+	uint32_t fetch_filled_pc;	/* PC whose line the I-cache just delivered, MEM_TLB_INVALID if none */
+	uint32_t mem_stall;	/* cycles the pipeline still waits for the D-cache */
+	uint32_t ex_stall;	/* EX keeps its group this cycle, its multiply/divide unit is busy */
+	muldiv_config_t muldiv_config;
+	struct muldiv_state *muldiv;	/* allocated by the first multiply or divide */
+
+	/* Guest memory. Regions only describe the legal address ranges, backing */
+	/* pages are allocated on first touch and second level tables once a page */
+	/* inside their 4 MiB window is touched. The cores of a multicore machine */
+	/* all use core 0's, memory_home points to it (to the context itself otherwise). */
+	struct sim_context_struct *memory_home;
+	mem_region_t mem_regions[NUM_MEM_REGION];
+	mem_page_t **mem_page_table[MEM_L1_ENTRIES];
+	mem_page_t *mem_resident_pages;
+	uint32_t mem_resident_count;
+	/* reads and writes are kept apart so that write entries can only exist for pages already marked dirty */
+	mem_tlb_entry_t mem_tlb_read[MEM_TLB_ENTRIES];
+	mem_tlb_entry_t mem_tlb_write[MEM_TLB_ENTRIES];
+	/* direct mapped on the PC, entries are dropped when a store hits the text segment */
+	predecode_entry_t predecode_cache[PREDECODE_ENTRIES];
+
+	/* Program file, the ELF loader keeps its mapping until the next load. */
+	char program_file[256];
+	uint8_t *program_map;
+	size_t program_map_size;
+
+	/* Fast-forward engines, allocated on first use. */
+	uint32_t ff_engine;
+	struct threaded_state *threaded;
+	struct dbt_state *dbt;
+
+	/* Driver. */
+	uint32_t quiet; /*no loader or status messages*/
+	uint32_t batch_mode; /*no prompts or banners, quit ends the script*/
+	uint32_t max_cycles; /*sim gives up after this many cycles, 0 = never*/
+	FILE *command_input; /*where handle_command() reads from*/
+	struct timespec host_start; /*when the program was loaded, the results' host throughput is measured from there*/
+	struct trace_state *trace; /*retired instructions are recorded while set*/
+	struct replay_state *replay; /*the pipeline replays a trace while set*/
+	struct profile_state *profile; /*cycles are charged to guest PCs while set*/
+} sim_context_t;
 
-char prog_file[32];
+extern _Thread_local sim_context_t *SIM;
+
+#define CURRENT_STATE (SIM->current_state)
+#define NEXT_STATE (SIM->next_state)
+#define RUN_FLAG (SIM->run_flag)
+#define INSTRUCTION_COUNT (SIM->instruction_count)
+#define CYCLE_COUNT (SIM->cycle_count)
+#define PROGRAM_SIZE (SIM->program_size)
+#define PROGRAM_ENTRY (SIM->program_entry)
+#define IF_ID (SIM->if_id[0])	/* the oldest slot, also where the group's stall state lives */
+#define ID_EX (SIM->id_ex[0])
+#define EX_MEM (SIM->ex_mem[0])
+#define MEM_WB (SIM->mem_wb[0])
+#define IF_ID_GROUP (SIM->if_id)
+#define ID_EX_GROUP (SIM->id_ex)
+#define EX_MEM_GROUP (SIM->ex_mem)
+#define MEM_WB_GROUP (SIM->mem_wb)
+#define ISSUE_WIDTH (SIM->issue_width)
+#define ENABLE_FORWARDING (SIM->enable_forwarding)
+#define STATS (SIM->stats)
+#define BPRED_CONFIG (SIM->bpred_config)
+#define ICACHE_CONFIG (SIM->icache_config)
+#define DCACHE_CONFIG (SIM->dcache_config)
+#define L2_CONFIG (SIM->l2_config)
+#define DRAM_CONFIG (SIM->dram_config)
+#define PREFETCH_CONFIG (SIM->prefetch_config)
+#define STOREBUF_CONFIG (SIM->storebuf_config)
+#define OOO_CONFIG (SIM->ooo_config)
+#define MULTICORE_CONFIG (SIM->multicore_config)
+#define CORE_ID (SIM->core_id)
+#define FETCH_STALL (SIM->fetch_stall)
+#define FETCH_FILLED_PC (SIM->fetch_filled_pc)
+#define MEM_STALL (SIM->mem_stall)
+#define EX_STALL (SIM->ex_stall)
+#define MULDIV_CONFIG (SIM->muldiv_config)
+#define MEM_REGIONS (SIM->memory_home->mem_regions)
+#define MEM_PAGE_TABLE (SIM->memory_home->mem_page_table)
+#define MEM_RESIDENT_PAGES (SIM->memory_home->mem_resident_pages)
+#define MEM_RESIDENT_COUNT (SIM->memory_home->mem_resident_count)
+#define MEM_TLB_READ (SIM->mem_tlb_read)
+#define MEM_TLB_WRITE (SIM->mem_tlb_write)
+#define PREDECODE_CACHE (SIM->predecode_cache)
+#define prog_file (SIM->program_file)
+#define FF_ENGINE (SIM->ff_engine)
+#define QUIET (SIM->quiet)
+#define BATCH_MODE (SIM->batch_mode)
+#define MAX_CYCLES (SIM->max_cycles)
+#define COMMAND_INPUT (SIM->command_input)
+
+sim_context_t *sim_create();
+void sim_destroy(sim_context_t *ctx);
+void sim_start(const char *program);
 
 
 /***************************************************************/
@@ -90,12 +620,26 @@ char prog_file[32];
 void help();
 uint32_t mem_read_32(uint32_t address);
 void mem_write_32(uint32_t address, uint32_t value);
+void mem_write_sub(uint32_t address, uint32_t value, uint32_t size);
+int mem_cas_32(uint32_t address, uint32_t expected, uint32_t value);
+int mem_region_index(uint32_t address);
+mem_page_t *mem_page_lookup(uint32_t address);
+mem_page_t *mem_page_touch(uint32_t address);
+void mem_page_map(uint32_t address, uint8_t *data);
+void mem_page_own(mem_page_t *page);
+void mem_clear_dirty();
+void mem_tlb_flush();
+void mem_report();
 void cycle();
 void run(int num_cycles);
 void runAll();
 void mdump(uint32_t start, uint32_t stop) ;
 void rdump();
-void handle_command();
+int handle_command();
+int set_engine(const char *name);
+int set_issue_width(uint32_t width);
+void ff_command(const char *arg);
+void write_results_json(FILE *out, int dump_regs);
 void reset();
 void init_memory();
 void load_program();
@@ -105,8 +649,144 @@ void MEM();/*IMPLEMENT THIS*/
 void EX();/*IMPLEMENT THIS*/
 void ID();/*IMPLEMENT THIS*/
 void IF();/*IMPLEMENT THIS*/
+uint32_t detect_hazard(CPU_Pipeline_Reg *id_ex, uint32_t rs, uint32_t rt);
 void show_pipeline();/*IMPLEMENT THIS*/
+/***************************************************************/
+/* Functional (fast-forward) execution engines                                                            */
+/***************************************************************/
+typedef enum {
+	ENGINE_INTERP = 0,	/* func_step() one instruction at a time */
+	ENGINE_THREADED,	/* pre-translated, direct threaded code (mu-threaded.c) */
+	ENGINE_DBT,		/* hot basic blocks translated to host code (mu-dbt.c) */
+	NUM_ENGINES
+} ff_engine_t;
+
+extern const char *ENGINE_NAMES[NUM_ENGINES];
+
+void text_modified(uint32_t address);
+uint32_t threaded_run(uint32_t count, uint32_t stop_pc, int to_pc);
+void threaded_invalidate(uint32_t address);
+void threaded_flush();
+void threaded_release();
+uint32_t dbt_run(uint32_t count, uint32_t stop_pc, int to_pc);
+void dbt_invalidate(uint32_t address);
+void dbt_flush();
+void dbt_release();
+uint32_t MEM_load(const decoded_inst_t *d, uint32_t address);
+uint32_t MEM_extend(const decoded_inst_t *d, uint32_t word);
+uint32_t MEM_access_size(const decoded_inst_t *d);
+void MEM_store(const decoded_inst_t *d, uint32_t address, uint32_t value);
+uint32_t MEM_atomic(const decoded_inst_t *d, uint32_t address, uint32_t value);
+uint32_t EX_R_Processing(const decoded_inst_t *d, uint32_t a, uint32_t b);
+uint32_t EX_Iimm_Processing(const decoded_inst_t *d, uint32_t a);
+uint32_t EX_Branch_Processing(const decoded_inst_t *d, uint32_t a, uint32_t b);
+void pipeline_flush();
+void pipeline_drain();
+int func_step();
+void fast_forward(uint32_t count, uint32_t stop_pc, int to_pc);
 void initialize();
 void print_program(); /*IMPLEMENT THIS*/
 void print_instruction(uint32_t);
+void decode_instruction(uint32_t instruction, decoded_inst_t *d);
+const decoded_inst_t *predecode(uint32_t pc);
+void predecode_invalidate(uint32_t address);
+void predecode_flush();
+void disasm_instruction(const decoded_inst_t *d, char *buf, size_t len);
+int sweep_run(const char *jobs_file, int threads, FILE *csv);
+void stats_reset();
+void stats_report();
+void stats_write_json(FILE *out);
+int bpred_set(const char *name);
+int bpred_param(const char *name, uint32_t value);
+int bpred_config_valid(const bpred_config_t *config);
+uint32_t bpred_predict(uint32_t pc, const decoded_inst_t *d, uint32_t *info);
+void bpred_update(uint32_t pc, const decoded_inst_t *d, uint32_t info, int taken, uint32_t target);
+void bpred_recover(uint32_t info);
+void bpred_release();
+uint8_t *bpred_snapshot(size_t *size);
+int bpred_restore(const uint8_t *blob, size_t size);
+int cache_param(const char *which, const char *name, const char *value);
+int cache_config_valid(const cache_config_t *config);
+uint32_t cache_fetch(uint32_t pc);
+uint32_t cache_data(uint32_t pc, uint32_t address, int write);
+uint32_t cache_data_access(uint32_t pc, uint32_t address, int write, uint32_t now);
+int cache_prefetch(uint32_t address, uint32_t now);
+uint32_t cache_fill(uint32_t address, uint32_t now);
+void cache_release();
+uint8_t *cache_snapshot(size_t *size);
+int cache_restore(const uint8_t *blob, size_t size);
+uint8_t *cache_l2_snapshot(size_t *size);
+int cache_l2_restore(const uint8_t *blob, size_t size);
+int dram_param(const char *name, uint32_t value);
+int dram_config_valid(const dram_config_t *config);
+uint32_t dram_access(uint32_t address, int write, uint32_t now);
+void dram_release();
+uint8_t *dram_snapshot(size_t *size);
+int dram_restore(const uint8_t *blob, size_t size);
+int prefetch_set(const char *name);
+int prefetch_param(const char *name, uint32_t value);
+int prefetch_config_valid(const prefetch_config_t *config);
+void prefetch_train(uint32_t pc, uint32_t address, int missed, int used, uint32_t now);
+int prefetch_miss(uint32_t address, uint32_t now, uint32_t *latency);
+void prefetch_release();
+uint8_t *prefetch_snapshot(size_t *size);
+int prefetch_restore(const uint8_t *blob, size_t size);
+int storebuf_param(const char *name, uint32_t value);
+int storebuf_config_valid(const storebuf_config_t *config);
+uint32_t storebuf_store(uint32_t address, uint32_t size);
+uint32_t storebuf_load(uint32_t pc, uint32_t address, uint32_t size);
+void storebuf_release();
+uint8_t *storebuf_snapshot(size_t *size);
+int storebuf_restore(const uint8_t *blob, size_t size);
+int ooo_param(const char *name, uint32_t value);
+int ooo_config_valid(const ooo_config_t *config);
+void ooo_cycle();
+void ooo_show();
+void ooo_release();
+uint8_t *ooo_snapshot(size_t *size);
+int ooo_restore(const uint8_t *blob, size_t size);
+int multicore_param(const char *name, uint32_t value);
+int multicore_config_valid(const multicore_config_t *config);
+void multicore_run(uint32_t cycles, int to_completion);
+void multicore_reset();
+void multicore_release();
+void multicore_rdump();
+void multicore_report();
+void multicore_write_json(FILE *out);
+void multicore_lock_memory();
+void multicore_unlock_memory();
+void multicore_text_modified();
+uint32_t coherence_access(uint32_t line, int write, int *present);
+void coherence_evict(uint32_t line);
+void coherence_forget();
+int muldiv_param(const char *name, uint32_t value);
+int muldiv_config_valid(const muldiv_config_t *config);
+void muldiv_release();
+uint32_t muldiv_busy(const decoded_inst_t *d);
+uint32_t muldiv_execute(const decoded_inst_t *d);
+uint32_t muldiv_wait(const decoded_inst_t *d);
+uint8_t *muldiv_snapshot(size_t *size);
+int muldiv_restore(const uint8_t *blob, size_t size);
+int checkpoint_save(const char *file);
+int checkpoint_load(const char *file);
+int trace_start(const char *file);
+void trace_stop();
+void trace_retire(uint32_t pc, const decoded_inst_t *d, uint32_t value, uint32_t address, uint32_t data);
+int replay_start(const char *file);
+void replay_stop();
+uint32_t replay_restart();
+const char *replay_file();
+const trace_record_t *replay_record(uint32_t seq);
+int replay_fetch(uint32_t pc, uint32_t *raw, uint32_t *seq);
+void replay_take(uint32_t seq);
+void replay_rewind(uint32_t seq);
+int replay_next_pc(uint32_t seq, uint32_t *pc);
+void profile_start(const char *folded_file);
+void profile_stop();
+void profile_clear();
+void profile_cycle(uint32_t pc, uint32_t cause);
+void profile_retire(uint32_t pc, const decoded_inst_t *d);
+void profile_top(uint32_t n);
+int profile_folded(const char *file);
 
+#endif
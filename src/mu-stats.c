@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Performance counters: the pipeline stages bump the STATS fields, this     */
+/* file only clears and reports them.                                                                       */
+/***************************************************************/
+static const char *CLASS_NAMES[NUM_CLASSES] = {
+	[CLASS_NONE] = "other",
+	[CLASS_ALU] = "alu",
+	[CLASS_ALU_IMM] = "alu-imm",
+	[CLASS_LOAD] = "load",
+	[CLASS_STORE] = "store",
+	[CLASS_BRANCH] = "branch",
+	[CLASS_JUMP] = "jump",
+	[CLASS_SYSTEM] = "system",
+};
+
+static const char *PAIR_SPLIT_NAMES[NUM_PAIR_SPLIT] = {
+	[PAIR_CONTROL] = "control",
+	[PAIR_MEMORY] = "memory",
+	[PAIR_DEPENDENCE] = "dependence",
+	[PAIR_LINE] = "line",
+	[PAIR_SYSTEM] = "system",
+	[PAIR_MULDIV] = "muldiv",
+};
+
+void stats_reset()
+{
+	memset(&STATS, 0, sizeof(STATS));
+}
+
+/***************************************************************/
+/* CPI in thousandths, 0 before anything has been committed                         */
+/***************************************************************/
+static uint32_t stats_cpi_milli()
+{
+	if (STATS.committed == 0) {
+		return 0;
+	}
+	return (uint32_t)(((uint64_t)STATS.cycles * 1000 + STATS.committed / 2) / STATS.committed);
+}
+
+static uint32_t stats_ipc_milli()
+{
+	if (STATS.cycles == 0) {
+		return 0;
+	}
+	return (uint32_t)(((uint64_t)STATS.committed * 1000 + STATS.cycles / 2) / STATS.cycles);
+}
+
+static void cache_report(const char *name, const cache_config_t *config, const cache_stats_t *stats)
+{
+	uint32_t accesses = stats->reads + stats->writes;
+	uint32_t misses = stats->read_misses + stats->write_misses;
+	uint32_t rate = accesses == 0 ? 0 : (uint32_t)(((uint64_t)misses * 1000 + accesses / 2) / accesses);
+
+	if (!config->enabled) {
+		return;
+	}
+	printf("%s\t\t: %u KiB %u-way %u B lines, %s, %s, %u/%u cycles\n", name, config->size / 1024, config->assoc,
+			config->line, CACHE_REPL_NAMES[config->repl], config->write_through ? "write-through" : "write-back",
+			config->hit_latency, config->hit_latency + config->miss_latency);
+	printf("  accesses\t\t: %u (%u reads, %u writes)\n", accesses, stats->reads, stats->writes);
+	printf("  misses\t\t: %u (%u.%u%%), %u writebacks\n", misses, rate / 10, rate % 10, stats->writebacks);
+	printf("  stall cycles\t\t: %u\n", stats->stall_cycles);
+}
+
+static void dram_report()
+{
+	uint32_t accesses = STATS.dram.row_hits + STATS.dram.row_misses + STATS.dram.row_conflicts;
+	uint32_t busy = STATS.cycles == 0 ? 0 : (uint32_t)(((uint64_t)STATS.dram.bus_busy_cycles * 1000) / STATS.cycles);
+	int i;
+
+	if (!DRAM_CONFIG.enabled) {
+		return;
+	}
+	printf("DRAM\t\t\t: %u banks, %u B rows, tCAS %u tRCD %u tRP %u tBURST %u, %u queued writes\n",
+			DRAM_CONFIG.banks, DRAM_CONFIG.row_size, DRAM_CONFIG.t_cas, DRAM_CONFIG.t_rcd, DRAM_CONFIG.t_rp,
+			DRAM_CONFIG.t_burst, DRAM_CONFIG.queue_depth);
+	printf("  accesses\t\t: %u (%u reads, %u writes)\n", STATS.dram.reads + STATS.dram.writes, STATS.dram.reads, STATS.dram.writes);
+	printf("  row hit/miss/conflict\t: %u/%u/%u of %u\n", STATS.dram.row_hits, STATS.dram.row_misses,
+			STATS.dram.row_conflicts, accesses);
+	printf("  avg read latency\t: %u cycles\n", STATS.dram.reads == 0 ? 0 : STATS.dram.read_latency / STATS.dram.reads);
+	printf("  bus utilisation\t: %u.%u%%\n", busy / 10, busy % 10);
+	printf("  write queue full\t: %u\n", STATS.dram.queue_full_stalls);
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if (STATS.dram.region_accesses[i] != 0) {
+			printf("  %s\t\t: %u accesses\n", MEM_REGIONS[i].name, STATS.dram.region_accesses[i]);
+		}
+	}
+}
+
+//Shares in tenths of a percent.
+static uint32_t per_mille(uint32_t part, uint32_t whole)
+{
+	return whole == 0 ? 0 : (uint32_t)(((uint64_t)part * 1000 + whole / 2) / whole);
+}
+
+static void prefetch_report()
+{
+	uint32_t accuracy = per_mille(STATS.prefetch.useful, STATS.prefetch.issued);
+	uint32_t coverage = per_mille(STATS.prefetch.useful, STATS.prefetch.useful + STATS.prefetch.misses);
+	uint32_t timely = per_mille(STATS.prefetch.useful - STATS.prefetch.late, STATS.prefetch.useful);
+
+	if (PREFETCH_CONFIG.scheme == PREFETCH_NONE) {
+		return;
+	}
+	printf("Prefetcher\t\t: %s (degree %u, distance %u, %u entries, %u streams)\n", PREFETCH_NAMES[PREFETCH_CONFIG.scheme],
+			PREFETCH_CONFIG.degree, PREFETCH_CONFIG.distance, PREFETCH_CONFIG.table_entries, PREFETCH_CONFIG.streams);
+	printf("  issued\t\t: %u (%u useful, %u useless)\n", STATS.prefetch.issued, STATS.prefetch.useful, STATS.prefetch.useless);
+	printf("  accuracy\t\t: %u.%u%%\n", accuracy / 10, accuracy % 10);
+	printf("  coverage\t\t: %u.%u%% (%u misses left)\n", coverage / 10, coverage % 10, STATS.prefetch.misses);
+	printf("  timeliness\t\t: %u.%u%% (%u late, %u cycles waited)\n", timely / 10, timely % 10,
+			STATS.prefetch.late, STATS.prefetch.late_cycles);
+}
+
+static void storebuf_report()
+{
+	if (STOREBUF_CONFIG.depth == 0) {
+		return;
+	}
+	printf("Store buffer\t\t: %u entries%s\n", STOREBUF_CONFIG.depth, STOREBUF_CONFIG.merge ? ", merging" : "");
+	printf("  stores\t\t: %u (%u merged, %u written to the D-cache)\n", STATS.storebuf.stores, STATS.storebuf.merged,
+			STATS.storebuf.drained);
+	printf("  loads forwarded\t: %u\n", STATS.storebuf.forwarded);
+	printf("  load conflicts\t: %u (%u cycles)\n", STATS.storebuf.conflicts, STATS.storebuf.conflict_cycles);
+	printf("  port wait cycles\t: %u\n", STATS.storebuf.port_cycles);
+	printf("  buffer full\t\t: %u (%u cycles)\n", STATS.storebuf.full_stalls, STATS.storebuf.full_stall_cycles);
+}
+
+static void issue_report()
+{
+	uint32_t paired = STATS.issue.groups == 0 ? 0 :
+			(uint32_t)(((uint64_t)STATS.issue.dual * 1000 + STATS.issue.groups / 2) / STATS.issue.groups);
+	int i;
+
+	if (ISSUE_WIDTH == 1) {
+		return;
+	}
+	printf("Issue width\t\t: %u\n", ISSUE_WIDTH);
+	printf("  groups fetched\t: %u (%u.%u%% paired)\n", STATS.issue.groups, paired / 10, paired % 10);
+	printf("  committed per slot\t: %u / %u\n", STATS.issue.slot_committed[0], STATS.issue.slot_committed[1]);
+	printf("  not paired\t\t:");
+	for (i = 0; i < NUM_PAIR_SPLIT; i++) {
+		printf(" %s %u", PAIR_SPLIT_NAMES[i], STATS.issue.split[i]);
+	}
+	printf("\n");
+}
+
+static void ooo_report()
+{
+	uint32_t occupancy = STATS.cycles == 0 ? 0 :
+			(uint32_t)(((uint64_t)STATS.ooo.rob_occupancy * 10 + STATS.cycles / 2) / STATS.cycles);
+	int i;
+
+	if (!OOO_CONFIG.enabled) {
+		return;
+	}
+	printf("Out-of-order core\t: %u wide, %u ROB, %u RS per class, %u LSQ\n", OOO_CONFIG.width,
+			OOO_CONFIG.rob_entries, OOO_CONFIG.rs_entries, OOO_CONFIG.lsq_entries);
+	printf("  renamed\t\t: %u (%u squashed, %u code flushes)\n", STATS.ooo.renamed, STATS.ooo.squashed,
+			STATS.ooo.code_flushes);
+	printf("  issued\t\t:");
+	for (i = 0; i < NUM_FU; i++) {
+		printf(" %s %u", FU_NAMES[i], STATS.ooo.issued[i]);
+	}
+	printf("\n");
+	printf("  ROB occupancy\t\t: %u.%u average\n", occupancy / 10, occupancy % 10);
+	printf("  rename stalls\t\t: %u ROB, %u RS, %u LSQ cycles\n", STATS.ooo.rob_full, STATS.ooo.rs_full,
+			STATS.ooo.lsq_full);
+	printf("  loads forwarded\t: %u (%u cycles waiting for older stores)\n", STATS.ooo.forwarded,
+			STATS.ooo.load_waits);
+}
+
+static void coherence_report()
+{
+	const coherence_stats_t *c = &STATS.coherence;
+
+	if (SIM->multicore == NULL && c->atomics == 0) {
+		return;
+	}
+	printf("Atomics\t\t\t: %u, %u SC failed\n", c->atomics, c->sc_failures);
+	if (SIM->multicore == NULL || !DCACHE_CONFIG.enabled) {
+		return;
+	}
+	printf("Coherence\t\t: core %u, MESI\n", CORE_ID);
+	printf("  fills\t\t\t: %u exclusive, %u shared, %u from a modified copy\n", c->exclusive_fills,
+			c->shared_fills, c->interventions);
+	printf("  upgrades\t\t: %u, %u copies invalidated\n", c->upgrades, c->invalidations_sent);
+	printf("  coherence misses\t: %u\n", c->coherence_misses);
+	printf("  snoop cycles\t\t: %u\n", c->snoop_cycles);
+}
+
+void stats_report()
+{
+	uint32_t cpi = stats_cpi_milli(), ipc = stats_ipc_milli();
+	int i;
+
+	printf("-------------------------------------\n");
+	printf("Performance Counters\n");
+	printf("-------------------------------------\n");
+	printf("Cycles\t\t\t: %u\n", STATS.cycles);
+	printf("Committed\t\t: %u\n", STATS.committed);
+	printf("CPI\t\t\t: %u.%03u\n", cpi / 1000, cpi % 1000);
+	printf("IPC\t\t\t: %u.%03u\n", ipc / 1000, ipc % 1000);
+	printf("Fast-forwarded\t\t: %u\n", INSTRUCTION_COUNT - STATS.committed);
+	printf("Data stall cycles\t: %u (%u stalls)\n", STATS.data_stall_cycles, STATS.data_stalls);
+	printf("Control stall cycles\t: %u (%u jumps/branches)\n", STATS.control_stall_cycles, STATS.control_events);
+	if (STATS.mul_ops + STATS.div_ops > 0) {
+		printf("Structural stall cycles\t: %u (%u waits for a busy multiply/divide unit)\n", STATS.structural_stall_cycles,
+				STATS.structural_stalls);
+		printf("Multiply/divide\t\t: %u mul (%u cycles, %s), %u div (%u cycles, %s)\n", STATS.mul_ops,
+				MULDIV_CONFIG.mul_latency, MULDIV_CONFIG.mul_pipelined ? "pipelined" : "iterative", STATS.div_ops,
+				MULDIV_CONFIG.div_latency, MULDIV_CONFIG.div_pipelined ? "pipelined" : "iterative");
+	}
+	if (BPRED_CONFIG.scheme != BPRED_NONE) {
+		printf("Branch predictor\t: %s (%u entries, %u history bits, %u BTB, %u RAS)\n", BPRED_NAMES[BPRED_CONFIG.scheme],
+				BPRED_CONFIG.table_entries, BPRED_CONFIG.history_bits, BPRED_CONFIG.btb_entries, BPRED_CONFIG.ras_depth);
+		printf("Mispredicted\t\t: %u of %u\n", STATS.bp_mispredicts, STATS.bp_resolved);
+	}
+	cache_report("L1 I-cache", &ICACHE_CONFIG, &STATS.icache);
+	cache_report("L1 D-cache", &DCACHE_CONFIG, &STATS.dcache);
+	cache_report("L2 cache", &L2_CONFIG, &STATS.l2);
+	dram_report();
+	prefetch_report();
+	storebuf_report();
+	issue_report();
+	ooo_report();
+	coherence_report();
+	printf("-------------------------------------\n");
+	printf("[Class]\t\t[Committed]\t[Data Stall]\t[Control Stall]\n");
+	printf("-------------------------------------\n");
+	for (i = 0; i < NUM_CLASSES; i++) {
+		if (STATS.class_committed[i] == 0 && STATS.class_data_stall_cycles[i] == 0 &&
+				STATS.class_control_stall_cycles[i] == 0) {
+			continue;
+		}
+		printf("%-8s\t%u\t\t%u\t\t%u\n", CLASS_NAMES[i], STATS.class_committed[i],
+				STATS.class_data_stall_cycles[i], STATS.class_control_stall_cycles[i]);
+	}
+	printf("-------------------------------------\n");
+	if (SIM->multicore != NULL) {
+		multicore_report();
+	}
+}
+
+/***************************************************************/
+/* The counters as a JSON object, in the style of write_results_json()        */
+/***************************************************************/
+static void cache_write_json(FILE *out, const char *name, const cache_stats_t *stats)
+{
+	fprintf(out, "    \"%s\": { \"reads\": %u, \"writes\": %u, \"read_misses\": %u, \"write_misses\": %u, "
+			"\"writebacks\": %u, \"stall_cycles\": %u },\n", name, stats->reads, stats->writes,
+			stats->read_misses, stats->write_misses, stats->writebacks, stats->stall_cycles);
+}
+
+void stats_write_json(FILE *out)
+{
+	int i;
+	fprintf(out, "{\n");
+	fprintf(out, "    \"cycles\": %u,\n", STATS.cycles);
+	fprintf(out, "    \"committed\": %u,\n", STATS.committed);
+	fprintf(out, "    \"cpi_milli\": %u,\n", stats_cpi_milli());
+	fprintf(out, "    \"ipc_milli\": %u,\n", stats_ipc_milli());
+	fprintf(out, "    \"data_stalls\": %u,\n", STATS.data_stalls);
+	fprintf(out, "    \"data_stall_cycles\": %u,\n", STATS.data_stall_cycles);
+	fprintf(out, "    \"control_events\": %u,\n", STATS.control_events);
+	fprintf(out, "    \"control_stall_cycles\": %u,\n", STATS.control_stall_cycles);
+	fprintf(out, "    \"structural_stalls\": %u,\n", STATS.structural_stalls);
+	fprintf(out, "    \"structural_stall_cycles\": %u,\n", STATS.structural_stall_cycles);
+	fprintf(out, "    \"mul_ops\": %u,\n", STATS.mul_ops);
+	fprintf(out, "    \"div_ops\": %u,\n", STATS.div_ops);
+	fprintf(out, "    \"bp_resolved\": %u,\n", STATS.bp_resolved);
+	fprintf(out, "    \"bp_mispredicts\": %u,\n", STATS.bp_mispredicts);
+	cache_write_json(out, "icache", &STATS.icache);
+	cache_write_json(out, "dcache", &STATS.dcache);
+	cache_write_json(out, "l2", &STATS.l2);
+	fprintf(out, "    \"dram\": { \"reads\": %u, \"writes\": %u, \"row_hits\": %u, \"row_misses\": %u, "
+			"\"row_conflicts\": %u, \"queue_full_stalls\": %u, \"read_latency\": %u, \"bus_busy_cycles\": %u, \"regions\": {",
+			STATS.dram.reads, STATS.dram.writes, STATS.dram.row_hits, STATS.dram.row_misses, STATS.dram.row_conflicts,
+			STATS.dram.queue_full_stalls, STATS.dram.read_latency, STATS.dram.bus_busy_cycles);
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		fprintf(out, "%s\"%s\": %u", i == 0 ? " " : ", ", MEM_REGIONS[i].name, STATS.dram.region_accesses[i]);
+	}
+	fprintf(out, " } },\n");
+	fprintf(out, "    \"prefetch\": { \"issued\": %u, \"useful\": %u, \"late\": %u, \"late_cycles\": %u, "
+			"\"useless\": %u, \"misses\": %u },\n", STATS.prefetch.issued, STATS.prefetch.useful, STATS.prefetch.late,
+			STATS.prefetch.late_cycles, STATS.prefetch.useless, STATS.prefetch.misses);
+	fprintf(out, "    \"storebuf\": { \"stores\": %u, \"merged\": %u, \"drained\": %u, \"forwarded\": %u, \"conflicts\": %u, "
+			"\"conflict_cycles\": %u, \"port_cycles\": %u, \"full_stalls\": %u, \"full_stall_cycles\": %u },\n",
+			STATS.storebuf.stores, STATS.storebuf.merged, STATS.storebuf.drained, STATS.storebuf.forwarded,
+			STATS.storebuf.conflicts, STATS.storebuf.conflict_cycles, STATS.storebuf.port_cycles,
+			STATS.storebuf.full_stalls, STATS.storebuf.full_stall_cycles);
+	fprintf(out, "    \"issue\": { \"groups\": %u, \"dual\": %u, \"slot_committed\": [%u, %u], \"split\": {",
+			STATS.issue.groups, STATS.issue.dual, STATS.issue.slot_committed[0], STATS.issue.slot_committed[1]);
+	for (i = 0; i < NUM_PAIR_SPLIT; i++) {
+		fprintf(out, "%s\"%s\": %u", i == 0 ? " " : ", ", PAIR_SPLIT_NAMES[i], STATS.issue.split[i]);
+	}
+	fprintf(out, " } },\n");
+	fprintf(out, "    \"ooo\": { \"renamed\": %u, \"issued\": {", STATS.ooo.renamed);
+	for (i = 0; i < NUM_FU; i++) {
+		fprintf(out, "%s\"%s\": %u", i == 0 ? " " : ", ", FU_NAMES[i], STATS.ooo.issued[i]);
+	}
+	fprintf(out, " }, \"squashed\": %u, \"rob_full\": %u, \"rs_full\": %u, \"lsq_full\": %u, \"forwarded\": %u, "
+			"\"load_waits\": %u, \"rob_occupancy\": %u, \"code_flushes\": %u },\n", STATS.ooo.squashed,
+			STATS.ooo.rob_full, STATS.ooo.rs_full, STATS.ooo.lsq_full, STATS.ooo.forwarded, STATS.ooo.load_waits,
+			STATS.ooo.rob_occupancy, STATS.ooo.code_flushes);
+	fprintf(out, "    \"coherence\": { \"exclusive_fills\": %u, \"shared_fills\": %u, \"interventions\": %u, "
+			"\"upgrades\": %u, \"invalidations_sent\": %u, \"coherence_misses\": %u, \"snoop_cycles\": %u, "
+			"\"atomics\": %u, \"sc_failures\": %u },\n", STATS.coherence.exclusive_fills, STATS.coherence.shared_fills,
+			STATS.coherence.interventions, STATS.coherence.upgrades, STATS.coherence.invalidations_sent,
+			STATS.coherence.coherence_misses, STATS.coherence.snoop_cycles, STATS.coherence.atomics,
+			STATS.coherence.sc_failures);
+	fprintf(out, "    \"classes\": {\n");
+	for (i = 0; i < NUM_CLASSES; i++) {
+		fprintf(out, "      \"%s\": { \"committed\": %u, \"data_stall_cycles\": %u, \"control_stall_cycles\": %u }%s\n",
+				CLASS_NAMES[i], STATS.class_committed[i], STATS.class_data_stall_cycles[i],
+				STATS.class_control_stall_cycles[i], i == NUM_CLASSES - 1 ? "" : ",");
+	}
+	fprintf(out, "    }\n");
+	fprintf(out, "  }");
+}
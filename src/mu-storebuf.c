@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Store buffer timing between MEM and the D-cache.                                                  */
+/*                                                                                                                               */
+/* MEM_store() still writes guest memory in program order, so the buffer   */
+/* only decides when a store reaches the D-cache and how long loads wait.   */
+/* A store takes one entry per line (or shares one with an earlier store to */
+/* that line when merging is on) and MEM goes on at once unless the buffer */
+/* is full. Entries are written to the D-cache oldest first whenever its    */
+/* single port is free, which is worked out lazily at the next access, and  */
+/* leave the buffer once the write is done. A load whose bytes are all in  */
+/* the buffer is forwarded from it, a load that overlaps only part of the    */
+/* buffered stores waits until they have been written, any other load goes */
+/* to the D-cache ahead of the buffered stores.                                                  */
+/***************************************************************/
+#define STOREBUF_MAX_DEPTH 64
+
+typedef struct {
+	uint32_t line;		/* line address */
+	uint32_t arrival;		/* cycle the first store entered */
+	uint32_t done;		/* cycle its D-cache write is done, 0 until it started */
+} storebuf_entry_t;
+
+/* per simulator context (SIM->storebuf), allocated by the first access */
+struct storebuf_state {
+	storebuf_entry_t *entries;	/* oldest first */
+	uint8_t *written;		/* per entry, one flag per byte of the line */
+	uint32_t count;
+	uint32_t line_size;		/* D-cache line the entries were made for */
+	uint32_t port_ready;	/* cycle the D-cache port is free */
+};
+
+#define SB (SIM->storebuf)
+
+static struct storebuf_state *storebuf_get()
+{
+	//the entries hold D-cache lines, a new line size starts an empty buffer
+	if (SB != NULL && SB->line_size == DCACHE_CONFIG.line) {
+		return SB;
+	}
+	storebuf_release();
+	SB = calloc(1, sizeof(struct storebuf_state));
+	if (SB != NULL) {
+		SB->line_size = DCACHE_CONFIG.line;
+		SB->entries = calloc(STOREBUF_CONFIG.depth, sizeof(storebuf_entry_t));
+		SB->written = calloc(STOREBUF_CONFIG.depth, SB->line_size);
+	}
+	if (SB == NULL || (STOREBUF_CONFIG.depth > 0 && (SB->entries == NULL || SB->written == NULL))) {
+		printf("Error: out of host memory for the store buffer\n");
+		exit(-1);
+	}
+	return SB;
+}
+
+void storebuf_release()
+{
+	if (SB == NULL) {
+		return;
+	}
+	free(SB->entries);
+	free(SB->written);
+	free(SB);
+	SB = NULL;
+}
+
+/***************************************************************/
+/* Configuration: 'storebuf <depth|merge> <n>'                                                     */
+/***************************************************************/
+int storebuf_config_valid(const storebuf_config_t *config)
+{
+	return config->depth <= STOREBUF_MAX_DEPTH && config->merge <= 1;
+}
+
+int storebuf_param(const char *name, uint32_t value)
+{
+	storebuf_config_t config = STOREBUF_CONFIG;
+	if (strcmp(name, "depth") == 0) {
+		config.depth = value;
+	}else if (strcmp(name, "merge") == 0) {
+		config.merge = value != 0;
+	}else {
+		return FALSE;
+	}
+	if (!storebuf_config_valid(&config)) {
+		return FALSE;
+	}
+	STOREBUF_CONFIG = config;
+	storebuf_release();
+	return TRUE;
+}
+
+/***************************************************************/
+/* Draining                                                                                                                     */
+/***************************************************************/
+static uint32_t max_u32(uint32_t a, uint32_t b)
+{
+	return a > b ? a : b;
+}
+
+//Start writing the oldest entry to the D-cache as soon as the port and the entry are there.
+static void storebuf_start_oldest()
+{
+	uint32_t start = max_u32(SB->port_ready, SB->entries[0].arrival);
+	SB->port_ready = start + cache_data_access(0, SB->entries[0].line, TRUE, start);
+	SB->entries[0].done = SB->port_ready;
+	STATS.storebuf.drained++;
+}
+
+//Let the oldest entry finish its write and leave, returns the cycle that happens.
+static uint32_t storebuf_drain_oldest()
+{
+	uint32_t done;
+	if (SB->entries[0].done == 0) {
+		storebuf_start_oldest();
+	}
+	done = SB->entries[0].done;
+	SB->count--;
+	memmove(&SB->entries[0], &SB->entries[1], SB->count * sizeof(storebuf_entry_t));
+	memmove(SB->written, SB->written + SB->line_size, SB->count * SB->line_size);
+	return done;
+}
+
+//What the buffer got done before cycle now while MEM was busy with other things.
+static void storebuf_catch_up(uint32_t now)
+{
+	while (SB->count > 0) {
+		if (SB->entries[0].done == 0 && max_u32(SB->port_ready, SB->entries[0].arrival) < now) {
+			storebuf_start_oldest();
+		}else if (SB->entries[0].done != 0 && SB->entries[0].done <= now) {
+			storebuf_drain_oldest();
+		}else {
+			break;
+		}
+	}
+}
+
+/***************************************************************/
+/* A store of size bytes in MEM, returns the cycles it stalls                         */
+/***************************************************************/
+uint32_t storebuf_store(uint32_t address, uint32_t size)
+{
+	uint32_t now = CYCLE_COUNT, stall = 0;
+	uint32_t line, offset, i;
+
+	storebuf_get();
+	storebuf_catch_up(now);
+	STATS.storebuf.stores++;
+	line = address & ~(SB->line_size - 1);
+	offset = address - line;
+	//a store running past the end of its line is only tracked up to it, like the cache does
+	size = offset + size > SB->line_size ? SB->line_size - offset : size;
+
+	//an entry that is already being written cannot take more bytes
+	for (i = 0; STOREBUF_CONFIG.merge && i < SB->count; i++) {
+		if (SB->entries[i].line == line && SB->entries[i].done == 0) {
+			memset(SB->written + i * SB->line_size + offset, 1, size);
+			STATS.storebuf.merged++;
+			return 0;
+		}
+	}
+	if (SB->count == STOREBUF_CONFIG.depth) {
+		//full: wait until the oldest entry has been written
+		stall = storebuf_drain_oldest() - now;
+		STATS.storebuf.full_stalls++;
+		STATS.storebuf.full_stall_cycles += stall;
+	}
+	SB->entries[SB->count].line = line;
+	SB->entries[SB->count].arrival = now + stall;
+	SB->entries[SB->count].done = 0;
+	memset(SB->written + SB->count * SB->line_size, 0, SB->line_size);
+	memset(SB->written + SB->count * SB->line_size + offset, 1, size);
+	SB->count++;
+	return stall;
+}
+
+/***************************************************************/
+/* A load of size bytes from pc in MEM, returns the cycles it stalls          */
+/***************************************************************/
+uint32_t storebuf_load(uint32_t pc, uint32_t address, uint32_t size)
+{
+	uint32_t now = CYCLE_COUNT, start, latency;
+	uint32_t line, offset, i, b, covered = 0;
+	int youngest = -1;
+
+	storebuf_get();
+	storebuf_catch_up(now);
+	line = address & ~(SB->line_size - 1);
+	offset = address - line;
+	size = offset + size > SB->line_size ? SB->line_size - offset : size;
+
+	for (b = offset; b < offset + size; b++) {
+		for (i = SB->count; i-- > 0; ) {
+			if (SB->entries[i].line == line && SB->written[i * SB->line_size + b]) {
+				if ((int)i > youngest) {
+					youngest = i;
+				}
+				covered++;
+				break;
+			}
+		}
+	}
+	if (size > 0 && covered == size) {
+		STATS.storebuf.forwarded++;
+		return 0;
+	}
+	if (youngest >= 0) {
+		//partly overlapping: the stores up to the youngest one involved go to the D-cache first
+		STATS.storebuf.conflicts++;
+		for (i = 0; i <= (uint32_t)youngest; i++) {
+			storebuf_drain_oldest();
+		}
+	}
+	start = max_u32(now, SB->port_ready);
+	if (youngest >= 0) {
+		STATS.storebuf.conflict_cycles += start - now;
+	}else {
+		STATS.storebuf.port_cycles += start - now;
+	}
+	latency = cache_data_access(pc, address, FALSE, start);
+	STATS.dcache.stall_cycles += latency - 1;
+	SB->port_ready = start + latency;
+	return start - now + latency - 1;
+}
+
+/***************************************************************/
+/* The buffered entries as one blob for checkpoints                                               */
+/***************************************************************/
+static size_t storebuf_blob_size()
+{
+	return 3 * 4 + STOREBUF_CONFIG.depth * (12 + DCACHE_CONFIG.line);
+}
+
+uint8_t *storebuf_snapshot(size_t *size)
+{
+	uint8_t *blob, *p;
+	uint32_t i;
+
+	storebuf_get();
+	*size = storebuf_blob_size();
+	blob = p = calloc(1, *size);
+	if (blob == NULL) {
+		printf("Error: out of host memory for the store buffer\n");
+		exit(-1);
+	}
+	mem_store_le32(p, SB->count);
+	mem_store_le32(p + 4, SB->line_size);
+	mem_store_le32(p + 8, SB->port_ready);
+	p += 12;
+	for (i = 0; i < SB->count; i++, p += 12) {
+		mem_store_le32(p, SB->entries[i].line);
+		mem_store_le32(p + 4, SB->entries[i].arrival);
+		mem_store_le32(p + 8, SB->entries[i].done);
+	}
+	p = blob + 12 + STOREBUF_CONFIG.depth * 12;
+	memcpy(p, SB->written, SB->count * SB->line_size);
+	return blob;
+}
+
+//After the D-cache configuration has been restored.
+int storebuf_restore(const uint8_t *blob, size_t size)
+{
+	const uint8_t *p = blob;
+	uint32_t i;
+
+	storebuf_release();
+	if (size != storebuf_blob_size() || mem_load_le32(p) > STOREBUF_CONFIG.depth ||
+			mem_load_le32(p + 4) != DCACHE_CONFIG.line) {
+		return FALSE;
+	}
+	storebuf_get();
+	SB->count = mem_load_le32(p);
+	SB->port_ready = mem_load_le32(p + 8);
+	p += 12;
+	for (i = 0; i < SB->count; i++, p += 12) {
+		SB->entries[i].line = mem_load_le32(p);
+		SB->entries[i].arrival = mem_load_le32(p + 4);
+		SB->entries[i].done = mem_load_le32(p + 8);
+	}
+	p = blob + 12 + STOREBUF_CONFIG.depth * 12;
+	memcpy(SB->written, p, SB->count * SB->line_size);
+	return TRUE;
+}
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Sweep runner: one simulator context per job, jobs spread over a pool of    */
+/* worker threads.                                                                                                               */
+/*                                                                                                                               */
+/* Every job line of the jobs file is '<program> [command; command ...]'.    */
+/* The commands are the interactive ones (forwarding 1; ff 1000; sim ...)    */
+/* and run in batch mode; a job without commands runs 'sim'. Each worker owns */
+/* a deque of jobs, takes work from its own end and steals from the other end */
+/* of another worker's deque once its own is empty. Results are kept per job  */
+/* and written as one CSV in job order, whatever order the jobs finished in.  */
+/***************************************************************/
+#define SWEEP_MAX_LINE 1024
+
+typedef struct {
+	char *program;
+	char *commands;		/* newline separated, ready for handle_command() */
+	char *spec;		/* commands as given in the jobs file, for the CSV */
+	/* results */
+	uint32_t completed;
+	uint32_t cycles;
+	uint32_t instructions;
+	uint32_t pc;
+} sweep_job_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	uint32_t *jobs;		/* job indices, the owner pops at tail, thieves take at head */
+	uint32_t head, tail;
+} sweep_deque_t;
+
+typedef struct {
+	sweep_job_t *jobs;
+	sweep_deque_t *deques;
+	int threads;
+} sweep_pool_t;
+
+typedef struct {
+	sweep_pool_t *pool;
+	int id;
+} sweep_worker_t;
+
+/***************************************************************/
+/* Take a job: own deque first (newest end), then steal (oldest end)          */
+/***************************************************************/
+static int sweep_take(sweep_pool_t *pool, int id, uint32_t *job)
+{
+	sweep_deque_t *q;
+	int i, found = FALSE;
+
+	for (i = 0; i < pool->threads && !found; i++) {
+		q = &pool->deques[(id + i) % pool->threads];
+		pthread_mutex_lock(&q->lock);
+		if (q->head != q->tail) {
+			*job = i == 0 ? q->jobs[--q->tail] : q->jobs[q->head++];
+			found = TRUE;
+		}
+		pthread_mutex_unlock(&q->lock);
+	}
+	//jobs are only handed out at start, so once every deque is empty the sweep is done
+	return found;
+}
+
+/***************************************************************/
+/* Simulate one job in a context of its own                                                         */
+/***************************************************************/
+static void sweep_job(sweep_job_t *job)
+{
+	SIM = sim_create();
+	QUIET = TRUE;
+	BATCH_MODE = TRUE;
+	sim_start(job->program);
+	COMMAND_INPUT = fmemopen(job->commands, strlen(job->commands), "r");
+	if (COMMAND_INPUT == NULL) {
+		printf("Error: Can't run the commands of %s\n", job->program);
+		exit(-1);
+	}
+	while (handle_command()) {
+	}
+	fclose(COMMAND_INPUT);
+	job->completed = RUN_FLAG == FALSE;
+	job->cycles = CYCLE_COUNT;
+	job->instructions = INSTRUCTION_COUNT;
+	job->pc = CURRENT_STATE.PC;
+	sim_destroy(SIM);
+}
+
+static void *sweep_worker(void *arg)
+{
+	sweep_worker_t *worker = arg;
+	uint32_t job;
+
+	while (sweep_take(worker->pool, worker->id, &job)) {
+		sweep_job(&worker->pool->jobs[job]);
+	}
+	return NULL;
+}
+
+/***************************************************************/
+/* Parse the jobs file, FALSE on error                                                                       */
+/***************************************************************/
+static char *sweep_strdup(const char *str)
+{
+	char *copy = malloc(strlen(str) + 1);
+	if (copy == NULL) {
+		printf("Error: out of host memory for the sweep\n");
+		exit(-1);
+	}
+	return strcpy(copy, str);
+}
+
+static int sweep_parse(const char *jobs_file, sweep_job_t **jobs, uint32_t *count)
+{
+	char line[SWEEP_MAX_LINE], *program, *spec, *c;
+	uint32_t capacity = 0, lineno = 0;
+	FILE *fp, *check;
+
+	fp = fopen(jobs_file, "r");
+	if (fp == NULL) {
+		printf("Error: Can't open jobs file %s\n", jobs_file);
+		return FALSE;
+	}
+	*jobs = NULL;
+	*count = 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		program = line + strspn(line, " \t");
+		if (*program == '\0' || *program == '#') {
+			continue;
+		}
+		spec = program + strcspn(program, " \t");
+		if (*spec != '\0') {
+			*spec++ = '\0';
+			spec += strspn(spec, " \t");
+		}
+		//a missing program would end the whole sweep from inside a worker
+		check = fopen(program, "r");
+		if (check == NULL) {
+			printf("Error: %s:%u: Can't open program file %s\n", jobs_file, lineno, program);
+			fclose(fp);
+			return FALSE;
+		}
+		fclose(check);
+		if (*count == capacity) {
+			capacity = capacity == 0 ? 64 : capacity * 2;
+			*jobs = realloc(*jobs, capacity * sizeof(sweep_job_t));
+			if (*jobs == NULL) {
+				printf("Error: out of host memory for the sweep\n");
+				exit(-1);
+			}
+		}
+		memset(&(*jobs)[*count], 0, sizeof(sweep_job_t));
+		(*jobs)[*count].program = sweep_strdup(program);
+		(*jobs)[*count].spec = sweep_strdup(spec);
+		(*jobs)[*count].commands = sweep_strdup(*spec == '\0' ? "sim" : spec);
+		for (c = (*jobs)[*count].commands; *c != '\0'; c++) {
+			if (*c == ';') {
+				*c = '\n';
+			}
+		}
+		(*count)++;
+	}
+	fclose(fp);
+	return TRUE;
+}
+
+static void csv_field(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str != '\0'; str++) {
+		if (*str == '"') {
+			fputc('"', out);
+		}
+		fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+/***************************************************************/
+/* Run every job of jobs_file on threads workers (0 = one per core), write */
+/* the CSV to out. Returns the process exit status.                                                  */
+/***************************************************************/
+int sweep_run(const char *jobs_file, int threads, FILE *out)
+{
+	sweep_job_t *jobs;
+	sweep_pool_t pool;
+	sweep_worker_t *workers;
+	pthread_t *tids;
+	uint32_t count, i;
+	int t;
+
+	if (!sweep_parse(jobs_file, &jobs, &count)) {
+		return 1;
+	}
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (threads <= 0) {
+		threads = 1;
+	}
+	if ((uint32_t)threads > count && count > 0) {
+		threads = count;
+	}
+
+	pool.jobs = jobs;
+	pool.threads = threads;
+	pool.deques = calloc(threads, sizeof(sweep_deque_t));
+	workers = calloc(threads, sizeof(sweep_worker_t));
+	tids = calloc(threads, sizeof(pthread_t));
+	if (pool.deques == NULL || workers == NULL || tids == NULL) {
+		printf("Error: out of host memory for the sweep\n");
+		exit(-1);
+	}
+	for (t = 0; t < threads; t++) {
+		pthread_mutex_init(&pool.deques[t].lock, NULL);
+		pool.deques[t].jobs = malloc((count / threads + 1) * sizeof(uint32_t));
+		if (pool.deques[t].jobs == NULL) {
+			printf("Error: out of host memory for the sweep\n");
+			exit(-1);
+		}
+	}
+	//deal the jobs round-robin, stealing evens out programs of different length
+	for (i = 0; i < count; i++) {
+		sweep_deque_t *q = &pool.deques[i % threads];
+		q->jobs[q->tail++] = i;
+	}
+	for (t = 0; t < threads; t++) {
+		workers[t].pool = &pool;
+		workers[t].id = t;
+		if (pthread_create(&tids[t], NULL, sweep_worker, &workers[t]) != 0) {
+			printf("Error: Can't start sweep worker %d\n", t);
+			exit(-1);
+		}
+	}
+	for (t = 0; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+	}
+
+	fprintf(out, "job,program,commands,completed,cycles,instructions,pc\n");
+	for (i = 0; i < count; i++) {
+		fprintf(out, "%u,", i);
+		csv_field(out, jobs[i].program);
+		fputc(',', out);
+		csv_field(out, jobs[i].spec);
+		fprintf(out, ",%u,%u,%u,0x%08x\n", jobs[i].completed, jobs[i].cycles, jobs[i].instructions, jobs[i].pc);
+		free(jobs[i].program);
+		free(jobs[i].spec);
+		free(jobs[i].commands);
+	}
+	for (t = 0; t < threads; t++) {
+		pthread_mutex_destroy(&pool.deques[t].lock);
+		free(pool.deques[t].jobs);
+	}
+	free(pool.deques);
+	free(workers);
+	free(tids);
+	free(jobs);
+	return 0;
+}
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Threaded-code engine for the functional mode.                                                      */
+/*                                                                                                                               */
+/* The text segment is translated once into an array of slots, one per word,   */
+/* holding the handler, the register operands, the immediate and, for          */
+/* branches and jal, a pointer to the target slot. With GCC/clang each slot  */
+/* stores the address of its handler label and dispatch is a single indirect  */
+/* jump at the end of every handler (direct threading). Other compilers get */
+/* the same handlers in a switch.                                                                              */
+/***************************************************************/
+#if defined(__GNUC__) && !defined(MU_NO_COMPUTED_GOTO)
+#define THREADED_DISPATCH 1
+#endif
+
+/* handlers for the decoded ops reuse the op_t values, these come after them */
+enum {
+	T_EXIT = NUM_OPS,	/* leave the translated code, the driver takes over at this slot */
+	T_INTERP,		/* hand the instruction to func_step() */
+	T_NOP,		/* no architectural effect (e.g. writes to x0) */
+	T_STOP,		/* marks the 'ff @<pc>' stop address */
+	NUM_THREADED_OPS
+};
+
+typedef struct threaded_inst_struct {
+#ifdef THREADED_DISPATCH
+	const void *handler;
+#endif
+	uint16_t op;
+	uint8_t rd, rs1, rs2;
+	int32_t imm;
+	struct threaded_inst_struct *target;	/* pre-bound branch/jal target */
+} threaded_inst_t;
+
+/* per simulator context (SIM->threaded), allocated by the first threaded_run() */
+struct threaded_state {
+	threaded_inst_t *code;	/* PROGRAM_SIZE slots plus a trailing exit slot */
+	uint32_t size;		/* translated words */
+	uint32_t stop;		/* slot holding T_STOP */
+#ifdef THREADED_DISPATCH
+	const void * const *labels;
+#endif
+};
+
+#define THREADED_CODE (SIM->threaded->code)
+#define THREADED_SIZE (SIM->threaded->size)
+#define THREADED_STOP (SIM->threaded->stop)
+#define THREADED_LABELS (SIM->threaded->labels)
+
+static uint32_t threaded_exec(threaded_inst_t *ip, uint32_t budget);
+
+/***************************************************************/
+/* Translate the text word behind one slot                                                              */
+/***************************************************************/
+static void threaded_translate_slot(uint32_t idx)
+{
+	threaded_inst_t *slot = &THREADED_CODE[idx];
+	uint32_t pc = MEM_TEXT_BEGIN + idx * 4;
+	const decoded_inst_t *d;
+	uint32_t target;
+
+	memset(slot, 0, sizeof(*slot));
+	if (idx == THREADED_STOP) {
+		slot->op = T_STOP;
+	}else if (idx >= THREADED_SIZE) {
+		slot->op = T_EXIT;
+	}else {
+		d = predecode(pc);
+		slot->op = d->op;
+		slot->rd = d->rd;
+		slot->rs1 = d->rs1;
+		slot->rs2 = d->rs2;
+		slot->imm = d->imm;
+		switch (d->cls) {
+			case CLASS_NONE:
+				//the driver ends the program on an empty word, anything else is skipped like in the pipeline
+				slot->op = d->raw == 0 ? T_EXIT : T_NOP;
+				break;
+			case CLASS_ALU:
+			case CLASS_ALU_IMM:
+			case CLASS_LOAD:
+				//atomics write memory even when they don't write a register, multiplies and divides have no handlers
+				if (d->op == OP_INVALID || op_is_atomic(d->op) || (op_is_muldiv(d->op) && d->writes_rd)) {
+					slot->op = T_INTERP;
+				}else if (!d->writes_rd) {
+					slot->op = T_NOP;
+				}
+				break;
+			case CLASS_STORE:
+				if (d->op == OP_INVALID) {
+					slot->op = T_INTERP;
+				}
+				break;
+			case CLASS_BRANCH:
+			case CLASS_JUMP:
+				if (d->op == OP_INVALID) {
+					slot->op = T_INTERP;
+					break;
+				}
+				if (d->op == OP_JALR) {
+					break;
+				}
+				//targets inside the translated code are bound now, the rest go through the interpreter
+				target = pc + d->imm - MEM_TEXT_BEGIN;
+				if (target <= THREADED_SIZE * 4 && (target & 3) == 0) {
+					slot->target = &THREADED_CODE[target >> 2];
+				}else {
+					slot->op = T_INTERP;
+				}
+				break;
+			default:
+				slot->op = T_INTERP;
+				break;
+		}
+	}
+#ifdef THREADED_DISPATCH
+	slot->handler = THREADED_LABELS[slot->op];
+#endif
+}
+
+/***************************************************************/
+/* Translate the whole text segment                                                                          */
+/***************************************************************/
+static void threaded_translate()
+{
+	uint32_t i;
+#ifdef THREADED_DISPATCH
+	if (THREADED_LABELS == NULL) {
+		threaded_exec(NULL, 0);
+	}
+#endif
+	THREADED_SIZE = PROGRAM_SIZE;
+	THREADED_CODE = calloc(THREADED_SIZE + 1, sizeof(threaded_inst_t));
+	if (THREADED_CODE == NULL) {
+		printf("Error: out of host memory for the threaded code\n");
+		exit(-1);
+	}
+	for (i = 0; i <= THREADED_SIZE; i++) {
+		threaded_translate_slot(i);
+	}
+}
+
+/***************************************************************/
+/* Drop the translation (new program loaded)                                                             */
+/***************************************************************/
+void threaded_flush()
+{
+	if (SIM->threaded == NULL) {
+		return;
+	}
+	free(THREADED_CODE);
+	THREADED_CODE = NULL;
+	THREADED_SIZE = 0;
+}
+
+/***************************************************************/
+/* Free everything the context's threaded engine holds                                      */
+/***************************************************************/
+void threaded_release()
+{
+	threaded_flush();
+	free(SIM->threaded);
+	SIM->threaded = NULL;
+}
+
+/***************************************************************/
+/* Retranslate the slots a store to the text segment overlapped                          */
+/***************************************************************/
+void threaded_invalidate(uint32_t address)
+{
+	uint32_t offset = address - MEM_TEXT_BEGIN;
+	if (SIM->threaded == NULL || THREADED_CODE == NULL || offset >= THREADED_SIZE * 4) {
+		return;
+	}
+	threaded_translate_slot(offset >> 2);
+	if ((offset & 3) != 0 && (offset >> 2) + 1 < THREADED_SIZE) {
+		threaded_translate_slot((offset >> 2) + 1);
+	}
+}
+
+/***************************************************************/
+/* Run translated code from ip for at most budget instructions                               */
+/***************************************************************/
+#define SLOT_PC(ip) (MEM_TEXT_BEGIN + (uint32_t)((ip) - THREADED_CODE) * 4)
+
+#ifdef THREADED_DISPATCH
+#define HANDLER(op)	L_##op:
+#define DISPATCH()	goto *ip->handler
+#else
+#define HANDLER(op)	case op:
+#define DISPATCH()	continue
+#endif
+/* every handler ends by moving ip and checking the instruction budget (no do/while, continue has to reach the switch loop) */
+#define NEXT()		{ ip++; if (--left == 0) goto out; DISPATCH(); }
+#define BRANCH(cond)	{ ip = (cond) ? ip->target : ip + 1; if (--left == 0) goto out; DISPATCH(); }
+
+static uint32_t threaded_exec(threaded_inst_t *ip, uint32_t budget)
+{
+	uint32_t *R = CURRENT_STATE.REGS;
+	uint32_t left = budget;
+	uint32_t interpreted = 0;
+	uint32_t target;
+
+#ifdef THREADED_DISPATCH
+	static const void * const labels[NUM_THREADED_OPS] = {
+		[OP_INVALID] = &&L_T_INTERP, [OP_ECALL] = &&L_T_INTERP,
+		[OP_ADD] = &&L_OP_ADD, [OP_SUB] = &&L_OP_SUB, [OP_SLL] = &&L_OP_SLL, [OP_XOR] = &&L_OP_XOR,
+		[OP_SRL] = &&L_OP_SRL, [OP_SRA] = &&L_OP_SRA, [OP_OR] = &&L_OP_OR, [OP_AND] = &&L_OP_AND,
+		[OP_ADDI] = &&L_OP_ADDI, [OP_XORI] = &&L_OP_XORI, [OP_ORI] = &&L_OP_ORI, [OP_ANDI] = &&L_OP_ANDI,
+		[OP_SLLI] = &&L_OP_SLLI, [OP_SRLI] = &&L_OP_SRLI, [OP_SRAI] = &&L_OP_SRAI,
+		[OP_LB] = &&L_OP_LB, [OP_LH] = &&L_OP_LH, [OP_LW] = &&L_OP_LW, [OP_LBU] = &&L_OP_LBU, [OP_LHU] = &&L_OP_LHU,
+		[OP_SB] = &&L_OP_SB, [OP_SH] = &&L_OP_SH, [OP_SW] = &&L_OP_SW,
+		[OP_BEQ] = &&L_OP_BEQ, [OP_BNE] = &&L_OP_BNE, [OP_BLT] = &&L_OP_BLT, [OP_BGE] = &&L_OP_BGE,
+		[OP_BLTU] = &&L_OP_BLTU, [OP_BGEU] = &&L_OP_BGEU,
+		[OP_JAL] = &&L_OP_JAL, [OP_JALR] = &&L_OP_JALR,
+		[T_EXIT] = &&L_T_EXIT, [T_INTERP] = &&L_T_INTERP, [T_NOP] = &&L_T_NOP, [T_STOP] = &&L_T_STOP,
+	};
+	if (ip == NULL) {
+		//first call only hands out the label addresses for translation
+		THREADED_LABELS = labels;
+		return 0;
+	}
+	DISPATCH();
+#else
+	for (;;) switch (ip->op) {
+#endif
+
+	HANDLER(OP_ADD)		R[ip->rd] = R[ip->rs1] + R[ip->rs2]; NEXT();
+	HANDLER(OP_SUB)		R[ip->rd] = R[ip->rs1] - R[ip->rs2]; NEXT();
+	HANDLER(OP_SLL)		R[ip->rd] = R[ip->rs1] << (R[ip->rs2] & 31); NEXT();
+	HANDLER(OP_XOR)		R[ip->rd] = R[ip->rs1] ^ R[ip->rs2]; NEXT();
+	HANDLER(OP_SRL)		R[ip->rd] = R[ip->rs1] >> (R[ip->rs2] & 31); NEXT();
+	HANDLER(OP_SRA)		R[ip->rd] = (uint32_t)((int32_t)R[ip->rs1] >> (R[ip->rs2] & 31)); NEXT();
+	HANDLER(OP_OR)		R[ip->rd] = R[ip->rs1] | R[ip->rs2]; NEXT();
+	HANDLER(OP_AND)		R[ip->rd] = R[ip->rs1] & R[ip->rs2]; NEXT();
+
+	HANDLER(OP_ADDI)	R[ip->rd] = R[ip->rs1] + ip->imm; NEXT();
+	HANDLER(OP_XORI)	R[ip->rd] = R[ip->rs1] ^ ip->imm; NEXT();
+	HANDLER(OP_ORI)		R[ip->rd] = R[ip->rs1] | ip->imm; NEXT();
+	HANDLER(OP_ANDI)	R[ip->rd] = R[ip->rs1] & ip->imm; NEXT();
+	HANDLER(OP_SLLI)	R[ip->rd] = R[ip->rs1] << ip->imm; NEXT();
+	HANDLER(OP_SRLI)	R[ip->rd] = R[ip->rs1] >> ip->imm; NEXT();
+	HANDLER(OP_SRAI)	R[ip->rd] = (uint32_t)((int32_t)R[ip->rs1] >> ip->imm); NEXT();
+
+	HANDLER(OP_LB)		R[ip->rd] = (int32_t)(int8_t)mem_read_32(R[ip->rs1] + ip->imm); NEXT();
+	HANDLER(OP_LH)		R[ip->rd] = (int32_t)(int16_t)mem_read_32(R[ip->rs1] + ip->imm); NEXT();
+	HANDLER(OP_LW)		R[ip->rd] = mem_read_32(R[ip->rs1] + ip->imm); NEXT();
+	HANDLER(OP_LBU)		R[ip->rd] = mem_read_32(R[ip->rs1] + ip->imm) & 255; NEXT();
+	HANDLER(OP_LHU)		R[ip->rd] = mem_read_32(R[ip->rs1] + ip->imm) & 65535; NEXT();
+
+	//stores into the text segment retranslate the slots they hit from inside the memory writes
+	HANDLER(OP_SB)		mem_write_sub(R[ip->rs1] + ip->imm, R[ip->rs2], 1); NEXT();
+	HANDLER(OP_SH)		mem_write_sub(R[ip->rs1] + ip->imm, R[ip->rs2], 2); NEXT();
+	HANDLER(OP_SW)		mem_write_32(R[ip->rs1] + ip->imm, R[ip->rs2]); NEXT();
+
+	HANDLER(OP_BEQ)		BRANCH(R[ip->rs1] == R[ip->rs2]);
+	HANDLER(OP_BNE)		BRANCH(R[ip->rs1] != R[ip->rs2]);
+	HANDLER(OP_BLT)		BRANCH((int32_t)R[ip->rs1] < (int32_t)R[ip->rs2]);
+	HANDLER(OP_BGE)		BRANCH((int32_t)R[ip->rs1] >= (int32_t)R[ip->rs2]);
+	HANDLER(OP_BLTU)	BRANCH(R[ip->rs1] < R[ip->rs2]);
+	HANDLER(OP_BGEU)	BRANCH(R[ip->rs1] >= R[ip->rs2]);
+
+	HANDLER(OP_JAL)
+		R[ip->rd] = SLOT_PC(ip) + 4;
+		R[0] = 0;
+		BRANCH(TRUE);
+	HANDLER(OP_JALR)
+		target = (R[ip->rs1] + ip->imm) & ~1u;
+		R[ip->rd] = SLOT_PC(ip) + 4;
+		R[0] = 0;
+		if (target - MEM_TEXT_BEGIN > THREADED_SIZE * 4 || (target & 3) != 0) {
+			//leaving the translated code, the driver continues with the interpreter
+			left--;
+			CURRENT_STATE.PC = target;
+			goto out_pc;
+		}
+		ip = &THREADED_CODE[(target - MEM_TEXT_BEGIN) >> 2];
+		if (--left == 0) goto out;
+		DISPATCH();
+
+	HANDLER(T_NOP)		NEXT();
+	HANDLER(T_INTERP)
+		CURRENT_STATE.PC = SLOT_PC(ip);
+		func_step();
+		interpreted++;
+		left--;
+		target = CURRENT_STATE.PC - MEM_TEXT_BEGIN;
+		if (RUN_FLAG == FALSE || left == 0 || target > THREADED_SIZE * 4 || (target & 3) != 0) {
+			goto out_pc;
+		}
+		ip = &THREADED_CODE[target >> 2];
+		DISPATCH();
+	HANDLER(T_EXIT)
+	HANDLER(T_STOP)
+		goto out;
+
+#ifndef THREADED_DISPATCH
+	}
+#endif
+
+out:
+	CURRENT_STATE.PC = SLOT_PC(ip);
+out_pc:
+	//func_step() already counted the instructions it ran
+	INSTRUCTION_COUNT += budget - left - interpreted;
+	return budget - left;
+}
+
+/***************************************************************/
+/* Fast-forward with the threaded engine, returns instructions executed        */
+/***************************************************************/
+uint32_t threaded_run(uint32_t count, uint32_t stop_pc, int to_pc)
+{
+	uint32_t executed = 0, offset, n;
+
+	if (SIM->threaded == NULL) {
+		SIM->threaded = calloc(1, sizeof(struct threaded_state));
+		if (SIM->threaded == NULL) {
+			printf("Error: out of host memory for the threaded code\n");
+			exit(-1);
+		}
+		THREADED_STOP = UINT32_MAX;
+	}
+	if (THREADED_CODE == NULL || THREADED_SIZE != PROGRAM_SIZE) {
+		threaded_flush();
+		threaded_translate();
+	}
+	if (to_pc && stop_pc - MEM_TEXT_BEGIN < THREADED_SIZE * 4 && (stop_pc & 3) == 0) {
+		THREADED_STOP = (stop_pc - MEM_TEXT_BEGIN) >> 2;
+		threaded_translate_slot(THREADED_STOP);
+	}
+	while (RUN_FLAG && (to_pc ? CURRENT_STATE.PC != stop_pc : executed < count)) {
+		offset = CURRENT_STATE.PC - MEM_TEXT_BEGIN;
+		if (offset <= THREADED_SIZE * 4 && (offset & 3) == 0) {
+			n = threaded_exec(&THREADED_CODE[offset >> 2], to_pc ? UINT32_MAX : count - executed);
+			executed += n;
+			if (n > 0) {
+				continue;
+			}
+		}
+		//outside the translated code or at its exit slot
+		if (!func_step()) {
+			RUN_FLAG = FALSE;
+			break;
+		}
+		executed++;
+	}
+	if (THREADED_STOP != UINT32_MAX) {
+		offset = THREADED_STOP;
+		THREADED_STOP = UINT32_MAX;
+		threaded_translate_slot(offset);
+	}
+	return executed;
+}
@@ -0,0 +1,725 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mu-riscv.h"
+
+/***************************************************************/
+/* Execution traces: every retired instruction with its PC, instruction   */
+/* word, the value it wrote to rd and the address, size and value of its    */
+/* memory access.                                                                                                         */
+/*                                                                                                                               */
+/* After an 8 byte magic and a version word the file is a list of blocks,   */
+/* each three little-endian words (records, raw size, stored size) and the */
+/* stored bytes: compressed if the stored size is below the raw size, raw  */
+/* otherwise. A record is a flags byte and the fields the flags call for.  */
+/* PCs, register values and addresses are delta-encoded against the last  */
+/* ones seen, the data of a load or store against the register it goes to */
+/* or comes from, and written as zigzag varints. Instruction words are only */
+/* written when they are not in a small PC-indexed word cache. All of that */
+/* starts over with each block, so blocks decode on their own.                   */
+/*                                                                                                                               */
+/* The simulator encodes into one block while a writer thread compresses   */
+/* and writes the other; it only waits when it fills a block before the   */
+/* previous one is on disk. The compressor is a byte-oriented LZ77 in the  */
+/* style of LZ4: a token with the literal and match lengths, the literals, */
+/* a 16 bit offset back into the block.                                                                      */
+/*                                                                                                                               */
+/* A replay reads the records back for the pipeline (see IF_word and     */
+/* EX_replay), decoding blocks as fetch gets to them. Decoded records are */
+/* kept in a ring so fetch can go back to the one after a mispredicted   */
+/* jump or branch. A replay gives the cycles of execution but is not much */
+/* cheaper: the pipeline stages are most of the time either way, the ALU  */
+/* and memory work it skips under 2% of it.                                                      */
+/***************************************************************/
+#define TRACE_MAGIC "MURVTRCE"
+#define TRACE_VERSION 1
+
+#define TRACE_BLOCK (256 * 1024)
+#define TRACE_RECORD_MAX 32		/* flags, 3 varints, word and data */
+#define TRACE_WORDS 1024		/* instruction word cache, power of two */
+#define TRACE_HASH_BITS 12
+#define REPLAY_RING 4096		/* decoded records kept, far more than the pipeline holds */
+
+/* record flags */
+#define TRACE_JUMP 0x01		/* PC is not the previous PC + 4, delta follows */
+#define TRACE_WORD 0x02		/* instruction word follows, it missed the word cache */
+#define TRACE_VALUE 0x04		/* rd value delta follows (loads carry theirs as data) */
+#define TRACE_LOAD 0x08		/* address delta and data follow, both bits for an atomic */
+#define TRACE_STORE 0x10
+#define TRACE_SIZE_SHIFT 5		/* log2 of the access size */
+
+typedef struct {
+	uint32_t pc;
+	uint32_t word;
+} trace_word_t;
+
+struct trace_state {
+	FILE *file;
+	char name[256];
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* the block the simulator fills and the one the writer has, double buffered */
+	uint8_t *block[2];
+	uint32_t filling;
+	uint32_t used;
+	uint32_t records;
+	/* handed to the writer and not on disk yet */
+	int pending;
+	uint32_t pending_used;
+	uint32_t pending_records;
+	int closing;
+	int failed;
+	uint8_t *packed;	/* compressor output, only the writer uses it */
+	/* encoder state, starts over with each block */
+	uint32_t pc;
+	uint32_t regs[RISCV_REGS];
+	uint32_t address;
+	trace_word_t words[TRACE_WORDS];
+	/* totals */
+	uint64_t instructions;
+	uint64_t raw_bytes;
+	uint64_t file_bytes;
+};
+
+struct replay_state {
+	FILE *file;
+	char name[256];
+	uint8_t *block;
+	uint8_t *packed;
+	uint32_t used;		/* bytes in the decoded block */
+	uint32_t position;	/* next record in it */
+	uint32_t left;		/* records in it not decoded yet */
+	/* decoder state, starts over with each block */
+	uint32_t pc;
+	uint32_t regs[RISCV_REGS];
+	uint32_t address;
+	trace_word_t words[TRACE_WORDS];
+	/* records by sequence number (from 1), those before decoded - REPLAY_RING are gone */
+	trace_record_t ring[REPLAY_RING];
+	uint32_t decoded;
+	uint32_t cursor;	/* the record the next fetch on the right path takes */
+	int end;
+};
+
+#define T (SIM->trace)
+#define R (SIM->replay)
+
+/***************************************************************/
+/* Block compression                                                                                                     */
+/***************************************************************/
+static uint32_t read_le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint8_t *put_length(uint8_t *out, uint32_t length)
+{
+	while (length >= 255) {
+		*out++ = 255;
+		length -= 255;
+	}
+	*out++ = length;
+	return out;
+}
+
+//Literals before a match (or the end of the block) and the match itself, offset 0 for none.
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *literals, uint32_t count, uint32_t offset, uint32_t length)
+{
+	uint8_t *token = out++;
+
+	*token = (count < 15 ? count : 15) << 4;
+	if (count >= 15) {
+		out = put_length(out, count - 15);
+	}
+	memcpy(out, literals, count);
+	out += count;
+	if (offset == 0) {
+		return out;
+	}
+	*out++ = offset & 0xFF;
+	*out++ = offset >> 8;
+	length -= 4;
+	*token |= length < 15 ? length : 15;
+	if (length >= 15) {
+		out = put_length(out, length - 15);
+	}
+	return out;
+}
+
+//Compressed size of size bytes, 0 if that does not come out below size.
+static uint32_t trace_compress(const uint8_t *in, uint32_t size, uint8_t *out)
+{
+	uint32_t table[1 << TRACE_HASH_BITS];
+	uint32_t i = 0, anchor = 0, match, length, h;
+	uint8_t *o = out;
+
+	memset(table, 0, sizeof(table));
+	//the last few bytes are always literals, so matches never read past the end
+	while (i + 8 <= size) {
+		h = (read_le32(in + i) * 2654435761u) >> (32 - TRACE_HASH_BITS);
+		match = table[h];
+		table[h] = i + 1;
+		if (match == 0 || i - (match - 1) > 0xFFFF || read_le32(in + match - 1) != read_le32(in + i)) {
+			i++;
+			continue;
+		}
+		match--;
+		for (length = 4; i + length < size && in[match + length] == in[i + length]; length++) {
+		}
+		//a sequence never grows by more than its literals plus a few bytes
+		if ((uint32_t)(o - out) + (i - anchor) + (i - anchor) / 255 + length / 255 + 8 >= size) {
+			return 0;
+		}
+		o = put_sequence(o, in + anchor, i - anchor, i - match, length);
+		i += length;
+		anchor = i;
+	}
+	if ((uint32_t)(o - out) + (size - anchor) + (size - anchor) / 255 + 2 >= size) {
+		return 0;
+	}
+	o = put_sequence(o, in + anchor, size - anchor, 0, 0);
+	return o - out;
+}
+
+//Decompress stored bytes into exactly size bytes, FALSE if they don't.
+static int trace_decompress(const uint8_t *in, uint32_t stored, uint8_t *out, uint32_t size)
+{
+	const uint8_t *end = in + stored;
+	uint32_t o = 0, count, offset, b;
+
+	while (in < end) {
+		b = *in++;
+		count = b >> 4;
+		if (count == 15) {
+			do {
+				if (in == end) {
+					return FALSE;
+				}
+				count += *in;
+			} while (*in++ == 255);
+		}
+		if (count > (uint32_t)(end - in) || count > size - o) {
+			return FALSE;
+		}
+		memcpy(out + o, in, count);
+		in += count;
+		o += count;
+		if (in == end) {
+			break;
+		}
+		if (end - in < 2) {
+			return FALSE;
+		}
+		offset = in[0] | (in[1] << 8);
+		in += 2;
+		count = (b & 15) + 4;
+		if ((b & 15) == 15) {
+			do {
+				if (in == end) {
+					return FALSE;
+				}
+				count += *in;
+			} while (*in++ == 255);
+		}
+		if (offset == 0 || offset > o || count > size - o) {
+			return FALSE;
+		}
+		//the match may overlap what it copies
+		for (; count > 0; count--, o++) {
+			out[o] = out[o - offset];
+		}
+	}
+	return o == size;
+}
+
+/***************************************************************/
+/* Writer thread                                                                                                           */
+/***************************************************************/
+static int trace_write_block(struct trace_state *t, const uint8_t *block, uint32_t used, uint32_t records)
+{
+	uint32_t stored = trace_compress(block, used, t->packed);
+	uint8_t header[12];
+
+	mem_store_le32(header, records);
+	mem_store_le32(header + 4, used);
+	mem_store_le32(header + 8, stored == 0 ? used : stored);
+	if (fwrite(header, 1, sizeof(header), t->file) != sizeof(header) ||
+			fwrite(stored == 0 ? block : t->packed, 1, stored == 0 ? used : stored, t->file) != (stored == 0 ? used : stored)) {
+		return FALSE;
+	}
+	t->file_bytes += sizeof(header) + (stored == 0 ? used : stored);
+	return TRUE;
+}
+
+static void *trace_writer(void *arg)
+{
+	struct trace_state *t = arg;
+	uint32_t index, used, records;
+
+	pthread_mutex_lock(&t->lock);
+	for (;;) {
+		while (!t->pending && !t->closing) {
+			pthread_cond_wait(&t->cond, &t->lock);
+		}
+		if (!t->pending) {
+			break;
+		}
+		index = t->filling ^ 1;
+		used = t->pending_used;
+		records = t->pending_records;
+		pthread_mutex_unlock(&t->lock);
+		//the simulator leaves this block alone until pending is cleared
+		if (!t->failed && !trace_write_block(t, t->block[index], used, records)) {
+			t->failed = TRUE;
+		}
+		pthread_mutex_lock(&t->lock);
+		t->pending = FALSE;
+		pthread_cond_broadcast(&t->cond);
+	}
+	pthread_mutex_unlock(&t->lock);
+	return NULL;
+}
+
+/***************************************************************/
+/* Recording                                                                                                                  */
+/***************************************************************/
+static void trace_block_start(struct trace_state *t)
+{
+	t->used = 0;
+	t->records = 0;
+	t->pc = 0;
+	t->address = 0;
+	memset(t->regs, 0, sizeof(t->regs));
+	memset(t->words, 0xFF, sizeof(t->words));
+}
+
+//Hand the filled block to the writer once it is done with the other one.
+static void trace_flush(struct trace_state *t)
+{
+	pthread_mutex_lock(&t->lock);
+	while (t->pending) {
+		pthread_cond_wait(&t->cond, &t->lock);
+	}
+	t->pending = TRUE;
+	t->pending_used = t->used;
+	t->pending_records = t->records;
+	t->filling ^= 1;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	t->instructions += t->records;
+	t->raw_bytes += t->used;
+	trace_block_start(t);
+}
+
+static uint8_t *put_varint(uint8_t *p, uint32_t value)
+{
+	while (value >= 0x80) {
+		*p++ = value | 0x80;
+		value >>= 7;
+	}
+	*p++ = value;
+	return p;
+}
+
+static uint8_t *put_delta(uint8_t *p, uint32_t value, uint32_t last)
+{
+	int32_t delta = value - last;
+	return put_varint(p, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+}
+
+//One retired instruction: value is what it wrote to rd, address and data its memory access (data is the
+//value loaded or stored, the old word for an atomic). Both are ignored for anything but loads and stores.
+void trace_retire(uint32_t pc, const decoded_inst_t *d, uint32_t value, uint32_t address, uint32_t data)
+{
+	struct trace_state *t = T;
+	trace_word_t *word = &t->words[(pc >> 2) & (TRACE_WORDS - 1)];
+	uint8_t *record = t->block[t->filling] + t->used;
+	uint8_t *p = record + 1;
+	uint32_t flags = 0, size, mask;
+
+	if (pc != t->pc + 4) {
+		flags |= TRACE_JUMP;
+		p = put_delta(p, pc, t->pc);
+	}
+	t->pc = pc;
+	if (word->pc != pc || word->word != d->raw) {
+		flags |= TRACE_WORD;
+		mem_store_le32(p, d->raw);
+		p += 4;
+		word->pc = pc;
+		word->word = d->raw;
+	}
+	if (d->cls == CLASS_LOAD || d->cls == CLASS_STORE) {
+		size = MEM_access_size(d);
+		flags |= (d->cls == CLASS_STORE ? TRACE_STORE : op_is_atomic(d->op) ? TRACE_LOAD | TRACE_STORE : TRACE_LOAD) |
+				((size >> 1) << TRACE_SIZE_SHIFT);
+		p = put_delta(p, address, t->address);
+		t->address = address;
+		if (d->cls == CLASS_STORE) {
+			//what is stored is what was last written to rs2, or its low bytes
+			mask = size < 4 ? (1u << (8 * size)) - 1 : ~0u;
+			p = put_delta(p, data & mask, t->regs[d->rs2] & mask);
+		}else {
+			p = put_delta(p, data, t->regs[d->rd]);
+			if (d->writes_rd) {
+				t->regs[d->rd] = data;
+			}
+		}
+	}else if (d->writes_rd) {
+		flags |= TRACE_VALUE;
+		p = put_delta(p, value, t->regs[d->rd]);
+		t->regs[d->rd] = value;
+	}
+	*record = flags;
+	t->used = p - t->block[t->filling];
+	t->records++;
+	if (t->used > TRACE_BLOCK - TRACE_RECORD_MAX) {
+		trace_flush(t);
+	}
+}
+
+/***************************************************************/
+/* Start and stop                                                                                                           */
+/***************************************************************/
+int trace_start(const char *file)
+{
+	struct trace_state *t;
+	uint8_t version[4];
+
+	//each core retires into its own pipeline, one file could not tell them apart
+	if (SIM->multicore != NULL) {
+		printf("Error: Traces only cover a single core\n");
+		return FALSE;
+	}
+	trace_stop();
+	t = calloc(1, sizeof(*t));
+	if (t == NULL || (t->block[0] = malloc(TRACE_BLOCK)) == NULL || (t->block[1] = malloc(TRACE_BLOCK)) == NULL ||
+			(t->packed = malloc(TRACE_BLOCK)) == NULL) {
+		printf("Error: Out of memory for the trace buffers\n");
+		exit(-1);
+	}
+	t->file = fopen(file, "wb");
+	mem_store_le32(version, TRACE_VERSION);
+	if (t->file == NULL || fwrite(TRACE_MAGIC, 1, 8, t->file) != 8 || fwrite(version, 1, 4, t->file) != 4) {
+		printf("Error: Can't write trace %s\n", file);
+		if (t->file != NULL) {
+			fclose(t->file);
+		}
+		free(t->block[0]);
+		free(t->block[1]);
+		free(t->packed);
+		free(t);
+		return FALSE;
+	}
+	snprintf(t->name, sizeof(t->name), "%s", file);
+	t->file_bytes = 12;
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	trace_block_start(t);
+	if (pthread_create(&t->writer, NULL, trace_writer, t) != 0) {
+		printf("Error: Can't start the trace writer\n");
+		exit(-1);
+	}
+	T = t;
+	if (!QUIET) {
+		printf("Tracing to %s\n", file);
+	}
+	return TRUE;
+}
+
+void trace_stop()
+{
+	struct trace_state *t = T;
+
+	if (t == NULL) {
+		return;
+	}
+	if (t->records > 0) {
+		trace_flush(t);
+	}
+	pthread_mutex_lock(&t->lock);
+	t->closing = TRUE;
+	pthread_cond_broadcast(&t->cond);
+	pthread_mutex_unlock(&t->lock);
+	pthread_join(t->writer, NULL);
+	if (fclose(t->file) != 0) {
+		t->failed = TRUE;
+	}
+	if (t->failed) {
+		printf("Error: Writing trace %s failed\n", t->name);
+	}else if (!QUIET) {
+		printf("Trace %s: %llu instructions, %llu bytes (%.2f per instruction, %llu before compression)\n", t->name,
+				(unsigned long long)t->instructions, (unsigned long long)t->file_bytes,
+				t->instructions == 0 ? 0.0 : (double)t->file_bytes / t->instructions, (unsigned long long)t->raw_bytes);
+	}
+	pthread_mutex_destroy(&t->lock);
+	pthread_cond_destroy(&t->cond);
+	free(t->block[0]);
+	free(t->block[1]);
+	free(t->packed);
+	free(t);
+	T = NULL;
+}
+
+/***************************************************************/
+/* Replay                                                                                                                       */
+/***************************************************************/
+static int replay_block(struct replay_state *r)
+{
+	uint8_t header[12];
+	uint32_t stored;
+
+	if (fread(header, 1, sizeof(header), r->file) != sizeof(header)) {
+		return FALSE;
+	}
+	r->left = read_le32(header);
+	r->used = read_le32(header + 4);
+	stored = read_le32(header + 8);
+	if (r->used > TRACE_BLOCK || stored > r->used ||
+			fread(stored < r->used ? r->packed : r->block, 1, stored, r->file) != stored ||
+			(stored < r->used && !trace_decompress(r->packed, stored, r->block, r->used))) {
+		printf("Error: Trace %s is corrupt\n", r->name);
+		return FALSE;
+	}
+	r->position = 0;
+	r->pc = 0;
+	r->address = 0;
+	memset(r->regs, 0, sizeof(r->regs));
+	memset(r->words, 0xFF, sizeof(r->words));
+	return TRUE;
+}
+
+static int get_varint(struct replay_state *r, uint32_t *value)
+{
+	uint32_t shift;
+
+	*value = 0;
+	for (shift = 0; shift < 35 && r->position < r->used; shift += 7) {
+		*value |= (uint32_t)(r->block[r->position] & 0x7F) << shift;
+		if (!(r->block[r->position++] & 0x80)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static int get_delta(struct replay_state *r, uint32_t *value)
+{
+	uint32_t v;
+
+	if (!get_varint(r, &v)) {
+		return FALSE;
+	}
+	*value += (v >> 1) ^ -(v & 1);
+	return TRUE;
+}
+
+//Decode the next record into the ring, FALSE at the end of the trace.
+static int replay_decode(struct replay_state *r)
+{
+	trace_record_t *e = &r->ring[(r->decoded + 1) & (REPLAY_RING - 1)];
+	trace_word_t *word;
+	uint32_t flags, rd, mask, ok = TRUE;
+
+	if (r->end) {
+		return FALSE;
+	}
+	//a block ends where its last record does
+	while (r->left == 0) {
+		if (r->position != r->used) {
+			printf("Error: Trace %s is corrupt\n", r->name);
+			r->end = TRUE;
+			return FALSE;
+		}
+		if (!replay_block(r)) {
+			r->end = TRUE;
+			return FALSE;
+		}
+	}
+	if (r->position == r->used) {
+		printf("Error: Trace %s is corrupt\n", r->name);
+		r->end = TRUE;
+		return FALSE;
+	}
+	flags = r->block[r->position++];
+	if (flags & TRACE_JUMP) {
+		ok = get_delta(r, &r->pc);
+	}else {
+		r->pc += 4;
+	}
+	word = &r->words[(r->pc >> 2) & (TRACE_WORDS - 1)];
+	if (flags & TRACE_WORD) {
+		if (r->used - r->position < 4) {
+			ok = FALSE;
+		}else {
+			word->pc = r->pc;
+			word->word = read_le32(r->block + r->position);
+			r->position += 4;
+		}
+	}else if (word->pc != r->pc) {
+		ok = FALSE;
+	}
+	memset(e, 0, sizeof(*e));
+	e->pc = r->pc;
+	e->raw = word->word;
+	rd = (e->raw >> 7) & 31;
+	if (flags & TRACE_VALUE) {
+		ok = ok && get_delta(r, &r->regs[rd]);
+		e->value = r->regs[rd];
+	}
+	if (flags & (TRACE_LOAD | TRACE_STORE)) {
+		ok = ok && get_delta(r, &r->address);
+		e->address = r->address;
+		if ((flags & (TRACE_LOAD | TRACE_STORE)) == TRACE_STORE) {
+			mask = (flags >> TRACE_SIZE_SHIFT) & 3;
+			mask = mask < 2 ? (1u << (8 << mask)) - 1 : ~0u;
+			e->data = r->regs[(e->raw >> 20) & 31];
+			ok = ok && get_delta(r, &e->data);
+			e->data &= mask;
+		}else {
+			e->data = r->regs[rd];
+			ok = ok && get_delta(r, &e->data);
+			e->value = e->data;
+			if (rd != 0) {
+				r->regs[rd] = e->data;
+			}
+		}
+	}
+	if (!ok) {
+		printf("Error: Trace %s is corrupt\n", r->name);
+		r->end = TRUE;
+		return FALSE;
+	}
+	r->left--;
+	r->decoded++;
+	return TRUE;
+}
+
+//The record with sequence number seq, NULL past the end of the trace (or for 0).
+const trace_record_t *replay_record(uint32_t seq)
+{
+	struct replay_state *r = R;
+
+	while (r->decoded < seq) {
+		if (!replay_decode(r)) {
+			return NULL;
+		}
+	}
+	return seq == 0 || seq + REPLAY_RING <= r->decoded ? NULL : &r->ring[seq & (REPLAY_RING - 1)];
+}
+
+//TRUE when the trace goes to pc next, raw is then the recorded word and seq its record. FALSE for a fetch
+//down a wrong path, or past the end of the trace where the program's own words are all there is.
+int replay_fetch(uint32_t pc, uint32_t *raw, uint32_t *seq)
+{
+	const trace_record_t *e = replay_record(R->cursor);
+
+	*seq = 0;
+	if (e == NULL || e->pc != pc) {
+		return FALSE;
+	}
+	*raw = e->raw;
+	*seq = R->cursor;
+	return TRUE;
+}
+
+//The fetch of record seq went ahead.
+void replay_take(uint32_t seq)
+{
+	R->cursor = seq + 1;
+}
+
+//Fetch goes back to record seq, what was fetched from there on was on a wrong path.
+void replay_rewind(uint32_t seq)
+{
+	R->cursor = seq;
+}
+
+//The PC the trace went on to after record seq, FALSE if that is not known.
+int replay_next_pc(uint32_t seq, uint32_t *pc)
+{
+	const trace_record_t *e = replay_record(seq + 1);
+
+	if (e == NULL) {
+		return FALSE;
+	}
+	*pc = e->pc;
+	return TRUE;
+}
+
+//Back to the first record, the PC fetch has to start at (the program entry for an empty trace).
+uint32_t replay_restart()
+{
+	struct replay_state *r = R;
+	const trace_record_t *e;
+
+	fseek(r->file, 12, SEEK_SET);
+	r->used = r->position = r->left = 0;
+	r->decoded = 0;
+	r->cursor = 1;
+	r->end = FALSE;
+	e = replay_record(1);
+	return e == NULL ? PROGRAM_ENTRY : e->pc;
+}
+
+const char *replay_file()
+{
+	return R == NULL ? NULL : R->name;
+}
+
+//Replays go through the in-order pipeline of a single core. The machine is reset to the start of the trace.
+int replay_start(const char *file)
+{
+	struct replay_state *r;
+	char magic[8];
+	uint8_t version[4];
+
+	if (SIM->multicore != NULL || OOO_CONFIG.enabled) {
+		printf("Error: Replays only drive the pipeline of a single core\n");
+		return FALSE;
+	}
+	replay_stop();
+	r = calloc(1, sizeof(*r));
+	if (r == NULL || (r->block = malloc(TRACE_BLOCK)) == NULL || (r->packed = malloc(TRACE_BLOCK)) == NULL) {
+		printf("Error: Out of memory for the replay buffers\n");
+		exit(-1);
+	}
+	r->file = fopen(file, "rb");
+	if (r->file == NULL || fread(magic, 1, 8, r->file) != 8 || fread(version, 1, 4, r->file) != 4 ||
+			memcmp(magic, TRACE_MAGIC, 8) != 0 || read_le32(version) != TRACE_VERSION) {
+		printf("Error: Can't read trace %s\n", file);
+		if (r->file != NULL) {
+			fclose(r->file);
+		}
+		free(r->block);
+		free(r->packed);
+		free(r);
+		return FALSE;
+	}
+	snprintf(r->name, sizeof(r->name), "%s", file);
+	R = r;
+	reset();
+	if (!QUIET) {
+		printf("Replaying %s\n", file);
+	}
+	return TRUE;
+}
+
+//Back to execution-driven simulation, the machine is left as it is.
+void replay_stop()
+{
+	struct replay_state *r = R;
+
+	if (r == NULL) {
+		return;
+	}
+	fclose(r->file);
+	free(r->block);
+	free(r->packed);
+	free(r);
+	R = NULL;
+}